@@ -0,0 +1,81 @@
+#pragma once
+
+#include "include/connection_pool.h"
+#include <curl/curl.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+// 一次转发的结果
+struct ForwardResult {
+    CURLcode code = CURLE_OK; // 传输层结果
+    long status = 0;          // 后端返回的 HTTP 状态码
+    std::string body;
+    double elapsedMs = 0;
+};
+
+using ForwardCallback = std::function<void(ForwardResult&&)>;
+
+// 基于 curl_multi 的事件循环：所有转发请求在一个线程上多路复用，
+// 调用方线程只负责提交和等待，慢后端不会占住转发线程
+class AsyncForwarder {
+public:
+    // maxHostConnections 限制到同一后端的连接数，0 表示不限制
+    explicit AsyncForwarder(long maxHostConnections = 0);
+    // 尚未完成的转发都以 CURLE_ABORTED_BY_CALLBACK 回调一次，等待结果的调用方不会被挂住
+    ~AsyncForwarder();
+
+    // 提交一次转发，完成后在事件循环线程上调用 done，回调中不应做耗时操作。
+    // body 为空且 post 为 false 时发送 GET，headers 为附加的请求头。返回的 id 可用于取消
+    uint64_t submit(const std::shared_ptr<ConnectionPool>& pool, const std::string& url, bool post, const std::string& body, int timeoutMs, ForwardCallback done,
+                    const std::vector<std::string>& headers = {});
+    // 取消尚未完成的转发，回调仍会被调用一次，code 为 CURLE_ABORTED_BY_CALLBACK；
+    // 已经完成的转发不受影响
+    void cancel(uint64_t id);
+    size_t inflight() const;
+
+private:
+    struct Transfer {
+        uint64_t id;
+        CURL* handle = nullptr;
+        std::shared_ptr<ConnectionPool> pool;
+        std::string url;
+        bool post;
+        std::string body;
+        curl_slist* headers = nullptr; // 句柄放回连接池时选项被重置，传输结束后即可释放
+        int timeoutMs;
+        ForwardCallback done;
+        std::string response;
+        std::chrono::steady_clock::time_point start;
+        ~Transfer() {
+            if (headers != nullptr) {
+                curl_slist_free_all(headers);
+            }
+        }
+    };
+
+    void loop();
+    void startTransfer(std::unique_ptr<Transfer> transfer);
+    void finishTransfer(CURL* handle, CURLcode code);
+    static void abortTransfer(Transfer& transfer);
+    static size_t writeCallback(void* contents, size_t size, size_t nmemb, void* userp);
+
+    CURLM* multi_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+    std::atomic<uint64_t> nextId_;
+    std::atomic<size_t> inflight_;
+
+    std::mutex queueMutex_;
+    std::deque<std::unique_ptr<Transfer>> pending_; // 等待加入 multi 的请求
+    std::vector<uint64_t> cancelled_;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Transfer>> active_; // 仅事件循环线程访问
+};
@@ -7,6 +7,7 @@
 #include <faiss/gpu/GpuIndexCagra.h>
 #include <faiss/IndexIDMap.h>
 #include <mutex>
+#include <shared_mutex>
 
 
 class CAGRAIndex {
@@ -17,7 +18,8 @@ public:
     void remove_vectors(const std::vector<long>& ids);
     std::pair<std::vector<long>, std::vector<float>> search_vectors(const std::vector<float>& query, int k);
 
-    void train(int num_train, const std::vector<float>& train_vec);
+    // GPU 图直接由训练数据构建，ids 是这些行的外部 id，为空时沿用行号
+    void train(int num_train, const std::vector<float>& train_vec, const std::vector<long>& ids = {});
     void add(int num_train, const std::vector<float>& train_vec);
 
     void saveIndex(const std::string& file_path);
@@ -29,5 +31,8 @@ private:
     faiss::gpu::GpuIndexCagra* gpu_index;
     faiss::Index* cpu_index;
     faiss::IndexIDMap* id_map;
-    std::mutex index_mutex;
+    // GPU 图中第 i 行对应的外部 id，搜索结果按它翻译；为空表示行号就是 id
+    std::vector<long> gpu_ids;
+    // 搜索共享持有，重建 GPU 图时独占，保证图和 gpu_ids 一致
+    std::shared_mutex index_mutex;
 };
\ No newline at end of file
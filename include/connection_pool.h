@@ -0,0 +1,38 @@
+#pragma once
+
+#include <curl/curl.h>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <chrono>
+
+// 到单个后端节点的 curl 句柄池。curl 句柄会缓存它建立的连接，
+// 复用句柄即复用与后端之间的 keep-alive 长连接，避免每次转发都重新握手
+class ConnectionPool {
+public:
+    // maxIdle 为池中最多保留的空闲句柄数，空闲超过 idleTimeoutMs 的句柄会被关闭
+    ConnectionPool(const std::string& baseUrl, size_t maxIdle, int idleTimeoutMs, int connectTimeoutMs);
+    ~ConnectionPool();
+
+    CURL* acquire();
+    // healthy 为 false 表示这次请求在传输层失败，句柄连同其连接一起丢弃
+    void release(CURL* handle, bool healthy);
+    size_t idleCount();
+
+private:
+    struct IdleHandle {
+        CURL* handle;
+        std::chrono::steady_clock::time_point lastUsed;
+    };
+
+    CURL* createHandle();
+    void configure(CURL* handle);
+    void evictExpired(); // 调用方需持有 mutex_
+
+    std::string baseUrl_;
+    size_t maxIdle_;
+    std::chrono::milliseconds idleTimeout_;
+    int connectTimeoutMs_;
+    std::mutex mutex_;
+    std::deque<IdleHandle> idle_; // 队尾是最近归还的句柄，其连接最可能仍然有效
+};
@@ -11,6 +11,7 @@
 #define REQUEST_ID "id"
 #define REQUEST_INDEX_TYPE "index_type"
 #define REQUEST_EF_SEARCH "ef_search"
+#define REQUEST_NPROBE "nprobe"
 #define REQUEST_NODE_ID "nodeId"
 #define REQUEST_ENDPOINT "endpoint"
 
@@ -24,5 +25,11 @@
 #define INDEX_TYPE_FLAT "FLAT"
 #define INDEX_TYPE_HNSW "HNSW"
 #define INDEX_TYPE_HNSWFLAT "HNSWFLAT"
+#define INDEX_TYPE_HNSWSQ8 "HNSWSQ8"
+#define INDEX_TYPE_HNSWFP16 "HNSWFP16"
+#define INDEX_TYPE_IVFSQ8 "IVFSQ8"
+#define INDEX_TYPE_IVFFLAT "IVFFLAT"
+#define INDEX_TYPE_IVFPQ_CPU "IVFPQ_CPU"
+#define INDEX_TYPE_SEGMENTED "SEGMENTED"
 
 #define RESPONSE_CONTENT_TYPE_JSON "application/json"
\ No newline at end of file
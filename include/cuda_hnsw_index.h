@@ -1,12 +1,27 @@
 #pragma once
 
 #include <vector>
+#include <string>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
 #include "hnswlib/hnswlib.h"
 
 class CUDAHNSWIndex {
 public:
     // 构造函数
-    CUDAHNSWIndex(int dim, int num_data, int M = 16, int ef_construction = 200); // 将MetricType参数修改为第三个参数
+    // quantizer 为图中向量的存储格式：none / sq8 / fp16 / binary。
+    // rerank_factor > 0 时另存一份原始向量，量化检索取 k * rerank_factor 个候选后按原始向量重排。
+    // repair_percent > 0 时，自上次修复以来删除的向量达到总数的该百分比就由后台线程修复图
+    CUDAHNSWIndex(int dim, int num_data, int M = 16, int ef_construction = 200, int ef_search = 50,
+                  const std::string& quantizer = "none", int rerank_factor = 0, int repair_percent = 10);
+    ~CUDAHNSWIndex();
+
+    // sq8 需要先用样本确定每一维的取值范围
+    void train(int num_train, const std::vector<float>& train_vec);
 
     void init_gpu();
 
@@ -17,15 +32,62 @@ public:
     void insert_vectors_batch(const std::vector<std::vector<float>>& data, const std::vector<long>& labels);
     void insert_vectors_batch(const std::vector<float>& data, const std::vector<long>& labels);
 
-    // 查询向量
-    std::pair<std::vector<long>, std::vector<float>> search_vectors(const std::vector<float>& query, int k, int ef_search = 50);
+    // 只打删除标记，被删节点的位置由之后插入的新向量复用
+    void remove_vectors(const std::vector<long>& ids);
+
+    // 把指向被删节点的邻居重新连到存活的节点上，返回修复后的图健康状况。可以和读写并发
+    hnswlib::GraphHealth repair();
+
+    // 查询向量，ef_search <= 0 时使用建索引时配置的值
+    std::pair<std::vector<long>, std::vector<float>> search_vectors(const std::vector<float>& query, int k, int ef_search = 0);
 
     std::pair<std::vector<long>, std::vector<float>> search_vectors_gpu(const std::vector<float>& query, int k, int ef_search = 50, bool use_hierarchy = true);
 
     std::vector<std::pair<std::vector<long>, std::vector<float>>> search_vectors_batch_gpu(const std::vector<float>& query, int k, int ef_search = 50, bool use_hierarchy = true);
 
+    // 按 bfs / rcm 重排节点在内存中的位置，使图上相邻的节点在内存中也相邻。
+    // 需要独占访问，只在索引离线构建时调用
+    void reorder(const std::string& order);
+
+    void saveIndex(const std::string& file_path);
+    void loadIndex(const std::string& file_path);
+
 private:
+    // 量化时把向量编码成图中存储的格式，否则原样返回
+    const void* encode(const float* data, std::vector<char>& code) const;
+    void storeRaw(const float* data, long label);
+    std::pair<std::vector<long>, std::vector<float>> rerank(const std::vector<float>& query, int k, std::priority_queue<std::pair<float, hnswlib::labeltype>> candidates);
+    void saveCodec(const std::string& file_path);
+    void loadCodec(const std::string& file_path);
+    void repairLoop();
+
     int dim;
+    int default_ef_search;
+    std::string quantizer;
+    int rerank_factor;
     hnswlib::SpaceInterface<float>* space;
+    hnswlib::QuantizedSpace* quantized_space = nullptr; // 与 space 是同一个对象，未量化时为空
+    hnswlib::L2Space* rerank_space = nullptr;
     hnswlib::HierarchicalNSW<float>* index;
+
+    // 重排用的原始向量，按 label 定位，不受图重排影响。只在内存中多占一份 fp32，按需开启
+    mutable std::shared_mutex raw_mutex;
+    std::unordered_map<long, size_t> raw_slots;
+    std::vector<float> raw_vectors;
+    std::vector<size_t> raw_free_slots; // 删除后空出的原始向量位置
+
+    // 后台修复
+    int repair_percent;
+    std::atomic<size_t> deleted_since_repair{0};
+    std::mutex repair_run_mutex; // 修复和重排不能同时进行
+    std::mutex repair_mutex;
+    std::condition_variable repair_cv;
+    bool repair_pending = false;
+    bool stopping = false;
+    std::thread repair_thread;
+
+    // init_gpu 传给 cuda_init 的连续副本，图在内存中按块存放，GPU 侧仍按连续数组读取
+    std::vector<char> gpu_level0;
+    std::vector<char*> gpu_link_lists;
+    std::vector<int> gpu_levels;
 };
\ No newline at end of file
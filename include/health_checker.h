@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+
+// 单个后端节点的熔断状态
+struct NodeHealth {
+    enum class State { CLOSED, OPEN, HALF_OPEN };
+    State state = State::CLOSED;
+    int consecutiveFailures = 0;
+    int ejections = 0;          // 连续被摘除的次数，决定下一次摘除的时长
+    bool trialInflight = false; // 半开状态下是否已有试探请求
+    std::chrono::steady_clock::time_point openUntil;
+    std::string reason;         // 最近一次被摘除的原因
+};
+
+// 按节点的熔断器：连续失败或响应时间离群的节点被摘除一段时间，
+// 到期后进入半开状态，只放行一个试探请求，成功则恢复，失败则加倍摘除时长
+class HealthChecker {
+public:
+    // maxEjectPercent 限制同时被摘除的节点比例，避免误判时整个集群不可用
+    HealthChecker(int consecutiveFailures, int baseEjectMs, int maxEjectMs, double latencyFactor, int maxEjectPercent);
+
+    // 节点当前能否接收请求，摘除到期的节点在这里转为半开
+    bool available(const std::string& url);
+    void onStart(const std::string& url);
+    // 返回 true 表示熔断器刚从半开恢复为关闭
+    bool onResult(const std::string& url, bool success);
+    // 请求被主动取消（如对冲的另一份先返回），半开节点的试探没有结论，允许再放行一个
+    void onCancel(const std::string& url);
+    // 响应时间超过中位数 latencyFactor 倍的节点按离群摘除，只统计已有样本的节点
+    void ejectSlowOutliers(const std::map<std::string, double>& ewmaMs);
+    NodeHealth snapshot(const std::string& url);
+    void prune(const std::vector<std::string>& urls);
+    static const char* stateName(NodeHealth::State state);
+
+private:
+    void eject(const std::string& url, NodeHealth& health, const std::string& reason);
+
+    int consecutiveFailures_;
+    int baseEjectMs_;
+    int maxEjectMs_;
+    double latencyFactor_;
+    int maxEjectPercent_;
+    std::mutex mutex_;
+    std::map<std::string, NodeHealth> nodes_;
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <faiss/IndexHNSW.h>
+#include <vector>
+#include <string>
+#include <faiss/IndexIDMap.h>
+#include <shared_mutex>
+
+// HNSW 图 + 标量量化存储 (SQ8 / FP16)，向量按 1 或 2 字节每维保存
+class HnswSQIndex {
+public:
+    HnswSQIndex(faiss::Index* index);
+    ~HnswSQIndex();
+    void insert_vectors(const std::vector<float>& data, uint64_t label);
+    void insert_batch_vectors(const std::vector<std::vector<float>>& vectors, const std::vector<long>& ids);
+    std::pair<std::vector<long>, std::vector<float>> search_vectors(const std::vector<float>& query, int k, int ef_search = 0);
+
+    void train(int num_train, const std::vector<float>& train_vec);
+
+    void saveIndex(const std::string& file_path);
+    void loadIndex(const std::string& file_path);
+private:
+    faiss::Index* index;
+    faiss::IndexIDMap* id_map;
+    std::shared_mutex index_mutex;
+};
@@ -2,6 +2,7 @@
 
 #include "visited_list_pool.h"
 #include "hnswlib.h"
+#include "memory_policy.h"
 #include <atomic>
 #include <random>
 #include <stdlib.h>
@@ -9,18 +10,33 @@
 #include <unordered_set>
 #include <list>
 #include <memory>
+#include <deque>
+#include <algorithm>
 
 namespace hnswlib {
 typedef unsigned int tableint;
 typedef unsigned int linklistsizeint;
 
+// Locality-preserving orders of the level-0 graph, see HierarchicalNSW::reorderGraph
+enum class GraphOrder { BFS, RCM };
+
+// Shape of the level-0 graph, see HierarchicalNSW::graphHealth
+struct GraphHealth {
+    size_t elements{0};        // elements not marked deleted
+    size_t deleted{0};
+    size_t unreachable{0};     // live elements a search starting at the entry point can never reach
+    size_t dangling_links{0};  // links from live elements to deleted ones
+    double average_degree{0};  // level-0 out-degree of live elements
+};
+
 template<typename dist_t>
 class HierarchicalNSW : public AlgorithmInterface<dist_t> {
  public:
     static const tableint MAX_LABEL_OPERATION_LOCKS = 65536;
     static const unsigned char DELETE_MARK = 0x01;
+    static constexpr size_t DIST_BATCH_SIZE = 16;  // neighbors whose distances are computed in one call
 
-    size_t max_elements_{0};
+    std::atomic<size_t> max_elements_{0};
     mutable std::atomic<size_t> cur_element_count{0};  // current number of elements
     size_t size_data_per_element_{0};
     size_t size_links_per_element_{0};
@@ -40,20 +56,56 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     mutable std::vector<std::mutex> label_op_locks_;
 
     std::mutex global;
-    std::vector<std::mutex> link_list_locks_;
 
     tableint enterpoint_node_{0};
 
     size_t size_links_level0_{0};
     size_t offsetData_{0}, offsetLevel0_{0}, label_offset_{ 0 };
 
-    char *data_level0_memory_{nullptr};
-    char **linkLists_{nullptr};
-    std::vector<int> element_levels_;  // keeps level of each element
+    // Level-0 records, upper-layer link lists, levels and link-list locks are kept in fixed-size
+    // chunks of chunk_elements_ elements, addressed by id >> chunk_bits_. Growing the index only
+    // allocates new chunks and publishes a new directory, existing elements are never moved, so
+    // capacity can grow while searches and inserts are running.
+    struct Level0Chunk {
+        char *data{nullptr};  // chunk_elements_ records of size_data_per_element_ bytes
+        IndexAllocation memory;  // backs data, placed according to memory_policy_
+        std::unique_ptr<char *[]> link_lists;
+        std::unique_ptr<int[]> levels;  // keeps level of each element
+        std::unique_ptr<std::mutex[]> locks;
+
+        ~Level0Chunk() { freeIndexMemory(memory); }
+    };
+
+    // What the directory holds per chunk, copied by value so an element is one load away
+    struct ChunkRef {
+        char *data;
+        char **link_lists;
+        int *levels;
+        std::mutex *locks;
+    };
+
+    static constexpr size_t MIN_CHUNK_ELEMENTS = 1 << 10;
+    static constexpr size_t MAX_CHUNK_ELEMENTS = 1 << 16;
+
+    size_t chunk_bits_{0};
+    size_t chunk_elements_{0};
+    size_t chunk_mask_{0};
+
+    std::atomic<ChunkRef *> chunks_{nullptr};  // directory, replaced as a whole on growth
+    std::mutex grow_lock_;  // serializes growth, guards the two vectors below
+    std::vector<std::unique_ptr<Level0Chunk>> chunk_storage_;
+    // directories replaced by growth stay alive until clear(), searches may still be reading them.
+    // Capacity doubles on each replacement, so together they stay under twice the live one.
+    std::vector<std::unique_ptr<ChunkRef[]>> directories_;
+    size_t directory_capacity_{0};
+    bool auto_grow_ = false;  // addPoint grows the index by a chunk instead of throwing when full
+    // huge page / NUMA placement of the level-0 chunks, taken from the process default at construction
+    MemoryPolicy memory_policy_{getDefaultMemoryPolicy()};
 
     size_t data_size_{0};
 
     DISTFUNC<dist_t> fstdistfunc_;
+    BATCHDISTFUNC<dist_t> batchdistfunc_{nullptr};
     void *dist_func_param_{nullptr};
 
     mutable std::mutex label_lookup_lock;  // lock for label_lookup_
@@ -94,13 +146,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         size_t random_seed = 100,
         bool allow_replace_deleted = false)
         : label_op_locks_(MAX_LABEL_OPERATION_LOCKS),
-            link_list_locks_(max_elements),
-            element_levels_(max_elements),
             allow_replace_deleted_(allow_replace_deleted) {
-        max_elements_ = max_elements;
         num_deleted_ = 0;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        batchdistfunc_ = s->get_batch_dist_func();
         dist_func_param_ = s->get_dist_func_param();
         if ( M <= 10000 ) {
             M_ = M;
@@ -122,10 +172,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         offsetData_ = size_links_level0_;
         label_offset_ = size_links_level0_ + data_size_;
         offsetLevel0_ = 0;
+        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
 
-        data_level0_memory_ = (char *) malloc(max_elements_ * size_data_per_element_);
-        if (data_level0_memory_ == nullptr)
-            throw std::runtime_error("Not enough memory");
+        initChunks(max_elements);
+        ensureCapacity(max_elements);
+        max_elements_ = max_elements;
 
         cur_element_count = 0;
 
@@ -135,10 +186,6 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         enterpoint_node_ = -1;
         maxlevel_ = -1;
 
-        linkLists_ = (char **) malloc(sizeof(void *) * max_elements_);
-        if (linkLists_ == nullptr)
-            throw std::runtime_error("Not enough memory: HierarchicalNSW failed to allocate linklists");
-        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
         mult_ = 1 / log(1.0 * M_);
         revSize_ = 1.0 / mult_;
     }
@@ -149,19 +196,124 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
     void clear() {
-        free(data_level0_memory_);
-        data_level0_memory_ = nullptr;
-        for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
-                free(linkLists_[i]);
-        }
-        free(linkLists_);
-        linkLists_ = nullptr;
+        if (chunks_.load() != nullptr) {
+            for (tableint i = 0; i < cur_element_count; i++) {
+                if (elementLevel(i) > 0)
+                    free(linkListsOf(i));
+            }
+        }
+        chunks_ = nullptr;
+        chunk_storage_.clear();
+        directories_.clear();
+        directory_capacity_ = 0;
+        max_elements_ = 0;
         cur_element_count = 0;
         visited_list_pool_.reset(nullptr);
     }
 
 
+    // Picks the chunk size for an index created with room for max_elements
+    void initChunks(size_t max_elements) {
+        chunk_bits_ = 0;
+        while (((size_t) 1 << chunk_bits_) < max_elements && ((size_t) 1 << chunk_bits_) < MAX_CHUNK_ELEMENTS)
+            chunk_bits_++;
+        while (((size_t) 1 << chunk_bits_) < MIN_CHUNK_ELEMENTS)
+            chunk_bits_++;
+        // with huge pages a chunk should span at least one 2 MB page, or most of it is wasted
+        if (memory_policy_.huge_pages != HugePages::NONE) {
+            while (((size_t) 1 << chunk_bits_) * size_data_per_element_ < detail::HUGE_PAGE_2M &&
+                   ((size_t) 1 << chunk_bits_) < MAX_CHUNK_ELEMENTS)
+                chunk_bits_++;
+        }
+        chunk_elements_ = (size_t) 1 << chunk_bits_;
+        chunk_mask_ = chunk_elements_ - 1;
+    }
+
+
+    // Makes sure ids below max_elements have storage, without moving existing elements.
+    // Safe to call concurrently with searches and inserts. Does not change max_elements_.
+    void ensureCapacity(size_t max_elements) {
+        std::unique_lock <std::mutex> lock(grow_lock_);
+        size_t have = chunk_storage_.size();
+        size_t need = (max_elements + chunk_mask_) >> chunk_bits_;
+        if (need <= have)
+            return;
+
+        for (size_t c = have; c < need; c++) {
+            std::unique_ptr<Level0Chunk> chunk(new Level0Chunk());
+            // zero-filled, so an element whose id is taken but not yet written reads as an empty, live node
+            chunk->memory = allocateIndexMemory(chunk_elements_ * size_data_per_element_, memory_policy_);
+            chunk->data = (char *) chunk->memory.ptr;
+            if (chunk->data == nullptr)
+                throw std::runtime_error("Not enough memory: HierarchicalNSW failed to allocate level0 chunk");
+            chunk->link_lists.reset(new char *[chunk_elements_]());
+            chunk->levels.reset(new int[chunk_elements_]());
+            chunk->locks.reset(new std::mutex[chunk_elements_]);
+            chunk_storage_.push_back(std::move(chunk));
+        }
+
+        auto refOf = [](const Level0Chunk &chunk) {
+            return ChunkRef{chunk.data, chunk.link_lists.get(), chunk.levels.get(), chunk.locks.get()};
+        };
+        if (need <= directory_capacity_) {
+            // slots past the old chunk count are not read by anyone yet, fill them in place
+            ChunkRef *directory = chunks_.load(std::memory_order_relaxed);
+            for (size_t c = have; c < need; c++)
+                directory[c] = refOf(*chunk_storage_[c]);
+            chunks_.store(directory, std::memory_order_release);
+            return;
+        }
+
+        size_t capacity = std::max(need, directory_capacity_ * 2);
+        std::unique_ptr<ChunkRef[]> directory(new ChunkRef[capacity]);
+        for (size_t c = 0; c < need; c++)
+            directory[c] = refOf(*chunk_storage_[c]);
+        chunks_.store(directory.get(), std::memory_order_release);
+        directories_.push_back(std::move(directory));
+        directory_capacity_ = capacity;
+    }
+
+
+    void setAutoGrow(bool auto_grow) {
+        auto_grow_ = auto_grow;
+    }
+
+
+    inline const ChunkRef &chunkOf(tableint internal_id) const {
+        return chunks_.load(std::memory_order_acquire)[internal_id >> chunk_bits_];
+    }
+
+
+    // Start of the level-0 record of an element: link list, data, label
+    inline char *level0Of(tableint internal_id) const {
+        return chunkOf(internal_id).data + (internal_id & chunk_mask_) * size_data_per_element_;
+    }
+
+
+    inline int &elementLevel(tableint internal_id) const {
+        return chunkOf(internal_id).levels[internal_id & chunk_mask_];
+    }
+
+
+    inline char *&linkListsOf(tableint internal_id) const {
+        return chunkOf(internal_id).link_lists[internal_id & chunk_mask_];
+    }
+
+
+    inline std::mutex &linkListLock(tableint internal_id) const {
+        return chunkOf(internal_id).locks[internal_id & chunk_mask_];
+    }
+
+
+    // Neighbor ids read one past the end of a list are not meaningful, only existing elements are prefetched
+    inline void prefetchLevel0(tableint internal_id, size_t offset) const {
+#ifdef USE_SSE
+        if (internal_id < cur_element_count)
+            _mm_prefetch(level0Of(internal_id) + offset, _MM_HINT_T0);
+#endif
+    }
+
+
     struct CompareByFirst {
         constexpr bool operator()(std::pair<dist_t, tableint> const& a,
             std::pair<dist_t, tableint> const& b) const noexcept {
@@ -175,6 +327,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    // Visited-set representation used by searches started after the call
+    void setVisitedSetType(VisitedSetType type) {
+        visited_list_pool_->setType(type);
+    }
+
+
     inline std::mutex& getLabelOpMutex(labeltype label) const {
         // calculate hash
         size_t lock_id = label & (MAX_LABEL_OPERATION_LOCKS - 1);
@@ -184,23 +342,23 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     inline labeltype getExternalLabel(tableint internal_id) const {
         labeltype return_label;
-        memcpy(&return_label, (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), sizeof(labeltype));
+        memcpy(&return_label, (level0Of(internal_id) + label_offset_), sizeof(labeltype));
         return return_label;
     }
 
 
     inline void setExternalLabel(tableint internal_id, labeltype label) const {
-        memcpy((data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), &label, sizeof(labeltype));
+        memcpy((level0Of(internal_id) + label_offset_), &label, sizeof(labeltype));
     }
 
 
     inline labeltype *getExternalLabeLp(tableint internal_id) const {
-        return (labeltype *) (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_);
+        return (labeltype *) (level0Of(internal_id) + label_offset_);
     }
 
 
     inline char *getDataByInternalId(tableint internal_id) const {
-        return (data_level0_memory_ + internal_id * size_data_per_element_ + offsetData_);
+        return (level0Of(internal_id) + offsetData_);
     }
 
 
@@ -222,11 +380,47 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         return num_deleted_;
     }
 
+    // Distances from data_point to at most DIST_BATCH_SIZE elements
+    inline void computeDistances(const void *data_point, const tableint *ids, size_t n, dist_t *out) const {
+        const void *vectors[DIST_BATCH_SIZE];
+        for (size_t i = 0; i < n; i++)
+            vectors[i] = getDataByInternalId(ids[i]);
+        if (batchdistfunc_) {
+            batchdistfunc_(data_point, vectors, n, dist_func_param_, out);
+        } else {
+            for (size_t i = 0; i < n; i++)
+                out[i] = fstdistfunc_(data_point, vectors[i], dist_func_param_);
+        }
+    }
+
+
+    // One step of the greedy descent through the upper layers: moves currObj to its closest
+    // neighbor if that one is closer than curdist, returns true if it moved
+    bool greedyStep(const void *data_point, const tableint *datal, size_t size, tableint &currObj, dist_t &curdist) const {
+        bool changed = false;
+        dist_t dists[DIST_BATCH_SIZE];
+        for (size_t i = 0; i < size; i += DIST_BATCH_SIZE) {
+            size_t n = std::min(size - i, DIST_BATCH_SIZE);
+            for (size_t b = 0; b < n; b++) {
+                if (datal[i + b] > max_elements_)
+                    throw std::runtime_error("cand error");
+            }
+            computeDistances(data_point, datal + i, n, dists);
+            for (size_t b = 0; b < n; b++) {
+                if (dists[b] < curdist) {
+                    curdist = dists[b];
+                    currObj = datal[i + b];
+                    changed = true;
+                }
+            }
+        }
+        return changed;
+    }
+
+
     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
     searchBaseLayer(tableint ep_id, const void *data_point, int layer) {
         VisitedList *vl = visited_list_pool_->getFreeVisitedList();
-        vl_type *visited_array = vl->mass;
-        vl_type visited_array_tag = vl->curV;
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidateSet;
@@ -241,7 +435,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             lowerBound = std::numeric_limits<dist_t>::max();
             candidateSet.emplace(-lowerBound, ep_id);
         }
-        visited_array[ep_id] = visited_array_tag;
+        vl->visit(ep_id);
 
         while (!candidateSet.empty()) {
             std::pair<dist_t, tableint> curr_el_pair = candidateSet.top();
@@ -252,50 +446,63 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
             tableint curNodeNum = curr_el_pair.second;
 
-            std::unique_lock <std::mutex> lock(link_list_locks_[curNodeNum]);
+            std::unique_lock <std::mutex> lock(linkListLock(curNodeNum));
 
             int *data;  // = (int *)(linkList0_ + curNodeNum * size_links_per_element0_);
             if (layer == 0) {
                 data = (int*)get_linklist0(curNodeNum);
             } else {
                 data = (int*)get_linklist(curNodeNum, layer);
-//                    data = (int *) (linkLists_[curNodeNum] + (layer - 1) * size_links_per_element_);
+//                    data = (int *) (linkListsOf(curNodeNum) + (layer - 1) * size_links_per_element_);
             }
             size_t size = getListCount((linklistsizeint*)data);
             tableint *datal = (tableint *) (data + 1);
 #ifdef USE_SSE
-            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-            _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
-            _mm_prefetch(getDataByInternalId(*(datal + 1)), _MM_HINT_T0);
+            // upper-layer lists are allocated to their exact size, nothing is read past the count
+            if (size > 0) {
+                vl->prefetch(*datal);
+                prefetchLevel0(*datal, offsetData_);
+            }
+            if (size > 1)
+                prefetchLevel0(*(datal + 1), offsetData_);
 #endif
 
-            for (size_t j = 0; j < size; j++) {
-                tableint candidate_id = *(datal + j);
-//                    if (candidate_id == 0) continue;
+            // unvisited neighbors are gathered first so their distances are computed in batches
+            tableint batch_ids[DIST_BATCH_SIZE];
+            dist_t batch_dists[DIST_BATCH_SIZE];
+            for (size_t j = 0; j < size;) {
+                size_t batch_size = 0;
+                for (; j < size && batch_size < DIST_BATCH_SIZE; j++) {
+                    tableint candidate_id = *(datal + j);
 #ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(datal + j + 1)), _MM_HINT_T0);
-                _mm_prefetch(getDataByInternalId(*(datal + j + 1)), _MM_HINT_T0);
+                    if (j + 1 < size) {
+                        vl->prefetch(*(datal + j + 1));
+                        prefetchLevel0(*(datal + j + 1), offsetData_);
+                    }
 #endif
-                if (visited_array[candidate_id] == visited_array_tag) continue;
-                visited_array[candidate_id] = visited_array_tag;
-                char *currObj1 = (getDataByInternalId(candidate_id));
+                    if (!vl->visit(candidate_id))
+                        batch_ids[batch_size++] = candidate_id;
+                }
+                computeDistances(data_point, batch_ids, batch_size, batch_dists);
 
-                dist_t dist1 = fstdistfunc_(data_point, currObj1, dist_func_param_);
-                if (top_candidates.size() < ef_construction_ || lowerBound > dist1) {
-                    candidateSet.emplace(-dist1, candidate_id);
+                for (size_t b = 0; b < batch_size; b++) {
+                    tableint candidate_id = batch_ids[b];
+                    dist_t dist1 = batch_dists[b];
+                    if (top_candidates.size() < ef_construction_ || lowerBound > dist1) {
+                        candidateSet.emplace(-dist1, candidate_id);
 #ifdef USE_SSE
-                    _mm_prefetch(getDataByInternalId(candidateSet.top().second), _MM_HINT_T0);
+                        _mm_prefetch(getDataByInternalId(candidateSet.top().second), _MM_HINT_T0);
 #endif
 
-                    if (!isMarkedDeleted(candidate_id))
-                        top_candidates.emplace(dist1, candidate_id);
+                        if (!isMarkedDeleted(candidate_id))
+                            top_candidates.emplace(dist1, candidate_id);
 
-                    if (top_candidates.size() > ef_construction_)
-                        top_candidates.pop();
+                        if (top_candidates.size() > ef_construction_)
+                            top_candidates.pop();
 
-                    if (!top_candidates.empty())
-                        lowerBound = top_candidates.top().first;
+                        if (!top_candidates.empty())
+                            lowerBound = top_candidates.top().first;
+                    }
                 }
             }
         }
@@ -315,8 +522,6 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         BaseFilterFunctor* isIdAllowed = nullptr,
         BaseSearchStopCondition<dist_t>* stop_condition = nullptr) const {
         VisitedList *vl = visited_list_pool_->getFreeVisitedList();
-        vl_type *visited_array = vl->mass;
-        vl_type visited_array_tag = vl->curV;
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_set;
@@ -337,7 +542,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             candidate_set.emplace(-lowerBound, ep_id);
         }
 
-        visited_array[ep_id] = visited_array_tag;
+        vl->visit(ep_id);
 
         while (!candidate_set.empty()) {
             std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
@@ -368,25 +573,31 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             }
 
 #ifdef USE_SSE
-            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-            _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
+            vl->prefetch(*(data + 1));
+            prefetchLevel0(*(data + 1), offsetData_);
             _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
 #endif
 
-            for (size_t j = 1; j <= size; j++) {
-                int candidate_id = *(data + j);
-//                    if (candidate_id == 0) continue;
+            // unvisited neighbors are gathered first so their distances are computed in batches
+            tableint batch_ids[DIST_BATCH_SIZE];
+            dist_t batch_dists[DIST_BATCH_SIZE];
+            for (size_t j = 1; j <= size;) {
+                size_t batch_size = 0;
+                for (; j <= size && batch_size < DIST_BATCH_SIZE; j++) {
+                    int candidate_id = *(data + j);
 #ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
-                _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
-                                _MM_HINT_T0);  ////////////
+                    vl->prefetch(*(data + j + 1));
+                    prefetchLevel0(*(data + j + 1), offsetData_);
 #endif
-                if (!(visited_array[candidate_id] == visited_array_tag)) {
-                    visited_array[candidate_id] = visited_array_tag;
+                    if (!vl->visit(candidate_id))
+                        batch_ids[batch_size++] = candidate_id;
+                }
+                computeDistances(data_point, batch_ids, batch_size, batch_dists);
 
+                for (size_t b = 0; b < batch_size; b++) {
+                    tableint candidate_id = batch_ids[b];
                     char *currObj1 = (getDataByInternalId(candidate_id));
-                    dist_t dist = fstdistfunc_(data_point, currObj1, dist_func_param_);
+                    dist_t dist = batch_dists[b];
 
                     bool flag_consider_candidate;
                     if (!bare_bone_search && stop_condition) {
@@ -398,9 +609,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     if (flag_consider_candidate) {
                         candidate_set.emplace(-dist, candidate_id);
 #ifdef USE_SSE
-                        _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_ +
-                                        offsetLevel0_,  ///////////
-                                        _MM_HINT_T0);  ////////////////////////
+                        _mm_prefetch(level0Of(candidate_set.top().second) + offsetLevel0_, _MM_HINT_T0);
 #endif
 
                         if (bare_bone_search || 
@@ -484,17 +693,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     linklistsizeint *get_linklist0(tableint internal_id) const {
-        return (linklistsizeint *) (data_level0_memory_ + internal_id * size_data_per_element_ + offsetLevel0_);
-    }
-
-
-    linklistsizeint *get_linklist0(tableint internal_id, char *data_level0_memory_) const {
-        return (linklistsizeint *) (data_level0_memory_ + internal_id * size_data_per_element_ + offsetLevel0_);
+        return (linklistsizeint *) (level0Of(internal_id) + offsetLevel0_);
     }
 
 
     linklistsizeint *get_linklist(tableint internal_id, int level) const {
-        return (linklistsizeint *) (linkLists_[internal_id] + (level - 1) * size_links_per_element_);
+        return (linklistsizeint *) (linkListsOf(internal_id) + (level - 1) * size_links_per_element_);
     }
 
 
@@ -526,7 +730,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         {
             // lock only during the update
             // because during the addition the lock for cur_c is already acquired
-            std::unique_lock <std::mutex> lock(link_list_locks_[cur_c], std::defer_lock);
+            std::unique_lock <std::mutex> lock(linkListLock(cur_c), std::defer_lock);
             if (isUpdate) {
                 lock.lock();
             }
@@ -544,7 +748,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
                 if (data[idx] && !isUpdate)
                     throw std::runtime_error("Possible memory corruption");
-                if (level > element_levels_[selectedNeighbors[idx]])
+                if (level > elementLevel(selectedNeighbors[idx]))
                     throw std::runtime_error("Trying to make a link on a non-existent level");
 
                 data[idx] = selectedNeighbors[idx];
@@ -552,7 +756,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         }
 
         for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
-            std::unique_lock <std::mutex> lock(link_list_locks_[selectedNeighbors[idx]]);
+            std::unique_lock <std::mutex> lock(linkListLock(selectedNeighbors[idx]));
 
             linklistsizeint *ll_other;
             if (level == 0)
@@ -566,7 +770,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 throw std::runtime_error("Bad value of sz_link_list_other");
             if (selectedNeighbors[idx] == cur_c)
                 throw std::runtime_error("Trying to connect an element to itself");
-            if (level > element_levels_[selectedNeighbors[idx]])
+            if (level > elementLevel(selectedNeighbors[idx]))
                 throw std::runtime_error("Trying to make a link on a non-existent level");
 
             tableint *data = (tableint *) (ll_other + 1);
@@ -634,31 +838,151 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         if (new_max_elements < cur_element_count)
             throw std::runtime_error("Cannot resize, max element is less than the current number of elements");
 
-        visited_list_pool_.reset(new VisitedListPool(1, new_max_elements));
+        // existing chunks are kept, so shrinking only lowers the limit and growing never copies
+        ensureCapacity(new_max_elements);
+        visited_list_pool_->resize(new_max_elements);
+        max_elements_ = new_max_elements;
+    }
 
-        element_levels_.resize(new_max_elements);
+    // Internal ids in the new layout order: order[new_id] = old_id.
+    // BFS walks the level-0 graph from the entry point, RCM (reverse Cuthill-McKee) starts
+    // each component from a minimum-degree node, visits neighbors by increasing degree and
+    // reverses the result. Both put nodes that are hops apart close together in memory.
+    std::vector<tableint> computeGraphOrder(GraphOrder method) const {
+        size_t n = cur_element_count;
+        std::vector<tableint> order;
+        order.reserve(n);
+        std::vector<char> placed(n, 0);
+        std::vector<tableint> neighbors;
+
+        auto degree = [this](tableint id) {
+            return getListCount(get_linklist0(id));
+        };
+        auto traverse = [&](tableint start) {
+            std::deque<tableint> queue{start};
+            placed[start] = 1;
+            while (!queue.empty()) {
+                tableint cur = queue.front();
+                queue.pop_front();
+                order.push_back(cur);
+                linklistsizeint *ll = get_linklist0(cur);
+                tableint *links = (tableint *) (ll + 1);
+                neighbors.assign(links, links + getListCount(ll));
+                if (method == GraphOrder::RCM) {
+                    std::stable_sort(neighbors.begin(), neighbors.end(), [&](tableint a, tableint b) {
+                        return degree(a) < degree(b);
+                    });
+                }
+                for (tableint next : neighbors) {
+                    if (next < n && !placed[next]) {
+                        placed[next] = 1;
+                        queue.push_back(next);
+                    }
+                }
+            }
+        };
+
+        if (method == GraphOrder::BFS) {
+            if (n > 0 && enterpoint_node_ < n)
+                traverse(enterpoint_node_);
+            for (tableint id = 0; id < n; id++) {
+                if (!placed[id])
+                    traverse(id);
+            }
+        } else {
+            // components are started from their lowest-degree node
+            std::vector<tableint> by_degree(n);
+            for (tableint id = 0; id < n; id++)
+                by_degree[id] = id;
+            std::stable_sort(by_degree.begin(), by_degree.end(), [&](tableint a, tableint b) {
+                return degree(a) < degree(b);
+            });
+            for (tableint id : by_degree) {
+                if (!placed[id])
+                    traverse(id);
+            }
+            std::reverse(order.begin(), order.end());
+        }
+        return order;
+    }
 
-        std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
 
-        // Reallocate base layer
-        char * data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
-        if (data_level0_memory_new == nullptr)
-            throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
-        data_level0_memory_ = data_level0_memory_new;
+    // Permutes internal ids so that graph neighbors sit close together in the level-0 chunks,
+    // rewriting link lists, labels, levels and the entry point. The permutation is applied to the
+    // memory layout itself, so saveIndex persists it with no format change.
+    // Not thread safe: no search, insert or delete may run concurrently.
+    void reorderGraph(GraphOrder method = GraphOrder::BFS) {
+        size_t n = cur_element_count;
+        if (n < 2)
+            return;
+        std::vector<tableint> order = computeGraphOrder(method);
+        std::vector<tableint> new_id(n);
+        for (tableint i = 0; i < n; i++)
+            new_id[order[i]] = i;
+
+        size_t num_chunks = (n + chunk_mask_) >> chunk_bits_;
+        std::vector<IndexAllocation> memory_new(num_chunks);
+        std::vector<char *> data_new(num_chunks, nullptr);
+        for (size_t c = 0; c < num_chunks; c++) {
+            memory_new[c] = allocateIndexMemory(chunk_elements_ * size_data_per_element_, memory_policy_);
+            data_new[c] = (char *) memory_new[c].ptr;
+            if (data_new[c] == nullptr) {
+                for (IndexAllocation &memory : memory_new)
+                    freeIndexMemory(memory);
+                throw std::runtime_error("Not enough memory: reorderGraph failed to allocate level0");
+            }
+        }
+        std::vector<int> element_levels_new(n);
+        std::vector<char *> link_lists_new(n);
+
+        auto remap = [this, &new_id](linklistsizeint *ll) {
+            tableint *links = (tableint *) (ll + 1);
+            unsigned short size = getListCount(ll);
+            for (unsigned short j = 0; j < size; j++)
+                links[j] = new_id[links[j]];
+        };
+        for (tableint i = 0; i < n; i++) {
+            tableint old = order[i];
+            char *record = data_new[i >> chunk_bits_] + (i & chunk_mask_) * size_data_per_element_;
+            memcpy(record, level0Of(old), size_data_per_element_);
+            remap((linklistsizeint *) (record + offsetLevel0_));
+            element_levels_new[i] = elementLevel(old);
+            link_lists_new[i] = linkListsOf(old);
+            for (int level = 1; level <= elementLevel(old); level++)
+                remap(get_linklist(old, level));
+        }
 
-        // Reallocate all other layers
-        char ** linkLists_new = (char **) realloc(linkLists_, sizeof(void *) * new_max_elements);
-        if (linkLists_new == nullptr)
-            throw std::runtime_error("Not enough memory: resizeIndex failed to allocate other layers");
-        linkLists_ = linkLists_new;
+        for (size_t c = 0; c < num_chunks; c++) {
+            freeIndexMemory(chunk_storage_[c]->memory);
+            chunk_storage_[c]->memory = memory_new[c];
+            chunk_storage_[c]->data = data_new[c];
+            chunks_.load()[c].data = data_new[c];
+        }
+        for (tableint i = 0; i < n; i++) {
+            elementLevel(i) = element_levels_new[i];
+            linkListsOf(i) = link_lists_new[i];
+        }
+        enterpoint_node_ = new_id[enterpoint_node_];
 
-        max_elements_ = new_max_elements;
+        {
+            std::unique_lock <std::mutex> lock(label_lookup_lock);
+            for (tableint i = 0; i < n; i++)
+                label_lookup_[getExternalLabel(i)] = i;
+        }
+        {
+            std::unique_lock <std::mutex> lock(deleted_elements_lock);
+            std::unordered_set<tableint> deleted_elements_new;
+            for (tableint id : deleted_elements)
+                deleted_elements_new.insert(new_id[id]);
+            deleted_elements.swap(deleted_elements_new);
+        }
     }
 
+
     size_t indexFileSize() const {
         size_t size = 0;
         size += sizeof(offsetLevel0_);
-        size += sizeof(max_elements_);
+        size += sizeof(size_t);  // max_elements_
         size += sizeof(cur_element_count);
         size += sizeof(size_data_per_element_);
         size += sizeof(label_offset_);
@@ -675,7 +999,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         size += cur_element_count * size_data_per_element_;
 
         for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
+            unsigned int linkListSize = elementLevel(i) > 0 ? size_links_per_element_ * elementLevel(i) : 0;
             size += sizeof(linkListSize);
             size += linkListSize;
         }
@@ -687,7 +1011,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         std::streampos position;
 
         writeBinaryPOD(output, offsetLevel0_);
-        writeBinaryPOD(output, max_elements_);
+        writeBinaryPOD(output, max_elements_.load());
         writeBinaryPOD(output, cur_element_count);
         writeBinaryPOD(output, size_data_per_element_);
         writeBinaryPOD(output, label_offset_);
@@ -701,13 +1025,17 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         writeBinaryPOD(output, mult_);
         writeBinaryPOD(output, ef_construction_);
 
-        output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
+        // chunks are written back to back, the file holds one contiguous level-0 block
+        for (size_t begin = 0; begin < cur_element_count; begin += chunk_elements_) {
+            size_t count = std::min(chunk_elements_, cur_element_count - begin);
+            output.write(level0Of(begin), count * size_data_per_element_);
+        }
 
         for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
+            unsigned int linkListSize = elementLevel(i) > 0 ? size_links_per_element_ * elementLevel(i) : 0;
             writeBinaryPOD(output, linkListSize);
             if (linkListSize)
-                output.write(linkLists_[i], linkListSize);
+                output.write(linkListsOf(i), linkListSize);
         }
         output.close();
     }
@@ -725,14 +1053,14 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         std::streampos total_filesize = input.tellg();
         input.seekg(0, input.beg);
 
+        size_t max_elements_file;
         readBinaryPOD(input, offsetLevel0_);
-        readBinaryPOD(input, max_elements_);
+        readBinaryPOD(input, max_elements_file);
         readBinaryPOD(input, cur_element_count);
 
         size_t max_elements = max_elements_i;
         if (max_elements < cur_element_count)
-            max_elements = max_elements_;
-        max_elements_ = max_elements;
+            max_elements = max_elements_file;
         readBinaryPOD(input, size_data_per_element_);
         readBinaryPOD(input, label_offset_);
         readBinaryPOD(input, offsetData_);
@@ -747,6 +1075,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        batchdistfunc_ = s->get_batch_dist_func();
         dist_func_param_ = s->get_dist_func_param();
 
         auto pos = input.tellg();
@@ -774,23 +1103,21 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         input.seekg(pos, input.beg);
 
-        data_level0_memory_ = (char *) malloc(max_elements * size_data_per_element_);
-        if (data_level0_memory_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
-        input.read(data_level0_memory_, cur_element_count * size_data_per_element_);
+        initChunks(max_elements);
+        ensureCapacity(max_elements);
+        max_elements_ = max_elements;
+        for (size_t begin = 0; begin < cur_element_count; begin += chunk_elements_) {
+            size_t count = std::min(chunk_elements_, cur_element_count - begin);
+            input.read(level0Of(begin), count * size_data_per_element_);
+        }
 
         size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
 
         size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
-        std::vector<std::mutex>(max_elements).swap(link_list_locks_);
         std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
 
         visited_list_pool_.reset(new VisitedListPool(1, max_elements));
 
-        linkLists_ = (char **) malloc(sizeof(void *) * max_elements);
-        if (linkLists_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
-        element_levels_ = std::vector<int>(max_elements);
         revSize_ = 1.0 / mult_;
         ef_ = 10;
         for (size_t i = 0; i < cur_element_count; i++) {
@@ -798,14 +1125,14 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             unsigned int linkListSize;
             readBinaryPOD(input, linkListSize);
             if (linkListSize == 0) {
-                element_levels_[i] = 0;
-                linkLists_[i] = nullptr;
+                elementLevel(i) = 0;
+                linkListsOf(i) = nullptr;
             } else {
-                element_levels_[i] = linkListSize / size_links_per_element_;
-                linkLists_[i] = (char *) malloc(linkListSize);
-                if (linkLists_[i] == nullptr)
+                elementLevel(i) = linkListSize / size_links_per_element_;
+                linkListsOf(i) = (char *) malloc(linkListSize);
+                if (linkListsOf(i) == nullptr)
                     throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-                input.read(linkLists_[i], linkListSize);
+                input.read(linkListsOf(i), linkListSize);
             }
         }
 
@@ -962,11 +1289,31 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             addPoint(data_point, label, -1);
             return;
         }
+        // a live label is updated in place and a deleted one takes back its own slot,
+        // only new labels take any vacant place
+        bool label_exists = false;
+        tableint existing_internal_id = 0;
+        {
+            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+            auto search = label_lookup_.find(label);
+            if (search != label_lookup_.end()) {
+                label_exists = true;
+                existing_internal_id = search->second;
+            }
+        }
+        if (label_exists && !isMarkedDeleted(existing_internal_id)) {
+            addPoint(data_point, label, -1);
+            return;
+        }
+
         // check if there is vacant place
         tableint internal_id_replaced;
         std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
         bool is_vacant_place = !deleted_elements.empty();
-        if (is_vacant_place) {
+        if (label_exists && deleted_elements.count(existing_internal_id)) {
+            internal_id_replaced = existing_internal_id;
+            deleted_elements.erase(internal_id_replaced);
+        } else if (is_vacant_place) {
             internal_id_replaced = *deleted_elements.begin();
             deleted_elements.erase(internal_id_replaced);
         }
@@ -982,12 +1329,16 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             setExternalLabel(internal_id_replaced, label);
 
             std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-            label_lookup_.erase(label_replaced);
+            auto replaced = label_lookup_.find(label_replaced);
+            if (replaced != label_lookup_.end() && replaced->second == internal_id_replaced)
+                label_lookup_.erase(replaced);
             label_lookup_[label] = internal_id_replaced;
             lock_table.unlock();
 
             unmarkDeletedInternal(internal_id_replaced);
-            updatePoint(data_point, internal_id_replaced, 1.0);
+            // the new vector is unrelated to the old one, so the old neighborhood is not rebuilt
+            // around it (that strands elements); repairDeletedElements has usually detached the slot already
+            updatePoint(data_point, internal_id_replaced, 0.0);
         }
     }
 
@@ -1002,7 +1353,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         if (entryPointCopy == internalId && cur_element_count == 1)
             return;
 
-        int elemLevel = element_levels_[internalId];
+        int elemLevel = elementLevel(internalId);
         std::uniform_real_distribution<float> distribution(0.0, 1.0);
         for (int layer = 0; layer <= elemLevel; layer++) {
             std::unordered_set<tableint> sCand;
@@ -1053,7 +1404,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 getNeighborsByHeuristic2(candidates, layer == 0 ? maxM0_ : maxM_);
 
                 {
-                    std::unique_lock <std::mutex> lock(link_list_locks_[neigh]);
+                    std::unique_lock <std::mutex> lock(linkListLock(neigh));
                     linklistsizeint *ll_cur;
                     ll_cur = get_linklist_at_level(neigh, layer);
                     size_t candSize = candidates.size();
@@ -1085,25 +1436,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 while (changed) {
                     changed = false;
                     unsigned int *data;
-                    std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
+                    std::unique_lock <std::mutex> lock(linkListLock(currObj));
                     data = get_linklist_at_level(currObj, level);
                     int size = getListCount(data);
                     tableint *datal = (tableint *) (data + 1);
-#ifdef USE_SSE
-                    _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
-#endif
-                    for (int i = 0; i < size; i++) {
-#ifdef USE_SSE
-                        _mm_prefetch(getDataByInternalId(*(datal + i + 1)), _MM_HINT_T0);
-#endif
-                        tableint cand = datal[i];
-                        dist_t d = fstdistfunc_(dataPoint, getDataByInternalId(cand), dist_func_param_);
-                        if (d < curdist) {
-                            curdist = d;
-                            currObj = cand;
-                            changed = true;
-                        }
-                    }
+                    changed = greedyStep(dataPoint, datal, size, currObj, curdist);
                 }
             }
         }
@@ -1123,7 +1460,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 topCandidates.pop();
             }
 
-            // Since element_levels_ is being used to get `dataPointLevel`, there could be cases where `topCandidates` could just contains entry point itself.
+            // Since elementLevel() is being used to get `dataPointLevel`, there could be cases where `topCandidates` could just contains entry point itself.
             // To prevent self loops, the `topCandidates` is filtered and thus can be empty.
             if (filteredTopCandidates.size() > 0) {
                 bool epDeleted = isMarkedDeleted(entryPointInternalId);
@@ -1139,8 +1476,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
-    std::vector<tableint> getConnectionsWithLock(tableint internalId, int level) {
-        std::unique_lock <std::mutex> lock(link_list_locks_[internalId]);
+    std::vector<tableint> getConnectionsWithLock(tableint internalId, int level) const {
+        std::unique_lock <std::mutex> lock(linkListLock(internalId));
         unsigned int *data = get_linklist_at_level(internalId, level);
         int size = getListCount(data);
         std::vector<tableint> result(size);
@@ -1150,6 +1487,186 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    /*
+    * Reconnects the in-neighbors of deleted elements. Every live element that links to a deleted
+    * one on some level gets that list rebuilt with getNeighborsByHeuristic2, choosing among its live
+    * neighbors and the live neighbors of the deleted ones. Deleted elements keep their own lists,
+    * the entry point may be one of them, but nothing links to them afterwards: searches stop
+    * visiting them and their slots can be reused without leaving stale links behind.
+    * Out-neighbors of deleted elements that no live element links to anymore are then reconnected
+    * with repairConnectionsForUpdate, otherwise reusing the deleted slots would strand them.
+    * Safe to run concurrently with searches and inserts; a list changed by an insert meanwhile is
+    * left for the next call. Returns the number of lists rewritten.
+    */
+    size_t repairDeletedElements() {
+        if (num_deleted_ == 0)
+            return 0;
+        size_t repaired = 0;
+        size_t count = cur_element_count;
+        std::unordered_set<tableint> candidate_ids;
+        for (tableint id = 0; id < count; id++) {
+            if (isMarkedDeleted(id))
+                continue;
+            int level;
+            {
+                std::unique_lock <std::mutex> lock(linkListLock(id));
+                level = elementLevel(id);
+            }
+            for (int layer = 0; layer <= level; layer++) {
+                std::vector<tableint> links = getConnectionsWithLock(id, layer);
+                bool dangling = false;
+                candidate_ids.clear();
+                for (tableint neighbor : links) {
+                    if (isMarkedDeleted(neighbor))
+                        dangling = true;
+                }
+                if (!dangling)
+                    continue;
+
+                // two hops through live and deleted neighbors alike, as updatePoint does
+                for (tableint neighbor : links) {
+                    if (!isMarkedDeleted(neighbor))
+                        candidate_ids.insert(neighbor);
+                    for (tableint second : getConnectionsWithLock(neighbor, layer)) {
+                        if (second != id && !isMarkedDeleted(second))
+                            candidate_ids.insert(second);
+                    }
+                }
+
+                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
+                const void *data_point = getDataByInternalId(id);
+                for (tableint cand : candidate_ids) {
+                    dist_t distance = fstdistfunc_(data_point, getDataByInternalId(cand), dist_func_param_);
+                    if (candidates.size() < ef_construction_) {
+                        candidates.emplace(distance, cand);
+                    } else if (distance < candidates.top().first) {
+                        candidates.pop();
+                        candidates.emplace(distance, cand);
+                    }
+                }
+                // no live element around, links through the deleted ones are all that is left
+                if (candidates.empty())
+                    continue;
+                getNeighborsByHeuristic2(candidates, layer == 0 ? maxM0_ : maxM_);
+
+                std::unique_lock <std::mutex> lock(linkListLock(id));
+                linklistsizeint *ll_cur = get_linklist_at_level(id, layer);
+                tableint *data = (tableint *) (ll_cur + 1);
+                if (getListCount(ll_cur) != links.size() || !std::equal(links.begin(), links.end(), data))
+                    continue;
+                std::vector<tableint> selected;
+                while (!candidates.empty()) {
+                    selected.push_back(candidates.top().second);
+                    candidates.pop();
+                }
+                setListCount(ll_cur, selected.size());
+                std::copy(selected.begin(), selected.end(), data);
+                lock.unlock();
+                repaired++;
+
+                // links back from the new neighbors while they have room, as inserts add them
+                size_t max_links = layer == 0 ? maxM0_ : maxM_;
+                for (tableint neighbor : selected) {
+                    std::unique_lock <std::mutex> lock_neighbor(linkListLock(neighbor));
+                    linklistsizeint *ll_other = get_linklist_at_level(neighbor, layer);
+                    size_t size_other = getListCount(ll_other);
+                    tableint *data_other = (tableint *) (ll_other + 1);
+                    if (size_other < max_links && std::find(data_other, data_other + size_other, id) == data_other + size_other) {
+                        data_other[size_other] = id;
+                        setListCount(ll_other, size_other + 1);
+                    }
+                }
+            }
+        }
+        repaired += reconnectOrphans(count);
+        return repaired;
+    }
+
+
+    // Gives every live element below count that only deleted elements link to at level 0 new
+    // neighbors and in-links, as if it was updated in place. Returns the number of elements reconnected.
+    size_t reconnectOrphans(size_t count) {
+        std::vector<char> linked(count, 0);
+        std::vector<tableint> orphans;
+        for (tableint id = 0; id < count; id++) {
+            if (isMarkedDeleted(id))
+                continue;
+            for (tableint neighbor : getConnectionsWithLock(id, 0)) {
+                if (neighbor < count)
+                    linked[neighbor] = 1;
+            }
+        }
+        for (tableint id = 0; id < count; id++) {
+            if (!linked[id] && !isMarkedDeleted(id) && id != enterpoint_node_)
+                orphans.push_back(id);
+        }
+        if (orphans.size() + num_deleted_ >= count)
+            return 0;  // nothing live left to connect to
+
+        for (tableint id : orphans) {
+            int level;
+            {
+                std::unique_lock <std::mutex> lock(linkListLock(id));
+                level = elementLevel(id);
+            }
+            std::unique_lock <std::mutex> lock_global(global);
+            int max_level = maxlevel_;
+            tableint enterpoint = enterpoint_node_;
+            lock_global.unlock();
+            if (level > max_level)
+                continue;
+            repairConnectionsForUpdate(getDataByInternalId(id), enterpoint, id, level, max_level);
+        }
+        return orphans.size();
+    }
+
+
+    /*
+    * Walks the level-0 graph from the entry point the way searches do, through deleted elements too,
+    * and counts live elements that cannot be reached, links to deleted elements and the average degree.
+    */
+    GraphHealth graphHealth() const {
+        GraphHealth health;
+        size_t count = cur_element_count;
+        if (count == 0)
+            return health;
+        std::vector<char> reached(count, 0);
+        std::vector<tableint> queue;
+        size_t total_degree = 0;
+        tableint enterpoint = enterpoint_node_;
+        if (enterpoint < count) {
+            reached[enterpoint] = 1;
+            queue.push_back(enterpoint);
+        }
+        for (size_t head = 0; head < queue.size(); head++) {
+            for (tableint next : getConnectionsWithLock(queue[head], 0)) {
+                if (next < count && !reached[next]) {
+                    reached[next] = 1;
+                    queue.push_back(next);
+                }
+            }
+        }
+        for (tableint id = 0; id < count; id++) {
+            if (isMarkedDeleted(id)) {
+                health.deleted++;
+                continue;
+            }
+            health.elements++;
+            if (!reached[id])
+                health.unreachable++;
+            std::vector<tableint> links = getConnectionsWithLock(id, 0);
+            total_degree += links.size();
+            for (tableint neighbor : links) {
+                if (neighbor < count && isMarkedDeleted(neighbor))
+                    health.dangling_links++;
+            }
+        }
+        if (health.elements > 0)
+            health.average_degree = (double) total_degree / health.elements;
+        return health;
+    }
+
+
     tableint addPoint(const void *data_point, labeltype label, int level) {
         tableint cur_c = 0;
         {
@@ -1175,7 +1692,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             }
 
             if (cur_element_count >= max_elements_) {
-                throw std::runtime_error("The number of elements exceeds the specified limit");
+                if (!auto_grow_)
+                    throw std::runtime_error("The number of elements exceeds the specified limit");
+                // one more chunk, searches and inserts holding other elements are not blocked
+                size_t new_max_elements = ((cur_element_count >> chunk_bits_) + 1) << chunk_bits_;
+                ensureCapacity(new_max_elements);
+                visited_list_pool_->resize(new_max_elements);
+                max_elements_ = new_max_elements;
             }
 
             cur_c = cur_element_count;
@@ -1183,12 +1706,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             label_lookup_[label] = cur_c;
         }
 
-        std::unique_lock <std::mutex> lock_el(link_list_locks_[cur_c]);
+        std::unique_lock <std::mutex> lock_el(linkListLock(cur_c));
         int curlevel = getRandomLevel(mult_);
         if (level > 0)
             curlevel = level;
 
-        element_levels_[cur_c] = curlevel;
+        elementLevel(cur_c) = curlevel;
 
         std::unique_lock <std::mutex> templock(global);
         int maxlevelcopy = maxlevel_;
@@ -1197,17 +1720,17 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         tableint currObj = enterpoint_node_;
         tableint enterpoint_copy = enterpoint_node_;
 
-        memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
+        memset(level0Of(cur_c) + offsetLevel0_, 0, size_data_per_element_);
 
         // Initialisation of the data and label
         memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
         memcpy(getDataByInternalId(cur_c), data_point, data_size_);
 
         if (curlevel) {
-            linkLists_[cur_c] = (char *) malloc(size_links_per_element_ * curlevel + 1);
-            if (linkLists_[cur_c] == nullptr)
+            linkListsOf(cur_c) = (char *) malloc(size_links_per_element_ * curlevel + 1);
+            if (linkListsOf(cur_c) == nullptr)
                 throw std::runtime_error("Not enough memory: addPoint failed to allocate linklist");
-            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
+            memset(linkListsOf(cur_c), 0, size_links_per_element_ * curlevel + 1);
         }
 
         if ((signed)currObj != -1) {
@@ -1218,22 +1741,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     while (changed) {
                         changed = false;
                         unsigned int *data;
-                        std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
+                        std::unique_lock <std::mutex> lock(linkListLock(currObj));
                         data = get_linklist(currObj, level);
                         int size = getListCount(data);
 
                         tableint *datal = (tableint *) (data + 1);
-                        for (int i = 0; i < size; i++) {
-                            tableint cand = datal[i];
-                            if (cand < 0 || cand > max_elements_)
-                                throw std::runtime_error("cand error");
-                            dist_t d = fstdistfunc_(data_point, getDataByInternalId(cand), dist_func_param_);
-                            if (d < curdist) {
-                                curdist = d;
-                                currObj = cand;
-                                changed = true;
-                            }
-                        }
+                        changed = greedyStep(data_point, datal, size, currObj, curdist);
                     }
                 }
             }
@@ -1269,6 +1782,14 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     std::priority_queue<std::pair<dist_t, labeltype >>
     searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        return searchKnnWithEf(query_data, k, ef_, isIdAllowed);
+    }
+
+
+    // searchKnn with the search breadth given per call instead of the shared ef_, so concurrent
+    // queries with different ef do not have to call setEf on the index
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnnWithEf(const void *query_data, size_t k, size_t ef, BaseFilterFunctor* isIdAllowed = nullptr) const {
         std::priority_queue<std::pair<dist_t, labeltype >> result;
         if (cur_element_count == 0) return result;
 
@@ -1287,18 +1808,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 metric_distance_computations+=size;
 
                 tableint *datal = (tableint *) (data + 1);
-                for (int i = 0; i < size; i++) {
-                    tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
-                        throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
-
-                    if (d < curdist) {
-                        curdist = d;
-                        currObj = cand;
-                        changed = true;
-                    }
-                }
+                changed = greedyStep(query_data, datal, size, currObj, curdist);
             }
         }
 
@@ -1306,10 +1816,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         bool bare_bone_search = !num_deleted_ && !isIdAllowed;
         if (bare_bone_search) {
             top_candidates = searchBaseLayerST<true>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
+                    currObj, query_data, std::max(ef, k), isIdAllowed);
         } else {
             top_candidates = searchBaseLayerST<false>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
+                    currObj, query_data, std::max(ef, k), isIdAllowed);
         }
 
         while (top_candidates.size() > k) {
@@ -1347,18 +1857,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 metric_distance_computations+=size;
 
                 tableint *datal = (tableint *) (data + 1);
-                for (int i = 0; i < size; i++) {
-                    tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
-                        throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
-
-                    if (d < curdist) {
-                        curdist = d;
-                        currObj = cand;
-                        changed = true;
-                    }
-                }
+                changed = greedyStep(query_data, datal, size, currObj, curdist);
             }
         }
 
@@ -1382,7 +1881,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         int connections_checked = 0;
         std::vector <int > inbound_connections_num(cur_element_count, 0);
         for (int i = 0; i < cur_element_count; i++) {
-            for (int l = 0; l <= element_levels_[i]; l++) {
+            for (int l = 0; l <= elementLevel(i); l++) {
                 linklistsizeint *ll_cur = get_linklist_at_level(i, l);
                 int size = getListCount(ll_cur);
                 tableint *data = (tableint *) (ll_cur + 1);
@@ -1400,7 +1899,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         if (cur_element_count > 1) {
             int min1 = inbound_connections_num[0], max1 = inbound_connections_num[0];
             for (int i=0; i < cur_element_count; i++) {
-                assert(inbound_connections_num[i] > 0);
+                // repairDeletedElements detaches deleted elements on purpose
+                assert(inbound_connections_num[i] > 0 || isMarkedDeleted(i));
                 min1 = std::min(inbound_connections_num[i], min1);
                 max1 = std::max(inbound_connections_num[i], max1);
             }
@@ -11,6 +11,13 @@
 #ifndef NO_MANUAL_VECTORIZATION
 #if (defined(__SSE__) || _M_IX86_FP > 0 || defined(_M_AMD64) || defined(_M_X64))
 #define USE_SSE
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// GCC and Clang build the AVX and AVX-512 kernels with target attributes whatever -march says,
+// and the spaces pick one at runtime from the CPU features, so one binary serves every CPU generation
+#define HNSWLIB_RUNTIME_DISPATCH
+#define USE_AVX
+#define USE_AVX512
+#else
 #ifdef __AVX__
 #define USE_AVX
 #ifdef __AVX512F__
@@ -19,6 +26,25 @@
 #endif
 #endif
 #endif
+#endif
+
+#if defined(HNSWLIB_RUNTIME_DISPATCH)
+#define HNSWLIB_TARGET_AVX __attribute__((target("avx")))
+#define HNSWLIB_TARGET_AVX512 __attribute__((target("avx512f")))
+#define HNSWLIB_TARGET_AVX512_VNNI __attribute__((target("avx2,avx512f,avx512bw,avx512vnni")))
+#define HNSWLIB_TARGET_AVX2_FMA __attribute__((target("avx2,fma")))
+#define HNSWLIB_TARGET_F16C __attribute__((target("avx,f16c,fma")))
+#define HNSWLIB_TARGET_POPCNT __attribute__((target("popcnt")))
+#define HNSWLIB_TARGET_AVX512_VPOPCNTDQ __attribute__((target("popcnt,avx512f,avx512vpopcntdq")))
+#else
+#define HNSWLIB_TARGET_AVX
+#define HNSWLIB_TARGET_AVX512
+#define HNSWLIB_TARGET_AVX512_VNNI
+#define HNSWLIB_TARGET_AVX2_FMA
+#define HNSWLIB_TARGET_F16C
+#define HNSWLIB_TARGET_POPCNT
+#define HNSWLIB_TARGET_AVX512_VPOPCNTDQ
+#endif
 
 #if defined(USE_AVX) || defined(USE_SSE)
 #ifdef _MSC_VER
@@ -116,14 +142,111 @@ static bool AVX512Capable() {
 }
 #endif
 
+
 #include <queue>
 #include <vector>
 #include <iostream>
+#include <string>
+#include <utility>
 #include <string.h>
 
 namespace hnswlib {
 typedef size_t labeltype;
 
+struct CpuFeatures {
+    bool sse{false};
+    bool popcnt{false};
+    bool avx{false};
+    bool avx2{false};
+    bool fma{false};
+    bool f16c{false};
+    bool avx512f{false};
+    bool avx512bw{false};
+    bool avx512vnni{false};
+    bool avx512fp16{false};
+    bool avx512vpopcntdq{false};
+};
+
+// Detected once per process, the spaces choose their kernels from it
+inline const CpuFeatures &GetCpuFeatures() {
+    static const CpuFeatures features = [] {
+        CpuFeatures f;
+#if defined(USE_AVX) || defined(USE_SSE)
+        f.sse = true;
+        f.avx = AVXCapable();
+        f.avx512f = AVX512Capable();
+        int cpuInfo[4];
+        cpuid(cpuInfo, 1, 0);
+        f.popcnt = (cpuInfo[2] & (1 << 23)) != 0;
+        f.fma = f.avx && (cpuInfo[2] & (1 << 12)) != 0;
+        f.f16c = f.avx && (cpuInfo[2] & (1 << 29)) != 0;
+        cpuid(cpuInfo, 0, 0);
+        if (cpuInfo[0] >= 7) {
+            cpuid(cpuInfo, 7, 0);
+            f.avx2 = f.avx && (cpuInfo[1] & (1 << 5)) != 0;
+            f.avx512bw = f.avx512f && (cpuInfo[1] & (1 << 30)) != 0;
+            f.avx512vnni = f.avx512bw && (cpuInfo[2] & (1 << 11)) != 0;
+            f.avx512fp16 = f.avx512bw && (cpuInfo[3] & (1 << 23)) != 0;
+            f.avx512vpopcntdq = f.avx512f && (cpuInfo[2] & (1 << 14)) != 0;
+        }
+#endif
+        return f;
+    }();
+    return features;
+}
+
+// Instruction sets of the kernels the spaces will use on this CPU, for startup logs
+inline std::string DescribeDistanceKernels() {
+    const CpuFeatures &f = GetCpuFeatures();
+    std::string floatKernels = "scalar";
+    std::string int8Kernels = "scalar";
+    std::string sq8Kernels = "scalar";
+    std::string fp16Kernels = "scalar";
+    std::string binaryKernels = f.popcnt ? "popcnt" : "scalar";
+#if defined(USE_SSE)
+    floatKernels = "sse";
+#endif
+#if defined(USE_AVX)
+    if (f.avx)
+        floatKernels = "avx";
+    if (f.avx2 && f.fma)
+        sq8Kernels = "avx2";
+    if (f.f16c && f.fma)
+        fp16Kernels = "f16c";
+#endif
+#if defined(USE_AVX512)
+    if (f.avx512f)
+        floatKernels = "avx512";
+    if (f.avx512vnni)
+        int8Kernels = "avx512vnni";
+    if (f.avx512f) {
+        sq8Kernels = "avx512";
+        fp16Kernels = "avx512";
+    }
+    if (f.avx512vpopcntdq)
+        binaryKernels = "avx512vpopcntdq";
+#endif
+    std::string cpu;
+    const std::pair<const char *, bool> flags[] = {
+        {"sse", f.sse}, {"popcnt", f.popcnt}, {"avx", f.avx}, {"avx2", f.avx2}, {"fma", f.fma}, {"f16c", f.f16c},
+        {"avx512f", f.avx512f}, {"avx512bw", f.avx512bw}, {"avx512vnni", f.avx512vnni}, {"avx512fp16", f.avx512fp16},
+        {"avx512vpopcntdq", f.avx512vpopcntdq}};
+    for (const auto &flag : flags) {
+        if (!flag.second)
+            continue;
+        if (!cpu.empty())
+            cpu += ",";
+        cpu += flag.first;
+    }
+#if defined(HNSWLIB_RUNTIME_DISPATCH)
+    const char *mode = "runtime";
+#else
+    const char *mode = "compile-time";
+#endif
+    return "float=" + floatKernels + " uint8=" + int8Kernels + " sq8=" + sq8Kernels + " fp16=" + fp16Kernels +
+        " binary=" + binaryKernels + " dispatch=" + mode + " cpu=" + (cpu.empty() ? "none" : cpu);
+}
+
 // This can be extended to store state for filtering (e.g. from a std::set)
 class BaseFilterFunctor {
  public:
@@ -170,6 +293,10 @@ static void readBinaryPOD(std::istream &in, T &podRef) {
 template<typename MTYPE>
 using DISTFUNC = MTYPE(*)(const void *, const void *, const void *);
 
+// Distances from one query to n vectors at once: out[i] = dist(query, vectors[i])
+template<typename MTYPE>
+using BATCHDISTFUNC = void(*)(const void *query, const void *const *vectors, size_t n, const void *param, MTYPE *out);
+
 template<typename MTYPE>
 class SpaceInterface {
  public:
@@ -180,6 +307,11 @@ class SpaceInterface {
 
     virtual void *get_dist_func_param() = 0;
 
+    // Optional, spaces without a batched kernel return nullptr and distances are computed one at a time
+    virtual BATCHDISTFUNC<MTYPE> get_batch_dist_func() {
+        return nullptr;
+    }
+
     virtual ~SpaceInterface() {}
 };
 
@@ -221,8 +353,10 @@ AlgorithmInterface<dist_t>::searchKnnCloserFirst(const void* query_data, size_t
 }
 }  // namespace hnswlib
 
+#include "space_batch.h"
 #include "space_l2.h"
 #include "space_ip.h"
+#include "space_quantized.h"
 #include "stop_condition.h"
 #include "bruteforce.h"
 #include "hnswalg.h"
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Placement of large index arrays. Graph traversal touches memory at random, so on big indexes
+// it is bound by TLB misses and by remote NUMA accesses; backing the arrays with huge pages and
+// binding or interleaving them across nodes addresses both. Without a policy plain calloc is used.
+
+namespace hnswlib {
+
+enum class HugePages {
+    NONE,
+    THP,         // transparent huge pages, madvise(MADV_HUGEPAGE) on 2 MB aligned mappings
+    HUGETLB_2M,  // pages reserved in the hugetlbfs pool, falls back to THP when the pool is empty
+    HUGETLB_1G
+};
+
+enum class NumaMode { NONE, BIND, INTERLEAVE };
+
+struct MemoryPolicy {
+    HugePages huge_pages{HugePages::NONE};
+    NumaMode numa{NumaMode::NONE};
+    std::vector<int> numa_nodes;  // empty means every online node
+
+    bool isDefault() const {
+        return huge_pages == HugePages::NONE && numa == NumaMode::NONE;
+    }
+
+    // Parses none / thp / 2m / 1g
+    static HugePages parseHugePages(const std::string &value) {
+        if (value.empty() || value == "none")
+            return HugePages::NONE;
+        if (value == "thp")
+            return HugePages::THP;
+        if (value == "2m")
+            return HugePages::HUGETLB_2M;
+        if (value == "1g")
+            return HugePages::HUGETLB_1G;
+        throw std::runtime_error("Unknown huge page mode: " + value);
+    }
+
+    // Parses none / bind / interleave
+    static NumaMode parseNumaMode(const std::string &value) {
+        if (value.empty() || value == "none")
+            return NumaMode::NONE;
+        if (value == "bind")
+            return NumaMode::BIND;
+        if (value == "interleave")
+            return NumaMode::INTERLEAVE;
+        throw std::runtime_error("Unknown NUMA mode: " + value);
+    }
+
+    // Parses a node list in the kernel's format, e.g. "0", "0,1" or "0-3"
+    static std::vector<int> parseNodeList(const std::string &value) {
+        std::vector<int> nodes;
+        std::stringstream ss(value);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (item.empty() || item == "\n")
+                continue;
+            size_t dash = item.find('-');
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            if (first < 0 || last < first)
+                throw std::runtime_error("Illegal NUMA node list: " + value);
+            for (int node = first; node <= last; node++)
+                nodes.push_back(node);
+        }
+        return nodes;
+    }
+
+    std::string describe() const {
+        static const char *huge_names[] = {"none", "thp", "2m", "1g"};
+        static const char *numa_names[] = {"none", "bind", "interleave"};
+        std::string desc = std::string("huge_pages=") + huge_names[(int) huge_pages] + " numa=" + numa_names[(int) numa];
+        if (numa != NumaMode::NONE) {
+            desc += " nodes=";
+            if (numa_nodes.empty())
+                desc += "all";
+            for (size_t i = 0; i < numa_nodes.size(); i++)
+                desc += (i ? "," : "") + std::to_string(numa_nodes[i]);
+        }
+        return desc;
+    }
+};
+
+// Process-wide policy picked up by indexes created afterwards, set once at startup from the config
+inline MemoryPolicy &defaultMemoryPolicyStorage() {
+    static MemoryPolicy policy;
+    return policy;
+}
+
+inline std::mutex &defaultMemoryPolicyLock() {
+    static std::mutex lock;
+    return lock;
+}
+
+inline void setDefaultMemoryPolicy(const MemoryPolicy &policy) {
+    std::unique_lock <std::mutex> lock(defaultMemoryPolicyLock());
+    defaultMemoryPolicyStorage() = policy;
+}
+
+inline MemoryPolicy getDefaultMemoryPolicy() {
+    std::unique_lock <std::mutex> lock(defaultMemoryPolicyLock());
+    return defaultMemoryPolicyStorage();
+}
+
+// Zero-filled block from allocateIndexMemory, freed with freeIndexMemory
+struct IndexAllocation {
+    void *ptr{nullptr};
+    size_t mapped_bytes{0};  // 0 when the block came from calloc
+};
+
+namespace detail {
+
+static const size_t HUGE_PAGE_2M = (size_t) 2 << 20;
+static const size_t HUGE_PAGE_1G = (size_t) 1 << 30;
+
+// Each kind of fallback is reported once per process, not once per chunk
+inline void warnOnce(std::atomic<bool> &warned, const std::string &message) {
+    if (!warned.exchange(true))
+        HNSWERR << "warning: " << message << std::endl;
+}
+
+#if defined(__linux__)
+inline std::vector<int> onlineNumaNodes() {
+    std::ifstream in("/sys/devices/system/node/online");
+    std::string line;
+    if (!in || !std::getline(in, line))
+        return {0};
+    return MemoryPolicy::parseNodeList(line);
+}
+
+inline void applyNumaPolicy(void *ptr, size_t bytes, const MemoryPolicy &policy) {
+#if defined(SYS_mbind)
+    static std::atomic<bool> warned{false};
+    // mbind is called through syscall(), so libnuma is not needed
+    const int MPOL_BIND_MODE = 2;
+    const int MPOL_INTERLEAVE_MODE = 3;
+    const size_t MAX_NODES = 1024;
+    unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    std::vector<int> nodes = policy.numa_nodes.empty() ? onlineNumaNodes() : policy.numa_nodes;
+    for (int node : nodes) {
+        if (node >= 0 && (size_t) node < MAX_NODES)
+            mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    }
+    int mode = policy.numa == NumaMode::BIND ? MPOL_BIND_MODE : MPOL_INTERLEAVE_MODE;
+    if (syscall(SYS_mbind, ptr, bytes, mode, mask, MAX_NODES + 1, 0) != 0)
+        warnOnce(warned, std::string("mbind failed, index memory is placed by the kernel: ") + strerror(errno));
+#else
+    static std::atomic<bool> warned{false};
+    warnOnce(warned, "NUMA placement is not supported on this platform");
+#endif
+}
+
+// Anonymous mapping of bytes aligned to align, the slack around it is unmapped
+inline void *mapAligned(size_t bytes, size_t align) {
+    size_t length = bytes + align;
+    char *raw = (char *) mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return nullptr;
+    char *start = (char *) (((uintptr_t) raw + align - 1) & ~(uintptr_t) (align - 1));
+    if (start > raw)
+        munmap(raw, start - raw);
+    size_t tail = (raw + length) - (start + bytes);
+    if (tail > 0)
+        munmap(start + bytes, tail);
+    return start;
+}
+#endif
+
+}  // namespace detail
+
+// Zero-filled memory for a large index array, placed according to policy.
+// hugetlb pages are only used for blocks of at least one page; smaller blocks and an empty
+// hugetlbfs pool fall back to transparent huge pages.
+inline IndexAllocation allocateIndexMemory(size_t bytes, const MemoryPolicy &policy) {
+    IndexAllocation allocation;
+#if defined(__linux__)
+    if (!policy.isDefault() && bytes > 0) {
+        static std::atomic<bool> warned_hugetlb{false};
+        static std::atomic<bool> warned_mmap{false};
+        HugePages huge_pages = policy.huge_pages;
+        if (huge_pages == HugePages::HUGETLB_1G && bytes < detail::HUGE_PAGE_1G)
+            huge_pages = HugePages::HUGETLB_2M;
+        if (huge_pages == HugePages::HUGETLB_2M && bytes < detail::HUGE_PAGE_2M)
+            huge_pages = HugePages::THP;
+
+        void *ptr = nullptr;
+        size_t mapped = 0;
+#if defined(MAP_HUGETLB)
+        if (huge_pages == HugePages::HUGETLB_2M || huge_pages == HugePages::HUGETLB_1G) {
+            size_t page = huge_pages == HugePages::HUGETLB_1G ? detail::HUGE_PAGE_1G : detail::HUGE_PAGE_2M;
+            int page_shift = huge_pages == HugePages::HUGETLB_1G ? 30 : 21;
+            mapped = (bytes + page - 1) & ~(page - 1);
+            // MAP_HUGE_SHIFT is 26, spelled out for older headers
+            ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_shift << 26), -1, 0);
+            if (ptr == MAP_FAILED) {
+                ptr = nullptr;
+                detail::warnOnce(warned_hugetlb, "no hugetlbfs pages available, using transparent huge pages instead");
+                huge_pages = HugePages::THP;
+            }
+        }
+#else
+        if (huge_pages == HugePages::HUGETLB_2M || huge_pages == HugePages::HUGETLB_1G)
+            huge_pages = HugePages::THP;
+#endif
+        if (ptr == nullptr) {
+            // 2 MB alignment lets THP back the whole block, NUMA-only mappings need 4 KB
+            size_t align = huge_pages == HugePages::THP ? detail::HUGE_PAGE_2M : (size_t) sysconf(_SC_PAGESIZE);
+            mapped = (bytes + align - 1) & ~(align - 1);
+            ptr = detail::mapAligned(mapped, align);
+#if defined(MADV_HUGEPAGE)
+            if (ptr != nullptr && huge_pages == HugePages::THP)
+                madvise(ptr, mapped, MADV_HUGEPAGE);
+#endif
+        }
+        if (ptr != nullptr) {
+            // binding takes effect on first touch, the pages are not faulted in yet
+            if (policy.numa != NumaMode::NONE)
+                detail::applyNumaPolicy(ptr, mapped, policy);
+            allocation.ptr = ptr;
+            allocation.mapped_bytes = mapped;
+            return allocation;
+        }
+        detail::warnOnce(warned_mmap, std::string("mmap of index memory failed, using calloc: ") + strerror(errno));
+    }
+#endif
+    allocation.ptr = calloc(1, bytes);
+    return allocation;
+}
+
+inline void freeIndexMemory(IndexAllocation &allocation) {
+#if defined(__linux__)
+    if (allocation.mapped_bytes > 0) {
+        munmap(allocation.ptr, allocation.mapped_bytes);
+        allocation = IndexAllocation();
+        return;
+    }
+#endif
+    free(allocation.ptr);
+    allocation = IndexAllocation();
+}
+
+}  // namespace hnswlib
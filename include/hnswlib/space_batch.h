@@ -0,0 +1,218 @@
+#pragma once
+#include "hnswlib.h"
+
+// Batched float kernels for L2Space and InnerProductSpace.
+// Four vectors are accumulated side by side, so each load of the query is shared by four
+// distances and the four horizontal sums are folded into one reduction.
+// Each kernel is stamped out with the target attribute of its Ops, so vector registers are
+// only ever passed between functions compiled for the same target.
+
+namespace hnswlib {
+
+#if defined(USE_SSE)
+struct BatchOpsSSE {
+    typedef __m128 reg;
+    static constexpr size_t width = 4;
+
+    static reg zero() { return _mm_setzero_ps(); }
+    static reg load(const float *p) { return _mm_loadu_ps(p); }
+
+    static reg l2(reg sum, reg q, reg v) {
+        reg diff = _mm_sub_ps(q, v);
+        return _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+    }
+
+    static reg ip(reg sum, reg q, reg v) {
+        return _mm_add_ps(sum, _mm_mul_ps(q, v));
+    }
+
+    static float reduce(reg a) {
+        float PORTABLE_ALIGN32 tmp[4];
+        _mm_store_ps(tmp, a);
+        return tmp[0] + tmp[1] + tmp[2] + tmp[3];
+    }
+
+    static void reduce4(reg a, reg b, reg c, reg d, float *out) {
+        _MM_TRANSPOSE4_PS(a, b, c, d);
+        _mm_storeu_ps(out, _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, d)));
+    }
+};
+#endif
+
+#if defined(USE_AVX)
+struct BatchOpsAVX {
+    typedef __m256 reg;
+    static constexpr size_t width = 8;
+
+    HNSWLIB_TARGET_AVX static reg zero() { return _mm256_setzero_ps(); }
+    HNSWLIB_TARGET_AVX static reg load(const float *p) { return _mm256_loadu_ps(p); }
+
+    HNSWLIB_TARGET_AVX static reg l2(reg sum, reg q, reg v) {
+        reg diff = _mm256_sub_ps(q, v);
+        return _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+    }
+
+    HNSWLIB_TARGET_AVX static reg ip(reg sum, reg q, reg v) {
+        return _mm256_add_ps(sum, _mm256_mul_ps(q, v));
+    }
+
+    HNSWLIB_TARGET_AVX static float reduce(reg a) {
+        float PORTABLE_ALIGN32 tmp[8];
+        _mm256_store_ps(tmp, a);
+        return tmp[0] + tmp[1] + tmp[2] + tmp[3] + tmp[4] + tmp[5] + tmp[6] + tmp[7];
+    }
+
+    HNSWLIB_TARGET_AVX static void reduce4(reg a, reg b, reg c, reg d, float *out) {
+        // each 128-bit half ends up holding partial sums of a, b, c, d in that order
+        reg ab = _mm256_hadd_ps(a, b);
+        reg cd = _mm256_hadd_ps(c, d);
+        reg abcd = _mm256_hadd_ps(ab, cd);
+        _mm_storeu_ps(out, _mm_add_ps(_mm256_castps256_ps128(abcd), _mm256_extractf128_ps(abcd, 1)));
+    }
+};
+#endif
+
+#if defined(USE_AVX512)
+struct BatchOpsAVX512 {
+    typedef __m512 reg;
+    static constexpr size_t width = 16;
+
+    HNSWLIB_TARGET_AVX512 static reg zero() { return _mm512_setzero_ps(); }
+    HNSWLIB_TARGET_AVX512 static reg load(const float *p) { return _mm512_loadu_ps(p); }
+
+    HNSWLIB_TARGET_AVX512 static reg l2(reg sum, reg q, reg v) {
+        reg diff = _mm512_sub_ps(q, v);
+        return _mm512_add_ps(sum, _mm512_mul_ps(diff, diff));
+    }
+
+    HNSWLIB_TARGET_AVX512 static reg ip(reg sum, reg q, reg v) {
+        return _mm512_add_ps(sum, _mm512_mul_ps(q, v));
+    }
+
+    // Adds the upper 256 bits onto the lower ones. Goes through memory because the 512 to 256 bit
+    // cast and extract intrinsics start from _mm256_undefined_* and trip -Wmaybe-uninitialized
+    HNSWLIB_TARGET_AVX512 static __m256 fold(reg a) {
+        float PORTABLE_ALIGN64 tmp[16];
+        _mm512_store_ps(tmp, a);
+        return _mm256_add_ps(_mm256_load_ps(tmp), _mm256_load_ps(tmp + 8));
+    }
+
+    HNSWLIB_TARGET_AVX512 static float reduce(reg a) {
+        __m256 a8 = fold(a);
+        __m128 a4 = _mm_add_ps(_mm256_castps256_ps128(a8), _mm256_extractf128_ps(a8, 1));
+        a4 = _mm_hadd_ps(a4, a4);
+        return _mm_cvtss_f32(_mm_hadd_ps(a4, a4));
+    }
+
+    HNSWLIB_TARGET_AVX512 static void reduce4(reg a, reg b, reg c, reg d, float *out) {
+        // same folding as the AVX version once each register is down to 256 bits
+        __m256 ab = _mm256_hadd_ps(fold(a), fold(b));
+        __m256 cd = _mm256_hadd_ps(fold(c), fold(d));
+        __m256 abcd = _mm256_hadd_ps(ab, cd);
+        _mm_storeu_ps(out, _mm_add_ps(_mm256_castps256_ps128(abcd), _mm256_extractf128_ps(abcd, 1)));
+    }
+};
+#endif
+
+// Dimensions left over after the last full register
+template<bool InnerProduct>
+static inline float
+BatchResiduals(const float *q, const float *v, size_t begin, size_t end) {
+    float sum = 0;
+    for (size_t i = begin; i < end; i++) {
+        if (InnerProduct) {
+            sum += q[i] * v[i];
+        } else {
+            float diff = q[i] - v[i];
+            sum += diff * diff;
+        }
+    }
+    return sum;
+}
+
+// Defines NAME<InnerProduct> with the given target attribute. The body is a macro rather than
+// a template shared by all ISAs so that it carries the same target as the Ops helpers it calls.
+#define HNSWLIB_BATCH_DISTANCE(NAME, TARGET, Ops)                                                   \
+template<bool InnerProduct>                                                                        \
+TARGET static void                                                                                 \
+NAME(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {   \
+    typedef typename Ops::reg reg;                                                                 \
+    size_t qty = *((size_t *) qty_ptr);                                                            \
+    size_t qty_simd = qty - qty % Ops::width;                                                      \
+    const float *q = (const float *) query;                                                        \
+                                                                                                   \
+    size_t i = 0;                                                                                  \
+    for (; i + 4 <= n; i += 4) {                                                                   \
+        const float *v[4] = {(const float *) vectors[i], (const float *) vectors[i + 1],           \
+                             (const float *) vectors[i + 2], (const float *) vectors[i + 3]};      \
+        reg sum0 = Ops::zero(), sum1 = Ops::zero(), sum2 = Ops::zero(), sum3 = Ops::zero();        \
+        for (size_t j = 0; j < qty_simd; j += Ops::width) {                                        \
+            reg vq = Ops::load(q + j);                                                             \
+            if (InnerProduct) {                                                                    \
+                sum0 = Ops::ip(sum0, vq, Ops::load(v[0] + j));                                     \
+                sum1 = Ops::ip(sum1, vq, Ops::load(v[1] + j));                                     \
+                sum2 = Ops::ip(sum2, vq, Ops::load(v[2] + j));                                     \
+                sum3 = Ops::ip(sum3, vq, Ops::load(v[3] + j));                                     \
+            } else {                                                                               \
+                sum0 = Ops::l2(sum0, vq, Ops::load(v[0] + j));                                     \
+                sum1 = Ops::l2(sum1, vq, Ops::load(v[1] + j));                                     \
+                sum2 = Ops::l2(sum2, vq, Ops::load(v[2] + j));                                     \
+                sum3 = Ops::l2(sum3, vq, Ops::load(v[3] + j));                                     \
+            }                                                                                      \
+        }                                                                                          \
+        Ops::reduce4(sum0, sum1, sum2, sum3, out + i);                                             \
+        for (size_t k = 0; k < 4; k++) {                                                           \
+            if (qty_simd < qty)                                                                    \
+                out[i + k] += BatchResiduals<InnerProduct>(q, v[k], qty_simd, qty);                \
+            if (InnerProduct)                                                                      \
+                out[i + k] = 1.0f - out[i + k];                                                    \
+        }                                                                                          \
+    }                                                                                              \
+    for (; i < n; i++) {                                                                           \
+        const float *v = (const float *) vectors[i];                                               \
+        reg sum = Ops::zero();                                                                     \
+        for (size_t j = 0; j < qty_simd; j += Ops::width) {                                        \
+            if (InnerProduct)                                                                      \
+                sum = Ops::ip(sum, Ops::load(q + j), Ops::load(v + j));                            \
+            else                                                                                   \
+                sum = Ops::l2(sum, Ops::load(q + j), Ops::load(v + j));                            \
+        }                                                                                          \
+        float res = Ops::reduce(sum) + BatchResiduals<InnerProduct>(q, v, qty_simd, qty);          \
+        out[i] = InnerProduct ? 1.0f - res : res;                                                  \
+    }                                                                                              \
+}
+
+#if defined(USE_SSE)
+HNSWLIB_BATCH_DISTANCE(BatchDistanceSSE, , BatchOpsSSE)
+#endif
+
+#if defined(USE_AVX)
+HNSWLIB_BATCH_DISTANCE(BatchDistanceAVX, HNSWLIB_TARGET_AVX, BatchOpsAVX)
+#endif
+
+#if defined(USE_AVX512)
+HNSWLIB_BATCH_DISTANCE(BatchDistanceAVX512, HNSWLIB_TARGET_AVX512, BatchOpsAVX512)
+#endif
+
+#undef HNSWLIB_BATCH_DISTANCE
+
+// Widest kernel the CPU supports that fits at least one register into dim, nullptr without SIMD
+template<bool InnerProduct>
+static BATCHDISTFUNC<float>
+SelectBatchDistance(size_t dim) {
+#if defined(USE_AVX512)
+    if (dim >= BatchOpsAVX512::width && GetCpuFeatures().avx512f)
+        return BatchDistanceAVX512<InnerProduct>;
+#endif
+#if defined(USE_AVX)
+    if (dim >= BatchOpsAVX::width && GetCpuFeatures().avx)
+        return BatchDistanceAVX<InnerProduct>;
+#endif
+#if defined(USE_SSE)
+    if (dim >= BatchOpsSSE::width)
+        return BatchDistanceSSE<InnerProduct>;
+#endif
+    return nullptr;
+}
+
+}  // namespace hnswlib
@@ -21,6 +21,7 @@ InnerProductDistance(const void *pVect1, const void *pVect2, const void *qty_ptr
 #if defined(USE_AVX)
 
 // Favor using AVX if available.
+HNSWLIB_TARGET_AVX
 static float
 InnerProductSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float PORTABLE_ALIGN32 TmpRes[8];
@@ -68,6 +69,7 @@ InnerProductSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const void *qt
     return sum;
 }
 
+HNSWLIB_TARGET_AVX
 static float
 InnerProductDistanceSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     return 1.0f - InnerProductSIMD4ExtAVX(pVect1v, pVect2v, qty_ptr);
@@ -143,6 +145,7 @@ InnerProductDistanceSIMD4ExtSSE(const void *pVect1v, const void *pVect2v, const
 
 #if defined(USE_AVX512)
 
+HNSWLIB_TARGET_AVX512
 static float
 InnerProductSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float PORTABLE_ALIGN64 TmpRes[16];
@@ -194,10 +197,13 @@ InnerProductSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void
         sum512 = _mm512_fmadd_ps(v1, v2, sum512);
     }
 
-    float sum = _mm512_reduce_add_ps(sum512);
+    _mm512_store_ps(TmpRes, sum512);
+    float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7] +
+                TmpRes[8] + TmpRes[9] + TmpRes[10] + TmpRes[11] + TmpRes[12] + TmpRes[13] + TmpRes[14] + TmpRes[15];
     return sum;
 }
 
+HNSWLIB_TARGET_AVX512
 static float
 InnerProductDistanceSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     return 1.0f - InnerProductSIMD16ExtAVX512(pVect1v, pVect2v, qty_ptr);
@@ -207,6 +213,7 @@ InnerProductDistanceSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, co
 
 #if defined(USE_AVX)
 
+HNSWLIB_TARGET_AVX
 static float
 InnerProductSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float PORTABLE_ALIGN32 TmpRes[8];
@@ -243,6 +250,7 @@ InnerProductSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *q
     return sum;
 }
 
+HNSWLIB_TARGET_AVX
 static float
 InnerProductDistanceSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     return 1.0f - InnerProductSIMD16ExtAVX(pVect1v, pVect2v, qty_ptr);
@@ -341,6 +349,7 @@ InnerProductDistanceSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v,
 
 class InnerProductSpace : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    BATCHDISTFUNC<float> batchdistfunc_;
     size_t data_size_;
     size_t dim_;
 
@@ -349,21 +358,21 @@ class InnerProductSpace : public SpaceInterface<float> {
         fstdistfunc_ = InnerProductDistance;
 #if defined(USE_AVX) || defined(USE_SSE) || defined(USE_AVX512)
     #if defined(USE_AVX512)
-        if (AVX512Capable()) {
+        if (GetCpuFeatures().avx512f) {
             InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX512;
             InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX512;
-        } else if (AVXCapable()) {
+        } else if (GetCpuFeatures().avx) {
             InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX;
             InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX;
         }
     #elif defined(USE_AVX)
-        if (AVXCapable()) {
+        if (GetCpuFeatures().avx) {
             InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX;
             InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX;
         }
     #endif
     #if defined(USE_AVX)
-        if (AVXCapable()) {
+        if (GetCpuFeatures().avx) {
             InnerProductSIMD4Ext = InnerProductSIMD4ExtAVX;
             InnerProductDistanceSIMD4Ext = InnerProductDistanceSIMD4ExtAVX;
         }
@@ -378,6 +387,7 @@ class InnerProductSpace : public SpaceInterface<float> {
         else if (dim > 4)
             fstdistfunc_ = InnerProductDistanceSIMD4ExtResiduals;
 #endif
+        batchdistfunc_ = SelectBatchDistance<true>(dim);
         dim_ = dim;
         data_size_ = dim * sizeof(float);
     }
@@ -394,6 +404,10 @@ class InnerProductSpace : public SpaceInterface<float> {
         return &dim_;
     }
 
+    BATCHDISTFUNC<float> get_batch_dist_func() {
+        return batchdistfunc_;
+    }
+
 ~InnerProductSpace() {}
 };
 
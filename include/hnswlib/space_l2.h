@@ -22,6 +22,7 @@ L2Sqr(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
 #if defined(USE_AVX512)
 
 // Favor using AVX512 if available.
+HNSWLIB_TARGET_AVX512
 static float
 L2SqrSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float *pVect1 = (float *) pVect1v;
@@ -57,6 +58,7 @@ L2SqrSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_p
 #if defined(USE_AVX)
 
 // Favor using AVX if available.
+HNSWLIB_TARGET_AVX
 static float
 L2SqrSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float *pVect1 = (float *) pVect1v;
@@ -207,6 +209,7 @@ L2SqrSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty
 
 class L2Space : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    BATCHDISTFUNC<float> batchdistfunc_;
     size_t data_size_;
     size_t dim_;
 
@@ -215,12 +218,12 @@ class L2Space : public SpaceInterface<float> {
         fstdistfunc_ = L2Sqr;
 #if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
     #if defined(USE_AVX512)
-        if (AVX512Capable())
+        if (GetCpuFeatures().avx512f)
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX512;
-        else if (AVXCapable())
+        else if (GetCpuFeatures().avx)
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
     #elif defined(USE_AVX)
-        if (AVXCapable())
+        if (GetCpuFeatures().avx)
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
     #endif
 
@@ -233,6 +236,7 @@ class L2Space : public SpaceInterface<float> {
         else if (dim > 4)
             fstdistfunc_ = L2SqrSIMD4ExtResiduals;
 #endif
+        batchdistfunc_ = SelectBatchDistance<false>(dim);
         dim_ = dim;
         data_size_ = dim * sizeof(float);
     }
@@ -249,6 +253,10 @@ class L2Space : public SpaceInterface<float> {
         return &dim_;
     }
 
+    BATCHDISTFUNC<float> get_batch_dist_func() {
+        return batchdistfunc_;
+    }
+
     ~L2Space() {}
 };
 
@@ -291,6 +299,37 @@ static int L2SqrI(const void* __restrict pVect1, const void* __restrict pVect2,
     return (res);
 }
 
+#if defined(USE_AVX512)
+// 32 bytes per step: widen to 16-bit differences and square-accumulate them with vpdpwssd
+HNSWLIB_TARGET_AVX512_VNNI
+static int
+L2SqrIAVX512VNNI(const void *__restrict pVect1, const void *__restrict pVect2, const void *__restrict qty_ptr) {
+    size_t qty = *((size_t *) qty_ptr);
+    const unsigned char *a = (const unsigned char *) pVect1;
+    const unsigned char *b = (const unsigned char *) pVect2;
+    size_t qty32 = qty - qty % 32;
+
+    __m512i sum = _mm512_setzero_si512();
+    for (size_t i = 0; i < qty32; i += 32) {
+        __m512i va = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (a + i)));
+        __m512i vb = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (b + i)));
+        __m512i diff = _mm512_sub_epi16(va, vb);
+        sum = _mm512_dpwssd_epi32(sum, diff, diff);
+    }
+    // summed through memory, GCC 12 warns on the undefined register inside _mm512_reduce_add_epi32
+    int PORTABLE_ALIGN64 TmpRes[16];
+    _mm512_store_si512(TmpRes, sum);
+    int res = 0;
+    for (size_t i = 0; i < 16; i++)
+        res += TmpRes[i];
+    for (size_t i = qty32; i < qty; i++) {
+        int diff = a[i] - b[i];
+        res += diff * diff;
+    }
+    return res;
+}
+#endif
+
 class L2SpaceI : public SpaceInterface<int> {
     DISTFUNC<int> fstdistfunc_;
     size_t data_size_;
@@ -303,6 +342,10 @@ class L2SpaceI : public SpaceInterface<int> {
         } else {
             fstdistfunc_ = L2SqrI;
         }
+#if defined(USE_AVX512)
+        if (dim >= 32 && GetCpuFeatures().avx512vnni)
+            fstdistfunc_ = L2SqrIAVX512VNNI;
+#endif
         dim_ = dim;
         data_size_ = dim * sizeof(unsigned char);
     }
@@ -0,0 +1,500 @@
+#pragma once
+#include "hnswlib.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// Spaces that store compressed codes instead of raw floats:
+// SQ8Space (one byte per dimension), Fp16Space (half precision) and BinarySpace (one bit per dimension).
+// Vectors and queries are encoded with encode() before they reach HierarchicalNSW, and
+// distances are computed between two codes.
+
+namespace hnswlib {
+
+class QuantizedSpace : public SpaceInterface<float> {
+ public:
+    // Writes get_data_size() bytes of code for a vector of dim floats
+    virtual void encode(const float *vec, void *code) const = 0;
+
+    // Fits the codec to n sample vectors, codecs without parameters ignore it
+    virtual void train(const float *, size_t) {}
+
+    virtual bool is_trained() const {
+        return true;
+    }
+
+    // Codec parameters, persisted next to the index
+    virtual void saveParams(std::ostream &) const {}
+
+    virtual void loadParams(std::istream &) {}
+};
+
+#if defined(USE_AVX512)
+// GCC 12 warns that the undefined passthrough register of the unmasked AVX-512 conversions and of
+// _mm512_reduce_add_* is read uninitialized, so the kernels use the zero-masked forms and fold
+// their sums through memory.
+HNSWLIB_TARGET_AVX512
+static inline float
+ReduceAddAVX512(__m512 sum) {
+    float PORTABLE_ALIGN64 tmp[16];
+    _mm512_store_ps(tmp, sum);
+    __m256 sum8 = _mm256_add_ps(_mm256_load_ps(tmp), _mm256_load_ps(tmp + 8));
+    __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+    sum4 = _mm_hadd_ps(sum4, sum4);
+    sum4 = _mm_hadd_ps(sum4, sum4);
+    return _mm_cvtss_f32(sum4);
+}
+
+HNSWLIB_TARGET_AVX512
+static inline uint64_t
+ReduceAddAVX512(__m512i sum) {
+    uint64_t PORTABLE_ALIGN64 tmp[8];
+    _mm512_store_si512(tmp, sum);
+    uint64_t res = 0;
+    for (size_t i = 0; i < 8; i++)
+        res += tmp[i];
+    return res;
+}
+#endif
+
+/////////////////////////////////////////////////////////////
+// SQ8: per-dimension min and step, code = round((x - min) / step)
+/////////////////////////////////////////////////////////////
+
+struct SQ8Param {
+    size_t dim;
+    const float *weight;  // step^2 per dimension, the decoded L2 distance is sum(weight * (a - b)^2)
+};
+
+static float
+SQ8L2Sqr(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    const SQ8Param *param = (const SQ8Param *) param_ptr;
+    const unsigned char *a = (const unsigned char *) pVect1;
+    const unsigned char *b = (const unsigned char *) pVect2;
+    float res = 0;
+    for (size_t i = 0; i < param->dim; i++) {
+        float diff = (float) ((int) a[i] - (int) b[i]);
+        res += param->weight[i] * diff * diff;
+    }
+    return res;
+}
+
+#if defined(USE_AVX)
+HNSWLIB_TARGET_AVX2_FMA
+static float
+SQ8L2SqrAVX2(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    const SQ8Param *param = (const SQ8Param *) param_ptr;
+    const unsigned char *a = (const unsigned char *) pVect1;
+    const unsigned char *b = (const unsigned char *) pVect2;
+    size_t qty = param->dim;
+    size_t qty8 = qty - qty % 8;
+
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8) {
+        __m256i va = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (a + i)));
+        __m256i vb = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (b + i)));
+        __m256 diff = _mm256_cvtepi32_ps(_mm256_sub_epi32(va, vb));
+        sum = _mm256_fmadd_ps(_mm256_mul_ps(diff, diff), _mm256_loadu_ps(param->weight + i), sum);
+    }
+    __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    sum4 = _mm_hadd_ps(sum4, sum4);
+    sum4 = _mm_hadd_ps(sum4, sum4);
+    float res = _mm_cvtss_f32(sum4);
+    for (size_t i = qty8; i < qty; i++) {
+        float diff = (float) ((int) a[i] - (int) b[i]);
+        res += param->weight[i] * diff * diff;
+    }
+    return res;
+}
+#endif
+
+#if defined(USE_AVX512)
+HNSWLIB_TARGET_AVX512
+static float
+SQ8L2SqrAVX512(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    const SQ8Param *param = (const SQ8Param *) param_ptr;
+    const unsigned char *a = (const unsigned char *) pVect1;
+    const unsigned char *b = (const unsigned char *) pVect2;
+    size_t qty = param->dim;
+    size_t qty16 = qty - qty % 16;
+
+    __m512 sum = _mm512_setzero_ps();
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m512i va = _mm512_maskz_cvtepu8_epi32(0xffff, _mm_loadu_si128((const __m128i *) (a + i)));
+        __m512i vb = _mm512_maskz_cvtepu8_epi32(0xffff, _mm_loadu_si128((const __m128i *) (b + i)));
+        __m512 diff = _mm512_maskz_cvtepi32_ps(0xffff, _mm512_sub_epi32(va, vb));
+        sum = _mm512_fmadd_ps(_mm512_mul_ps(diff, diff), _mm512_loadu_ps(param->weight + i), sum);
+    }
+    float res = ReduceAddAVX512(sum);
+    for (size_t i = qty16; i < qty; i++) {
+        float diff = (float) ((int) a[i] - (int) b[i]);
+        res += param->weight[i] * diff * diff;
+    }
+    return res;
+}
+#endif
+
+class SQ8Space : public QuantizedSpace {
+    DISTFUNC<float> fstdistfunc_;
+    size_t dim_;
+    std::vector<float> min_;
+    std::vector<float> step_;
+    std::vector<float> weight_;
+    SQ8Param param_;
+    bool trained_{false};
+
+    void updateWeights() {
+        for (size_t i = 0; i < dim_; i++)
+            weight_[i] = step_[i] * step_[i];
+    }
+
+ public:
+    SQ8Space(size_t dim) : dim_(dim), min_(dim, 0.0f), step_(dim, 1.0f / 255), weight_(dim) {
+        updateWeights();
+        param_.dim = dim_;
+        param_.weight = weight_.data();
+        fstdistfunc_ = SQ8L2Sqr;
+#if defined(USE_AVX512)
+        if (dim >= 16 && GetCpuFeatures().avx512f) {
+            fstdistfunc_ = SQ8L2SqrAVX512;
+            return;
+        }
+#endif
+#if defined(USE_AVX)
+        if (dim >= 8 && GetCpuFeatures().avx2 && GetCpuFeatures().fma)
+            fstdistfunc_ = SQ8L2SqrAVX2;
+#endif
+    }
+
+    void train(const float *data, size_t n) {
+        if (n == 0)
+            throw std::runtime_error("SQ8Space needs at least one training vector");
+        std::vector<float> max(data, data + dim_);
+        std::copy(data, data + dim_, min_.begin());
+        for (size_t j = 1; j < n; j++) {
+            const float *vec = data + j * dim_;
+            for (size_t i = 0; i < dim_; i++) {
+                min_[i] = std::min(min_[i], vec[i]);
+                max[i] = std::max(max[i], vec[i]);
+            }
+        }
+        for (size_t i = 0; i < dim_; i++) {
+            float range = max[i] - min_[i];
+            step_[i] = range > 0 ? range / 255 : 1.0f;
+        }
+        updateWeights();
+        trained_ = true;
+    }
+
+    bool is_trained() const {
+        return trained_;
+    }
+
+    void encode(const float *vec, void *code) const {
+        unsigned char *out = (unsigned char *) code;
+        for (size_t i = 0; i < dim_; i++) {
+            float q = std::round((vec[i] - min_[i]) / step_[i]);
+            out[i] = (unsigned char) std::min(std::max(q, 0.0f), 255.0f);
+        }
+    }
+
+    void saveParams(std::ostream &out) const {
+        writeBinaryPOD(out, dim_);
+        out.write((const char *) min_.data(), dim_ * sizeof(float));
+        out.write((const char *) step_.data(), dim_ * sizeof(float));
+    }
+
+    void loadParams(std::istream &in) {
+        size_t dim = 0;
+        readBinaryPOD(in, dim);
+        if (dim != dim_)
+            throw std::runtime_error("SQ8Space parameters were saved for a different dimension");
+        in.read((char *) min_.data(), dim_ * sizeof(float));
+        in.read((char *) step_.data(), dim_ * sizeof(float));
+        if (!in)
+            throw std::runtime_error("SQ8Space parameters are truncated");
+        updateWeights();
+        trained_ = true;
+    }
+
+    size_t get_data_size() {
+        return dim_;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &param_;
+    }
+
+    ~SQ8Space() {}
+};
+
+/////////////////////////////////////////////////////////////
+// fp16: IEEE half precision, accumulated in fp32
+/////////////////////////////////////////////////////////////
+
+// Round to nearest even, out-of-range values become infinity
+static inline uint16_t
+FloatToHalf(float value) {
+    uint32_t x;
+    memcpy(&x, &value, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t mant = x & 0x7fffff;
+    int exp = (int) ((x >> 23) & 0xff);
+    if (exp == 0xff)
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    int e = exp - 127 + 15;
+    if (e >= 31)
+        return sign | 0x7c00;
+    if (e <= 0) {
+        if (e < -10)
+            return sign;
+        mant |= 0x800000;
+        int shift = 14 - e;
+        uint32_t half = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1)))
+            half++;
+        return sign | (uint16_t) half;
+    }
+    uint32_t half = ((uint32_t) e << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    // a carry out of the mantissa correctly bumps the exponent
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+        half++;
+    return sign | (uint16_t) half;
+}
+
+static inline float
+HalfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if (exp == 0) {
+        if (mant == 0) {
+            x = sign;
+        } else {
+            exp = 127 - 15 + 1;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                exp--;
+            }
+            x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        }
+    } else if (exp == 31) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+    float value;
+    memcpy(&value, &x, sizeof(value));
+    return value;
+}
+
+static float
+Fp16L2Sqr(const void *pVect1, const void *pVect2, const void *qty_ptr) {
+    size_t qty = *((size_t *) qty_ptr);
+    const uint16_t *a = (const uint16_t *) pVect1;
+    const uint16_t *b = (const uint16_t *) pVect2;
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        float diff = HalfToFloat(a[i]) - HalfToFloat(b[i]);
+        res += diff * diff;
+    }
+    return res;
+}
+
+#if defined(USE_AVX)
+HNSWLIB_TARGET_F16C
+static float
+Fp16L2SqrF16C(const void *pVect1, const void *pVect2, const void *qty_ptr) {
+    size_t qty = *((size_t *) qty_ptr);
+    const uint16_t *a = (const uint16_t *) pVect1;
+    const uint16_t *b = (const uint16_t *) pVect2;
+    size_t qty8 = qty - qty % 8;
+
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8) {
+        __m256 va = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (a + i)));
+        __m256 vb = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (b + i)));
+        __m256 diff = _mm256_sub_ps(va, vb);
+        sum = _mm256_fmadd_ps(diff, diff, sum);
+    }
+    __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    sum4 = _mm_hadd_ps(sum4, sum4);
+    sum4 = _mm_hadd_ps(sum4, sum4);
+    float res = _mm_cvtss_f32(sum4);
+    for (size_t i = qty8; i < qty; i++) {
+        float diff = HalfToFloat(a[i]) - HalfToFloat(b[i]);
+        res += diff * diff;
+    }
+    return res;
+}
+#endif
+
+#if defined(USE_AVX512)
+HNSWLIB_TARGET_AVX512
+static float
+Fp16L2SqrAVX512(const void *pVect1, const void *pVect2, const void *qty_ptr) {
+    size_t qty = *((size_t *) qty_ptr);
+    const uint16_t *a = (const uint16_t *) pVect1;
+    const uint16_t *b = (const uint16_t *) pVect2;
+    size_t qty16 = qty - qty % 16;
+
+    __m512 sum = _mm512_setzero_ps();
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m512 va = _mm512_maskz_cvtph_ps(0xffff, _mm256_loadu_si256((const __m256i *) (a + i)));
+        __m512 vb = _mm512_maskz_cvtph_ps(0xffff, _mm256_loadu_si256((const __m256i *) (b + i)));
+        __m512 diff = _mm512_sub_ps(va, vb);
+        sum = _mm512_fmadd_ps(diff, diff, sum);
+    }
+    float res = ReduceAddAVX512(sum);
+    for (size_t i = qty16; i < qty; i++) {
+        float diff = HalfToFloat(a[i]) - HalfToFloat(b[i]);
+        res += diff * diff;
+    }
+    return res;
+}
+#endif
+
+class Fp16Space : public QuantizedSpace {
+    DISTFUNC<float> fstdistfunc_;
+    size_t dim_;
+
+ public:
+    Fp16Space(size_t dim) : dim_(dim) {
+        fstdistfunc_ = Fp16L2Sqr;
+#if defined(USE_AVX512)
+        if (dim >= 16 && GetCpuFeatures().avx512f) {
+            fstdistfunc_ = Fp16L2SqrAVX512;
+            return;
+        }
+#endif
+#if defined(USE_AVX)
+        if (dim >= 8 && GetCpuFeatures().f16c && GetCpuFeatures().fma)
+            fstdistfunc_ = Fp16L2SqrF16C;
+#endif
+    }
+
+    void encode(const float *vec, void *code) const {
+        uint16_t *out = (uint16_t *) code;
+        for (size_t i = 0; i < dim_; i++)
+            out[i] = FloatToHalf(vec[i]);
+    }
+
+    size_t get_data_size() {
+        return dim_ * sizeof(uint16_t);
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &dim_;
+    }
+
+    ~Fp16Space() {}
+};
+
+/////////////////////////////////////////////////////////////
+// Binary: one sign bit per dimension, Hamming distance
+/////////////////////////////////////////////////////////////
+
+static float
+Hamming(const void *pVect1, const void *pVect2, const void *words_ptr) {
+    size_t words = *((size_t *) words_ptr);
+    const uint64_t *a = (const uint64_t *) pVect1;
+    const uint64_t *b = (const uint64_t *) pVect2;
+    uint64_t res = 0;
+    for (size_t i = 0; i < words; i++)
+        res += __builtin_popcountll(a[i] ^ b[i]);
+    return (float) res;
+}
+
+#if defined(USE_SSE)
+HNSWLIB_TARGET_POPCNT
+static float
+HammingPOPCNT(const void *pVect1, const void *pVect2, const void *words_ptr) {
+    size_t words = *((size_t *) words_ptr);
+    const uint64_t *a = (const uint64_t *) pVect1;
+    const uint64_t *b = (const uint64_t *) pVect2;
+    uint64_t res = 0;
+    for (size_t i = 0; i < words; i++)
+        res += __builtin_popcountll(a[i] ^ b[i]);
+    return (float) res;
+}
+#endif
+
+#if defined(USE_AVX512)
+HNSWLIB_TARGET_AVX512_VPOPCNTDQ
+static float
+HammingAVX512(const void *pVect1, const void *pVect2, const void *words_ptr) {
+    size_t words = *((size_t *) words_ptr);
+    const uint64_t *a = (const uint64_t *) pVect1;
+    const uint64_t *b = (const uint64_t *) pVect2;
+    size_t words8 = words - words % 8;
+
+    __m512i sum = _mm512_setzero_si512();
+    for (size_t i = 0; i < words8; i += 8) {
+        __m512i diff = _mm512_xor_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(diff));
+    }
+    uint64_t res = ReduceAddAVX512(sum);
+    for (size_t i = words8; i < words; i++)
+        res += __builtin_popcountll(a[i] ^ b[i]);
+    return (float) res;
+}
+#endif
+
+class BinarySpace : public QuantizedSpace {
+    DISTFUNC<float> fstdistfunc_;
+    size_t dim_;
+    size_t words_;
+
+ public:
+    BinarySpace(size_t dim) : dim_(dim), words_((dim + 63) / 64) {
+        fstdistfunc_ = Hamming;
+#if defined(USE_AVX512)
+        if (words_ >= 8 && GetCpuFeatures().avx512vpopcntdq) {
+            fstdistfunc_ = HammingAVX512;
+            return;
+        }
+#endif
+#if defined(USE_SSE)
+        if (GetCpuFeatures().popcnt)
+            fstdistfunc_ = HammingPOPCNT;
+#endif
+    }
+
+    // Bit i is set when dimension i is positive, unused bits of the last word stay zero
+    void encode(const float *vec, void *code) const {
+        uint64_t *out = (uint64_t *) code;
+        std::fill(out, out + words_, 0);
+        for (size_t i = 0; i < dim_; i++) {
+            if (vec[i] > 0)
+                out[i / 64] |= (uint64_t) 1 << (i % 64);
+        }
+    }
+
+    size_t get_data_size() {
+        return words_ * sizeof(uint64_t);
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &words_;
+    }
+
+    ~BinarySpace() {}
+};
+
+}  // namespace hnswlib
@@ -2,77 +2,331 @@
 
 #include <mutex>
 #include <string.h>
-#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define HNSWLIB_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#define HNSWLIB_COLD __attribute__((noinline, cold))
+#else
+#define HNSWLIB_UNLIKELY(x) (x)
+#define HNSWLIB_COLD
+#endif
 
 namespace hnswlib {
 typedef unsigned short int vl_type;
 
+// How a VisitedList remembers visited ids.
+// DENSE keeps a 2-byte tag per element and is the fastest.
+// BITSET keeps one bit per element and clears only the words touched by the last search.
+// HASHED keeps an open-addressing set whose size follows the number of visited ids,
+// for indexes where even one bit per element per thread is too much.
+// AUTO picks DENSE for small indexes and BITSET / HASHED as the index grows.
+enum class VisitedSetType { AUTO, DENSE, BITSET, HASHED };
+
 class VisitedList {
  public:
+    static constexpr size_t DENSE_MAX_ELEMENTS = 1 << 24;
+    static constexpr size_t BITSET_MAX_ELEMENTS = (size_t) 1 << 30;
+
+    VisitedSetType type;
+    uint64_t generation{0};  // pool generation the list was created for
+
     vl_type curV;
-    vl_type *mass;
+    vl_type *mass{nullptr};
     unsigned int numelements;
 
-    VisitedList(int numelements1) {
-        curV = -1;
+    VisitedList(size_t numelements1, VisitedSetType type1 = VisitedSetType::DENSE) {
         numelements = numelements1;
-        mass = new vl_type[numelements];
+        type = resolveType(type1, numelements);
+        curV = -1;
+        if (type == VisitedSetType::DENSE) {
+            mass = new vl_type[numelements];
+        } else if (type == VisitedSetType::BITSET) {
+            bits_.assign((numelements + 63) / 64, 0);
+        } else {
+            table_.assign(HASHED_INITIAL_CAPACITY, 0);
+            epoch_ = 0;
+        }
+    }
+
+    static VisitedSetType resolveType(VisitedSetType type, size_t numelements) {
+        if (type != VisitedSetType::AUTO)
+            return type;
+        if (numelements <= DENSE_MAX_ELEMENTS)
+            return VisitedSetType::DENSE;
+        if (numelements <= BITSET_MAX_ELEMENTS)
+            return VisitedSetType::BITSET;
+        return VisitedSetType::HASHED;
     }
 
     void reset() {
-        curV++;
-        if (curV == 0) {
-            memset(mass, 0, sizeof(vl_type) * numelements);
+        if (type == VisitedSetType::DENSE) {
             curV++;
+            if (curV == 0) {
+                memset(mass, 0, sizeof(vl_type) * numelements);
+                curV++;
+            }
+        } else if (type == VisitedSetType::BITSET) {
+            for (uint32_t word : touched_)
+                bits_[word] = 0;
+            touched_.clear();
+        } else {
+            // entries of older epochs count as empty, so the table is only wiped when the epoch wraps
+            epoch_++;
+            hashed_count_ = 0;
+            if (epoch_ == 0) {
+                std::fill(table_.begin(), table_.end(), 0);
+                epoch_++;
+            }
+        }
+    }
+
+    // Marks id as visited, returns true if it had already been visited since the last reset
+    inline bool visit(unsigned int id) {
+        if (type == VisitedSetType::DENSE) {
+            if (HNSWLIB_UNLIKELY(id >= numelements))
+                grow(id);
+            if (mass[id] == curV)
+                return true;
+            mass[id] = curV;
+            return false;
+        }
+        if (type == VisitedSetType::BITSET) {
+            if (HNSWLIB_UNLIKELY((id >> 6) >= bits_.size()))
+                grow(id);
+            uint64_t &word = bits_[id >> 6];
+            uint64_t mask = (uint64_t) 1 << (id & 63);
+            if (word & mask)
+                return true;
+            if (word == 0)
+                touched_.push_back(id >> 6);
+            word |= mask;
+            return false;
         }
+        return hashedVisit(id);
+    }
+
+    inline void prefetch(unsigned int id) const {
+#if defined(__GNUC__)
+        if (type == VisitedSetType::DENSE) {
+            __builtin_prefetch(mass + id);
+        } else if (type == VisitedSetType::BITSET) {
+            __builtin_prefetch(bits_.data() + (id >> 6));
+        } else {
+            __builtin_prefetch(table_.data() + slotOf(id, table_.size()));
+        }
+#endif
+    }
+
+    // Bytes held by the list, for sizing decisions and diagnostics
+    size_t memoryUsage() const {
+        return (mass ? sizeof(vl_type) * numelements : 0) + bits_.capacity() * sizeof(uint64_t)
+            + touched_.capacity() * sizeof(uint32_t) + table_.capacity() * sizeof(uint64_t);
     }
 
     ~VisitedList() { delete[] mass; }
+
+ private:
+    static constexpr size_t HASHED_INITIAL_CAPACITY = 1 << 12;
+
+    std::vector<uint64_t> bits_;
+    std::vector<uint32_t> touched_;  // bitset words set since the last reset
+
+    // each slot holds (epoch << 32) | id, linear probing
+    std::vector<uint64_t> table_;
+    uint32_t epoch_{0};
+    size_t hashed_count_{0};
+
+    // Ids past the size the list was created for show up when the index grows during a search
+    HNSWLIB_COLD void grow(unsigned int id) {
+        size_t n = std::max((size_t) id + 1, (size_t) numelements * 2);
+        if (type == VisitedSetType::DENSE) {
+            // zero never equals curV after a reset, so the new tail reads as not visited
+            vl_type *mass_new = new vl_type[n];
+            memcpy(mass_new, mass, sizeof(vl_type) * numelements);
+            memset(mass_new + numelements, 0, sizeof(vl_type) * (n - numelements));
+            delete[] mass;
+            mass = mass_new;
+        } else {
+            bits_.resize((n + 63) / 64, 0);
+        }
+        numelements = n;
+    }
+
+    static inline size_t slotOf(unsigned int id, size_t capacity) {
+        return (size_t) (((uint64_t) id * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+    }
+
+    bool hashedVisit(unsigned int id) {
+        const uint64_t entry = ((uint64_t) epoch_ << 32) | id;
+        const size_t mask = table_.size() - 1;
+        for (size_t slot = slotOf(id, table_.size());; slot = (slot + 1) & mask) {
+            uint64_t current = table_[slot];
+            if (current == entry)
+                return true;
+            if ((uint32_t) (current >> 32) != epoch_) {
+                table_[slot] = entry;
+                break;
+            }
+        }
+        if (++hashed_count_ * 2 > table_.size())
+            growTable();
+        return false;
+    }
+
+    void growTable() {
+        std::vector<uint64_t> old(table_.size() * 2, 0);
+        old.swap(table_);
+        const size_t mask = table_.size() - 1;
+        for (uint64_t current : old) {
+            if ((uint32_t) (current >> 32) != epoch_)
+                continue;
+            size_t slot = slotOf((unsigned int) current, table_.size());
+            while ((uint32_t) (table_[slot] >> 32) == epoch_)
+                slot = (slot + 1) & mask;
+            table_[slot] = current;
+        }
+    }
 };
 ///////////////////////////////////////////////////////////
 //
 // Class for multi-threaded pool-management of VisitedLists
 //
+// Each thread keeps a few lists in a thread-local cache, so a search normally takes and returns
+// its list without touching shared state. Lists that do not fit in the cache go to a small
+// lock-free array of shared slots, and only when both are empty is a new list allocated.
+//
 /////////////////////////////////////////////////////////
 
 class VisitedListPool {
-    std::deque<VisitedList *> pool;
-    std::mutex poolguard;
-    int numelements;
+    static constexpr size_t SHARED_SLOTS = 64;
+    static constexpr size_t THREAD_CACHE_SIZE = 4;
+
+    struct CacheEntry {
+        const VisitedListPool *pool{nullptr};
+        std::weak_ptr<void> alive;  // expires when the pool is destroyed, its address may be reused
+        VisitedList *list{nullptr};
+    };
+
+    struct ThreadCache {
+        CacheEntry entries[THREAD_CACHE_SIZE];
+        ~ThreadCache() {
+            for (auto &entry : entries)
+                delete entry.list;
+        }
+    };
+
+    static ThreadCache &threadCache() {
+        static thread_local ThreadCache cache;
+        return cache;
+    }
+
+    std::atomic<VisitedList *> shared_[SHARED_SLOTS];
+    std::atomic<size_t> numelements_;
+    std::atomic<VisitedSetType> type_;
+    std::atomic<uint64_t> generation_{1};
+    std::shared_ptr<void> alive_;
+
+    VisitedList *newList() {
+        uint64_t generation = generation_.load(std::memory_order_acquire);
+        VisitedList *list = new VisitedList(numelements_.load(std::memory_order_acquire), type_.load(std::memory_order_acquire));
+        list->generation = generation;
+        return list;
+    }
+
+    bool isCurrent(const VisitedList *list) const {
+        return list->generation == generation_.load(std::memory_order_acquire);
+    }
 
  public:
-    VisitedListPool(int initmaxpools, int numelements1) {
-        numelements = numelements1;
-        for (int i = 0; i < initmaxpools; i++)
-            pool.push_front(new VisitedList(numelements));
+    VisitedListPool(int initmaxpools, size_t numelements1, VisitedSetType type = VisitedSetType::AUTO)
+        : numelements_(numelements1), type_(type), alive_(std::make_shared<char>(0)) {
+        for (size_t i = 0; i < SHARED_SLOTS; i++)
+            shared_[i].store(nullptr, std::memory_order_relaxed);
+        for (int i = 0; i < initmaxpools && i < (int) SHARED_SLOTS; i++)
+            shared_[i].store(newList(), std::memory_order_relaxed);
     }
 
     VisitedList *getFreeVisitedList() {
-        VisitedList *rez;
-        {
-            std::unique_lock <std::mutex> lock(poolguard);
-            if (pool.size() > 0) {
-                rez = pool.front();
-                pool.pop_front();
-            } else {
-                rez = new VisitedList(numelements);
+        VisitedList *rez = nullptr;
+        for (auto &entry : threadCache().entries) {
+            if (entry.list == nullptr)
+                continue;
+            if (entry.alive.expired()) {
+                // left behind by a destroyed pool
+                delete entry.list;
+                entry = CacheEntry();
+            } else if (rez == nullptr && entry.pool == this) {
+                rez = entry.list;
+                entry.list = nullptr;
+                if (!isCurrent(rez)) {
+                    delete rez;
+                    rez = nullptr;
+                }
+            }
+        }
+        for (size_t i = 0; rez == nullptr && i < SHARED_SLOTS; i++) {
+            if (shared_[i].load(std::memory_order_relaxed) == nullptr)
+                continue;
+            rez = shared_[i].exchange(nullptr, std::memory_order_acq_rel);
+            if (rez != nullptr && !isCurrent(rez)) {
+                delete rez;
+                rez = nullptr;
             }
         }
+        if (rez == nullptr)
+            rez = newList();
         rez->reset();
         return rez;
     }
 
     void releaseVisitedList(VisitedList *vl) {
-        std::unique_lock <std::mutex> lock(poolguard);
-        pool.push_front(vl);
+        if (!isCurrent(vl)) {
+            delete vl;
+            return;
+        }
+        for (auto &entry : threadCache().entries) {
+            if (entry.list == nullptr) {
+                entry.pool = this;
+                entry.alive = alive_;
+                entry.list = vl;
+                return;
+            }
+        }
+        for (size_t i = 0; i < SHARED_SLOTS; i++) {
+            VisitedList *expected = nullptr;
+            if (shared_[i].compare_exchange_strong(expected, vl, std::memory_order_acq_rel))
+                return;
+        }
+        delete vl;
+    }
+
+    // Lists grow on their own when they meet larger ids, so they are only dropped (when next returned
+    // to or taken from the pool) if the new size resolves to another set type. Searches still holding
+    // one finish safely either way.
+    void resize(size_t numelements) {
+        size_t old = numelements_.exchange(numelements, std::memory_order_acq_rel);
+        VisitedSetType type = type_.load(std::memory_order_acquire);
+        if (VisitedList::resolveType(type, old) != VisitedList::resolveType(type, numelements))
+            generation_++;
+    }
+
+    void setType(VisitedSetType type) {
+        type_.store(type, std::memory_order_release);
+        generation_++;
+    }
+
+    size_t getNumElements() const {
+        return numelements_.load(std::memory_order_acquire);
     }
 
     ~VisitedListPool() {
-        while (pool.size()) {
-            VisitedList *rez = pool.front();
-            pool.pop_front();
-            delete rez;
-        }
+        for (size_t i = 0; i < SHARED_SLOTS; i++)
+            delete shared_[i].load(std::memory_order_relaxed);
     }
 };
 }  // namespace hnswlib
@@ -2,6 +2,26 @@
 
 #include <string>
 
+// 由配置文件给出的索引构建参数，未配置的项使用默认值
+struct IndexParams {
+    int hnsw_m = 16;            // HNSW 每层的邻居数
+    int ef_construction = 200;  // HNSW 建图时的候选队列长度
+    int ef_search = 50;         // HNSW 默认搜索队列长度
+    int nlist = 256;            // IVF 聚类中心数
+    int nprobe = 16;            // IVF 默认探查的倒排表数
+    int pq_m = 32;              // PQ 子空间数，需整除 dim
+    int pq_nbits = 8;           // PQ 每个子空间的编码位数
+    int search_threads = 1;     // IVF 单个查询内并行扫描倒排表的线程数
+    int train_size = 0;         // 触发训练所需的真实向量数，0 表示按索引类型估算
+    int memtable_size = 10000;  // SEGMENTED 内存段写满多少条后封存
+    int merge_factor = 4;       // SEGMENTED 同一层的段数达到多少时合并
+    std::string segment_type = "HNSWFLAT"; // SEGMENTED 封存段的索引类型：HNSWFLAT / IVFFLAT / FLAT
+    std::string graph_order = "none";      // CUDAHNSW 重建时按图的遍历顺序重排节点：none / bfs / rcm
+    std::string hnsw_quantizer = "none";   // CUDAHNSW 图中向量的存储格式：none / sq8 / fp16 / binary
+    int rerank_factor = 0;      // CUDAHNSW 量化后取 k * rerank_factor 个候选按原始向量重排，0 表示不重排
+    int hnsw_repair_percent = 10; // CUDAHNSW 删除累计到总数的百分之几时后台修复图，0 表示不修复
+};
+
 class IndexFactory {
 public:
     enum class IndexType {
@@ -11,6 +31,12 @@ public:
         IVFPQ,
         CAGRA,
         CUDAHNSW,
+        HNSWSQ8,
+        HNSWFP16,
+        IVFSQ8,
+        IVFFLAT,
+        IVFPQ_CPU,
+        SEGMENTED,
         UNKNOWN = -1 
     };
 
@@ -19,7 +45,15 @@ public:
         IP
     };
 
-    void* init(IndexType type, int dim = 1, int num_train = 1000, MetricType metric = MetricType::L2);
+    void* init(IndexType type, int dim = 1, int num_train = 1000, MetricType metric = MetricType::L2, const IndexParams& params = IndexParams());
+
+    // 由配置或请求中的名字得到索引类型，无法识别时返回 UNKNOWN
+    static IndexType parseIndexType(const std::string& name);
+    static std::string typeName(IndexType type);
+    // 是否需要先用真实数据训练后才能写入
+    static bool needsTraining(IndexType type, const IndexParams& params = IndexParams());
+    // 训练前需要攒够的真实向量条数
+    static int trainSize(IndexType type, const IndexParams& params);
 };
 
 IndexFactory* getGlobalIndexFactory();
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <faiss/Index.h>
+#include <faiss/impl/IDSelector.h>
+#include <vector>
+#include <string>
+#include <faiss/IndexIDMap.h>
+#include <shared_mutex>
+
+// CPU 上的 IVF 系列索引 (IVF-Flat / IVF-PQ / IVF-SQ8)
+class IVFCPUIndex {
+public:
+    // search_threads > 1 时单个查询在探查的倒排表之间用 OpenMP 并行扫描
+    IVFCPUIndex(faiss::Index* index, int search_threads = 1);
+    ~IVFCPUIndex();
+    void insert_vectors(const std::vector<float>& data, uint64_t label);
+    void insert_batch_vectors(const std::vector<std::vector<float>>& vectors, const std::vector<long>& ids);
+    void remove_vectors(const std::vector<long>& ids);
+    std::pair<std::vector<long>, std::vector<float>> search_vectors(const std::vector<float>& query, int k, int nprobe = 0);
+
+    void train(int num_train, const std::vector<float>& train_vec);
+
+    void saveIndex(const std::string& file_path);
+    void loadIndex(const std::string& file_path);
+private:
+    faiss::Index* index;
+    faiss::IndexIDMap* id_map;
+    int search_threads;
+    std::shared_mutex index_mutex;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <random>
+
+// 单个后端节点的负载统计
+struct NodeStats {
+    std::atomic<int> inflight{0};      // 已转发未返回的请求数
+    std::atomic<double> ewmaMs{0};     // 响应时间的指数加权移动平均
+    std::atomic<bool> sampled{false};  // 是否已有响应时间样本
+};
+
+// 按延迟感知的负载均衡：每次随机取两个候选节点，选预期代价
+// ewma * (inflight + 1) 较小的一个 (power of two choices)，没有样本的节点用候选节点 ewma 的中位数代替
+class LoadBalancer {
+public:
+    // alpha 为新样本的权重，失败的请求按 failurePenaltyMs 计入延迟
+    LoadBalancer(double alpha, double failurePenaltyMs);
+
+    std::shared_ptr<NodeStats> stats(const std::string& url);
+    // 从候选节点的 url 中选出一个，返回其下标，candidates 不能为空
+    size_t pick(const std::vector<std::string>& candidates);
+    void onStart(NodeStats& stats);
+    void onFinish(NodeStats& stats, double elapsedMs, bool success);
+    // 被主动取消的请求不计入延迟样本
+    void onCancel(NodeStats& stats);
+    // 丢弃已经不在拓扑中的节点的统计
+    void prune(const std::vector<std::string>& urls);
+
+private:
+    double cost(const NodeStats& stats, double priorMs) const;
+
+    double alpha_;
+    double failurePenaltyMs_;
+    std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<NodeStats>> stats_;
+    std::mt19937 rng_;
+};
+
+// 最近一段时间的响应时间样本，用于估计分位数
+class LatencyWindow {
+public:
+    explicit LatencyWindow(size_t capacity = 1024);
+    void add(double ms);
+    // 样本数少于 minSamples 时返回负数
+    double percentile(double p, size_t minSamples = 20);
+
+private:
+    std::mutex mutex_;
+    std::vector<double> samples_;
+    size_t capacity_;
+    size_t next_;
+};
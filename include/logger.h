@@ -1,8 +1,33 @@
 #pragma once
 
 #include "spdlog/spdlog.h"
+#include <map>
+#include <string>
 
 extern std::shared_ptr<spdlog::logger> GlobalLogger;
 
-void init_global_logger();
-void set_log_level(spdlog::level::level_enum log_level);
\ No newline at end of file
+// 日志输出配置，默认异步写控制台
+struct LogOptions {
+    spdlog::level::level_enum level = spdlog::level::info;
+    bool async = true;
+    size_t queueSize = 8192;                 // 异步队列的条数上限，预先分配
+    std::string overflow = "overrun_oldest"; // 队列满时：block 等待，overrun_oldest 丢弃最旧的，discard_new 丢弃新的
+    bool console = true;
+    std::string file;                        // 非空时同时写入按大小滚动的文件
+    size_t fileMaxMb = 100;
+    size_t fileMaxCount = 5;
+};
+
+// 从配置文件的 log_* 项读取，没有的项保留默认值
+LogOptions readLogOptions(const std::map<std::string, std::string>& config);
+
+void init_global_logger(const LogOptions& options = LogOptions());
+void set_log_level(spdlog::level::level_enum log_level);
+
+// 热路径上的 debug 日志：级别没有开启时不计算参数也不格式化；
+// 编译时定义 VDB_DISABLE_DEBUG_LOG 则整条语句被去掉
+#ifdef VDB_DISABLE_DEBUG_LOG
+#define LOG_DEBUG(...) (void)0
+#else
+#define LOG_DEBUG(...) do { if (GlobalLogger->should_log(spdlog::level::debug)) { GlobalLogger->debug(__VA_ARGS__); } } while (0)
+#endif
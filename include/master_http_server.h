@@ -2,7 +2,14 @@
 
 #include "include/httplib.h"
 #include <etcd/Client.hpp>
+#include <etcd/Watcher.hpp>
 #include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
 #include "rapidjson/document.h"
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/writer.h"
@@ -23,15 +30,34 @@ public:
     void run();
 
 private:
+    std::string etcdEndpoints_;
     etcd::Client etcdClient_;
     httplib::Server httpServer_;
     int httpPort_;
     std::set<std::string> key_set;
 
+    // 由 etcd watch 维护的拓扑缓存，读请求不再访问 etcd
+    std::map<std::string, std::string> topology_; // etcd key -> value
+    int64_t topologyVersion_;                     // 最近一次变更对应的 etcd revision
+    std::mutex topologyMutex_;
+    std::condition_variable topologyCv_;
+    bool watchBroken_;
+    std::atomic<bool> running_;
+    std::thread watchThread_;
+    std::atomic<int> topologyWatchers_; // 正在等待的拓扑长轮询数
+
     void setResponse(httplib::Response& res, int retCode, const std::string& msg, const rapidjson::Document* data = nullptr);
     void getNodeInfo(const httplib::Request& req, httplib::Response& res);
     void addNode(const httplib::Request& req, httplib::Response& res);
     void removeNode(const httplib::Request& req, httplib::Response& res);
     void getInstance(const httplib::Request& req, httplib::Response& res);
+    void addCollection(const httplib::Request& req, httplib::Response& res);
+    void getCollection(const httplib::Request& req, httplib::Response& res);
+    void removeCollection(const httplib::Request& req, httplib::Response& res);
+    void watchTopology(const httplib::Request& req, httplib::Response& res);
+    void watchLoop();
+    bool loadTopology();
+    void applyWatchResponse(const etcd::Response& response);
+    std::vector<std::pair<std::string, std::string>> cachedEntries(const std::string& prefix, int64_t& version);
 
 };
\ No newline at end of file
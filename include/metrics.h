@@ -0,0 +1,168 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cstdlib>
+#include "tracing.h"
+
+// 热路径上的计数与延迟统计。写入只对本线程所在分片做 relaxed 原子加，
+// 不加锁；抓取 /metrics 时再把各分片汇总
+class Counter {
+public:
+    void add(uint64_t n = 1);
+    uint64_t value() const;
+
+private:
+    static constexpr size_t kStripes = 8;
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> value{0};
+    };
+    Stripe stripes_[kStripes];
+};
+
+// HDR 风格的对数线性直方图：单位微秒，每个 2 的幂区间再分 8 个桶，
+// 分位数的相对误差约 12.5%，可表示到约 12 天
+class Histogram {
+public:
+    static constexpr int kSubBucketBits = 3;
+    static constexpr int kMaxBits = 40;
+    static constexpr size_t kBuckets = ((kMaxBits - kSubBucketBits) << kSubBucketBits) + (1 << kSubBucketBits);
+
+    struct Snapshot {
+        std::vector<uint64_t> counts;
+        uint64_t count = 0;
+        double sumSeconds = 0;
+        // 返回秒
+        double quantile(double q) const;
+    };
+
+    void record(double seconds);
+    void recordMicros(uint64_t micros);
+    Snapshot snapshot() const;
+
+    static size_t bucketOf(uint64_t micros);
+    static double bucketValue(size_t bucket); // 桶的中点，单位微秒
+
+private:
+    static constexpr size_t kStripes = 4;
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> counts[kBuckets] = {};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sumMicros{0};
+    };
+    Stripe stripes_[kStripes];
+};
+
+// 记录从构造到析构的耗时
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& histogram) : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        histogram_.record(std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count());
+    }
+
+private:
+    Histogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// 进程内所有指标的注册表。查找需要加锁，调用方应在初始化时取得引用并缓存，
+// 不要在每次请求中查找
+class MetricsRegistry {
+public:
+    static MetricsRegistry& instance();
+
+    // labels 形如 endpoint="/search",index_type="HNSWFLAT"，同名同标签返回同一个实例
+    Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "");
+    Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+    // 抓取时调用 fn 取当前值
+    void gauge(const std::string& name, const std::string& help, const std::string& labels, std::function<double()> fn);
+
+    // Prometheus 文本格式；直方图以 summary 输出进程启动以来的分位数
+    std::string render();
+
+private:
+    enum class Type { COUNTER, HISTOGRAM, GAUGE };
+    struct Family {
+        Type type;
+        std::string help;
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms;
+        std::map<std::string, std::function<double()>> gauges;
+    };
+
+    Family& family(const std::string& name, const std::string& help, Type type);
+
+    std::mutex mutex_;
+    std::map<std::string, Family> families_;
+};
+
+// 记录某个 http 路径的请求数、5xx 数和延迟
+class EndpointMetrics {
+public:
+    EndpointMetrics(const std::string& service, const std::string& path);
+    void record(double seconds, int status);
+
+private:
+    Histogram& latency_;
+    Counter& requests_;
+    Counter& errors_;
+};
+
+// 当前线程正在处理的 http 请求的开始时间，httplib 的路由前回调和日志回调在同一线程上执行
+inline std::chrono::steady_clock::time_point& requestStartTime() {
+    static thread_local std::chrono::steady_clock::time_point start;
+    return start;
+}
+
+// 给 httplib 服务挂上按路径的延迟统计和请求采样追踪，并注册 GET /metrics 和 GET /debug/traces。
+// 只统计 paths 中的路径，避免任意路径撑大标签集合。被采样的请求在响应头中带上
+// Server-Timing 和 X-Trace-Id，客户端可以用 X-Trace-Sampled: 1 强制采样
+template <typename Server>
+void instrumentHttpServer(Server& server, const std::string& service, const std::vector<std::string>& paths) {
+    // 构造后只读，请求线程无需加锁
+    auto endpoints = std::make_shared<std::map<std::string, std::unique_ptr<EndpointMetrics>>>();
+    for (const auto& path : paths) {
+        (*endpoints)[path].reset(new EndpointMetrics(service, path));
+    }
+    server.set_pre_routing_handler([endpoints, service](const auto& req, auto&) {
+        requestStartTime() = std::chrono::steady_clock::now();
+        if (endpoints->find(req.path) != endpoints->end()) {
+            Tracer::instance().begin(service, req.path, req.get_header_value(Tracer::kTraceIdHeader), req.get_header_value(Tracer::kSampledHeader) == "1");
+        } else {
+            currentTrace().reset();
+        }
+        return Server::HandlerResponse::Unhandled;
+    });
+    // 在写出响应头之前执行
+    server.set_post_routing_handler([](const auto&, auto& res) {
+        const std::shared_ptr<Trace>& trace = currentTrace();
+        if (trace) {
+            res.set_header("Server-Timing", trace->serverTiming());
+            res.set_header(Tracer::kTraceIdHeader, trace->traceId);
+            Tracer::instance().finish(res.status);
+        }
+    });
+    server.set_logger([endpoints](const auto& req, const auto& res) {
+        auto it = endpoints->find(req.path);
+        if (it != endpoints->end()) {
+            it->second->record(std::chrono::duration<double>(std::chrono::steady_clock::now() - requestStartTime()).count(), res.status);
+        }
+    });
+    server.Get("/metrics", [](const auto&, auto& res) {
+        res.set_content(MetricsRegistry::instance().render(), "text/plain; version=0.0.4");
+    });
+    server.Get("/debug/traces", [](const auto& req, auto& res) {
+        size_t limit = 50;
+        if (req.has_param("limit")) {
+            limit = std::strtoul(req.get_param_value("limit").c_str(), nullptr, 10);
+        }
+        res.set_content(Tracer::instance().dump(limit), "application/json");
+    });
+}
@@ -1,9 +1,21 @@
 #include "include/httplib.h"
+#include "include/connection_pool.h"
+#include "include/async_forwarder.h"
+#include "include/load_balancer.h"
+#include "include/health_checker.h"
+#include "include/result_cache.h"
+#include "include/single_flight.h"
+#include "include/metrics.h"
+#include "rapidjson/document.h"
 #include <curl/curl.h>
 #include <string>
 #include <sstream>
 #include <vector>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
 
 // 节点信息结构
 struct NodeInfo {
@@ -13,9 +25,52 @@ struct NodeInfo {
     int type; // 0 表示综合节点，1 表示索引节点，2 表示存储节点
 };
 
+// 一个分片对应 master 中的一个实例，实例内的节点互为副本
+struct ShardInfo {
+    std::string instanceId;
+    std::vector<NodeInfo> nodes;
+};
+
+// 由配置文件给出的转发参数
+struct ProxyOptions {
+    int poolSize = 16;              // 每个后端节点最多保留的空闲连接数
+    int poolIdleTimeoutMs = 60000;  // 空闲连接超过该时间后关闭
+    int connectTimeoutMs = 3000;    // 与后端建立连接的超时
+    int requestTimeoutMs = 20000;   // 单次转发的默认总超时
+    std::map<std::string, int> routeTimeoutsMs; // 按路径单独配置的转发超时
+    int forwardThreads = 2;         // 转发事件循环线程数
+    int serverThreads = 64;         // http 工作线程数，工作线程只等待转发结果
+    int maxWaitingWorkers = 48;     // 同时等待后端结果的工作线程上限，超出时直接返回 503，0 表示不限制
+    double ewmaAlpha = 0.3;         // 节点响应时间 EWMA 中新样本的权重
+    double failurePenaltyMs = 1000; // 转发失败时计入 EWMA 的延迟
+    bool hedgeEnabled = true;       // 读请求超过分位延迟仍未返回时，向另一个副本再发一份
+    double hedgePercentile = 95;    // 对冲延迟取该路径最近响应时间的分位数
+    int hedgeMinDelayMs = 2;        // 对冲延迟的下限，避免后端很快时几乎每个请求都被对冲
+    int readRetries = 1;            // 读请求连接失败时换节点重试的次数
+    std::string collection;         // 分片集合名，为空时只代理 instanceId 这一个实例
+    std::string metric = "L2";      // 后端的距离度量，合并各分片结果时决定排序方向，L2 或 IP
+    int topologyWatchTimeoutMs = 30000; // 拓扑长轮询的最长等待时间，超时后也会刷新一次拓扑
+    int healthCheckIntervalMs = 1000; // 主动探测后端 /health 的间隔，0 表示不探测
+    int healthCheckTimeoutMs = 500;   // 探测请求的超时
+    int ejectConsecutiveFailures = 3; // 连续失败多少次后摘除节点
+    int ejectBaseMs = 5000;           // 第一次摘除的时长，连续摘除时翻倍
+    int ejectMaxMs = 60000;           // 摘除时长的上限
+    double outlierLatencyFactor = 3;  // 响应时间超过中位数多少倍时按离群摘除，0 表示不按延迟摘除
+    int maxEjectPercent = 50;         // 同时被摘除的节点比例上限
+    int searchCacheMb = 0;            // 搜索结果缓存的内存上限，0 表示关闭
+    int searchCacheTtlMs = 1000;      // 缓存条目的有效期，限制其他 proxy 写入造成的不一致时间
+    bool searchSingleFlight = true;   // 合并请求体完全相同的并发搜索
+};
+
+// proxy 缓存的一次搜索响应
+struct CachedResponse {
+    std::string body;
+    std::chrono::steady_clock::time_point expiresAt;
+};
+
 class ProxyHttpServer {
 public:
-    ProxyHttpServer(const std::string& masterServerHost, int masterServerPort, const std::string& instanceId);
+    ProxyHttpServer(const std::string& masterServerHost, int masterServerPort, const std::string& instanceId, const ProxyOptions& options = ProxyOptions());
     ~ProxyHttpServer();
     void start(int port);
 
@@ -23,13 +78,34 @@ private:
     std::string masterServerHost_; // Master Server 的主机地址
     int masterServerPort_;         // Master Server 的端口
     std::string instanceId_;       // 当前 Proxy Server 所属的实例 ID
+    ProxyOptions options_;
     CURL* curlHandle_;
     httplib::Server httpServer_;
-    std::vector<NodeInfo> nodes_[2]; // 使用两个数组
-    std::atomic<int> activeNodesIndex_; // 指示当前活动的数组索引
-    std::atomic<size_t> nextNodeIndex_; // 轮询索引
+    // 当前拓扑，按集合中的分片顺序排列。发布后不再修改，更新时整体替换，
+    // 读者用 currentShards() 取快照，持有期间不受拓扑更新影响
+    std::shared_ptr<const std::vector<ShardInfo>> shards_;
     std::mutex nodesMutex_; // 保证节点信息的线程安全访问
-    bool running_; // 控制定时器线程的运行
+    std::atomic<bool> running_; // 控制拓扑订阅线程的运行
+    std::thread healthThread_;  // 主动探测线程，析构时在释放转发线程之前 join
+    std::mutex healthMutex_;
+    std::condition_variable healthCv_; // 析构时唤醒探测线程，不用等满一个探测间隔
+    std::map<std::string, std::shared_ptr<ConnectionPool>> pools_; // 节点 url -> 连接池
+    std::mutex poolsMutex_;
+    std::vector<std::unique_ptr<AsyncForwarder>> forwarders_;
+    std::atomic<size_t> nextForwarder_;
+    std::atomic<int> waitingWorkers_; // 正在等待后端结果的工作线程数
+    LoadBalancer balancer_;
+    HealthChecker health_;
+    ResultCache<CachedResponse> searchCache_; // 以请求体为键，经本 proxy 的写入会让其失效
+    std::atomic<uint64_t> writeVersion_;
+    SingleFlight<ForwardResult> searchFlights_;
+    std::map<std::string, Histogram*> backendLatency_; // 路径 -> 后端响应时间，构造后只读
+    Counter* hedges_;
+    Counter* retries_;
+    Counter* cacheHits_;
+    Counter* flightsShared_;
+    Counter* rejected_;
+    std::map<std::string, std::unique_ptr<LatencyWindow>> readLatency_; // 读请求路径 -> 最近的响应时间，构造后只读
 
     std::set<std::string> follower_request;  // 主从节点都可处理的请求的路径集合
     std::set<std::string> leader_request; // 只有主节点可以处理的请求的路径集合
@@ -39,9 +115,28 @@ private:
     void setupForwarding();
     void forwardRequest(const httplib::Request& req, httplib::Response& res, const std::string& path);
     void handleTopologyRequest(httplib::Response& res);
+    std::shared_ptr<ConnectionPool> getPool(const std::string& url);
+    std::vector<NodeInfo> eligibleNodes(const ShardInfo& shard, const std::string& path);
+    // 请求缺少路由所需的 id 时返回 false
+    bool shardFor(const std::vector<ShardInfo>& shards, const httplib::Request& req, const std::string& path, size_t& shard);
+    ForwardResult forwardToShard(const ShardInfo& shard, const std::string& path, bool post, const std::string& body);
+    // 同时向每个目标分片转发一份，返回的结果与 targets 一一对应
+    std::vector<ForwardResult> fanOut(const std::vector<const ShardInfo*>& targets, const std::string& path, bool post, const std::vector<std::string>& bodies);
+    ForwardResult scatterSearch(const std::vector<ShardInfo>& shards, const std::string& body);
+    ForwardResult scatterWrite(const std::vector<ShardInfo>& shards, const std::string& path, const std::string& body);
+    void setForwardResponse(httplib::Response& res, const std::string& path, const ForwardResult& result);
+    std::pair<AsyncForwarder*, uint64_t> submitTo(const NodeInfo& node, const std::string& path, bool post, const std::string& body, ForwardCallback done);
+    int hedgeDelayMs(const std::string& path);
+    int routeTimeoutMs(const std::string& path) const;
+    void prunePools(const std::vector<NodeInfo>& nodes);
     void initCurl();
     void cleanupCurl();
     static size_t writeCallback(void *contents, size_t size, size_t nmemb, void *userp);
+    bool fetchFromMaster(const std::string& path, rapidjson::Document& doc, int timeoutMs);
+    bool fetchInstanceNodes(const std::string& instanceId, std::vector<NodeInfo>& nodes);
+    std::shared_ptr<const std::vector<ShardInfo>> currentShards() const;
     void fetchAndUpdateNodes(); // 获取并更新节点信息
-    void startNodeUpdateTimer(); // 启动节点更新定时器
+    void startHealthChecks(); // 启动主动探测线程
+    int64_t waitTopologyChange(int64_t version); // 长轮询 master 的拓扑版本
+    void startNodeUpdateTimer(); // 启动拓扑订阅线程
 };
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+
+// 按内存上限淘汰的分片 LRU 缓存。每个条目带写入版本号，
+// 查找时版本号与调用方给出的当前版本不同即视为失效，写入后不必逐条清理
+template <typename Value>
+class ResultCache {
+public:
+    // capacityBytes 为 0 表示关闭缓存，sizeOf 估算单个值占用的字节数
+    ResultCache(size_t capacityBytes, std::function<size_t(const Value&)> sizeOf, size_t shardCount = 16)
+    : sizeOf_(std::move(sizeOf)), shards_(capacityBytes == 0 ? 0 : shardCount) {
+        for (auto& shard : shards_) {
+            shard.reset(new Shard());
+            shard->capacity = capacityBytes / shardCount;
+        }
+    }
+
+    bool enabled() const {
+        return !shards_.empty();
+    }
+
+    bool get(const std::string& key, uint64_t version, Value& value) {
+        if (!enabled()) {
+            return false;
+        }
+        Shard& shard = shardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            misses_++;
+            return false;
+        }
+        if (it->second->version != version) {
+            erase(shard, it);
+            misses_++;
+            return false;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        value = it->second->value;
+        hits_++;
+        return true;
+    }
+
+    // version 应取计算结果之前读到的版本，计算期间有写入时该条目自然失效
+    void put(const std::string& key, uint64_t version, Value value) {
+        if (!enabled()) {
+            return;
+        }
+        size_t bytes = key.size() * 2 + sizeOf_(value) + kEntryOverhead;
+        Shard& shard = shardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (bytes > shard.capacity) {
+            return;
+        }
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            erase(shard, it);
+        }
+        while (shard.bytes + bytes > shard.capacity && !shard.lru.empty()) {
+            erase(shard, shard.index.find(shard.lru.back().key));
+        }
+        shard.lru.push_front(Entry{key, version, std::move(value), bytes});
+        shard.index[key] = shard.lru.begin();
+        shard.bytes += bytes;
+    }
+
+    uint64_t hits() const {
+        return hits_.load();
+    }
+
+    uint64_t misses() const {
+        return misses_.load();
+    }
+
+private:
+    // 链表节点和哈希表项的大致开销
+    static constexpr size_t kEntryOverhead = 96;
+
+    struct Entry {
+        std::string key;
+        uint64_t version;
+        Value value;
+        size_t bytes;
+    };
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> lru; // 表头为最近使用
+        std::unordered_map<std::string, typename std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+        size_t capacity = 0;
+    };
+
+    Shard& shardOf(const std::string& key) {
+        return *shards_[std::hash<std::string>()(key) % shards_.size()];
+    }
+
+    void erase(Shard& shard, typename std::unordered_map<std::string, typename std::list<Entry>::iterator>::iterator it) {
+        shard.bytes -= it->second->bytes;
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+
+    std::function<size_t(const Value&)> sizeOf_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "index_factory.h"
+#include <faiss/Index.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+// 分层的 LSM 式索引：写入先进入可变的暴力检索内存段，写满后封存，
+// 由后台线程构建成 HNSW / IVF 段，同一层的段数达到 merge_factor 时合并成更大的段。
+// 搜索并行查询所有段后合并 top-k。
+// remove_vectors 只在索引层面提供删除，服务端的写入链路（raft 日志、WAL、存储）还没有删除操作
+class SegmentedIndex {
+public:
+    SegmentedIndex(int dim, faiss::MetricType metric, const IndexParams& params);
+    ~SegmentedIndex();
+    void insert_vectors(const std::vector<float>& data, uint64_t label);
+    void insert_batch_vectors(const std::vector<std::vector<float>>& vectors, const std::vector<long>& ids);
+    void remove_vectors(const std::vector<long>& ids);
+    std::pair<std::vector<long>, std::vector<float>> search_vectors(const std::vector<float>& query, int k, int ef_search = 0, int nprobe = 0);
+
+    void saveIndex(const std::string& file_path);
+    void loadIndex(const std::string& file_path);
+
+private:
+    struct Segment {
+        faiss::Index* index = nullptr;
+        std::vector<long> ids;  // 段内位置到外部 id 的映射
+        uint64_t seq = 0;       // 段的写入代数，用于判断删除标记是否作用于该段
+        uint64_t file_id = 0;   // 持久化时的文件编号
+        bool built = false;     // false 表示仍是暴力检索的 flat 段
+        std::string saved_path; // 已封存的段不可变，保存到同一路径时跳过
+        ~Segment();
+    };
+    using SegmentPtr = std::shared_ptr<Segment>;
+
+    void add(const float* data, size_t n, const long* ids);
+    SegmentPtr newMemtable();
+    faiss::Index* buildIndex(const float* data, size_t n);
+    std::pair<std::vector<long>, std::vector<float>> searchSegment(const Segment& segment, const std::vector<float>& query, int k, int ef_search, int nprobe);
+    bool isDeleted(long id, uint64_t seq) const;
+    void buildLoop();
+    void buildSegment(const SegmentPtr& sealed);
+    void maybeMerge();
+    void collectTombstones();
+
+    int dim;
+    faiss::MetricType metric;
+    IndexParams params;
+
+    std::shared_mutex memtable_mutex;
+    SegmentPtr memtable;
+
+    std::mutex segments_mutex;
+    std::vector<SegmentPtr> segments; // 已封存的段，只读
+
+    mutable std::shared_mutex tombstone_mutex;
+    std::unordered_map<long, uint64_t> tombstones; // id -> 删除时内存段的代数，更早的段中该 id 视为已删除
+
+    std::mutex save_mutex;
+    std::atomic<uint64_t> next_seq{0};
+    std::atomic<uint64_t> next_file_id{0};
+
+    std::mutex build_mutex;
+    std::condition_variable build_cv;
+    std::deque<SegmentPtr> build_queue;
+    bool stopping = false;
+    std::thread build_thread;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+
+// 合并相同 key 的并发调用：同一时刻只有第一个调用真正执行，
+// 之后到达的调用等待它的结果，异常同样会传给所有等待者。
+// key 中需要包含数据版本，写入之后到达的请求不会拿到写入之前的结果
+template <typename Value>
+class SingleFlight {
+public:
+    explicit SingleFlight(size_t shardCount = 16) : shards_(shardCount) {
+        for (auto& shard : shards_) {
+            shard.reset(new Shard());
+        }
+    }
+
+    // shared 不为空时返回本次结果是否来自其他调用
+    Value run(const std::string& key, const std::function<Value()>& fn, bool* shared = nullptr) {
+        Shard& shard = *shards_[std::hash<std::string>()(key) % shards_.size()];
+        std::promise<Value> promise;
+        std::shared_future<Value> future;
+        bool leader = false;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.inflight.find(key);
+            if (it != shard.inflight.end()) {
+                future = it->second;
+            } else {
+                future = promise.get_future().share();
+                shard.inflight.emplace(key, future);
+                leader = true;
+            }
+        }
+        if (shared != nullptr) {
+            *shared = !leader;
+        }
+        if (!leader) {
+            return future.get();
+        }
+        try {
+            Value value = fn();
+            finish(shard, key);
+            promise.set_value(value);
+            return value;
+        } catch (...) {
+            finish(shard, key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_future<Value>> inflight;
+    };
+
+    void finish(Shard& shard, const std::string& key) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.inflight.erase(key);
+    }
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
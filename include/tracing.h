@@ -0,0 +1,128 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// 请求内一个阶段的耗时，时间相对 trace 开始，单位微秒
+struct Span {
+    const char* name;   // 只接受字符串字面量，热路径上不分配
+    std::string detail; // 可选的附加说明，如转发的后端地址
+    uint32_t startUs;
+    uint32_t durationUs;
+    uint16_t depth;
+};
+
+// 一次被采样的请求
+struct Trace {
+    std::string traceId;
+    std::string service;
+    std::string endpoint;
+    int64_t startMs = 0; // 墙上时间，便于和日志对照
+    std::chrono::steady_clock::time_point start;
+    uint64_t durationUs = 0;
+    int status = 0;
+
+    // 扇出的工作线程和转发的事件循环线程会并发追加 span
+    void addSpan(const char* name, std::chrono::steady_clock::time_point begin, uint16_t depth, std::string detail = "");
+    std::vector<Span> spans() const;
+    // Server-Timing 响应头的值，dur 单位毫秒
+    std::string serverTiming() const;
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<Span> spans_;
+};
+
+// 当前线程正在处理的 trace，未采样时为空，httplib 的各个回调和处理函数在同一线程上执行
+inline std::shared_ptr<Trace>& currentTrace() {
+    static thread_local std::shared_ptr<Trace> trace;
+    return trace;
+}
+
+// 当前线程上 span 的嵌套深度
+inline uint16_t& traceDepth() {
+    static thread_local uint16_t depth = 0;
+    return depth;
+}
+
+// 采样决策和最近若干条 trace 的环形缓冲。只有被采样的请求会分配和加锁，
+// 未采样的请求每个 span 只多一次 thread_local 读取
+class Tracer {
+public:
+    static constexpr const char* kTraceIdHeader = "X-Trace-Id";
+    static constexpr const char* kSampledHeader = "X-Trace-Sampled";
+
+    static Tracer& instance();
+
+    // sampleRate 取 [0, 1]，capacity 为保留的 trace 条数
+    void configure(double sampleRate, size_t capacity);
+
+    // 开始当前线程上的请求。上游已经采样的请求（forceSample）一定采样并沿用其 trace id，
+    // 否则按采样率决定；traceId 为空时生成新的
+    void begin(const std::string& service, const std::string& endpoint, const std::string& traceId, bool forceSample);
+    // 结束当前线程上的 trace 并放入环形缓冲
+    void finish(int status);
+
+    // 最近的 limit 条 trace，新的在前，JSON 格式
+    std::string dump(size_t limit) const;
+
+private:
+    Tracer();
+
+    std::atomic<uint64_t> threshold_; // 随机数小于该值时采样
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<Trace>> ring_;
+    size_t next_ = 0;
+};
+
+// 记录从构造到析构的阶段耗时，当前线程没有被采样的 trace 时什么都不做
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) : trace_(currentTrace().get()), name_(name) {
+        if (trace_ != nullptr) {
+            start_ = std::chrono::steady_clock::now();
+            depth_ = traceDepth()++;
+        }
+    }
+    ~TraceSpan() {
+        if (trace_ != nullptr) {
+            traceDepth()--;
+            trace_->addSpan(name_, start_, depth_);
+        }
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    Trace* trace_;
+    const char* name_;
+    std::chrono::steady_clock::time_point start_;
+    uint16_t depth_ = 0;
+};
+
+// 把 trace 带到另一个线程上，析构时恢复该线程原来的状态
+class TraceContextGuard {
+public:
+    TraceContextGuard(std::shared_ptr<Trace> trace, uint16_t depth) : saved_(std::move(currentTrace())), savedDepth_(traceDepth()) {
+        currentTrace() = std::move(trace);
+        traceDepth() = depth;
+    }
+    ~TraceContextGuard() {
+        currentTrace() = std::move(saved_);
+        traceDepth() = savedDepth_;
+    }
+    TraceContextGuard(const TraceContextGuard&) = delete;
+    TraceContextGuard& operator=(const TraceContextGuard&) = delete;
+
+private:
+    std::shared_ptr<Trace> saved_;
+    uint16_t savedDepth_;
+};
+
+// 转发到下游时附带的请求头，未采样时为空
+std::vector<std::string> traceHeaders();
@@ -18,7 +18,8 @@ public:
         ADD_FOLLOWER,
         SNAPSHOT,
         SET_LEADER,
-        LIST_NODE
+        LIST_NODE,
+        REBUILD_INDEX
     };
 
     VdbHttpServer(const std::string& host, int port, VectorEngine* vector_engine, RaftStuff* raft_stuff);
@@ -32,6 +33,9 @@ private:
     void snapshotHandler(const httplib::Request& req, httplib::Response& res);
     void addFollowerHandler(const httplib::Request& req, httplib::Response& res);
     void listNodeHandler(const httplib::Request& req, httplib::Response& res);
+    void rebuildIndexHandler(const httplib::Request& req, httplib::Response& res);
+    void rebuildStatusHandler(const httplib::Request& req, httplib::Response& res);
+    void healthHandler(const httplib::Request& req, httplib::Response& res);
     void setJsonResponse(const rapidjson::Document& json_response, httplib::Response& res);
     void setErrorJsonResponse(httplib::Response&res, int error_code, const std::string& errorMsg);
     bool isRequestValid(const rapidjson::Document& json_request, CheckType check_type);
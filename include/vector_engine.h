@@ -2,6 +2,13 @@
 
 #include "vector_index.h"
 #include "vector_storage.h"
+#include "result_cache.h"
+#include "single_flight.h"
+#include "metrics.h"
+#include <memory>
+#include <atomic>
+#include <array>
+#include <map>
 
 enum class ServerType {
     VDB,
@@ -27,10 +34,33 @@ public:
     void takeSnapshot();
     void loadSnapshot();
 
+    // 按请求中的 index_type 和参数在后台重建索引
+    void rebuildIndex(const rapidjson::Document& json_request);
+    bool isRebuilding() const;
+    void setAppliedLogID(uint64_t log_id);
+
+    // 开启搜索结果缓存，capacity_bytes 为缓存占用的内存上限
+    void enableResultCache(size_t capacity_bytes);
+    // 合并相同的并发搜索，默认开启
+    void enableSingleFlight(bool enabled);
+
 private:
+    using SearchResult = std::pair<std::vector<long>, std::vector<float>>;
+    // 已应用的写入次数与索引代数之和，任一变化都会让缓存的结果失效
+    uint64_t dataVersion() const;
+    Histogram& searchLatency(IndexFactory::IndexType type);
+
     std::string db_path;
     VectorIndex* vector_index_;
     VectorStorage* vector_storage_;
     ServerType server_type;
+    std::unique_ptr<ResultCache<SearchResult>> result_cache_;
+    std::unique_ptr<SingleFlight<SearchResult>> single_flight_;
+    std::atomic<uint64_t> write_version_{0};
+
+    // 按索引类型的搜索延迟，下标为索引类型的枚举值
+    std::array<std::atomic<Histogram*>, 16> search_latency_{};
+    std::map<std::string, Histogram*> write_latency_; // "操作/阶段" -> 写入延迟，构造后只读
+    Counter& single_flight_shared_;
 };
 
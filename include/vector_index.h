@@ -5,13 +5,40 @@
 #include <vector>
 #include "rapidjson/document.h"
 #include <fstream>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <functional>
+
+namespace faiss {
+struct IndexFlat;
+}
 
 class VectorIndex {
 public:
     VectorIndex(void* index, IndexFactory::IndexType type): increaseID_(0), index(index), type(type) {};
     ~VectorIndex();
 
-    std::pair<std::vector<long>, std::vector<float>> search(const std::vector<float>& data, int k);
+    // 需要训练的索引先把写入的向量暂存在暴力检索的缓冲区中，
+    // 攒够 train_size 条后在后台用真实数据训练，再把缓冲区的数据写入索引
+    void deferTraining(int dim, int train_size, IndexFactory::MetricType metric = IndexFactory::MetricType::L2);
+
+    // 记录建索引用的参数，重建时以此为默认值
+    void setBuildParams(int dim, int num_train, const IndexParams& params);
+    IndexParams getBuildParams() const;
+
+    // 在后台用 WAL 中已提交的数据构建新索引（可以换索引类型和参数），
+    // 构建期间的写入会被追平，完成后原子地替换当前索引，搜索不中断
+    void rebuild(IndexFactory::IndexType new_type, const IndexParams& params);
+    bool isRebuilding() const;
+    // 状态机在应用一条 raft 日志前调用，用来确定重建读取 WAL 的边界
+    void setAppliedLogID(uint64_t log_id);
+    // 每次替换索引后加一，搜索结果缓存据此失效
+    uint64_t generation() const;
+
+    // ef_search / nprobe 为单次请求的搜索参数，<= 0 表示使用索引默认值
+    std::pair<std::vector<long>, std::vector<float>> search(const std::vector<float>& data, int k, int ef_search = 0, int nprobe = 0);
     void insert(const std::vector<float>& data, uint64_t id);
     void insert_batch(const std::vector<std::vector<float>>& vectors, const std::vector<long>& ids);
 
@@ -33,8 +60,53 @@ public:
     IndexFactory::IndexType type;
 
 private:
+    enum class TrainState { TRAINED, BUFFERING, TRAINING, DRAINING };
+
+    std::pair<std::vector<long>, std::vector<float>> indexSearch(const std::vector<float>& data, int k, int ef_search, int nprobe);
+    void indexInsert(const std::vector<float>& data, uint64_t id);
+    void indexInsertBatch(const std::vector<std::vector<float>>& vectors, const std::vector<long>& ids);
+    // train_ids 是训练向量的外部 id，只有直接用训练数据建图的 CAGRA 需要
+    void indexTrain(int num_train, const std::vector<float>& train_vec, const std::vector<long>& train_ids);
+    void indexReorder(const std::string& order);
+
+    bool stage(const float* data, size_t n, const long* ids);
+    std::pair<std::vector<long>, std::vector<float>> searchStaging(const std::vector<float>& data, int k);
+    void trainInBackground();
+
+    void rebuildInBackground(IndexFactory::IndexType new_type, IndexParams params, uint64_t applied_log_id);
+    // 按顺序流式读取 WAL 中 log id 不超过 max_log_id 的插入，每攒够 batch_size 条回调一次
+    void forEachWalBatch(uint64_t max_log_id, size_t batch_size,
+                         const std::function<void(const std::vector<float>&, const std::vector<long>&)>& callback);
+    // 从 WAL 中均匀随机抽取至多 num_sample 条向量作为训练集
+    void sampleWalVectors(uint64_t max_log_id, size_t num_sample, std::vector<float>& vectors, std::vector<long>& ids);
+    void destroyIndex();
+
     void* index;
 
+    std::atomic<TrainState> train_state_{TrainState::TRAINED};
+    std::shared_mutex staging_mutex_;
+    faiss::IndexFlat* staging_index_ = nullptr; // 训练完成前的写入缓冲
+    std::vector<long> staging_ids_;
+    int train_size_ = 0;
+    size_t next_train_trigger_ = 0;
+    IndexFactory::MetricType metric_ = IndexFactory::MetricType::L2;
+    std::thread train_thread_;
+
+    // 搜索和写入持有共享锁，替换索引时持有独占锁
+    mutable std::shared_mutex swap_mutex_;
+    std::atomic<bool> rebuilding_{false};
+    std::mutex capture_mutex_;
+    std::vector<float> captured_vectors_; // 重建期间的写入
+    std::vector<long> captured_ids_;
+    std::vector<uint64_t> captured_log_ids_; // 每条写入所属的 raft 日志，重放时据此跳过 WAL 中已有的
+    std::atomic<uint64_t> applied_log_id_{0};
+    std::atomic<uint64_t> generation_{0};
+    std::thread rebuild_thread_;
+    std::string wal_path_;
+    int dim_ = 0;
+    int num_train_ = 1000;
+    IndexParams build_params_;
+
     uint64_t increaseID_;
     std::fstream wal_log_file_;
     uint64_t lastSnapshotID_;
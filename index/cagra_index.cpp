@@ -6,6 +6,7 @@
 #include <faiss/index_io.h>
 #include <faiss/gpu/GpuIndexCagra.h>
 #include <fstream>
+#include <stdexcept>
 
 CAGRAIndex::CAGRAIndex(faiss::Index* cpu_index, faiss::gpu::GpuIndexCagra* gpu_index): cpu_index(cpu_index), gpu_index(gpu_index) {
     this->id_map = new faiss::IndexIDMap(cpu_index);
@@ -32,7 +33,12 @@ void CAGRAIndex::insert_vectors(const std::vector<float>& data, uint64_t label)
 
 void CAGRAIndex::insert_batch_vectors(const std::vector<std::vector<float>>& vectors, const std::vector<long>& ids) {
     try {
-        id_map->add_with_ids(vectors.size(), vectors.data()->data(), ids.data());
+        // vector<vector<float>> 的行之间不连续，先拼接成一块
+        std::vector<float> flat;
+        for (const auto& vector : vectors) {
+            flat.insert(flat.end(), vector.begin(), vector.end());
+        }
+        id_map->add_with_ids(vectors.size(), flat.data(), ids.data());
     } catch (std::runtime_error e) {
         GlobalLogger->error("insert error: {}", e.what());
     }
@@ -49,7 +55,15 @@ std::pair<std::vector<long>, std::vector<float>> CAGRAIndex::search_vectors(cons
     std::vector<long> indices(num_queries * k);
     std::vector<float> distances(num_queries * k);
     
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
     gpu_index->search(num_queries, query.data(), k, distances.data(), indices.data());
+    if (!gpu_ids.empty()) {
+        for (auto& idx : indices) {
+            if (idx >= 0 && static_cast<size_t>(idx) < gpu_ids.size()) {
+                idx = gpu_ids[idx];
+            }
+        }
+    }
     return {indices, distances};
 }
 
@@ -70,8 +84,13 @@ void CAGRAIndex::loadIndex(const std::string& file_path) {
     }
 }
 
-void CAGRAIndex::train(int num_train, const std::vector<float>& train_vec) {
+void CAGRAIndex::train(int num_train, const std::vector<float>& train_vec, const std::vector<long>& ids) {
+    if (!ids.empty() && ids.size() != static_cast<size_t>(num_train)) {
+        throw std::runtime_error("CAGRA train ids do not match the number of training vectors");
+    }
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
     gpu_index->train(num_train, train_vec.data());
+    gpu_ids = ids;
     // gpu_index->copyTo(dynamic_cast<faiss::IndexHNSWCagra*>(cpu_index));
 }
 
@@ -80,6 +99,12 @@ void CAGRAIndex::add(int num_train, const std::vector<float>& train_vec) {
 }
 
 void CAGRAIndex::update_index() {
-    std::lock_guard<std::mutex> lock(index_mutex);
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
     gpu_index->copyFrom(dynamic_cast<faiss::IndexHNSWCagra*>(cpu_index));
+    // 从 CPU 图拷贝后行号与 id_map 的顺序一致；绕过 id_map 直接 add 的行没有 id，只能沿用行号
+    if (static_cast<faiss::idx_t>(id_map->id_map.size()) == cpu_index->ntotal) {
+        gpu_ids.assign(id_map->id_map.begin(), id_map->id_map.end());
+    } else {
+        gpu_ids.clear();
+    }
 }
\ No newline at end of file
@@ -1,16 +1,199 @@
 #include "cuda_hnsw_index.h"
+#include "include/logger.h"
+#include "include/metrics.h"
 #include <vector>
 #include "cuda/search_kernel.cuh"
 #include <thread>
+#include <limits>
+#include <stdexcept>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <chrono>
 
-CUDAHNSWIndex::CUDAHNSWIndex(int dim, int num_data, int M, int ef_construction) : dim(dim) { // 将MetricType参数修改为第三个参数
-    bool normalize = false;
-    space = new hnswlib::L2Space(dim);
-    index = new hnswlib::HierarchicalNSW<float>(space, num_data, M, ef_construction);
+namespace {
+
+// 最近一次修复后的图健康状况。索引在重建时会被替换，指标按进程注册一次
+struct GraphHealthMetrics {
+    std::atomic<double> unreachable{0};
+    std::atomic<double> deleted{0};
+    std::atomic<double> dangling_links{0};
+    std::atomic<double> average_degree{0};
+    Counter* repaired_lists;
+
+    GraphHealthMetrics() {
+        MetricsRegistry& metrics = MetricsRegistry::instance();
+        metrics.gauge("vdb_hnsw_unreachable_nodes", "Live HNSW nodes unreachable from the entry point after the last repair", "", [this] { return unreachable.load(); });
+        metrics.gauge("vdb_hnsw_deleted_nodes", "HNSW nodes marked deleted and not yet reused", "", [this] { return deleted.load(); });
+        metrics.gauge("vdb_hnsw_dangling_links", "Level-0 links from live HNSW nodes to deleted ones after the last repair", "", [this] { return dangling_links.load(); });
+        metrics.gauge("vdb_hnsw_average_degree", "Average level-0 out-degree of live HNSW nodes after the last repair", "", [this] { return average_degree.load(); });
+        repaired_lists = &metrics.counter("vdb_hnsw_repaired_lists_total", "HNSW neighbor lists rebuilt around deleted nodes");
+    }
+
+    static GraphHealthMetrics& instance() {
+        static GraphHealthMetrics metrics;
+        return metrics;
+    }
+};
+
+} // namespace
+
+CUDAHNSWIndex::CUDAHNSWIndex(int dim, int num_data, int M, int ef_construction, int ef_search, const std::string& quantizer, int rerank_factor, int repair_percent)
+    : dim(dim), default_ef_search(ef_search), quantizer(quantizer), rerank_factor(std::max(rerank_factor, 0)), repair_percent(std::max(repair_percent, 0)) {
+    if (quantizer == "sq8") {
+        quantized_space = new hnswlib::SQ8Space(dim);
+    } else if (quantizer == "fp16") {
+        quantized_space = new hnswlib::Fp16Space(dim);
+    } else if (quantizer == "binary") {
+        quantized_space = new hnswlib::BinarySpace(dim);
+    } else if (quantizer != "none" && !quantizer.empty()) {
+        throw std::runtime_error("Unknown hnsw_quantizer: " + quantizer);
+    }
+    if (quantized_space != nullptr) {
+        space = quantized_space;
+        // 重排按原始向量算精确的 L2 距离
+        if (this->rerank_factor > 0) {
+            rerank_space = new hnswlib::L2Space(dim);
+        }
+    } else {
+        space = new hnswlib::L2Space(dim);
+        this->rerank_factor = 0;
+    }
+    // 被删节点的位置留给新插入的向量
+    index = new hnswlib::HierarchicalNSW<float>(space, num_data, M, ef_construction, 100, true);
+    // num_data 只是初始容量，写满后按块扩容
+    index->setAutoGrow(true);
+    if (this->repair_percent > 0) {
+        repair_thread = std::thread(&CUDAHNSWIndex::repairLoop, this);
+    }
+}
+
+CUDAHNSWIndex::~CUDAHNSWIndex() {
+    {
+        std::lock_guard<std::mutex> lock(repair_mutex);
+        stopping = true;
+    }
+    repair_cv.notify_all();
+    if (repair_thread.joinable()) {
+        repair_thread.join();
+    }
+    delete index;
+    delete space;
+    delete rerank_space;
+}
+
+void CUDAHNSWIndex::train(int num_train, const std::vector<float>& train_vec) {
+    if (quantized_space != nullptr) {
+        quantized_space->train(train_vec.data(), num_train);
+    }
+}
+
+const void* CUDAHNSWIndex::encode(const float* data, std::vector<char>& code) const {
+    if (quantized_space == nullptr) {
+        return data;
+    }
+    code.resize(space->get_data_size());
+    quantized_space->encode(data, code.data());
+    return code.data();
+}
+
+void CUDAHNSWIndex::storeRaw(const float* data, long label) {
+    std::unique_lock<std::shared_mutex> lock(raw_mutex);
+    auto it = raw_slots.find(label);
+    size_t slot;
+    if (it == raw_slots.end()) {
+        if (!raw_free_slots.empty()) {
+            slot = raw_free_slots.back();
+            raw_free_slots.pop_back();
+        } else {
+            slot = raw_vectors.size() / dim;
+            raw_vectors.resize((slot + 1) * dim);
+        }
+        raw_slots.emplace(label, slot);
+    } else {
+        slot = it->second;
+    }
+    std::copy(data, data + dim, raw_vectors.begin() + slot * dim);
 }
 
 void CUDAHNSWIndex::insert_vectors(const float* data, long label) {
-    index->addPoint(data, label);
+    std::vector<char> code;
+    index->addPoint(encode(data, code), label, true);
+    if (rerank_factor > 0) {
+        storeRaw(data, label);
+    }
+}
+
+void CUDAHNSWIndex::remove_vectors(const std::vector<long>& ids) {
+    size_t removed = 0;
+    for (long id : ids) {
+        // 不存在或已删除的 id 忽略
+        try {
+            index->markDelete(id);
+            removed++;
+        } catch (const std::runtime_error&) {
+            continue;
+        }
+        if (rerank_factor > 0) {
+            std::unique_lock<std::shared_mutex> lock(raw_mutex);
+            auto it = raw_slots.find(id);
+            if (it != raw_slots.end()) {
+                raw_free_slots.push_back(it->second);
+                raw_slots.erase(it);
+            }
+        }
+    }
+    if (removed == 0 || repair_percent == 0) {
+        return;
+    }
+    size_t pending = deleted_since_repair += removed;
+    if (pending * 100 >= static_cast<size_t>(repair_percent) * std::max<size_t>(index->getCurrentElementCount(), 1)) {
+        {
+            std::lock_guard<std::mutex> lock(repair_mutex);
+            repair_pending = true;
+        }
+        repair_cv.notify_one();
+    }
+}
+
+hnswlib::GraphHealth CUDAHNSWIndex::repair() {
+    std::lock_guard<std::mutex> run_lock(repair_run_mutex);
+    deleted_since_repair = 0;
+    auto start = std::chrono::steady_clock::now();
+    size_t repaired = index->repairDeletedElements();
+    hnswlib::GraphHealth health = index->graphHealth();
+    auto end = std::chrono::steady_clock::now();
+
+    GraphHealthMetrics& metrics = GraphHealthMetrics::instance();
+    metrics.unreachable = static_cast<double>(health.unreachable);
+    metrics.deleted = static_cast<double>(health.deleted);
+    metrics.dangling_links = static_cast<double>(health.dangling_links);
+    metrics.average_degree = health.average_degree;
+    metrics.repaired_lists->add(repaired);
+    GlobalLogger->info("HNSW graph repaired in {} ms: {} lists rebuilt, {} live, {} deleted, {} unreachable, {} dangling links, average degree {:.2f}",
+                       std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count(), repaired, health.elements,
+                       health.deleted, health.unreachable, health.dangling_links, health.average_degree);
+    return health;
+}
+
+void CUDAHNSWIndex::repairLoop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(repair_mutex);
+            repair_cv.wait(lock, [this] { return stopping || repair_pending; });
+            if (stopping) {
+                return;
+            }
+            repair_pending = false;
+        }
+        // 修复失败时被删节点仍留在图中，只影响检索效率
+        try {
+            repair();
+        } catch (const std::exception& e) {
+            GlobalLogger->error("Failed to repair HNSW graph: {}", e.what());
+        }
+    }
 }
 
 template<class Function>
@@ -81,12 +264,21 @@ void CUDAHNSWIndex::insert_vectors_batch(const std::vector<float>& data, const s
 }
 
 std::pair<std::vector<long>, std::vector<float>> CUDAHNSWIndex::search_vectors(const std::vector<float>& query, int k, int ef_search) { // 修改返回类型
-    index->setEf(ef_search);
-    auto result = index->searchKnn(query.data(), k);
+    int ef = ef_search > 0 ? ef_search : default_ef_search;
+    std::vector<char> code;
+    const void* query_code = encode(query.data(), code);
+    if (rerank_factor > 0) {
+        size_t num_candidates = static_cast<size_t>(k) * rerank_factor;
+        return rerank(query, k, index->searchKnnWithEf(query_code, num_candidates, std::max(static_cast<size_t>(ef), num_candidates)));
+    }
 
-    std::vector<long> indices(k);
-    std::vector<float> distances(k);
-    for (int j = 0; j < k; j++) {
+    // ef 按请求传入，不改索引上的共享状态，并发查询之间互不影响
+    auto result = index->searchKnnWithEf(query_code, k, ef);
+
+    // 结果队列的堆顶是最远的，从后往前填；不足 k 个时补 -1
+    std::vector<long> indices(k, -1);
+    std::vector<float> distances(k, std::numeric_limits<float>::max());
+    for (int j = static_cast<int>(result.size()) - 1; j >= 0; j--) {
         auto item = result.top();
         indices[j] = item.second;
         distances[j] = item.first;
@@ -96,7 +288,125 @@ std::pair<std::vector<long>, std::vector<float>> CUDAHNSWIndex::search_vectors(c
     return {indices, distances};
 }
 
+std::pair<std::vector<long>, std::vector<float>> CUDAHNSWIndex::rerank(const std::vector<float>& query, int k, std::priority_queue<std::pair<float, hnswlib::labeltype>> candidates) {
+    std::vector<std::pair<float, long>> scored;
+    scored.reserve(candidates.size());
+    {
+        std::shared_lock<std::shared_mutex> lock(raw_mutex);
+        hnswlib::DISTFUNC<float> dist_func = rerank_space->get_dist_func();
+        void* dist_param = rerank_space->get_dist_func_param();
+        for (; !candidates.empty(); candidates.pop()) {
+            long label = static_cast<long>(candidates.top().second);
+            auto it = raw_slots.find(label);
+            if (it == raw_slots.end()) {
+                continue;
+            }
+            scored.emplace_back(dist_func(query.data(), raw_vectors.data() + it->second * dim, dist_param), label);
+        }
+    }
+    size_t num_results = std::min(scored.size(), static_cast<size_t>(k));
+    std::partial_sort(scored.begin(), scored.begin() + num_results, scored.end());
+
+    std::vector<long> indices(k, -1);
+    std::vector<float> distances(k, std::numeric_limits<float>::max());
+    for (size_t j = 0; j < num_results; j++) {
+        distances[j] = scored[j].first;
+        indices[j] = scored[j].second;
+    }
+    return {indices, distances};
+}
+
+void CUDAHNSWIndex::reorder(const std::string& order) {
+    std::lock_guard<std::mutex> run_lock(repair_run_mutex);
+    if (order == "bfs") {
+        index->reorderGraph(hnswlib::GraphOrder::BFS);
+    } else if (order == "rcm") {
+        index->reorderGraph(hnswlib::GraphOrder::RCM);
+    } else {
+        throw std::runtime_error("Unknown graph_order: " + order);
+    }
+}
+
+void CUDAHNSWIndex::saveIndex(const std::string& file_path) {
+    index->saveIndex(file_path);
+    if (quantized_space != nullptr) {
+        saveCodec(file_path + ".codec");
+    }
+}
+
+void CUDAHNSWIndex::loadIndex(const std::string& file_path) {
+    // 保留当前容量，文件中的图更大时按文件中的容量分配
+    index->loadIndex(file_path, space, index->getMaxElements());
+    if (quantized_space != nullptr) {
+        loadCodec(file_path + ".codec");
+    }
+}
+
+// 量化参数和重排用的原始向量保存在索引文件旁边：
+// 量化格式名、量化参数、原始向量条数，以及每条的 label 和向量
+void CUDAHNSWIndex::saveCodec(const std::string& file_path) {
+    std::ofstream out(file_path, std::ios::binary);
+    if (!out) {
+        throw std::runtime_error("Failed to open " + file_path);
+    }
+    uint32_t name_size = quantizer.size();
+    hnswlib::writeBinaryPOD(out, name_size);
+    out.write(quantizer.data(), name_size);
+    quantized_space->saveParams(out);
+
+    std::shared_lock<std::shared_mutex> lock(raw_mutex);
+    uint64_t num_raw = raw_slots.size();
+    hnswlib::writeBinaryPOD(out, num_raw);
+    for (const auto& entry : raw_slots) {
+        int64_t label = entry.first;
+        hnswlib::writeBinaryPOD(out, label);
+        out.write(reinterpret_cast<const char*>(raw_vectors.data() + entry.second * dim), dim * sizeof(float));
+    }
+    if (!out) {
+        throw std::runtime_error("Failed to write " + file_path);
+    }
+}
+
+void CUDAHNSWIndex::loadCodec(const std::string& file_path) {
+    std::ifstream in(file_path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Missing quantizer parameters " + file_path);
+    }
+    uint32_t name_size = 0;
+    hnswlib::readBinaryPOD(in, name_size);
+    std::string name(name_size, '\0');
+    in.read(&name[0], name_size);
+    if (name != quantizer) {
+        throw std::runtime_error("Index was saved with hnsw_quantizer " + name + ", configured " + quantizer);
+    }
+    quantized_space->loadParams(in);
+
+    uint64_t num_raw = 0;
+    hnswlib::readBinaryPOD(in, num_raw);
+    std::unique_lock<std::shared_mutex> lock(raw_mutex);
+    raw_slots.clear();
+    raw_vectors.clear();
+    raw_free_slots.clear();
+    // 保存时开启了重排而现在关闭时，跳过原始向量
+    if (rerank_factor == 0) {
+        return;
+    }
+    raw_vectors.resize(num_raw * dim);
+    for (uint64_t i = 0; i < num_raw; i++) {
+        int64_t label = 0;
+        hnswlib::readBinaryPOD(in, label);
+        in.read(reinterpret_cast<char*>(raw_vectors.data() + i * dim), dim * sizeof(float));
+        raw_slots[label] = i;
+    }
+    if (!in) {
+        throw std::runtime_error("Quantizer parameters are truncated: " + file_path);
+    }
+}
+
 void CUDAHNSWIndex::check() {
+    if (quantized_space != nullptr) {
+        throw std::runtime_error("check() prints fp32 vectors, not supported with hnsw_quantizer " + quantizer);
+    }
     for (int i = 0; i < index->cur_element_count; i++) {
         char* data_ptr = index->getDataByInternalId(i);
         float* data = (float*) data_ptr;
@@ -119,11 +429,15 @@ void CUDAHNSWIndex::check() {
 }
 
 void CUDAHNSWIndex::init_gpu() {
+    // GPU 内核按 fp32 读取图中的向量
+    if (quantized_space != nullptr) {
+        throw std::runtime_error("GPU search is not supported with hnsw_quantizer " + quantizer);
+    }
     // for (int i = 0; i < index->cur_element_count; i++) {
-    //     std::cout << "element_levels_[" << i << "] = " << index->element_levels_[i] << std::endl;
+    //     std::cout << "elementLevel(" << i << ") = " << index->elementLevel(i) << std::endl;
     // }
     // for (int i = 0; i < index->cur_element_count; i++) {
-    //     for (int l = 0; l < index->element_levels_[i]; l++) {
+    //     for (int l = 0; l < index->elementLevel(i); l++) {
     //       unsigned int *linklist = index->get_linklist_at_level(i, l);
     //       int deg = index->getListCount(linklist);
     //       printf("linklist[%d][%d] = [", i, l);
@@ -133,7 +447,17 @@ void CUDAHNSWIndex::init_gpu() {
     //       printf("]\n");
     //     }
     // }
-    cuda_init(dim, index->data_level0_memory_, index->size_data_per_element_, index->offsetData_, index->maxM0_, index->ef_, index->cur_element_count, index->data_size_, index->offsetLevel0_, index->linkLists_, index->element_levels_.data(), index->size_links_per_element_, index->maxlevel_);
+    size_t count = index->cur_element_count;
+    size_t record_size = index->size_data_per_element_;
+    gpu_level0.resize(count * record_size);
+    gpu_link_lists.resize(count);
+    gpu_levels.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        std::copy(index->level0Of(i), index->level0Of(i) + record_size, gpu_level0.begin() + i * record_size);
+        gpu_link_lists[i] = index->linkListsOf(i);
+        gpu_levels[i] = index->elementLevel(i);
+    }
+    cuda_init(dim, gpu_level0.data(), index->size_data_per_element_, index->offsetData_, index->maxM0_, index->ef_, index->cur_element_count, index->data_size_, index->offsetLevel0_, gpu_link_lists.data(), gpu_levels.data(), index->size_links_per_element_, index->maxlevel_);
 }
 
 std::pair<std::vector<long>, std::vector<float>> CUDAHNSWIndex::search_vectors_gpu(const std::vector<float>& query, int k, int ef_search, bool use_hierarchy) {
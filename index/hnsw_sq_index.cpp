@@ -0,0 +1,79 @@
+#include "include/hnsw_sq_index.h"
+#include "include/logger.h"
+#include <faiss/IndexIDMap.h>
+#include <faiss/index_io.h>
+#include <fstream>
+#include <mutex>
+
+HnswSQIndex::HnswSQIndex(faiss::Index* index) : index(index) {
+    this->id_map = new faiss::IndexIDMap(index);
+    this->id_map->own_fields = true;
+}
+
+HnswSQIndex::~HnswSQIndex() {
+    delete id_map;
+}
+
+void HnswSQIndex::insert_vectors(const std::vector<float>& data, uint64_t label) {
+    long id = static_cast<long>(label);
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    id_map->add_with_ids(1, data.data(), &id);
+}
+
+void HnswSQIndex::insert_batch_vectors(const std::vector<std::vector<float>>& vectors, const std::vector<long>& ids) {
+    // 各行向量内存不连续，先拼接成一块再交给 faiss
+    std::vector<float> flat;
+    flat.reserve(vectors.size() * index->d);
+    for (const auto& vec : vectors) {
+        flat.insert(flat.end(), vec.begin(), vec.end());
+    }
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    id_map->add_with_ids(vectors.size(), flat.data(), ids.data());
+}
+
+std::pair<std::vector<long>, std::vector<float>> HnswSQIndex::search_vectors(const std::vector<float>& query, int k, int ef_search) {
+    int dim = index->d;
+    int num_queries = query.size() / dim;
+    std::vector<long> indices(num_queries * k);
+    std::vector<float> distances(num_queries * k);
+
+    // ef_search <= 0 时使用建索引时配置的 efSearch
+    faiss::SearchParametersHNSW params;
+    params.efSearch = ef_search;
+
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    id_map->search(num_queries, query.data(), k, distances.data(), indices.data(), ef_search > 0 ? &params : nullptr);
+    return {indices, distances};
+}
+
+void HnswSQIndex::saveIndex(const std::string& file_path) {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    faiss::write_index(id_map, file_path.c_str());
+}
+
+void HnswSQIndex::loadIndex(const std::string& file_path) {
+    std::ifstream file(file_path);
+    if (file.good()) {
+        file.close();
+        faiss::Index* raw = faiss::read_index(file_path.c_str());
+        faiss::IndexIDMap* loaded = dynamic_cast<faiss::IndexIDMap*>(raw);
+        if (loaded == nullptr) {
+            GlobalLogger->error("Index file {} is not an id-mapped index. Skipping loading index.", file_path);
+            delete raw;
+            return;
+        }
+        loaded->own_fields = true;
+
+        std::unique_lock<std::shared_mutex> lock(index_mutex);
+        delete id_map;
+        id_map = loaded;
+        index = loaded->index;
+    } else {
+        GlobalLogger->warn("File not found: {}. Skipping loading index.", file_path);
+    }
+}
+
+void HnswSQIndex::train(int num_train, const std::vector<float>& train_vec) {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    index->train(num_train, train_vec.data());
+}
@@ -21,8 +21,13 @@ void IVFPQIndex::insert_vectors(const std::vector<float>& data, uint64_t label)
 
 void IVFPQIndex::insert_batch_vectors(const std::vector<std::vector<float>>& vectors, const std::vector<long>& ids) {
     try {
+        // vector<vector<float>> 的行之间不连续，先拼接成一块
+        std::vector<float> flat;
+        for (const auto& vector : vectors) {
+            flat.insert(flat.end(), vector.begin(), vector.end());
+        }
         std::lock_guard<std::mutex> lock(index_mutex);
-        id_map->add_with_ids(vectors.size(), vectors.data()->data(), ids.data());
+        id_map->add_with_ids(vectors.size(), flat.data(), ids.data());
     } catch (std::runtime_error e) {
         GlobalLogger->error("insert error: {}", e.what());
     }
@@ -41,7 +46,7 @@ std::pair<std::vector<long>, std::vector<float>> IVFPQIndex::search_vectors(cons
     std::vector<float> distances(num_queries * k);
     
     std::lock_guard<std::mutex> lock(index_mutex);
-    index->search(num_queries, query.data(), k, distances.data(), indices.data());
+    id_map->search(num_queries, query.data(), k, distances.data(), indices.data());
     return {indices, distances};
 }
 
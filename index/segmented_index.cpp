@@ -0,0 +1,592 @@
+#include "include/segmented_index.h"
+#include "include/constant.h"
+#include "include/logger.h"
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/impl/IDSelector.h>
+#include <faiss/index_io.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <unordered_set>
+
+namespace {
+    const char SEGMENT_MANIFEST_MAGIC[8] = {'V', 'D', 'B', 'S', 'E', 'G', '0', '1'};
+
+    template <typename T>
+    void writePod(std::ofstream& out, const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    void readPod(std::ifstream& in, T& value) {
+        in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+
+    // 段内检索时跳过已被删除标记覆盖的位置，位置先经 ids 映射成外部 id。
+    // 调用方需持有删除标记的读锁
+    struct TombstoneSelector : faiss::IDSelector {
+        const std::vector<long>& ids;
+        const std::unordered_map<long, uint64_t>& tombstones;
+        uint64_t seq;
+
+        TombstoneSelector(const std::vector<long>& ids, const std::unordered_map<long, uint64_t>& tombstones, uint64_t seq) : ids(ids), tombstones(tombstones), seq(seq) {}
+
+        bool is_member(faiss::idx_t i) const override {
+            auto it = tombstones.find(ids[i]);
+            return it == tombstones.end() || seq >= it->second;
+        }
+    };
+}
+
+SegmentedIndex::Segment::~Segment() {
+    delete index;
+}
+
+SegmentedIndex::SegmentedIndex(int dim, faiss::MetricType metric, const IndexParams& params) : dim(dim), metric(metric), params(params) {
+    this->params.memtable_size = std::max(this->params.memtable_size, 1);
+    memtable = newMemtable();
+    build_thread = std::thread(&SegmentedIndex::buildLoop, this);
+}
+
+SegmentedIndex::~SegmentedIndex() {
+    {
+        std::lock_guard<std::mutex> lock(build_mutex);
+        stopping = true;
+    }
+    build_cv.notify_all();
+    if (build_thread.joinable()) {
+        build_thread.join();
+    }
+}
+
+SegmentedIndex::SegmentPtr SegmentedIndex::newMemtable() {
+    SegmentPtr segment = std::make_shared<Segment>();
+    segment->index = new faiss::IndexFlat(dim, metric);
+    segment->seq = next_seq++;
+    segment->file_id = next_file_id++;
+    return segment;
+}
+
+void SegmentedIndex::insert_vectors(const std::vector<float>& data, uint64_t label) {
+    long id = static_cast<long>(label);
+    try {
+        add(data.data(), 1, &id);
+    } catch (const std::exception& e) {
+        GlobalLogger->error("insert error: {}", e.what());
+    }
+}
+
+void SegmentedIndex::insert_batch_vectors(const std::vector<std::vector<float>>& vectors, const std::vector<long>& ids) {
+    // 各行向量内存不连续，先拼接成一块再交给 faiss
+    std::vector<float> flat;
+    flat.reserve(vectors.size() * dim);
+    for (const auto& vec : vectors) {
+        flat.insert(flat.end(), vec.begin(), vec.end());
+    }
+    try {
+        add(flat.data(), ids.size(), ids.data());
+    } catch (const std::exception& e) {
+        GlobalLogger->error("insert error: {}", e.what());
+    }
+}
+
+void SegmentedIndex::add(const float* data, size_t n, const long* ids) {
+    std::unique_lock<std::shared_mutex> lock(memtable_mutex);
+    memtable->index->add(n, data);
+    memtable->ids.insert(memtable->ids.end(), ids, ids + n);
+    if (memtable->ids.size() < static_cast<size_t>(params.memtable_size)) {
+        return;
+    }
+
+    // 内存段写满后封存，封存的 flat 段立即可查，构建交给后台线程
+    SegmentPtr sealed = memtable;
+    memtable = newMemtable();
+    {
+        std::lock_guard<std::mutex> segments_lock(segments_mutex);
+        segments.push_back(sealed);
+    }
+    {
+        std::lock_guard<std::mutex> build_lock(build_mutex);
+        build_queue.push_back(sealed);
+    }
+    build_cv.notify_one();
+}
+
+void SegmentedIndex::remove_vectors(const std::vector<long>& ids) {
+    std::unordered_set<long> removed(ids.begin(), ids.end());
+    std::unique_lock<std::shared_mutex> lock(memtable_mutex);
+
+    // 内存段中的直接物理删除，封存的段只记删除标记，合并时再清理
+    std::vector<faiss::idx_t> positions;
+    for (size_t i = 0; i < memtable->ids.size(); i++) {
+        if (removed.count(memtable->ids[i]) > 0) {
+            positions.push_back(i);
+        }
+    }
+    if (!positions.empty()) {
+        faiss::IDSelectorBatch selector(positions.size(), positions.data());
+        memtable->index->remove_ids(selector);
+        // IndexFlat 删除后保持剩余向量的相对顺序，id 映射按同样方式压缩
+        auto it = std::remove_if(memtable->ids.begin(), memtable->ids.end(), [&removed](long id) {
+            return removed.count(id) > 0;
+        });
+        memtable->ids.erase(it, memtable->ids.end());
+    }
+
+    std::unique_lock<std::shared_mutex> tombstone_lock(tombstone_mutex);
+    for (long id : ids) {
+        tombstones[id] = memtable->seq;
+    }
+}
+
+bool SegmentedIndex::isDeleted(long id, uint64_t seq) const {
+    std::shared_lock<std::shared_mutex> lock(tombstone_mutex);
+    auto it = tombstones.find(id);
+    return it != tombstones.end() && seq < it->second;
+}
+
+std::pair<std::vector<long>, std::vector<float>> SegmentedIndex::searchSegment(const Segment& segment, const std::vector<float>& query, int k, int ef_search, int nprobe) {
+    int num_queries = query.size() / dim;
+    std::vector<long> indices(num_queries * k, -1);
+    std::vector<float> distances(num_queries * k);
+    if (segment.ids.empty()) {
+        return {indices, distances};
+    }
+
+    // ef_search / nprobe <= 0 时使用建段时配置的默认值
+    faiss::SearchParameters flat_params;
+    faiss::SearchParametersHNSW hnsw_params;
+    faiss::SearchParametersIVF ivf_params;
+    faiss::SearchParameters* search_params = &flat_params;
+    if (dynamic_cast<const faiss::IndexHNSW*>(segment.index) != nullptr) {
+        if (ef_search > 0) {
+            hnsw_params.efSearch = ef_search;
+        } else {
+            hnsw_params.efSearch = static_cast<const faiss::IndexHNSW*>(segment.index)->hnsw.efSearch;
+        }
+        search_params = &hnsw_params;
+    } else if (const faiss::IndexIVF* ivf_index = dynamic_cast<const faiss::IndexIVF*>(segment.index)) {
+        ivf_params.nprobe = nprobe > 0 ? nprobe : ivf_index->nprobe;
+        search_params = &ivf_params;
+    }
+
+    // 删除标记在段内检索时过滤，不用为被删除的条数放大 k
+    std::shared_lock<std::shared_mutex> lock(tombstone_mutex);
+    TombstoneSelector selector(segment.ids, tombstones, segment.seq);
+    if (!tombstones.empty()) {
+        search_params->sel = &selector;
+    }
+    segment.index->search(num_queries, query.data(), k, distances.data(), indices.data(), search_params);
+    lock.unlock();
+    for (auto& idx : indices) {
+        if (idx >= 0) {
+            idx = segment.ids[idx];
+        }
+    }
+    return {indices, distances};
+}
+
+std::pair<std::vector<long>, std::vector<float>> SegmentedIndex::search_vectors(const std::vector<float>& query, int k, int ef_search, int nprobe) {
+    int num_queries = query.size() / dim;
+
+    // 持有内存段的读锁时取段列表，保证封存过程中的数据不会被漏查
+    std::vector<SegmentPtr> snapshot;
+    std::vector<std::pair<std::vector<long>, std::vector<float>>> partial;
+    {
+        std::shared_lock<std::shared_mutex> lock(memtable_mutex);
+        {
+            std::lock_guard<std::mutex> segments_lock(segments_mutex);
+            snapshot = segments;
+        }
+        snapshot.push_back(memtable);
+        partial.resize(snapshot.size());
+        partial.back() = searchSegment(*memtable, query, k, ef_search, nprobe);
+    }
+
+    int num_sealed = snapshot.size() - 1;
+#pragma omp parallel for schedule(dynamic) if (num_sealed > 1)
+    for (int i = 0; i < num_sealed; i++) {
+        partial[i] = searchSegment(*snapshot[i], query, k, ef_search, nprobe);
+    }
+
+    bool larger_is_better = (metric == faiss::METRIC_INNER_PRODUCT);
+    std::vector<long> indices(num_queries * k, -1);
+    std::vector<float> distances(num_queries * k, larger_is_better ? std::numeric_limits<float>::lowest() : std::numeric_limits<float>::max());
+    for (int q = 0; q < num_queries; q++) {
+        std::vector<std::pair<float, long>> candidates;
+        for (size_t s = 0; s < snapshot.size(); s++) {
+            for (int j = q * k; j < (q + 1) * k; j++) {
+                long id = partial[s].first[j];
+                if (id >= 0) {
+                    candidates.emplace_back(partial[s].second[j], id);
+                }
+            }
+        }
+        size_t num_results = std::min(candidates.size(), static_cast<size_t>(k));
+        std::partial_sort(candidates.begin(), candidates.begin() + num_results, candidates.end(), [larger_is_better](const std::pair<float, long>& a, const std::pair<float, long>& b) {
+            return larger_is_better ? a.first > b.first : a.first < b.first;
+        });
+        for (size_t j = 0; j < num_results; j++) {
+            distances[q * k + j] = candidates[j].first;
+            indices[q * k + j] = candidates[j].second;
+        }
+    }
+    return {indices, distances};
+}
+
+faiss::Index* SegmentedIndex::buildIndex(const float* data, size_t n) {
+    if (params.segment_type == INDEX_TYPE_FLAT) {
+        faiss::IndexFlat* flat_index = new faiss::IndexFlat(dim, metric);
+        flat_index->add(n, data);
+        return flat_index;
+    }
+    if (params.segment_type == INDEX_TYPE_IVFFLAT) {
+        // 段内数据量有限，聚类中心数按每个中心至少 39 个样本收缩
+        int nlist = std::max(1, std::min(params.nlist, static_cast<int>(n / 39)));
+        faiss::IndexFlat* quantizer = new faiss::IndexFlat(dim, metric);
+        faiss::IndexIVFFlat* ivf_index = new faiss::IndexIVFFlat(quantizer, dim, nlist, metric);
+        ivf_index->own_fields = true;
+        ivf_index->nprobe = std::min(params.nprobe, nlist);
+        ivf_index->train(n, data);
+        ivf_index->add(n, data);
+        // 合并时需要按位置取回原始向量
+        ivf_index->make_direct_map();
+        return ivf_index;
+    }
+    faiss::IndexHNSWFlat* hnsw_index = new faiss::IndexHNSWFlat(dim, params.hnsw_m, metric);
+    hnsw_index->hnsw.efConstruction = params.ef_construction;
+    hnsw_index->hnsw.efSearch = params.ef_search;
+    hnsw_index->add(n, data);
+    return hnsw_index;
+}
+
+void SegmentedIndex::buildLoop() {
+    while (true) {
+        SegmentPtr sealed;
+        {
+            std::unique_lock<std::mutex> lock(build_mutex);
+            build_cv.wait(lock, [this] { return stopping || !build_queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            sealed = build_queue.front();
+            build_queue.pop_front();
+        }
+        // 构建失败时 flat 段仍留在段列表中，可以继续被查询
+        try {
+            buildSegment(sealed);
+            maybeMerge();
+            collectTombstones();
+        } catch (const std::exception& e) {
+            GlobalLogger->error("Failed to build segment: {}", e.what());
+        }
+    }
+}
+
+void SegmentedIndex::buildSegment(const SegmentPtr& sealed) {
+    size_t n = sealed->ids.size();
+    std::vector<float> all(n * dim);
+    sealed->index->reconstruct_n(0, n, all.data());
+
+    SegmentPtr built = std::make_shared<Segment>();
+    built->seq = sealed->seq;
+    built->file_id = next_file_id++;
+    built->built = true;
+    std::vector<float> vectors;
+    vectors.reserve(all.size());
+    for (size_t i = 0; i < n; i++) {
+        if (!isDeleted(sealed->ids[i], sealed->seq)) {
+            vectors.insert(vectors.end(), all.begin() + i * dim, all.begin() + (i + 1) * dim);
+            built->ids.push_back(sealed->ids[i]);
+        }
+    }
+    if (!built->ids.empty()) {
+        built->index = buildIndex(vectors.data(), built->ids.size());
+    }
+
+    std::lock_guard<std::mutex> lock(segments_mutex);
+    auto it = std::find(segments.begin(), segments.end(), sealed);
+    if (it == segments.end()) {
+        return;
+    }
+    if (built->ids.empty()) {
+        segments.erase(it);
+    } else {
+        *it = built;
+    }
+    GlobalLogger->debug("Segment {} built with {} vectors", built->seq, built->ids.size());
+}
+
+void SegmentedIndex::maybeMerge() {
+    if (params.merge_factor < 2) {
+        return;
+    }
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(build_mutex);
+            if (stopping) {
+                return;
+            }
+        }
+
+        // 按段大小分层，第 t 层的段大小约为 memtable_size * merge_factor^t，
+        // 同一层攒够 merge_factor 个段时合并成上一层的一个段
+        std::vector<SegmentPtr> inputs;
+        {
+            std::lock_guard<std::mutex> lock(segments_mutex);
+            std::map<int, std::vector<SegmentPtr>> tiers;
+            for (const auto& segment : segments) {
+                if (!segment->built) {
+                    continue;
+                }
+                int tier = 0;
+                size_t capacity = params.memtable_size;
+                while (segment->ids.size() >= capacity * params.merge_factor) {
+                    capacity *= params.merge_factor;
+                    tier++;
+                }
+                tiers[tier].push_back(segment);
+            }
+            for (const auto& tier : tiers) {
+                if (tier.second.size() >= static_cast<size_t>(params.merge_factor)) {
+                    inputs.assign(tier.second.begin(), tier.second.begin() + params.merge_factor);
+                    break;
+                }
+            }
+        }
+        if (inputs.empty()) {
+            return;
+        }
+
+        SegmentPtr merged = std::make_shared<Segment>();
+        merged->file_id = next_file_id++;
+        merged->built = true;
+        std::vector<float> vectors;
+        for (const auto& segment : inputs) {
+            size_t n = segment->ids.size();
+            std::vector<float> all(n * dim);
+            segment->index->reconstruct_n(0, n, all.data());
+            for (size_t i = 0; i < n; i++) {
+                if (!isDeleted(segment->ids[i], segment->seq)) {
+                    vectors.insert(vectors.end(), all.begin() + i * dim, all.begin() + (i + 1) * dim);
+                    merged->ids.push_back(segment->ids[i]);
+                }
+            }
+            merged->seq = std::max(merged->seq, segment->seq);
+        }
+        if (!merged->ids.empty()) {
+            merged->index = buildIndex(vectors.data(), merged->ids.size());
+        }
+
+        std::lock_guard<std::mutex> lock(segments_mutex);
+        for (const auto& segment : inputs) {
+            segments.erase(std::remove(segments.begin(), segments.end(), segment), segments.end());
+        }
+        if (!merged->ids.empty()) {
+            segments.push_back(merged);
+        }
+        GlobalLogger->debug("Merged {} segments into one segment with {} vectors", inputs.size(), merged->ids.size());
+    }
+}
+
+void SegmentedIndex::collectTombstones() {
+    // 构建和合并只在本线程进行，封存出的新段代数不小于已有的删除标记，
+    // 所以快照之后更早的段只会变少，据快照判断可以丢弃的标记是安全的
+    std::vector<SegmentPtr> snapshot;
+    std::unordered_map<long, uint64_t> droppable;
+    {
+        std::lock_guard<std::mutex> segments_lock(segments_mutex);
+        std::shared_lock<std::shared_mutex> tombstone_lock(tombstone_mutex);
+        if (tombstones.empty()) {
+            return;
+        }
+        snapshot = segments;
+        droppable = tombstones;
+    }
+
+    // 删除标记只作用于更早的段，没有更早的段还持有该 id 时就不再需要
+    for (const auto& segment : snapshot) {
+        for (long id : segment->ids) {
+            auto it = droppable.find(id);
+            if (it != droppable.end() && segment->seq < it->second) {
+                droppable.erase(it);
+            }
+        }
+        if (droppable.empty()) {
+            return;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> tombstone_lock(tombstone_mutex);
+    size_t dropped = 0;
+    for (const auto& tombstone : droppable) {
+        // 期间同一 id 被再次删除时代数会变，留给下一轮判断
+        auto it = tombstones.find(tombstone.first);
+        if (it != tombstones.end() && it->second == tombstone.second) {
+            tombstones.erase(it);
+            dropped++;
+        }
+    }
+    GlobalLogger->debug("Dropped {} tombstones, {} remaining", dropped, tombstones.size());
+}
+
+void SegmentedIndex::saveIndex(const std::string& file_path) {
+    std::lock_guard<std::mutex> save_lock(save_mutex);
+    std::vector<SegmentPtr> snapshot;
+    std::unordered_map<long, uint64_t> tombstones_snapshot;
+    SegmentPtr current_memtable;
+    std::string memtable_path = file_path + ".memtable";
+    {
+        // 内存段可变，持锁写出；封存的段不可变，放到锁外写
+        std::shared_lock<std::shared_mutex> lock(memtable_mutex);
+        {
+            std::lock_guard<std::mutex> segments_lock(segments_mutex);
+            snapshot = segments;
+        }
+        {
+            std::shared_lock<std::shared_mutex> tombstone_lock(tombstone_mutex);
+            tombstones_snapshot = tombstones;
+        }
+        current_memtable = memtable;
+        faiss::write_index(memtable->index, memtable_path.c_str());
+    }
+
+    std::unordered_set<std::string> referenced;
+    for (const auto& segment : snapshot) {
+        std::string segment_path = file_path + ".seg" + std::to_string(segment->file_id);
+        if (segment->saved_path != segment_path) {
+            faiss::write_index(segment->index, segment_path.c_str());
+            segment->saved_path = segment_path;
+        }
+        referenced.insert(std::filesystem::path(segment_path).filename().string());
+    }
+
+    std::ofstream out(file_path, std::ios::binary | std::ios::trunc);
+    out.write(SEGMENT_MANIFEST_MAGIC, sizeof(SEGMENT_MANIFEST_MAGIC));
+    writePod(out, dim);
+    writePod(out, static_cast<uint64_t>(snapshot.size() + 1));
+    snapshot.push_back(current_memtable);
+    for (size_t i = 0; i < snapshot.size(); i++) {
+        const SegmentPtr& segment = snapshot[i];
+        uint8_t is_memtable = (i + 1 == snapshot.size()) ? 1 : 0;
+        writePod(out, is_memtable);
+        writePod(out, static_cast<uint8_t>(segment->built ? 1 : 0));
+        writePod(out, segment->seq);
+        writePod(out, segment->file_id);
+        writePod(out, static_cast<uint64_t>(segment->ids.size()));
+        out.write(reinterpret_cast<const char*>(segment->ids.data()), segment->ids.size() * sizeof(long));
+    }
+    writePod(out, static_cast<uint64_t>(tombstones_snapshot.size()));
+    for (const auto& tombstone : tombstones_snapshot) {
+        writePod(out, tombstone.first);
+        writePod(out, tombstone.second);
+    }
+    out.close();
+    if (out.fail()) {
+        GlobalLogger->error("Failed to write segment manifest {}", file_path);
+        return;
+    }
+
+    // 清理已经被合并掉的段文件
+    std::filesystem::path manifest(file_path);
+    std::filesystem::path folder = manifest.has_parent_path() ? manifest.parent_path() : std::filesystem::path(".");
+    std::string prefix = manifest.filename().string() + ".seg";
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(folder, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, prefix.size(), prefix) == 0 && referenced.count(name) == 0) {
+            std::filesystem::remove(entry.path(), ec);
+        }
+    }
+}
+
+void SegmentedIndex::loadIndex(const std::string& file_path) {
+    std::ifstream in(file_path, std::ios::binary);
+    if (!in.good()) {
+        GlobalLogger->warn("File not found: {}. Skipping loading index.", file_path);
+        return;
+    }
+
+    char magic[sizeof(SEGMENT_MANIFEST_MAGIC)];
+    in.read(magic, sizeof(magic));
+    int saved_dim = 0;
+    readPod(in, saved_dim);
+    if (!in.good() || !std::equal(magic, magic + sizeof(magic), SEGMENT_MANIFEST_MAGIC) || saved_dim != dim) {
+        GlobalLogger->error("Invalid segment manifest {}. Skipping loading index.", file_path);
+        return;
+    }
+
+    uint64_t num_segments = 0;
+    readPod(in, num_segments);
+    std::vector<SegmentPtr> loaded;
+    SegmentPtr loaded_memtable;
+    uint64_t max_seq = 0;
+    uint64_t max_file_id = 0;
+    for (uint64_t i = 0; i < num_segments; i++) {
+        SegmentPtr segment = std::make_shared<Segment>();
+        uint8_t is_memtable = 0;
+        uint8_t built = 0;
+        uint64_t num_ids = 0;
+        readPod(in, is_memtable);
+        readPod(in, built);
+        readPod(in, segment->seq);
+        readPod(in, segment->file_id);
+        readPod(in, num_ids);
+        segment->built = built != 0;
+        segment->ids.resize(num_ids);
+        in.read(reinterpret_cast<char*>(segment->ids.data()), num_ids * sizeof(long));
+
+        std::string segment_path = is_memtable ? file_path + ".memtable" : file_path + ".seg" + std::to_string(segment->file_id);
+        segment->index = faiss::read_index(segment_path.c_str());
+        if (!is_memtable) {
+            segment->saved_path = segment_path;
+        }
+        max_seq = std::max(max_seq, segment->seq);
+        max_file_id = std::max(max_file_id, segment->file_id);
+        if (is_memtable) {
+            loaded_memtable = segment;
+        } else {
+            loaded.push_back(segment);
+        }
+    }
+    std::unordered_map<long, uint64_t> loaded_tombstones;
+    uint64_t num_tombstones = 0;
+    readPod(in, num_tombstones);
+    for (uint64_t i = 0; i < num_tombstones && in.good(); i++) {
+        long id = 0;
+        uint64_t seq = 0;
+        readPod(in, id);
+        readPod(in, seq);
+        loaded_tombstones[id] = seq;
+    }
+    if (!in.good() || loaded_memtable == nullptr) {
+        GlobalLogger->error("Truncated segment manifest {}. Skipping loading index.", file_path);
+        return;
+    }
+
+    next_seq = max_seq + 1;
+    next_file_id = max_file_id + 1;
+    {
+        std::unique_lock<std::shared_mutex> lock(memtable_mutex);
+        std::lock_guard<std::mutex> segments_lock(segments_mutex);
+        std::unique_lock<std::shared_mutex> tombstone_lock(tombstone_mutex);
+        memtable = loaded_memtable;
+        segments = loaded;
+        tombstones = loaded_tombstones;
+    }
+    // 保存时尚未构建完的段重新排队构建
+    {
+        std::lock_guard<std::mutex> lock(build_mutex);
+        for (const auto& segment : loaded) {
+            if (!segment->built) {
+                build_queue.push_back(segment);
+            }
+        }
+    }
+    build_cv.notify_one();
+    GlobalLogger->info("Loaded {} segments from {}", loaded.size(), file_path);
+}
@@ -1,12 +1,84 @@
 #include "logger.h"
+#include "metrics.h"
+#include "spdlog/async.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/sinks/rotating_file_sink.h"
+#include <cstdlib>
+#include <stdexcept>
 
 std::shared_ptr<spdlog::logger> GlobalLogger;
 
-void init_global_logger() {
-    GlobalLogger = spdlog::stdout_color_mt("GlobalLogger");
+LogOptions readLogOptions(const std::map<std::string, std::string>& config) {
+    LogOptions options;
+    auto read = [&config](const std::string& key) {
+        auto it = config.find(key);
+        return it != config.end() ? it->second : std::string();
+    };
+    if (!read("log_level").empty()) {
+        options.level = spdlog::level::from_str(read("log_level"));
+    }
+    if (!read("log_async").empty()) {
+        options.async = read("log_async") != "0";
+    }
+    if (!read("log_queue_size").empty()) {
+        options.queueSize = std::stoul(read("log_queue_size"));
+    }
+    if (!read("log_overflow").empty()) {
+        options.overflow = read("log_overflow");
+    }
+    if (!read("log_console").empty()) {
+        options.console = read("log_console") != "0";
+    }
+    options.file = read("log_file");
+    if (!read("log_file_max_mb").empty()) {
+        options.fileMaxMb = std::stoul(read("log_file_max_mb"));
+    }
+    if (!read("log_file_max_count").empty()) {
+        options.fileMaxCount = std::stoul(read("log_file_max_count"));
+    }
+    return options;
+}
+
+void init_global_logger(const LogOptions& options) {
+    std::vector<spdlog::sink_ptr> sinks;
+    if (options.console) {
+        sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
+    }
+    if (!options.file.empty()) {
+        sinks.push_back(std::make_shared<spdlog::sinks::rotating_file_sink_mt>(options.file, options.fileMaxMb << 20, options.fileMaxCount));
+    }
+
+    if (options.async) {
+        spdlog::async_overflow_policy policy;
+        if (options.overflow == "block") {
+            policy = spdlog::async_overflow_policy::block;
+        } else if (options.overflow == "overrun_oldest") {
+            policy = spdlog::async_overflow_policy::overrun_oldest;
+        } else if (options.overflow == "discard_new") {
+            policy = spdlog::async_overflow_policy::discard_new;
+        } else {
+            throw std::runtime_error("Unknown log_overflow: " + options.overflow);
+        }
+        // 格式化和写出都在后台线程上完成，请求线程只把消息放进队列
+        spdlog::init_thread_pool(options.queueSize, 1);
+        std::shared_ptr<spdlog::details::thread_pool> pool = spdlog::thread_pool();
+        GlobalLogger = std::make_shared<spdlog::async_logger>("GlobalLogger", sinks.begin(), sinks.end(), pool, policy);
+        // 队列满时丢弃的日志条数
+        MetricsRegistry::instance().gauge("log_messages_dropped", "Log messages dropped because the async queue was full", "", [pool]() {
+            return static_cast<double>(pool->overrun_counter() + pool->discard_counter());
+        });
+    } else {
+        GlobalLogger = std::make_shared<spdlog::logger>("GlobalLogger", sinks.begin(), sinks.end());
+    }
+    GlobalLogger->set_level(options.level);
+    // 告警以上立即落盘，其余每秒刷一次
+    GlobalLogger->flush_on(spdlog::level::warn);
+    spdlog::register_logger(GlobalLogger);
+    spdlog::flush_every(std::chrono::seconds(1));
+    // 退出时把队列中剩余的日志写完
+    std::atexit(spdlog::shutdown);
 }
 
 void set_log_level(spdlog::level::level_enum log_level) {
     GlobalLogger->set_level(log_level);
-}
\ No newline at end of file
+}
@@ -0,0 +1,191 @@
+#include "metrics.h"
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+// 每个线程固定写一个分片，线程数多于分片数时才会共享缓存行
+size_t stripeIndex(size_t stripes) {
+    static std::atomic<size_t> next{0};
+    static thread_local size_t index = next++;
+    return index % stripes;
+}
+
+std::string withLabels(const std::string& name, const std::string& labels, const std::string& extra = "") {
+    std::string all = labels;
+    if (!extra.empty()) {
+        all += all.empty() ? extra : "," + extra;
+    }
+    return all.empty() ? name : name + "{" + all + "}";
+}
+
+} // namespace
+
+void Counter::add(uint64_t n) {
+    stripes_[stripeIndex(kStripes)].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const auto& stripe : stripes_) {
+        total += stripe.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t Histogram::bucketOf(uint64_t micros) {
+    micros = std::min<uint64_t>(micros, (1ULL << kMaxBits) - 1);
+    if (micros < (1ULL << (kSubBucketBits + 1))) {
+        return micros;
+    }
+    int msb = 63 - __builtin_clzll(micros);
+    int shift = msb - kSubBucketBits;
+    return (static_cast<size_t>(shift) << kSubBucketBits) + (micros >> shift);
+}
+
+double Histogram::bucketValue(size_t bucket) {
+    if (bucket < (1ULL << (kSubBucketBits + 1))) {
+        return bucket;
+    }
+    int shift = static_cast<int>(bucket >> kSubBucketBits) - 1;
+    uint64_t lower = ((bucket & ((1ULL << kSubBucketBits) - 1)) + (1ULL << kSubBucketBits)) << shift;
+    return lower + (1ULL << shift) / 2.0;
+}
+
+void Histogram::record(double seconds) {
+    recordMicros(seconds <= 0 ? 0 : static_cast<uint64_t>(seconds * 1e6));
+}
+
+void Histogram::recordMicros(uint64_t micros) {
+    Stripe& stripe = stripes_[stripeIndex(kStripes)];
+    stripe.counts[bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+    stripe.count.fetch_add(1, std::memory_order_relaxed);
+    stripe.sumMicros.fetch_add(micros, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot snapshot;
+    snapshot.counts.assign(kBuckets, 0);
+    uint64_t sumMicros = 0;
+    for (const auto& stripe : stripes_) {
+        for (size_t i = 0; i < kBuckets; i++) {
+            snapshot.counts[i] += stripe.counts[i].load(std::memory_order_relaxed);
+        }
+        sumMicros += stripe.sumMicros.load(std::memory_order_relaxed);
+    }
+    // 以各桶之和为准，抓取期间并发写入造成的 count 与桶不一致不影响分位数
+    for (uint64_t count : snapshot.counts) {
+        snapshot.count += count;
+    }
+    snapshot.sumSeconds = sumMicros / 1e6;
+    return snapshot;
+}
+
+double Histogram::Snapshot::quantile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * count)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucketValue(i) / 1e6;
+        }
+    }
+    return bucketValue(counts.size() - 1) / 1e6;
+}
+
+MetricsRegistry& MetricsRegistry::instance() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricsRegistry::Family& MetricsRegistry::family(const std::string& name, const std::string& help, Type type) {
+    auto it = families_.find(name);
+    if (it == families_.end()) {
+        it = families_.emplace(name, Family()).first;
+        it->second.type = type;
+        it->second.help = help;
+    } else if (it->second.type != type) {
+        throw std::runtime_error("Metric " + name + " registered with a different type");
+    }
+    return it->second;
+}
+
+Counter& MetricsRegistry::counter(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = family(name, help, Type::COUNTER).counters[labels];
+    if (!entry) {
+        entry.reset(new Counter());
+    }
+    return *entry;
+}
+
+Histogram& MetricsRegistry::histogram(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = family(name, help, Type::HISTOGRAM).histograms[labels];
+    if (!entry) {
+        entry.reset(new Histogram());
+    }
+    return *entry;
+}
+
+void MetricsRegistry::gauge(const std::string& name, const std::string& help, const std::string& labels, std::function<double()> fn) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    family(name, help, Type::GAUGE).gauges[labels] = std::move(fn);
+}
+
+std::string MetricsRegistry::render() {
+    static const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+    std::ostringstream out;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& item : families_) {
+        const std::string& name = item.first;
+        const Family& family = item.second;
+        out << "# HELP " << name << " " << family.help << "\n";
+        switch (family.type) {
+            case Type::COUNTER:
+                out << "# TYPE " << name << " counter\n";
+                for (const auto& counter : family.counters) {
+                    out << withLabels(name, counter.first) << " " << counter.second->value() << "\n";
+                }
+                break;
+            case Type::GAUGE:
+                out << "# TYPE " << name << " gauge\n";
+                for (const auto& gauge : family.gauges) {
+                    out << withLabels(name, gauge.first) << " " << gauge.second() << "\n";
+                }
+                break;
+            case Type::HISTOGRAM:
+                out << "# TYPE " << name << " summary\n";
+                for (const auto& histogram : family.histograms) {
+                    Histogram::Snapshot snapshot = histogram.second->snapshot();
+                    for (double q : kQuantiles) {
+                        std::ostringstream quantile;
+                        quantile << "quantile=\"" << q << "\"";
+                        out << withLabels(name, histogram.first, quantile.str()) << " " << snapshot.quantile(q) << "\n";
+                    }
+                    out << withLabels(name + "_sum", histogram.first) << " " << snapshot.sumSeconds << "\n";
+                    out << withLabels(name + "_count", histogram.first) << " " << snapshot.count << "\n";
+                }
+                break;
+        }
+    }
+    return out.str();
+}
+
+EndpointMetrics::EndpointMetrics(const std::string& service, const std::string& path)
+: latency_(MetricsRegistry::instance().histogram(service + "_http_request_duration_seconds", "HTTP request latency", "endpoint=\"" + path + "\"")),
+  requests_(MetricsRegistry::instance().counter(service + "_http_requests_total", "HTTP requests", "endpoint=\"" + path + "\"")),
+  errors_(MetricsRegistry::instance().counter(service + "_http_errors_total", "HTTP responses with status >= 500", "endpoint=\"" + path + "\"")) {}
+
+void EndpointMetrics::record(double seconds, int status) {
+    latency_.record(seconds);
+    requests_.add();
+    if (status >= 500) {
+        errors_.add();
+    }
+}
@@ -0,0 +1,182 @@
+#include "tracing.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <sstream>
+
+namespace {
+
+// 每个线程独立的 xorshift，采样判断不加锁
+uint64_t nextRandom() {
+    static thread_local uint64_t state = std::random_device{}() | (static_cast<uint64_t>(std::random_device{}()) << 32) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+std::string newTraceId() {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(nextRandom()));
+    return buf;
+}
+
+uint32_t micros(std::chrono::steady_clock::duration duration) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    return static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(us, 0), std::numeric_limits<uint32_t>::max()));
+}
+
+// 按开始时间排序，同时开始时外层在前
+bool spanBefore(const Span& a, const Span& b) {
+    return a.startUs != b.startUs ? a.startUs < b.startUs : a.depth < b.depth;
+}
+
+} // namespace
+
+void Trace::addSpan(const char* name, std::chrono::steady_clock::time_point begin, uint16_t depth, std::string detail) {
+    auto now = std::chrono::steady_clock::now();
+    Span span{name, std::move(detail), micros(begin - start), micros(now - begin), depth};
+    std::lock_guard<std::mutex> lock(mutex_);
+    spans_.push_back(std::move(span));
+}
+
+std::vector<Span> Trace::spans() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return spans_;
+}
+
+std::string Trace::serverTiming() const {
+    // span 在结束时追加，按开始时间排序后更接近阅读顺序
+    std::vector<Span> sorted = spans();
+    std::stable_sort(sorted.begin(), sorted.end(), spanBefore);
+    std::ostringstream oss;
+    oss.precision(3);
+    oss << std::fixed;
+    for (const auto& span : sorted) {
+        oss << span.name;
+        if (!span.detail.empty()) {
+            oss << ";desc=\"" << span.detail << "\"";
+        }
+        oss << ";dur=" << span.durationUs / 1000.0 << ", ";
+    }
+    oss << "total;dur=" << micros(std::chrono::steady_clock::now() - start) / 1000.0;
+    return oss.str();
+}
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer() : threshold_(0) {
+    configure(0.01, 256);
+}
+
+void Tracer::configure(double sampleRate, size_t capacity) {
+    sampleRate = std::min(std::max(sampleRate, 0.0), 1.0);
+    threshold_ = sampleRate >= 1.0 ? std::numeric_limits<uint64_t>::max() : static_cast<uint64_t>(sampleRate * std::numeric_limits<uint64_t>::max());
+    std::lock_guard<std::mutex> lock(mutex_);
+    ring_.assign(std::max<size_t>(capacity, 1), nullptr);
+    next_ = 0;
+}
+
+void Tracer::begin(const std::string& service, const std::string& endpoint, const std::string& traceId, bool forceSample) {
+    traceDepth() = 0;
+    uint64_t threshold = threshold_.load(std::memory_order_relaxed);
+    if (!forceSample && (threshold == 0 || nextRandom() >= threshold)) {
+        currentTrace().reset();
+        return;
+    }
+    auto trace = std::make_shared<Trace>();
+    // 上游传入的 id 过长时不沿用，避免撑大缓冲
+    trace->traceId = traceId.empty() || traceId.size() > 64 ? newTraceId() : traceId;
+    trace->service = service;
+    trace->endpoint = endpoint;
+    trace->startMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    trace->start = std::chrono::steady_clock::now();
+    currentTrace() = std::move(trace);
+}
+
+void Tracer::finish(int status) {
+    std::shared_ptr<Trace> trace = std::move(currentTrace());
+    currentTrace().reset();
+    if (!trace) {
+        return;
+    }
+    trace->status = status;
+    trace->durationUs = micros(std::chrono::steady_clock::now() - trace->start);
+    std::lock_guard<std::mutex> lock(mutex_);
+    ring_[next_] = std::move(trace);
+    next_ = (next_ + 1) % ring_.size();
+}
+
+std::string Tracer::dump(size_t limit) const {
+    std::vector<std::shared_ptr<Trace>> traces;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 1; i <= ring_.size() && traces.size() < limit; i++) {
+            const auto& trace = ring_[(next_ + ring_.size() - i) % ring_.size()];
+            if (!trace) {
+                break;
+            }
+            traces.push_back(trace);
+        }
+    }
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("traces");
+    writer.StartArray();
+    for (const auto& trace : traces) {
+        writer.StartObject();
+        writer.Key("traceId");
+        writer.String(trace->traceId.c_str());
+        writer.Key("service");
+        writer.String(trace->service.c_str());
+        writer.Key("endpoint");
+        writer.String(trace->endpoint.c_str());
+        writer.Key("startMs");
+        writer.Int64(trace->startMs);
+        writer.Key("durationUs");
+        writer.Uint64(trace->durationUs);
+        writer.Key("status");
+        writer.Int(trace->status);
+        writer.Key("spans");
+        writer.StartArray();
+        std::vector<Span> spans = trace->spans();
+        std::stable_sort(spans.begin(), spans.end(), spanBefore);
+        for (const auto& span : spans) {
+            writer.StartObject();
+            writer.Key("name");
+            writer.String(span.name);
+            if (!span.detail.empty()) {
+                writer.Key("detail");
+                writer.String(span.detail.c_str());
+            }
+            writer.Key("startUs");
+            writer.Uint(span.startUs);
+            writer.Key("durationUs");
+            writer.Uint(span.durationUs);
+            writer.Key("depth");
+            writer.Uint(span.depth);
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    return buffer.GetString();
+}
+
+std::vector<std::string> traceHeaders() {
+    const std::shared_ptr<Trace>& trace = currentTrace();
+    if (!trace) {
+        return {};
+    }
+    return {std::string(Tracer::kTraceIdHeader) + ": " + trace->traceId, std::string(Tracer::kSampledHeader) + ": 1"};
+}
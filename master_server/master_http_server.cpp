@@ -1,5 +1,6 @@
 #include "include/master_http_server.h"
 #include "include/logger.h"
+#include "include/metrics.h"
 #include <sstream>
 #include <iostream>
 #include "rapidjson/document.h"
@@ -32,9 +33,16 @@ rapidjson::Document ServerInfo::toJson() const {
     return doc;
 }
 
+namespace {
+// 同时挂起的拓扑长轮询上限。每个长轮询在等待期间占住一个 http 工作线程，
+// 线程池在这之外另留出普通请求的线程，长轮询再多也不会让普通请求排队
+const int kMaxTopologyWatchers = 64;
+}
 
 MasterHttpServer::MasterHttpServer(const std::string& etcdEndpoints, int httpPort)
-: etcdClient_(etcdEndpoints), httpPort_(httpPort) {
+: etcdEndpoints_(etcdEndpoints), etcdClient_(etcdEndpoints), httpPort_(httpPort), topologyVersion_(0), watchBroken_(false), running_(true), topologyWatchers_(0) {
+    int workerThreads = static_cast<int>(CPPHTTPLIB_THREAD_POOL_COUNT) + kMaxTopologyWatchers;
+    httpServer_.new_task_queue = [workerThreads] { return new httplib::ThreadPool(workerThreads); };
     httpServer_.Get("/getNodeInfo", [this](const httplib::Request& req, httplib::Response& res) {
         getNodeInfo(req, res);
     });
@@ -47,9 +55,31 @@ MasterHttpServer::MasterHttpServer(const std::string& etcdEndpoints, int httpPor
     httpServer_.Get("/getInstance", [this](const httplib::Request& req, httplib::Response& res) {
         getInstance(req, res);
     });
+    httpServer_.Post("/addCollection", [this](const httplib::Request& req, httplib::Response& res) {
+        addCollection(req, res);
+    });
+    httpServer_.Get("/getCollection", [this](const httplib::Request& req, httplib::Response& res) {
+        getCollection(req, res);
+    });
+    httpServer_.Delete("/removeCollection", [this](const httplib::Request& req, httplib::Response& res) {
+        removeCollection(req, res);
+    });
+    httpServer_.Get("/watchTopology", [this](const httplib::Request& req, httplib::Response& res) {
+        watchTopology(req, res);
+    });
+    instrumentHttpServer(httpServer_, "master", {"/getNodeInfo", "/addNode", "/removeNode", "/getInstance", "/addCollection", "/getCollection", "/removeCollection", "/watchTopology"});
+    watchThread_ = std::thread(&MasterHttpServer::watchLoop, this);
 }
 
 MasterHttpServer::~MasterHttpServer() {
+    {
+        std::lock_guard<std::mutex> lock(topologyMutex_);
+        running_ = false;
+        topologyCv_.notify_all();
+    }
+    if (watchThread_.joinable()) {
+        watchThread_.join();
+    }
     for (auto& key: key_set) {
         etcdClient_.rm(key);
     }
@@ -163,48 +193,249 @@ void MasterHttpServer::getInstance(const httplib::Request& req, httplib::Respons
     auto instanceId = req.get_param_value("instanceId");
     GlobalLogger->info("Getting instance information for instanceId: {}", instanceId);
 
+    // 从拓扑缓存读取，proxy 的每次拉取不再访问 etcd
+    std::string keyPrefix = "/instances/" + instanceId + "/nodes/";
+    int64_t version = 0;
+    std::vector<std::pair<std::string, std::string>> entries = cachedEntries(keyPrefix, version);
+
+    rapidjson::Document doc;
+    doc.SetObject();
+    rapidjson::Document::AllocatorType& allocator = doc.GetAllocator();
+
+    rapidjson::Value nodesArray(rapidjson::kArrayType);
+    for (const auto& entry : entries) {
+        GlobalLogger->debug("Processing key: {}", entry.first);
+        rapidjson::Document nodeDoc;
+        nodeDoc.Parse(entry.second.c_str());
+        if (!nodeDoc.IsObject()) {
+            GlobalLogger->warn("Invalid JSON format for key: {}", entry.first);
+            continue;
+        }
+
+        // 使用 CopyFrom 方法将节点信息添加到数组中
+        rapidjson::Value nodeValue(nodeDoc, allocator);
+        nodesArray.PushBack(nodeValue, allocator);
+    }
+
+    doc.AddMember("instanceId", rapidjson::Value(instanceId.c_str(), allocator), allocator);
+    doc.AddMember("nodes", nodesArray, allocator);
+    doc.AddMember("version", version, allocator);
+
+    GlobalLogger->info("Instance info retrieved successfully for instanceId: {}", instanceId);
+    setResponse(res, 0, "Instance info retrieved successfully", &doc);
+}
+
+// 集合由若干实例组成，每个实例是一个分片，proxy 按分片顺序做哈希路由。
+// 分片列表决定了数据的分布，创建后不允许覆盖
+void MasterHttpServer::addCollection(const httplib::Request& req, httplib::Response& res) {
+    rapidjson::Document doc;
+    doc.Parse(req.body.c_str());
+    if (!doc.IsObject() || !doc.HasMember("name") || !doc["name"].IsString() || !doc.HasMember("shards") || !doc["shards"].IsArray() || doc["shards"].Empty()) {
+        setResponse(res, 1, "Invalid JSON format");
+        return;
+    }
+    for (const auto& shard : doc["shards"].GetArray()) {
+        if (!shard.IsString()) {
+            setResponse(res, 1, "Shards must be instance ids");
+            return;
+        }
+    }
+
     try {
-        std::string etcdKeyPrefix = "/instances/" + instanceId + "/nodes/";
-        GlobalLogger->debug("etcd key prefix: {}", etcdKeyPrefix);
+        std::string name = doc["name"].GetString();
+        std::string etcdKey = "/collections/" + name;
 
-        etcd::Response etcdResponse = etcdClient_.ls(etcdKeyPrefix).get();
-        GlobalLogger->debug("etcd ls response received");
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        doc.Accept(writer);
 
+        etcd::Response etcdResponse = etcdClient_.add(etcdKey, buffer.GetString()).get();
         if (!etcdResponse.is_ok()) {
-            GlobalLogger->error("Error accessing etcd: {}", etcdResponse.error_message());
-            setResponse(res, 1, "Error accessing etcd: " + etcdResponse.error_message());
+            setResponse(res, 1, "Error adding collection to etcd: " + etcdResponse.error_message());
             return;
         }
+        GlobalLogger->info("Collection {} added with {} shards", name, doc["shards"].Size());
+        setResponse(res, 0, "Collection added successfully");
+    } catch (const std::exception& e) {
+        setResponse(res, 1, std::string("Error accessing etcd: ") + e.what());
+    }
+}
 
-        const auto& keys = etcdResponse.keys();
-        const auto& values = etcdResponse.values();
-        
-        rapidjson::Document doc;
-        doc.SetObject();
-        rapidjson::Document::AllocatorType& allocator = doc.GetAllocator();
-        
-        rapidjson::Value nodesArray(rapidjson::kArrayType);
-        for (size_t i = 0; i < keys.size(); ++i) {
-            GlobalLogger->debug("Processing key: {}", keys[i]);
-            rapidjson::Document nodeDoc;
-            nodeDoc.Parse(values[i].as_string().c_str());
-            if (!nodeDoc.IsObject()) {
-                GlobalLogger->warn("Invalid JSON format for key: {}", keys[i]);
-                continue;
-            }
-
-            // 使用 CopyFrom 方法将节点信息添加到数组中
-            rapidjson::Value nodeValue(nodeDoc, allocator);
-            nodesArray.PushBack(nodeValue, allocator);
+void MasterHttpServer::getCollection(const httplib::Request& req, httplib::Response& res) {
+    auto name = req.get_param_value("name");
+    std::string value;
+    {
+        std::lock_guard<std::mutex> lock(topologyMutex_);
+        auto it = topology_.find("/collections/" + name);
+        if (it == topology_.end()) {
+            setResponse(res, 1, "Collection not found: " + name);
+            return;
         }
+        value = it->second;
+    }
 
-        doc.AddMember("instanceId", rapidjson::Value(instanceId.c_str(), allocator), allocator);
-        doc.AddMember("nodes", nodesArray, allocator);
-        
-        GlobalLogger->info("Instance info retrieved successfully for instanceId: {}", instanceId);
-        setResponse(res, 0, "Instance info retrieved successfully", &doc);
+    rapidjson::Document doc;
+    doc.Parse(value.c_str());
+    if (!doc.IsObject()) {
+        setResponse(res, 1, "Invalid JSON format");
+        return;
+    }
+    setResponse(res, 0, "Collection info retrieved successfully", &doc);
+}
+
+void MasterHttpServer::removeCollection(const httplib::Request& req, httplib::Response& res) {
+    auto name = req.get_param_value("name");
+    try {
+        etcd::Response etcdResponse = etcdClient_.rm("/collections/" + name).get();
+        if (!etcdResponse.is_ok()) {
+            setResponse(res, 1, "Error removing collection from etcd: " + etcdResponse.error_message());
+            return;
+        }
+        setResponse(res, 0, "Collection removed successfully");
     } catch (const std::exception& e) {
-        GlobalLogger->error("Exception accessing etcd: {}", e.what());
         setResponse(res, 1, "Exception accessing etcd: " + std::string(e.what()));
     }
+}
+
+// 长轮询：拓扑版本与客户端持有的版本不同，或者等待超时后返回当前版本。
+// 版本取 etcd 的 revision，master 重启后也不会回退
+void MasterHttpServer::watchTopology(const httplib::Request& req, httplib::Response& res) {
+    int64_t known = -1;
+    int timeoutMs = 30000;
+    try {
+        if (req.has_param("version")) {
+            known = std::stoll(req.get_param_value("version"));
+        }
+        if (req.has_param("timeoutMs")) {
+            timeoutMs = std::stoi(req.get_param_value("timeoutMs"));
+        }
+    } catch (const std::exception& e) {
+        setResponse(res, 1, "Invalid parameter: " + std::string(e.what()));
+        return;
+    }
+    // 每个长轮询占用一个 http 工作线程，限制最长等待时间
+    timeoutMs = std::min(std::max(timeoutMs, 0), 60000);
+    // 超过上限时直接返回错误，不占用留给普通请求的线程；proxy 收到错误后退避并退化为轮询
+    if (topologyWatchers_.fetch_add(1) >= kMaxTopologyWatchers) {
+        topologyWatchers_--;
+        GlobalLogger->warn("Rejecting topology watch: {} watches already pending", kMaxTopologyWatchers);
+        setResponse(res, 1, "Too many topology watches");
+        return;
+    }
+
+    int64_t version;
+    {
+        std::unique_lock<std::mutex> lock(topologyMutex_);
+        topologyCv_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, known] {
+            return topologyVersion_ != known || !running_;
+        });
+        version = topologyVersion_;
+    }
+    topologyWatchers_--;
+
+    rapidjson::Document doc;
+    doc.SetObject();
+    doc.AddMember("version", version, doc.GetAllocator());
+    setResponse(res, 0, "Topology version", &doc);
+}
+
+std::vector<std::pair<std::string, std::string>> MasterHttpServer::cachedEntries(const std::string& prefix, int64_t& version) {
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::lock_guard<std::mutex> lock(topologyMutex_);
+    for (auto it = topology_.lower_bound(prefix); it != topology_.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+        entries.emplace_back(it->first, it->second);
+    }
+    version = topologyVersion_;
+    return entries;
+}
+
+bool MasterHttpServer::loadTopology() {
+    std::map<std::string, std::string> snapshot;
+    int64_t revision = 0;
+    try {
+        for (const std::string prefix : {"/instances/", "/collections/"}) {
+            etcd::Response etcdResponse = etcdClient_.ls(prefix).get();
+            if (!etcdResponse.is_ok()) {
+                GlobalLogger->error("Error loading topology from etcd: {}", etcdResponse.error_message());
+                return false;
+            }
+            const auto& keys = etcdResponse.keys();
+            const auto& values = etcdResponse.values();
+            for (size_t i = 0; i < keys.size(); ++i) {
+                snapshot[keys[i]] = values[i].as_string();
+            }
+            revision = std::max(revision, etcdResponse.index());
+        }
+    } catch (const std::exception& e) {
+        GlobalLogger->error("Exception loading topology from etcd: {}", e.what());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(topologyMutex_);
+    topology_.swap(snapshot);
+    topologyVersion_ = std::max(topologyVersion_, revision);
+    topologyCv_.notify_all();
+    GlobalLogger->info("Topology loaded at revision {}", topologyVersion_);
+    return true;
+}
+
+void MasterHttpServer::applyWatchResponse(const etcd::Response& response) {
+    if (!response.is_ok()) {
+        GlobalLogger->error("etcd watch error: {}", response.error_message());
+        return;
+    }
+    std::lock_guard<std::mutex> lock(topologyMutex_);
+    for (const auto& event : response.events()) {
+        if (event.event_type() == etcd::Event::EventType::PUT) {
+            topology_[event.kv().key()] = event.kv().as_string();
+        } else if (event.event_type() == etcd::Event::EventType::DELETE_) {
+            topology_.erase(event.kv().key());
+        }
+    }
+    topologyVersion_ = std::max(topologyVersion_, response.index());
+    topologyCv_.notify_all();
+}
+
+void MasterHttpServer::watchLoop() {
+    while (running_) {
+        if (!loadTopology()) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+        int64_t fromIndex;
+        {
+            std::lock_guard<std::mutex> lock(topologyMutex_);
+            watchBroken_ = false;
+            fromIndex = topologyVersion_ + 1;
+        }
+        // 从全量加载之后的 revision 开始 watch，中间的变更不会丢失
+        std::vector<std::unique_ptr<etcd::Watcher>> watchers;
+        for (const std::string prefix : {"/instances/", "/collections/"}) {
+            watchers.emplace_back(new etcd::Watcher(etcdEndpoints_, prefix, fromIndex, [this](etcd::Response response) {
+                applyWatchResponse(response);
+            }, true));
+            watchers.back()->Wait([this](bool cancelled) {
+                // 由下面的 Cancel 主动取消时不用处理；watch 自己断开时重新全量加载
+                if (cancelled) {
+                    return;
+                }
+                std::lock_guard<std::mutex> lock(topologyMutex_);
+                watchBroken_ = true;
+                topologyCv_.notify_all();
+            });
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(topologyMutex_);
+            topologyCv_.wait(lock, [this] { return watchBroken_ || !running_; });
+        }
+        for (auto& watcher : watchers) {
+            watcher->Cancel();
+        }
+        watchers.clear();
+        if (running_) {
+            GlobalLogger->warn("etcd watch interrupted, reloading topology");
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
 }
\ No newline at end of file
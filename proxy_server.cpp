@@ -1,5 +1,6 @@
 #include "include/proxy_http_server.h"
 #include "include/logger.h"
+#include "include/tracing.h"
 
 std::map<std::string, std::string> readConfigFile(const std::string& filename) {
     std::ifstream file(filename);
@@ -33,16 +34,76 @@ int main(int argc, char* argv[]) {
     // 读取配置文件
     auto config = readConfigFile(config_file_path);
 
-    init_global_logger();
-    set_log_level(spdlog::level::debug);
+    init_global_logger(readLogOptions(config));
 
     std::string master_host = config["master_host"]; // Master Server 地址
     int master_port = std::stoi(config["master_port"]); // Master Server 端口
     std::string instance_id = config["instance_id"]; // 代理服务器所属的实例 ID
     int proxy_port = std::stoi(config["proxy_port"]); // 代理服务器监听端口
 
+    // 转发参数，配置文件中没有的项保留默认值
+    ProxyOptions options;
+    auto readInt = [&config](const std::string& key, int& value) {
+        auto it = config.find(key);
+        if (it != config.end() && !it->second.empty()) {
+            value = std::stoi(it->second);
+        }
+    };
+    readInt("pool_size", options.poolSize);
+    readInt("pool_idle_timeout_ms", options.poolIdleTimeoutMs);
+    readInt("connect_timeout_ms", options.connectTimeoutMs);
+    readInt("request_timeout_ms", options.requestTimeoutMs);
+    readInt("forward_threads", options.forwardThreads);
+    readInt("server_threads", options.serverThreads);
+    readInt("max_waiting_workers", options.maxWaitingWorkers);
+    auto readDouble = [&config](const std::string& key, double& value) {
+        auto it = config.find(key);
+        if (it != config.end() && !it->second.empty()) {
+            value = std::stod(it->second);
+        }
+    };
+    readDouble("ewma_alpha", options.ewmaAlpha);
+    readDouble("failure_penalty_ms", options.failurePenaltyMs);
+    int hedgeEnabled = options.hedgeEnabled ? 1 : 0;
+    readInt("hedge_enabled", hedgeEnabled);
+    options.hedgeEnabled = hedgeEnabled != 0;
+    readDouble("hedge_percentile", options.hedgePercentile);
+    readInt("hedge_min_delay_ms", options.hedgeMinDelayMs);
+    readInt("read_retries", options.readRetries);
+    readInt("topology_watch_timeout_ms", options.topologyWatchTimeoutMs);
+    readInt("health_check_interval_ms", options.healthCheckIntervalMs);
+    readInt("health_check_timeout_ms", options.healthCheckTimeoutMs);
+    readInt("eject_consecutive_failures", options.ejectConsecutiveFailures);
+    readInt("eject_base_ms", options.ejectBaseMs);
+    readInt("eject_max_ms", options.ejectMaxMs);
+    readDouble("outlier_latency_factor", options.outlierLatencyFactor);
+    readInt("max_eject_percent", options.maxEjectPercent);
+    readInt("search_cache_mb", options.searchCacheMb);
+    readInt("search_cache_ttl_ms", options.searchCacheTtlMs);
+    int searchSingleFlight = options.searchSingleFlight ? 1 : 0;
+    readInt("search_single_flight", searchSingleFlight);
+    options.searchSingleFlight = searchSingleFlight != 0;
+    options.collection = config["collection"];
+    if (!config["metric"].empty()) {
+        options.metric = config["metric"];
+    }
+    // 形如 route_timeout_ms./search=2000 的按路径超时
+    const std::string routeTimeoutPrefix = "route_timeout_ms.";
+    for (const auto& item : config) {
+        if (item.first.compare(0, routeTimeoutPrefix.size(), routeTimeoutPrefix) == 0 && !item.second.empty()) {
+            options.routeTimeoutsMs[item.first.substr(routeTimeoutPrefix.size())] = std::stoi(item.second);
+        }
+    }
+
+    // 请求追踪的采样率和保留条数，被采样的请求会把 trace id 传给后端
+    double traceSampleRate = 0.01;
+    int traceBufferSize = 256;
+    readDouble("trace_sample_rate", traceSampleRate);
+    readInt("trace_buffer_size", traceBufferSize);
+    Tracer::instance().configure(traceSampleRate, traceBufferSize);
+
     GlobalLogger->info("Starting ProxyServer...");
-    ProxyHttpServer proxy(master_host, master_port, instance_id);
+    ProxyHttpServer proxy(master_host, master_port, instance_id, options);
     GlobalLogger->info("Starting Proxy Server on port {}", proxy_port);
     proxy.start(proxy_port);
 
@@ -0,0 +1,197 @@
+#include "include/async_forwarder.h"
+#include "include/logger.h"
+#include <algorithm>
+
+AsyncForwarder::AsyncForwarder(long maxHostConnections) : multi_(curl_multi_init()), running_(true), nextId_(1), inflight_(0) {
+    // 加入 multi 的句柄改用 multi 自己的连接缓存，连接池的上限管不到这里，需要在 multi 上单独限制；
+    // 超出上限的转发在 multi 内部排队，直到有连接空出来
+    if (maxHostConnections > 0) {
+        curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS, maxHostConnections);
+    }
+    thread_ = std::thread(&AsyncForwarder::loop, this);
+}
+
+AsyncForwarder::~AsyncForwarder() {
+    running_ = false;
+    curl_multi_wakeup(multi_);
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    for (auto& entry : active_) {
+        curl_multi_remove_handle(multi_, entry.second->handle);
+        entry.second->pool->release(entry.second->handle, false);
+        abortTransfer(*entry.second);
+    }
+    active_.clear();
+    std::deque<std::unique_ptr<Transfer>> pending;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        pending.swap(pending_);
+    }
+    for (auto& transfer : pending) {
+        abortTransfer(*transfer);
+    }
+    curl_multi_cleanup(multi_);
+}
+
+void AsyncForwarder::abortTransfer(Transfer& transfer) {
+    ForwardResult result;
+    result.code = CURLE_ABORTED_BY_CALLBACK;
+    if (transfer.handle != nullptr) {
+        result.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - transfer.start).count();
+    }
+    transfer.done(std::move(result));
+}
+
+uint64_t AsyncForwarder::submit(const std::shared_ptr<ConnectionPool>& pool, const std::string& url, bool post, const std::string& body, int timeoutMs, ForwardCallback done,
+                               const std::vector<std::string>& headers) {
+    auto transfer = std::make_unique<Transfer>();
+    transfer->id = nextId_++;
+    transfer->pool = pool;
+    transfer->url = url;
+    transfer->post = post;
+    transfer->body = body;
+    for (const auto& header : headers) {
+        transfer->headers = curl_slist_append(transfer->headers, header.c_str());
+    }
+    transfer->timeoutMs = timeoutMs;
+    transfer->done = std::move(done);
+    uint64_t id = transfer->id;
+    {
+        // 在锁内判断，析构时取走队列之后不会再有转发被遗漏
+        std::unique_lock<std::mutex> lock(queueMutex_);
+        if (!running_) {
+            lock.unlock();
+            abortTransfer(*transfer);
+            return id;
+        }
+        inflight_++;
+        pending_.push_back(std::move(transfer));
+    }
+    curl_multi_wakeup(multi_);
+    return id;
+}
+
+void AsyncForwarder::cancel(uint64_t id) {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        cancelled_.push_back(id);
+    }
+    curl_multi_wakeup(multi_);
+}
+
+size_t AsyncForwarder::inflight() const {
+    return inflight_.load();
+}
+
+size_t AsyncForwarder::writeCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+    static_cast<std::string*>(userp)->append(static_cast<char*>(contents), size * nmemb);
+    return size * nmemb;
+}
+
+void AsyncForwarder::startTransfer(std::unique_ptr<Transfer> transfer) {
+    CURL* handle = transfer->pool->acquire();
+    if (handle == nullptr) {
+        inflight_--;
+        ForwardResult result;
+        result.code = CURLE_COULDNT_CONNECT;
+        transfer->done(std::move(result));
+        return;
+    }
+    transfer->handle = handle;
+    transfer->start = std::chrono::steady_clock::now();
+    curl_easy_setopt(handle, CURLOPT_URL, transfer->url.c_str());
+    if (transfer->post) {
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDS, transfer->body.c_str());
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, static_cast<long>(transfer->body.size()));
+    } else {
+        curl_easy_setopt(handle, CURLOPT_HTTPGET, 1L);
+    }
+    if (transfer->headers != nullptr) {
+        curl_easy_setopt(handle, CURLOPT_HTTPHEADER, transfer->headers);
+    }
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, static_cast<long>(transfer->timeoutMs));
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writeCallback);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &transfer->response);
+    curl_easy_setopt(handle, CURLOPT_PRIVATE, reinterpret_cast<void*>(static_cast<uintptr_t>(transfer->id)));
+    curl_multi_add_handle(multi_, handle);
+    active_[transfer->id] = std::move(transfer);
+}
+
+void AsyncForwarder::finishTransfer(CURL* handle, CURLcode code) {
+    void* priv = nullptr;
+    curl_easy_getinfo(handle, CURLINFO_PRIVATE, &priv);
+    uint64_t id = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(priv));
+    curl_multi_remove_handle(multi_, handle);
+
+    auto it = active_.find(id);
+    if (it == active_.end()) {
+        curl_easy_cleanup(handle);
+        return;
+    }
+    std::unique_ptr<Transfer> transfer = std::move(it->second);
+    active_.erase(it);
+    inflight_--;
+
+    ForwardResult result;
+    result.code = code;
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &result.status);
+    result.body = std::move(transfer->response);
+    result.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - transfer->start).count();
+    transfer->pool->release(handle, code == CURLE_OK);
+    transfer->done(std::move(result));
+}
+
+void AsyncForwarder::loop() {
+    while (running_) {
+        std::deque<std::unique_ptr<Transfer>> pending;
+        std::vector<uint64_t> cancelled;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            pending.swap(pending_);
+            cancelled.swap(cancelled_);
+        }
+        for (uint64_t id : cancelled) {
+            auto it = std::find_if(pending.begin(), pending.end(), [id](const std::unique_ptr<Transfer>& transfer) {
+                return transfer->id == id;
+            });
+            std::unique_ptr<Transfer> transfer;
+            if (it != pending.end()) {
+                transfer = std::move(*it);
+                pending.erase(it);
+            } else {
+                auto active = active_.find(id);
+                if (active == active_.end()) {
+                    continue;
+                }
+                transfer = std::move(active->second);
+                active_.erase(active);
+                // 传输到一半的连接状态未知，不再放回连接池
+                curl_multi_remove_handle(multi_, transfer->handle);
+                transfer->pool->release(transfer->handle, false);
+            }
+            inflight_--;
+            abortTransfer(*transfer);
+        }
+        for (auto& transfer : pending) {
+            startTransfer(std::move(transfer));
+        }
+
+        int running_handles = 0;
+        curl_multi_perform(multi_, &running_handles);
+
+        int msgs_left = 0;
+        CURLMsg* msg = nullptr;
+        while ((msg = curl_multi_info_read(multi_, &msgs_left)) != nullptr) {
+            if (msg->msg == CURLMSG_DONE) {
+                finishTransfer(msg->easy_handle, msg->data.result);
+            }
+        }
+
+        // 内部使用 poll 等待所有连接上的事件，提交和取消通过 curl_multi_wakeup 唤醒
+        CURLMcode mc = curl_multi_poll(multi_, nullptr, 0, 1000, nullptr);
+        if (mc != CURLM_OK) {
+            GlobalLogger->error("curl_multi_poll() failed: {}", curl_multi_strerror(mc));
+        }
+    }
+}
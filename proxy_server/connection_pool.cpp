@@ -0,0 +1,87 @@
+#include "include/connection_pool.h"
+#include "include/logger.h"
+#include <algorithm>
+
+ConnectionPool::ConnectionPool(const std::string& baseUrl, size_t maxIdle, int idleTimeoutMs, int connectTimeoutMs)
+: baseUrl_(baseUrl), maxIdle_(maxIdle), idleTimeout_(idleTimeoutMs), connectTimeoutMs_(connectTimeoutMs) {}
+
+ConnectionPool::~ConnectionPool() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& idle : idle_) {
+        curl_easy_cleanup(idle.handle);
+    }
+    idle_.clear();
+}
+
+CURL* ConnectionPool::createHandle() {
+    CURL* handle = curl_easy_init();
+    if (handle == nullptr) {
+        GlobalLogger->error("curl_easy_init() failed for {}", baseUrl_);
+    }
+    return handle;
+}
+
+void ConnectionPool::configure(CURL* handle) {
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_NODELAY, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE, 120L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPINTVL, 60L);
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(connectTimeoutMs_));
+    // 连接在 curl 自己的缓存中空闲过久也不再复用，和池的空闲超时保持一致
+    curl_easy_setopt(handle, CURLOPT_MAXAGE_CONN, static_cast<long>(std::max<long>(idleTimeout_.count() / 1000, 1)));
+}
+
+CURL* ConnectionPool::acquire() {
+    CURL* handle = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        evictExpired();
+        if (!idle_.empty()) {
+            handle = idle_.back().handle;
+            idle_.pop_back();
+        }
+    }
+    if (handle == nullptr) {
+        handle = createHandle();
+        if (handle == nullptr) {
+            return nullptr;
+        }
+    }
+    configure(handle);
+    return handle;
+}
+
+void ConnectionPool::release(CURL* handle, bool healthy) {
+    if (handle == nullptr) {
+        return;
+    }
+    if (!healthy) {
+        curl_easy_cleanup(handle);
+        return;
+    }
+    // reset 只清除选项，句柄缓存的连接保留下来
+    curl_easy_reset(handle);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    evictExpired();
+    if (idle_.size() >= maxIdle_) {
+        curl_easy_cleanup(handle);
+        return;
+    }
+    idle_.push_back({handle, std::chrono::steady_clock::now()});
+}
+
+size_t ConnectionPool::idleCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return idle_.size();
+}
+
+void ConnectionPool::evictExpired() {
+    auto now = std::chrono::steady_clock::now();
+    // 队首是最久未使用的句柄
+    while (!idle_.empty() && now - idle_.front().lastUsed > idleTimeout_) {
+        curl_easy_cleanup(idle_.front().handle);
+        idle_.pop_front();
+    }
+}
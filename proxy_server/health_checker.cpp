@@ -0,0 +1,143 @@
+#include "include/health_checker.h"
+#include "include/logger.h"
+#include <algorithm>
+#include <set>
+
+namespace {
+// 响应时间低于该值的节点不按离群处理，避免毫秒级抖动触发摘除
+const double kMinOutlierMs = 50;
+}
+
+HealthChecker::HealthChecker(int consecutiveFailures, int baseEjectMs, int maxEjectMs, double latencyFactor, int maxEjectPercent)
+: consecutiveFailures_(std::max(consecutiveFailures, 1)), baseEjectMs_(baseEjectMs), maxEjectMs_(std::max(maxEjectMs, baseEjectMs)),
+  latencyFactor_(latencyFactor), maxEjectPercent_(maxEjectPercent) {}
+
+const char* HealthChecker::stateName(NodeHealth::State state) {
+    switch (state) {
+        case NodeHealth::State::CLOSED:
+            return "closed";
+        case NodeHealth::State::OPEN:
+            return "open";
+        case NodeHealth::State::HALF_OPEN:
+            return "half_open";
+    }
+    return "unknown";
+}
+
+bool HealthChecker::available(const std::string& url) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    NodeHealth& health = nodes_[url];
+    if (health.state == NodeHealth::State::OPEN && std::chrono::steady_clock::now() >= health.openUntil) {
+        health.state = NodeHealth::State::HALF_OPEN;
+        health.trialInflight = false;
+        GlobalLogger->info("Backend {} half-open after ejection", url);
+    }
+    switch (health.state) {
+        case NodeHealth::State::CLOSED:
+            return true;
+        case NodeHealth::State::HALF_OPEN:
+            return !health.trialInflight;
+        default:
+            return false;
+    }
+}
+
+void HealthChecker::onStart(const std::string& url) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    NodeHealth& health = nodes_[url];
+    if (health.state == NodeHealth::State::HALF_OPEN) {
+        health.trialInflight = true;
+    }
+}
+
+bool HealthChecker::onResult(const std::string& url, bool success) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    NodeHealth& health = nodes_[url];
+    if (success) {
+        health.consecutiveFailures = 0;
+        if (health.state == NodeHealth::State::HALF_OPEN) {
+            health.state = NodeHealth::State::CLOSED;
+            health.trialInflight = false;
+            health.ejections = 0;
+            GlobalLogger->info("Backend {} recovered", url);
+            return true;
+        }
+        return false;
+    }
+    health.consecutiveFailures++;
+    if (health.state == NodeHealth::State::HALF_OPEN) {
+        eject(url, health, "trial request failed");
+    } else if (health.state == NodeHealth::State::CLOSED && health.consecutiveFailures >= consecutiveFailures_) {
+        eject(url, health, std::to_string(health.consecutiveFailures) + " consecutive failures");
+    }
+    return false;
+}
+
+void HealthChecker::onCancel(const std::string& url) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    NodeHealth& health = nodes_[url];
+    if (health.state == NodeHealth::State::HALF_OPEN) {
+        health.trialInflight = false;
+    }
+}
+
+void HealthChecker::eject(const std::string& url, NodeHealth& health, const std::string& reason) {
+    // 半开的节点本来就不在服务中，重新摘除不受比例限制
+    if (health.state == NodeHealth::State::CLOSED) {
+        size_t ejected = 0;
+        for (const auto& item : nodes_) {
+            if (item.second.state != NodeHealth::State::CLOSED) {
+                ejected++;
+            }
+        }
+        if ((ejected + 1) * 100 > nodes_.size() * static_cast<size_t>(maxEjectPercent_)) {
+            GlobalLogger->warn("Backend {} not ejected ({}): ejection limit reached", url, reason);
+            return;
+        }
+    }
+    // 连续被摘除的节点摘除时长翻倍
+    long long ejectMs = std::min<long long>(static_cast<long long>(baseEjectMs_) << std::min(health.ejections, 16), maxEjectMs_);
+    health.state = NodeHealth::State::OPEN;
+    health.trialInflight = false;
+    health.ejections++;
+    health.openUntil = std::chrono::steady_clock::now() + std::chrono::milliseconds(ejectMs);
+    health.reason = reason;
+    GlobalLogger->warn("Backend {} ejected for {} ms: {}", url, ejectMs, reason);
+}
+
+void HealthChecker::ejectSlowOutliers(const std::map<std::string, double>& ewmaMs) {
+    if (ewmaMs.size() < 3 || latencyFactor_ <= 0) {
+        return;
+    }
+    std::vector<double> latencies;
+    for (const auto& item : ewmaMs) {
+        latencies.push_back(item.second);
+    }
+    std::nth_element(latencies.begin(), latencies.begin() + latencies.size() / 2, latencies.end());
+    double threshold = std::max(latencies[latencies.size() / 2] * latencyFactor_, kMinOutlierMs);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& item : ewmaMs) {
+        NodeHealth& health = nodes_[item.first];
+        if (health.state == NodeHealth::State::CLOSED && item.second > threshold) {
+            eject(item.first, health, "latency " + std::to_string(static_cast<int>(item.second)) + " ms above " + std::to_string(static_cast<int>(threshold)) + " ms");
+        }
+    }
+}
+
+NodeHealth HealthChecker::snapshot(const std::string& url) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return nodes_[url];
+}
+
+void HealthChecker::prune(const std::vector<std::string>& urls) {
+    std::set<std::string> alive(urls.begin(), urls.end());
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = nodes_.begin(); it != nodes_.end();) {
+        if (alive.find(it->first) == alive.end()) {
+            it = nodes_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,120 @@
+#include "include/load_balancer.h"
+#include <algorithm>
+#include <set>
+
+LoadBalancer::LoadBalancer(double alpha, double failurePenaltyMs)
+: alpha_(std::min(std::max(alpha, 0.01), 1.0)), failurePenaltyMs_(failurePenaltyMs), rng_(std::random_device{}()) {}
+
+std::shared_ptr<NodeStats> LoadBalancer::stats(const std::string& url) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = stats_[url];
+    if (!entry) {
+        entry = std::make_shared<NodeStats>();
+    }
+    return entry;
+}
+
+double LoadBalancer::cost(const NodeStats& stats, double priorMs) const {
+    double latency = stats.sampled.load() ? stats.ewmaMs.load() : priorMs;
+    return latency * (stats.inflight.load() + 1);
+}
+
+size_t LoadBalancer::pick(const std::vector<std::string>& candidates) {
+    if (candidates.size() == 1) {
+        return 0;
+    }
+    size_t first;
+    size_t second;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::uniform_int_distribution<size_t> dist(0, candidates.size() - 1);
+        first = dist(rng_);
+        second = dist(rng_);
+        while (second == first) {
+            second = dist(rng_);
+        }
+    }
+    std::vector<std::shared_ptr<NodeStats>> all;
+    std::vector<double> sampled;
+    for (const auto& url : candidates) {
+        all.push_back(stats(url));
+        if (all.back()->sampled.load()) {
+            sampled.push_back(all.back()->ewmaMs.load());
+        }
+    }
+    // 还没有样本的节点（新上线或刚从熔断恢复）按候选节点响应时间的中位数估计，
+    // 仍乘以在途请求数，不会因为代价为 0 吸走所有流量
+    double priorMs = 1.0;
+    if (!sampled.empty()) {
+        std::nth_element(sampled.begin(), sampled.begin() + sampled.size() / 2, sampled.end());
+        priorMs = std::max(sampled[sampled.size() / 2], priorMs);
+    }
+    double firstCost = cost(*all[first], priorMs);
+    double secondCost = cost(*all[second], priorMs);
+    if (firstCost != secondCost) {
+        return firstCost < secondCost ? first : second;
+    }
+    // 代价相同时选在途请求少的，两个候选本身是随机抽的，再相同时取哪个都不偏向固定节点
+    return all[first]->inflight.load() <= all[second]->inflight.load() ? first : second;
+}
+
+void LoadBalancer::onStart(NodeStats& stats) {
+    stats.inflight++;
+}
+
+void LoadBalancer::onFinish(NodeStats& stats, double elapsedMs, bool success) {
+    stats.inflight--;
+    double sample = success ? elapsedMs : std::max(elapsedMs, failurePenaltyMs_);
+    if (!stats.sampled.exchange(true)) {
+        stats.ewmaMs.store(sample);
+        return;
+    }
+    double current = stats.ewmaMs.load();
+    while (!stats.ewmaMs.compare_exchange_weak(current, current + alpha_ * (sample - current))) {
+    }
+}
+
+void LoadBalancer::onCancel(NodeStats& stats) {
+    stats.inflight--;
+}
+
+void LoadBalancer::prune(const std::vector<std::string>& urls) {
+    std::set<std::string> alive(urls.begin(), urls.end());
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = stats_.begin(); it != stats_.end();) {
+        if (alive.find(it->first) == alive.end()) {
+            it = stats_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+
+LatencyWindow::LatencyWindow(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)), next_(0) {
+    samples_.reserve(capacity_);
+}
+
+void LatencyWindow::add(double ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (samples_.size() < capacity_) {
+        samples_.push_back(ms);
+    } else {
+        samples_[next_] = ms;
+        next_ = (next_ + 1) % capacity_;
+    }
+}
+
+double LatencyWindow::percentile(double p, size_t minSamples) {
+    std::vector<double> samples;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (samples_.size() < minSamples || samples_.empty()) {
+            return -1;
+        }
+        samples = samples_;
+    }
+    size_t rank = std::min(samples.size() - 1, static_cast<size_t>(p / 100.0 * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+}
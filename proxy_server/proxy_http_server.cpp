@@ -1,26 +1,70 @@
 #include "include/proxy_http_server.h"
 #include "include/logger.h"
+#include "include/constant.h"
+#include "include/metrics.h"
+#include "include/tracing.h"
 #include "rapidjson/document.h"
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
 #include <iostream>
 #include <sstream>
 #include <chrono>
+#include <condition_variable>
+#include <queue>
 
-ProxyHttpServer::ProxyHttpServer(const std::string& masterServerHost, int masterServerPort, const std::string& instanceId)
-: masterServerHost_(masterServerHost), masterServerPort_(masterServerPort), instanceId_(instanceId), curlHandle_(nullptr), activeNodesIndex_(0) , nextNodeIndex_(0), running_(true) {
+ProxyHttpServer::ProxyHttpServer(const std::string& masterServerHost, int masterServerPort, const std::string& instanceId, const ProxyOptions& options)
+: masterServerHost_(masterServerHost), masterServerPort_(masterServerPort), instanceId_(instanceId), options_(options), curlHandle_(nullptr), shards_(std::make_shared<const std::vector<ShardInfo>>()), running_(true), nextForwarder_(0), waitingWorkers_(0), balancer_(options.ewmaAlpha, options.failurePenaltyMs),
+  health_(options.ejectConsecutiveFailures, options.ejectBaseMs, options.ejectMaxMs, options.outlierLatencyFactor, options.maxEjectPercent),
+  searchCache_(static_cast<size_t>(std::max(options.searchCacheMb, 0)) << 20, [](const CachedResponse& response) { return response.body.size(); }),
+  writeVersion_(0) {
     initCurl();
+    // 到每个后端的连接总数不超过连接池大小，平均分给各个事件循环
+    int forwardThreads = std::max(options_.forwardThreads, 1);
+    long maxHostConnections = (std::max(options_.poolSize, 1) + forwardThreads - 1) / forwardThreads;
+    for (int i = 0; i < forwardThreads; i++) {
+        forwarders_.emplace_back(new AsyncForwarder(maxHostConnections));
+    }
+    int serverThreads = std::max(options_.serverThreads, 1);
+    httpServer_.new_task_queue = [serverThreads] { return new httplib::ThreadPool(serverThreads); };
     setupForwarding();
-    startNodeUpdateTimer(); // 启动节点更新定时器
     follower_request = {"/search", "/query", "/listNode"};
     leader_request = {"/insert", "/insert_batch", "/snapshot", "/addFollower"};
     index_cannot = {"/query"};
     storage_cannot = {"/search", "/snapshot"};
+    for (const auto& path : follower_request) {
+        readLatency_[path].reset(new LatencyWindow());
+    }
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    for (const auto& paths : {follower_request, leader_request}) {
+        for (const auto& path : paths) {
+            backendLatency_[path] = &metrics.histogram("proxy_backend_request_seconds", "Latency of requests forwarded to backends", "endpoint=\"" + path + "\"");
+        }
+    }
+    hedges_ = &metrics.counter("proxy_hedged_requests_total", "Reads hedged to a second replica");
+    retries_ = &metrics.counter("proxy_retried_requests_total", "Reads retried after a connection failure");
+    cacheHits_ = &metrics.counter("proxy_search_cache_hits_total", "Searches answered from the proxy cache");
+    flightsShared_ = &metrics.counter("proxy_search_single_flight_shared_total", "Searches answered by an identical in-flight search");
+    rejected_ = &metrics.counter("proxy_rejected_requests_total", "Requests rejected because too many workers were waiting on backends");
+    metrics.gauge("proxy_inflight_forwards", "Forwards submitted and not yet finished", "", [this] {
+        size_t inflight = 0;
+        for (const auto& forwarder : forwarders_) {
+            inflight += forwarder->inflight();
+        }
+        return static_cast<double>(inflight);
+    });
 }
 
 
 ProxyHttpServer::~ProxyHttpServer() {
-    running_ = false; // 停止定时器循环
+    {
+        std::lock_guard<std::mutex> lock(healthMutex_);
+        running_ = false; // 停止拓扑订阅循环和探测循环
+    }
+    healthCv_.notify_all();
+    // 探测线程会用到转发线程和连接池，先等它退出再释放
+    if (healthThread_.joinable()) {
+        healthThread_.join();
+    }
     cleanupCurl();
 }
 
@@ -38,146 +82,693 @@ void ProxyHttpServer::cleanupCurl() {
     if (curlHandle_) {
         curl_easy_cleanup(curlHandle_);
     }
+    forwarders_.clear();
+    {
+        std::lock_guard<std::mutex> lock(poolsMutex_);
+        pools_.clear();
+    }
     curl_global_cleanup();
 }
 
+std::shared_ptr<ConnectionPool> ProxyHttpServer::getPool(const std::string& url) {
+    std::lock_guard<std::mutex> lock(poolsMutex_);
+    auto it = pools_.find(url);
+    if (it != pools_.end()) {
+        return it->second;
+    }
+    auto pool = std::make_shared<ConnectionPool>(url, options_.poolSize, options_.poolIdleTimeoutMs, options_.connectTimeoutMs);
+    pools_[url] = pool;
+    return pool;
+}
+
+int ProxyHttpServer::routeTimeoutMs(const std::string& path) const {
+    auto it = options_.routeTimeoutsMs.find(path);
+    return it != options_.routeTimeoutsMs.end() ? it->second : options_.requestTimeoutMs;
+}
+
+std::vector<NodeInfo> ProxyHttpServer::eligibleNodes(const ShardInfo& shard, const std::string& path) {
+    bool leaderOnly = leader_request.find(path) != leader_request.end();
+    bool notIndex = index_cannot.find(path) != index_cannot.end();
+    bool notStorage = storage_cannot.find(path) != storage_cannot.end();
+    std::vector<NodeInfo> eligible;
+    for (const auto& node : shard.nodes) {
+        if ((leaderOnly && node.role != 0) || (notIndex && node.type == 1) || (notStorage && node.type == 2)) {
+            continue;
+        }
+        eligible.push_back(node);
+    }
+    // 去掉被熔断的节点；全部被熔断时仍然尝试所有节点，不直接拒绝请求
+    std::vector<NodeInfo> healthy;
+    for (const auto& node : eligible) {
+        if (health_.available(node.url)) {
+            healthy.push_back(node);
+        }
+    }
+    return healthy.empty() ? eligible : healthy;
+}
+
+namespace {
+
+// proxy 对外的路径与 vdb_server 的路由不一致时，换成后端的路径
+std::string backendPath(const std::string& path) {
+    if (path == "/insert_batch") {
+        return "/insertBatch";
+    }
+    return path;
+}
+
+} // namespace
+
+std::pair<AsyncForwarder*, uint64_t> ProxyHttpServer::submitTo(const NodeInfo& node, const std::string& path, bool post, const std::string& body, ForwardCallback done) {
+    AsyncForwarder* forwarder = forwarders_[nextForwarder_++ % forwarders_.size()].get();
+    // 统计节点的在途请求数和响应时间，供负载均衡使用
+    std::shared_ptr<NodeStats> stats = balancer_.stats(node.url);
+    balancer_.onStart(*stats);
+    health_.onStart(node.url);
+    std::string url = node.url;
+    auto latency = backendLatency_.find(path);
+    Histogram* histogram = latency != backendLatency_.end() ? latency->second : nullptr;
+    // 被采样的请求把 trace id 带给后端，后端的阶段耗时可以按同一个 id 查到
+    std::shared_ptr<Trace> trace = currentTrace();
+    uint16_t depth = traceDepth();
+    auto start = std::chrono::steady_clock::now();
+    uint64_t id = forwarder->submit(getPool(node.url), node.url + backendPath(path), post, body, routeTimeoutMs(path), [this, stats, url, histogram, done, trace, depth, start](ForwardResult&& result) {
+        if (trace) {
+            trace->addSpan(result.code == CURLE_ABORTED_BY_CALLBACK ? "backend.cancelled" : "backend", start, depth, url);
+        }
+        if (result.code == CURLE_ABORTED_BY_CALLBACK) {
+            balancer_.onCancel(*stats);
+            health_.onCancel(url);
+        } else {
+            if (histogram != nullptr) {
+                histogram->record(result.elapsedMs / 1000.0);
+            }
+            bool success = result.code == CURLE_OK && result.status < 500;
+            balancer_.onFinish(*stats, result.elapsedMs, success);
+            if (health_.onResult(url, success)) {
+                // 恢复的节点重新积累响应时间，避免摘除前的旧值再次触发离群摘除
+                stats->sampled = false;
+            }
+        }
+        done(std::move(result));
+    }, traceHeaders());
+    return {forwarder, id};
+}
+
+int ProxyHttpServer::hedgeDelayMs(const std::string& path) {
+    auto it = readLatency_.find(path);
+    if (!options_.hedgeEnabled || it == readLatency_.end()) {
+        return -1;
+    }
+    // 样本不足时不对冲，避免刚启动时把读流量翻倍
+    double delay = it->second->percentile(options_.hedgePercentile);
+    if (delay < 0) {
+        return -1;
+    }
+    return std::max(static_cast<int>(delay), options_.hedgeMinDelayMs);
+}
+
+namespace {
+
+// 连接没有建立或请求没有被后端完整处理，读请求换节点重试是安全的
+bool isConnectionFailure(CURLcode code) {
+    return code == CURLE_COULDNT_CONNECT || code == CURLE_COULDNT_RESOLVE_HOST || code == CURLE_SEND_ERROR
+        || code == CURLE_RECV_ERROR || code == CURLE_GOT_NOTHING;
+}
+
+// 一个分片上的所有在途转发。候选节点和 tried 只由发起转发的线程访问，其余字段由 mutex 保护
+struct ShardForward {
+    std::vector<NodeInfo> candidates;
+    std::vector<bool> tried;
+    int outstanding = 0;
+    bool done = false;      // 已经有转发成功
+    bool finished = false;  // 成功，或者失败且不再重试
+    bool hedged = false;
+    int retries = 0;
+    ForwardResult result;   // 成功的结果，或者最近一次失败的结果
+};
+
+// 一次 fanOut 的共享状态，转发的回调在事件循环线程上更新它
+struct PendingForwards {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<ShardForward> shards;
+};
+
+} // namespace
+
+std::vector<ForwardResult> ProxyHttpServer::fanOut(const std::vector<const ShardInfo*>& targets, const std::string& path, bool post, const std::vector<std::string>& bodies) {
+    // 所有分片的转发都交给事件循环，调用方线程只负责等待、对冲和重试
+    bool read = follower_request.find(path) != follower_request.end();
+    auto state = std::make_shared<PendingForwards>();
+    state->shards.resize(targets.size());
+    std::vector<std::pair<AsyncForwarder*, uint64_t>> submitted;
+
+    // 在分片还没发过的节点中按负载均衡策略挑一个
+    auto pickUntried = [&](size_t i) -> int {
+        const ShardForward& shard = state->shards[i];
+        std::vector<std::string> urls;
+        std::vector<int> indices;
+        for (size_t j = 0; j < shard.candidates.size(); j++) {
+            if (!shard.tried[j]) {
+                urls.push_back(shard.candidates[j].url);
+                indices.push_back(j);
+            }
+        }
+        return urls.empty() ? -1 : indices[balancer_.pick(urls)];
+    };
+    auto launch = [&](size_t i, int index) {
+        ShardForward& shard = state->shards[i];
+        shard.tried[index] = true;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            shard.outstanding++;
+        }
+        LOG_DEBUG("Forwarding request to: {}", shard.candidates[index].url + path);
+        submitted.push_back(submitTo(shard.candidates[index], path, post, bodies[i], [state, i](ForwardResult&& result) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            ShardForward& shard = state->shards[i];
+            shard.outstanding--;
+            if (!shard.done && result.code != CURLE_ABORTED_BY_CALLBACK) {
+                shard.done = result.code == CURLE_OK && result.status < 500;
+                shard.result = std::move(result);
+            }
+            state->cv.notify_all();
+        }));
+    };
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        ShardForward& shard = state->shards[i];
+        shard.candidates = eligibleNodes(*targets[i], path);
+        shard.tried.assign(shard.candidates.size(), false);
+        if (shard.candidates.empty()) {
+            GlobalLogger->error("No available nodes in {} for forwarding {}", targets[i]->instanceId, path);
+            shard.result.status = 503;
+            shard.finished = true;
+            continue;
+        }
+        launch(i, pickUntried(i));
+    }
+
+    // 只有读请求是幂等的，可以对冲和重试
+    int delayMs = read ? hedgeDelayMs(path) : -1;
+    auto hedgeAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(delayMs, 0));
+    int maxRetries = read ? options_.readRetries : 0;
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (true) {
+        bool allFinished = true;
+        bool waitHedge = false;
+        for (size_t i = 0; i < state->shards.size(); i++) {
+            ShardForward& shard = state->shards[i];
+            if (shard.finished) {
+                continue;
+            }
+            if (shard.done) {
+                shard.finished = true;
+                continue;
+            }
+            if (shard.outstanding == 0) {
+                // 该分片的转发都失败了，连接层面的失败换一个节点重试
+                int index = -1;
+                if (shard.retries < maxRetries && isConnectionFailure(shard.result.code)) {
+                    index = pickUntried(i);
+                }
+                if (index < 0) {
+                    shard.finished = true;
+                    continue;
+                }
+                shard.retries++;
+                retries_->add();
+                GlobalLogger->warn("Retrying {} after {}", path, curl_easy_strerror(shard.result.code));
+                lock.unlock();
+                launch(i, index);
+                lock.lock();
+            }
+            allFinished = false;
+            waitHedge = waitHedge || (delayMs >= 0 && !shard.hedged);
+        }
+        if (allFinished) {
+            break;
+        }
+        if (!waitHedge) {
+            state->cv.wait(lock);
+            continue;
+        }
+        if (state->cv.wait_until(lock, hedgeAt) != std::cv_status::timeout) {
+            continue;
+        }
+        // 超过对冲延迟仍未返回的分片，各向另一个副本再发一份
+        for (size_t i = 0; i < state->shards.size(); i++) {
+            ShardForward& shard = state->shards[i];
+            if (shard.hedged || shard.finished || shard.done || shard.outstanding == 0) {
+                continue;
+            }
+            shard.hedged = true;
+            int index = pickUntried(i);
+            if (index >= 0) {
+                GlobalLogger->info("Hedging {} after {} ms", path, delayMs);
+                hedges_->add();
+                lock.unlock();
+                launch(i, index);
+                lock.lock();
+            }
+        }
+    }
+    std::vector<ForwardResult> results;
+    for (const auto& shard : state->shards) {
+        results.push_back(shard.result);
+    }
+    lock.unlock();
+
+    // 取消还没有返回的转发，已经完成的取消不会有任何效果
+    for (const auto& item : submitted) {
+        item.first->cancel(item.second);
+    }
+    if (read) {
+        for (const auto& result : results) {
+            if (result.code == CURLE_OK && result.status < 500) {
+                readLatency_[path]->add(result.elapsedMs);
+            }
+        }
+    }
+    return results;
+}
+
+void ProxyHttpServer::prunePools(const std::vector<NodeInfo>& nodes) {
+    std::set<std::string> urls;
+    for (const auto& node : nodes) {
+        urls.insert(node.url);
+    }
+    // 已经下线的节点，连同其空闲连接一起释放；正在使用中的池由 shared_ptr 延后释放
+    std::lock_guard<std::mutex> lock(poolsMutex_);
+    for (auto it = pools_.begin(); it != pools_.end();) {
+        if (urls.find(it->first) == urls.end()) {
+            it = pools_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 void ProxyHttpServer::start(int port) {
     fetchAndUpdateNodes(); // 获取节点信息
+    startNodeUpdateTimer(); // 订阅之后的拓扑变化
+    startHealthChecks();
     GlobalLogger->info("Proxy server created");
     httpServer_.listen("0.0.0.0", port);
 }
 
 void ProxyHttpServer::setupForwarding() {
     httpServer_.Post("/search", [this](const httplib::Request& req, httplib::Response& res) {
-        GlobalLogger->info("Forwarding POST /search");
+        LOG_DEBUG("Forwarding POST /search");
         forwardRequest(req, res, "/search");
     });
     httpServer_.Post("/insert", [this](const httplib::Request& req, httplib::Response& res) {
-        GlobalLogger->info("Forwarding POST /insert");
+        LOG_DEBUG("Forwarding POST /insert");
         forwardRequest(req, res, "/insert");
     });
     httpServer_.Post("/insert_batch", [this](const httplib::Request& req, httplib::Response& res) {
-        GlobalLogger->info("Forwarding POST /insert_batch");
+        LOG_DEBUG("Forwarding POST /insert_batch");
         forwardRequest(req, res, "/insert_batch");
     });
     httpServer_.Post("/query", [this](const httplib::Request& req, httplib::Response& res) {
-        GlobalLogger->info("Forwarding POST /query");
+        LOG_DEBUG("Forwarding POST /query");
         forwardRequest(req, res, "/query");
     });
     httpServer_.Post("/snapshot", [this](const httplib::Request& req, httplib::Response& res) {
-        GlobalLogger->info("Forwarding POST /snapshot");
+        LOG_DEBUG("Forwarding POST /snapshot");
         forwardRequest(req, res, "/snapshot");
     });
     httpServer_.Post("/addFollower", [this](const httplib::Request& req, httplib::Response& res) {
-        GlobalLogger->info("Forwarding POST /addFollower");
+        LOG_DEBUG("Forwarding POST /addFollower");
         forwardRequest(req, res, "/addFollower");
     });
     httpServer_.Get("/listNode", [this](const httplib::Request& req, httplib::Response& res) {
-        GlobalLogger->info("Forwarding GET /listNode");
+        LOG_DEBUG("Forwarding GET /listNode");
         forwardRequest(req, res, "/listNode");
     });
     httpServer_.Get("/topology", [this](const httplib::Request&, httplib::Response& res) {
         this->handleTopologyRequest(res);
     });
+    instrumentHttpServer(httpServer_, "proxy", {"/search", "/insert", "/insert_batch", "/query", "/snapshot", "/addFollower", "/listNode", "/topology"});
 }
 
-void ProxyHttpServer::forwardRequest(const httplib::Request& req, httplib::Response& res, const std::string& path) {
-    auto start = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-    int activeIndex = activeNodesIndex_.load(); // 读取当前活动的数组索引
-    if (nodes_[activeIndex].empty()) {
-        GlobalLogger->error("No available nodes for forwarding");
-        res.status = 503;
-        res.set_content("Service Unavailable", "text/plain");
-        return;
+namespace {
+
+// 按 id 的哈希选分片，各个 proxy 必须得到相同的结果
+size_t shardOf(int64_t id, size_t shardCount) {
+    uint64_t x = static_cast<uint64_t>(id);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x % shardCount;
+}
+
+std::string toJsonString(const rapidjson::Value& value) {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    value.Accept(writer);
+    return buffer.GetString();
+}
+
+// 转发失败，或后端返回了错误码
+bool isFailedResult(const ForwardResult& result, rapidjson::Document& doc) {
+    if (result.code != CURLE_OK || result.status >= 500 || result.body.empty()) {
+        return true;
     }
+    doc.Parse(result.body.c_str());
+    return !doc.IsObject() || !doc.HasMember(RESPONSE_RETCODE) || !doc[RESPONSE_RETCODE].IsInt() || doc[RESPONSE_RETCODE].GetInt() != RESPONSE_RETCODE_SUCCESS;
+}
 
-    size_t nodeIndex = nextNodeIndex_.load() % nodes_[activeIndex].size();;
+// 由 proxy 自己拒绝的请求
+ForwardResult badRequest(const std::string& message) {
+    rapidjson::Document doc;
+    doc.SetObject();
+    rapidjson::Document::AllocatorType& allocator = doc.GetAllocator();
+    doc.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_ERROR, allocator);
+    doc.AddMember(RESPONSE_ERROR_MSG, rapidjson::Value(message.c_str(), allocator), allocator);
+    ForwardResult result;
+    result.status = 400;
+    result.body = toJsonString(doc);
+    return result;
+}
 
-    // 检查是否需要强制路由到主节点
-    if (leader_request.find(path) != leader_request.end()) {
-        if (index_cannot.find(path) != index_cannot.end()) {
-            for (size_t i = nodeIndex; ; i = (i + 1) % nodes_[activeIndex].size()) {
-                if (nodes_[activeIndex][i].role == 0 && nodes_[activeIndex][i].type != 1) {
-                    nodeIndex = i;
-                    break;
-                }
-            }
-        } else if (storage_cannot.find(path) != storage_cannot.end()) {
-            for (size_t i = nodeIndex; ; i = (i + 1) % nodes_[activeIndex].size()) {
-                if (nodes_[activeIndex][i].role == 0 && nodes_[activeIndex][i].type != 2) {
-                    nodeIndex = i;
-                    break;
-                }
-            }
-        } else {
-            for (size_t i = nodeIndex; ; i = (i + 1) % nodes_[activeIndex].size()) {
-                if (nodes_[activeIndex][i].role == 0) {
-                    nodeIndex = i;
-                    break;
-                }
-            }
+bool hasInt64Id(const rapidjson::Value& object) {
+    return object.IsObject() && object.HasMember(REQUEST_ID) && object[REQUEST_ID].IsInt64();
+}
+
+} // namespace
+
+bool ProxyHttpServer::shardFor(const std::vector<ShardInfo>& shards, const httplib::Request& req, const std::string& path, size_t& shard) {
+    shard = 0;
+    if (shards.size() == 1) {
+        return true;
+    }
+    rapidjson::Document doc;
+    doc.Parse(req.body.c_str());
+    // 写入和按 id 查询必须路由到 id 所在的分片，没有 id 时不能随便选一个分片
+    if (path == "/insert" || path == "/query") {
+        if (!doc.IsObject()) {
+            return false;
         }
-    } else {
-        if (index_cannot.find(path) != index_cannot.end()) {
-            for (size_t i = nodeIndex; ; i = (i + 1) % nodes_[activeIndex].size()) {
-                if (nodes_[activeIndex][i].type != 1) {
-                    nodeIndex = i;
-                    break;
-                }
-            }
-        } else if (storage_cannot.find(path) != storage_cannot.end()) {
-            for (size_t i = nodeIndex; ; i = (i + 1) % nodes_[activeIndex].size()) {
-                if (nodes_[activeIndex][i].type != 2) {
-                    nodeIndex = i;
-                    break;
-                }
-            }
+        const rapidjson::Value* object = &doc;
+        if (path == "/insert" && doc.HasMember(REQUEST_OBJECT) && doc[REQUEST_OBJECT].IsObject()) {
+            object = &doc[REQUEST_OBJECT];
+        }
+        if (!hasInt64Id(*object)) {
+            return false;
+        }
+        shard = shardOf((*object)[REQUEST_ID].GetInt64(), shards.size());
+        return true;
+    }
+    // 管理类请求可以用 instanceId 指定分片，默认发往第一个分片
+    std::string instanceId = req.get_param_value("instanceId");
+    if (instanceId.empty() && doc.IsObject() && doc.HasMember("instanceId") && doc["instanceId"].IsString()) {
+        instanceId = doc["instanceId"].GetString();
+    }
+    for (size_t i = 0; i < shards.size(); i++) {
+        if (shards[i].instanceId == instanceId) {
+            shard = i;
+            break;
+        }
+    }
+    return true;
+}
+
+ForwardResult ProxyHttpServer::forwardToShard(const ShardInfo& shard, const std::string& path, bool post, const std::string& body) {
+    return fanOut({&shard}, path, post, {body})[0];
+}
+
+ForwardResult ProxyHttpServer::scatterSearch(const std::vector<ShardInfo>& shards, const std::string& body) {
+    rapidjson::Document request;
+    request.Parse(body.c_str());
+    if (!request.IsObject() || !request.HasMember(REQUEST_K) || !request[REQUEST_K].IsInt()) {
+        // 请求不合法，交给后端返回错误信息
+        return forwardToShard(shards[0], "/search", true, body);
+    }
+    size_t k = std::max(request[REQUEST_K].GetInt(), 0);
+
+    std::vector<const ShardInfo*> targets;
+    for (const auto& shard : shards) {
+        targets.push_back(&shard);
+    }
+    std::vector<ForwardResult> results = fanOut(targets, "/search", true, std::vector<std::string>(shards.size(), body));
+
+    TraceSpan merge("merge");
+    // 任一分片失败都不能给出正确的全局 top-k，直接返回该分片的结果
+    std::vector<rapidjson::Document> docs(results.size());
+    double elapsedMs = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (isFailedResult(results[i], docs[i])) {
+            GlobalLogger->error("Search on shard {} failed", shards[i].instanceId);
+            return results[i];
         }
+        elapsedMs = std::max(elapsedMs, results[i].elapsedMs);
     }
 
-    nextNodeIndex_.store(nodeIndex + 1);
+    // 各分片的结果已按距离排好序，用堆做多路归并
+    struct Cursor {
+        float distance;
+        size_t shard;
+        rapidjson::SizeType pos;
+    };
+    bool largerIsBetter = options_.metric == "IP";
+    auto worse = [largerIsBetter](const Cursor& a, const Cursor& b) {
+        return largerIsBetter ? a.distance < b.distance : a.distance > b.distance;
+    };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(worse)> heap(worse);
+    auto hasResult = [&docs](size_t shard, rapidjson::SizeType pos) {
+        const rapidjson::Document& doc = docs[shard];
+        return doc.HasMember(RESPONSE_VECTORS) && doc.HasMember(RESPONSE_DISTANCES) && pos < doc[RESPONSE_VECTORS].Size() && pos < doc[RESPONSE_DISTANCES].Size();
+    };
+    for (size_t i = 0; i < docs.size(); i++) {
+        if (hasResult(i, 0)) {
+            heap.push({docs[i][RESPONSE_DISTANCES][0].GetFloat(), i, 0});
+        }
+    }
 
-    const auto& targetNode = nodes_[activeIndex][nodeIndex];
-    std::string targetUrl = targetNode.url + path;
-    GlobalLogger->info("Forwarding request to: {}", targetUrl);
+    rapidjson::Document response;
+    response.SetObject();
+    rapidjson::Document::AllocatorType& allocator = response.GetAllocator();
+    rapidjson::Value vectors(rapidjson::kArrayType);
+    rapidjson::Value distances(rapidjson::kArrayType);
+    while (!heap.empty() && vectors.Size() < k) {
+        Cursor top = heap.top();
+        heap.pop();
+        vectors.PushBack(rapidjson::Value(docs[top.shard][RESPONSE_VECTORS][top.pos], allocator), allocator);
+        distances.PushBack(top.distance, allocator);
+        if (hasResult(top.shard, top.pos + 1)) {
+            heap.push({docs[top.shard][RESPONSE_DISTANCES][top.pos + 1].GetFloat(), top.shard, top.pos + 1});
+        }
+    }
+    if (!vectors.Empty()) {
+        response.AddMember(RESPONSE_VECTORS, vectors, allocator);
+        response.AddMember(RESPONSE_DISTANCES, distances, allocator);
+    }
+    response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
 
-    CURL *curl = curl_easy_init();
-    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 3); //连接超时限制
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 20); //整个CURL操作的超时限制
+    ForwardResult merged;
+    merged.status = 200;
+    merged.body = toJsonString(response);
+    merged.elapsedMs = elapsedMs;
+    return merged;
+}
 
-    // 设置 CURL 选项
-    curl_easy_setopt(curl, CURLOPT_URL, targetUrl.c_str());
-    if (req.method == "POST") {
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, req.body.c_str());
+ForwardResult ProxyHttpServer::scatterWrite(const std::vector<ShardInfo>& shards, const std::string& path, const std::string& body) {
+    std::vector<const ShardInfo*> targets;
+    std::vector<std::string> bodies;
+    std::vector<size_t> counts; // 每个分片分到的条数，只对批量写入有意义
+    rapidjson::Document request;
+    request.Parse(body.c_str());
+    if (path == "/insert_batch") {
+        if (!request.IsObject() || !request.HasMember(REQUEST_OBJECTS) || !request[REQUEST_OBJECTS].IsArray()) {
+            return forwardToShard(shards[0], path, true, body);
+        }
+        // 按 id 把批量写入拆成每个分片一份，其余字段原样保留
+        std::vector<rapidjson::Value> objects;
+        for (size_t i = 0; i < shards.size(); i++) {
+            objects.emplace_back(rapidjson::kArrayType);
+        }
+        for (auto& object : request[REQUEST_OBJECTS].GetArray()) {
+            if (!hasInt64Id(object)) {
+                return badRequest("Missing or non-integer id in objects");
+            }
+            objects[shardOf(object[REQUEST_ID].GetInt64(), shards.size())].PushBack(object, request.GetAllocator());
+        }
+        for (size_t i = 0; i < shards.size(); i++) {
+            if (objects[i].Empty()) {
+                continue;
+            }
+            counts.push_back(objects[i].Size());
+            request[REQUEST_OBJECTS] = objects[i];
+            targets.push_back(&shards[i]);
+            bodies.push_back(toJsonString(request));
+        }
     } else {
-        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+        // 快照等管理请求发给每个分片
+        for (const auto& shard : shards) {
+            targets.push_back(&shard);
+            bodies.push_back(body);
+        }
+    }
+    if (targets.empty()) {
+        return forwardToShard(shards[0], path, true, body);
     }
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
 
-    // 响应数据容器
-    std::string response_data;
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_data);
+    // 各分片独立提交，没有跨分片的原子性：部分分片失败时成功的分片不会回滚。
+    // 逐个分片返回结果，调用方只需重试失败的分片
+    std::vector<ForwardResult> results = fanOut(targets, path, true, bodies);
+    rapidjson::Document response;
+    response.SetObject();
+    rapidjson::Document::AllocatorType& allocator = response.GetAllocator();
+    rapidjson::Value shardResults(rapidjson::kArrayType);
+    size_t failed = 0;
+    double elapsedMs = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        const ForwardResult& result = results[i];
+        elapsedMs = std::max(elapsedMs, result.elapsedMs);
+        rapidjson::Value item(rapidjson::kObjectType);
+        item.AddMember("instanceId", rapidjson::Value(targets[i]->instanceId.c_str(), allocator), allocator);
+        if (!counts.empty()) {
+            item.AddMember("count", static_cast<uint64_t>(counts[i]), allocator);
+        }
+        rapidjson::Document doc;
+        if (!isFailedResult(result, doc)) {
+            item.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
+            shardResults.PushBack(item, allocator);
+            continue;
+        }
+        failed++;
+        std::string error;
+        if (result.code != CURLE_OK) {
+            error = curl_easy_strerror(result.code);
+        } else if (doc.IsObject() && doc.HasMember(RESPONSE_ERROR_MSG) && doc[RESPONSE_ERROR_MSG].IsString()) {
+            error = doc[RESPONSE_ERROR_MSG].GetString();
+        } else {
+            error = "HTTP " + std::to_string(result.status);
+        }
+        GlobalLogger->error("{} on shard {} failed: {}", path, targets[i]->instanceId, error);
+        item.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_ERROR, allocator);
+        item.AddMember(RESPONSE_ERROR_MSG, rapidjson::Value(error.c_str(), allocator), allocator);
+        shardResults.PushBack(item, allocator);
+    }
+    response.AddMember(RESPONSE_RETCODE, failed == 0 ? RESPONSE_RETCODE_SUCCESS : RESPONSE_RETCODE_ERROR, allocator);
+    if (failed > 0) {
+        std::string message = std::to_string(failed) + " of " + std::to_string(results.size()) + " shards failed";
+        response.AddMember(RESPONSE_ERROR_MSG, rapidjson::Value(message.c_str(), allocator), allocator);
+    }
+    response.AddMember("shards", shardResults, allocator);
 
-    // 执行 CURL 请求
-    CURLcode curl_res = curl_easy_perform(curl);
-    if (curl_res != CURLE_OK) {
-        GlobalLogger->error("curl_easy_perform() failed: {}", curl_easy_strerror(curl_res));
-        res.status = 500;
-        res.set_content("Internal Server Error", "text/plain");
+    ForwardResult merged;
+    merged.status = 200;
+    merged.body = toJsonString(response);
+    merged.elapsedMs = elapsedMs;
+    return merged;
+}
+
+void ProxyHttpServer::setForwardResponse(httplib::Response& res, const std::string& path, const ForwardResult& result) {
+    if (result.code != CURLE_OK) {
+        GlobalLogger->error("Forwarding {} failed: {}", path, curl_easy_strerror(result.code));
+        if (result.code == CURLE_OPERATION_TIMEDOUT) {
+            res.status = 504;
+            res.set_content("Gateway Timeout", "text/plain");
+        } else {
+            res.status = 500;
+            res.set_content("Internal Server Error", "text/plain");
+        }
+    } else if (result.status == 503 && result.body.empty()) {
+        // 分片中没有能处理该请求的节点
+        res.status = 503;
+        res.set_content("Service Unavailable", "text/plain");
     } else {
-        GlobalLogger->info("Received response from server");
+        LOG_DEBUG("Received response from server");
         // 确保响应数据不为空
-        if (response_data.empty()) {
+        if (result.body.empty()) {
             GlobalLogger->error("Received empty response from server");
             res.status = 500;
             res.set_content("Internal Server Error", "text/plain");
         } else {
-            res.set_content(response_data, "application/json");
+            // 请求本身的错误原样返回状态码
+            if (result.status >= 400 && result.status < 500) {
+                res.status = result.status;
+            }
+            res.set_content(result.body, "application/json");
+        }
+    }
+}
+
+void ProxyHttpServer::forwardRequest(const httplib::Request& req, httplib::Response& res, const std::string& path) {
+    // 取拓扑快照，转发期间拓扑更新不影响这次请求
+    std::shared_ptr<const std::vector<ShardInfo>> topology = currentShards();
+    const std::vector<ShardInfo>& shards = *topology;
+    if (shards.empty()) {
+        GlobalLogger->error("No available nodes for forwarding {}", path);
+        res.status = 503;
+        res.set_content("Service Unavailable", "text/plain");
+        return;
+    }
+    // 命中缓存的搜索不再转发到后端
+    bool cacheable = path == "/search" && searchCache_.enabled();
+    uint64_t version = writeVersion_.load();
+    if (cacheable) {
+        TraceSpan span("cache.lookup");
+        CachedResponse cached;
+        if (searchCache_.get(req.body, version, cached) && std::chrono::steady_clock::now() < cached.expiresAt) {
+            cacheHits_->add();
+            res.set_content(cached.body, "application/json");
+            return;
+        }
+    }
+
+    // 慢后端会让工作线程都堵在等待上，超过上限的请求直接拒绝，留出线程处理其他请求
+    if (waitingWorkers_.fetch_add(1) >= options_.maxWaitingWorkers && options_.maxWaitingWorkers > 0) {
+        waitingWorkers_--;
+        rejected_->add();
+        GlobalLogger->warn("Rejecting {}: {} workers already waiting on backends", path, options_.maxWaitingWorkers);
+        res.status = 503;
+        res.set_content("Service Unavailable", "text/plain");
+        return;
+    }
+    struct WaitingGuard {
+        std::atomic<int>& count;
+        ~WaitingGuard() { count--; }
+    } waiting{waitingWorkers_};
+
+    auto forward = [&]() {
+        if (shards.size() > 1 && path == "/search") {
+            return scatterSearch(shards, req.body);
+        } else if (shards.size() > 1 && (path == "/insert_batch" || path == "/snapshot")) {
+            return scatterWrite(shards, path, req.body);
+        }
+        size_t shard = 0;
+        if (!shardFor(shards, req, path, shard)) {
+            return badRequest("Missing or non-integer id in the request");
+        }
+        return forwardToShard(shards[shard], path, req.method == "POST", req.body);
+    };
+    ForwardResult result;
+    if (path == "/search" && options_.searchSingleFlight) {
+        // 相同请求体的并发搜索只转发一次，键中带上写入版本，写入之后的搜索不会拿到旧结果
+        bool shared = false;
+        result = searchFlights_.run(req.body + "#" + std::to_string(version), forward, &shared);
+        if (shared) {
+            flightsShared_->add();
+        }
+    } else {
+        result = forward();
+    }
+    setForwardResponse(res, path, result);
+    if (leader_request.find(path) != leader_request.end()) {
+        writeVersion_++;
+    } else if (cacheable) {
+        rapidjson::Document doc;
+        if (!isFailedResult(result, doc)) {
+            searchCache_.put(req.body, version, CachedResponse{result.body, std::chrono::steady_clock::now() + std::chrono::milliseconds(options_.searchCacheTtlMs)});
         }
     }
-    auto end = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-    curl_easy_cleanup(curl);
-    GlobalLogger->debug("收到请求的时间:{}, 收到请求的时间:{}", start, end);
 }
 
 size_t ProxyHttpServer::writeCallback(void *contents, size_t size, size_t nmemb, void *userp) {
@@ -185,16 +776,15 @@ size_t ProxyHttpServer::writeCallback(void *contents, size_t size, size_t nmemb,
     return size * nmemb;
 }
 
-void ProxyHttpServer::fetchAndUpdateNodes() {
-    GlobalLogger->info("Fetching nodes from Master Server");
-
+bool ProxyHttpServer::fetchFromMaster(const std::string& path, rapidjson::Document& doc, int timeoutMs) {
     // 构建请求 URL
-    std::string url = "http://" + masterServerHost_ + ":" + std::to_string(masterServerPort_) + "/getInstance?instanceId=" + instanceId_;
+    std::string url = "http://" + masterServerHost_ + ":" + std::to_string(masterServerPort_) + path;
     GlobalLogger->debug("Requesting URL: {}", url);
 
     // 设置 CURL 选项
     curl_easy_setopt(curlHandle_, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curlHandle_, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(curlHandle_, CURLOPT_TIMEOUT_MS, static_cast<long>(timeoutMs));
     std::string response_data;
     curl_easy_setopt(curlHandle_, CURLOPT_WRITEFUNCTION, writeCallback);
     curl_easy_setopt(curlHandle_, CURLOPT_WRITEDATA, &response_data);
@@ -203,26 +793,28 @@ void ProxyHttpServer::fetchAndUpdateNodes() {
     CURLcode curl_res = curl_easy_perform(curlHandle_);
     if (curl_res != CURLE_OK) {
         GlobalLogger->error("curl_easy_perform() failed: {}", curl_easy_strerror(curl_res));
-        return;
+        return false;
     }
 
     // 解析响应数据
-    rapidjson::Document doc;
-    if (doc.Parse(response_data.c_str()).HasParseError()) {
+    if (doc.Parse(response_data.c_str()).HasParseError() || !doc.IsObject()) {
         GlobalLogger->error("Failed to parse JSON response");
-        return;
+        return false;
     }
 
     // 检查返回码
     if (doc["retCode"].GetInt() != 0) {
         GlobalLogger->error("Error from Master Server: {}", doc["msg"].GetString());
-        return;
+        return false;
     }
+    return true;
+}
 
-    // GlobalLogger->info(response_data);
-
-    int inactiveIndex = activeNodesIndex_.load() ^ 1; // 获取非活动数组的索引
-    nodes_[inactiveIndex].clear();
+bool ProxyHttpServer::fetchInstanceNodes(const std::string& instanceId, std::vector<NodeInfo>& nodes) {
+    rapidjson::Document doc;
+    if (!fetchFromMaster("/getInstance?instanceId=" + instanceId, doc, options_.requestTimeoutMs)) {
+        return false;
+    }
     const auto& nodesArray = doc["data"]["nodes"].GetArray();
     for (const auto& nodeVal : nodesArray) {
         NodeInfo node;
@@ -230,14 +822,56 @@ void ProxyHttpServer::fetchAndUpdateNodes() {
         node.url = nodeVal["url"].GetString();
         node.role = nodeVal["role"].GetInt();
         node.type = nodeVal["type"].GetInt();
-        nodes_[inactiveIndex].push_back(node);
+        nodes.push_back(node);
     }
+    return true;
+}
 
-    // 原子地切换活动数组索引
-    activeNodesIndex_.store(inactiveIndex);
-    GlobalLogger->info("Nodes updated successfully");
+std::shared_ptr<const std::vector<ShardInfo>> ProxyHttpServer::currentShards() const {
+    return std::atomic_load(&shards_);
 }
 
+void ProxyHttpServer::fetchAndUpdateNodes() {
+    GlobalLogger->info("Fetching nodes from Master Server");
+
+    // 未配置集合时只有 instanceId 这一个分片
+    std::vector<std::string> instanceIds;
+    if (options_.collection.empty()) {
+        instanceIds.push_back(instanceId_);
+    } else {
+        rapidjson::Document doc;
+        if (!fetchFromMaster("/getCollection?name=" + options_.collection, doc, options_.requestTimeoutMs)) {
+            return;
+        }
+        for (const auto& shard : doc["data"]["shards"].GetArray()) {
+            instanceIds.push_back(shard.GetString());
+        }
+    }
+
+    auto shards = std::make_shared<std::vector<ShardInfo>>();
+    std::vector<NodeInfo> allNodes;
+    for (const auto& instanceId : instanceIds) {
+        ShardInfo shard;
+        shard.instanceId = instanceId;
+        // 任一分片拉取失败都保留旧的拓扑，避免按错误的分片数路由
+        if (!fetchInstanceNodes(instanceId, shard.nodes)) {
+            return;
+        }
+        allNodes.insert(allNodes.end(), shard.nodes.begin(), shard.nodes.end());
+        shards->push_back(shard);
+    }
+
+    // 原子地发布新的拓扑，旧的拓扑在最后一个读者放下后释放
+    std::atomic_store(&shards_, std::shared_ptr<const std::vector<ShardInfo>>(shards));
+    prunePools(allNodes);
+    std::vector<std::string> urls;
+    for (const auto& node : allNodes) {
+        urls.push_back(node.url);
+    }
+    balancer_.prune(urls);
+    health_.prune(urls);
+    GlobalLogger->info("Nodes updated successfully");
+}
 
 void ProxyHttpServer::handleTopologyRequest(httplib::Response& res) {
     rapidjson::Document doc;
@@ -251,16 +885,32 @@ void ProxyHttpServer::handleTopologyRequest(httplib::Response& res) {
     // 添加 instanceId
     doc.AddMember("instanceId", rapidjson::Value(instanceId_.c_str(), allocator), allocator);
 
-    // 添加节点信息
+    if (!options_.collection.empty()) {
+        doc.AddMember("collection", rapidjson::Value(options_.collection.c_str(), allocator), allocator);
+    }
+
+    // 添加节点信息，每个节点带上所属的分片
     rapidjson::Value nodesArray(rapidjson::kArrayType);
-    int activeIndex = activeNodesIndex_.load();
-    for (const auto& node : nodes_[activeIndex]) {
-        rapidjson::Value nodeObj(rapidjson::kObjectType);
-        nodeObj.AddMember("nodeId", rapidjson::Value(node.nodeId.c_str(), allocator), allocator);
-        nodeObj.AddMember("url", rapidjson::Value(node.url.c_str(), allocator), allocator);
-        nodeObj.AddMember("role", node.role, allocator);
-        nodeObj.AddMember("type", node.type, allocator);
-        nodesArray.PushBack(nodeObj, allocator);
+    std::shared_ptr<const std::vector<ShardInfo>> shards = currentShards();
+    for (const auto& shard : *shards) {
+        for (const auto& node : shard.nodes) {
+            rapidjson::Value nodeObj(rapidjson::kObjectType);
+            nodeObj.AddMember("instanceId", rapidjson::Value(shard.instanceId.c_str(), allocator), allocator);
+            nodeObj.AddMember("nodeId", rapidjson::Value(node.nodeId.c_str(), allocator), allocator);
+            nodeObj.AddMember("url", rapidjson::Value(node.url.c_str(), allocator), allocator);
+            nodeObj.AddMember("role", node.role, allocator);
+            nodeObj.AddMember("type", node.type, allocator);
+            std::shared_ptr<NodeStats> stats = balancer_.stats(node.url);
+            nodeObj.AddMember("inflight", stats->inflight.load(), allocator);
+            nodeObj.AddMember("ewmaMs", stats->ewmaMs.load(), allocator);
+            NodeHealth health = health_.snapshot(node.url);
+            nodeObj.AddMember("health", rapidjson::StringRef(HealthChecker::stateName(health.state)), allocator);
+            nodeObj.AddMember("consecutiveFailures", health.consecutiveFailures, allocator);
+            if (health.state != NodeHealth::State::CLOSED) {
+                nodeObj.AddMember("ejectReason", rapidjson::Value(health.reason.c_str(), allocator), allocator);
+            }
+            nodesArray.PushBack(nodeObj, allocator);
+        }
     }
     doc.AddMember("nodes", nodesArray, allocator);
 
@@ -274,11 +924,101 @@ void ProxyHttpServer::handleTopologyRequest(httplib::Response& res) {
 }
 
 
+void ProxyHttpServer::startHealthChecks() {
+    if (options_.healthCheckIntervalMs <= 0) {
+        return;
+    }
+    // 还没有返回的探测，同一节点上一次探测未返回时不再发新的
+    struct Probes {
+        std::mutex mutex;
+        std::set<std::string> outstanding;
+    };
+    auto probes = std::make_shared<Probes>();
+    healthThread_ = std::thread([this, probes]() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(healthMutex_);
+                healthCv_.wait_for(lock, std::chrono::milliseconds(options_.healthCheckIntervalMs), [this] { return !running_; });
+                if (!running_) {
+                    return;
+                }
+            }
+            std::vector<std::string> urls;
+            std::shared_ptr<const std::vector<ShardInfo>> shards = currentShards();
+            for (const auto& shard : *shards) {
+                for (const auto& node : shard.nodes) {
+                    urls.push_back(node.url);
+                }
+            }
+            // 探测请求走转发事件循环，结果只影响熔断状态，不计入负载均衡的响应时间
+            for (const auto& url : urls) {
+                if (!running_) {
+                    return;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(probes->mutex);
+                    if (!probes->outstanding.insert(url).second) {
+                        continue;
+                    }
+                }
+                AsyncForwarder* forwarder = forwarders_[nextForwarder_++ % forwarders_.size()].get();
+                forwarder->submit(getPool(url), url + "/health", false, "", options_.healthCheckTimeoutMs, [this, url, probes](ForwardResult&& result) {
+                    {
+                        std::lock_guard<std::mutex> lock(probes->mutex);
+                        probes->outstanding.erase(url);
+                    }
+                    if (result.code != CURLE_ABORTED_BY_CALLBACK) {
+                        health_.onResult(url, result.code == CURLE_OK && result.status < 500);
+                    }
+                });
+            }
+            std::map<std::string, double> ewmaMs;
+            for (const auto& url : urls) {
+                std::shared_ptr<NodeStats> stats = balancer_.stats(url);
+                if (stats->sampled.load()) {
+                    ewmaMs[url] = stats->ewmaMs.load();
+                }
+            }
+            health_.ejectSlowOutliers(ewmaMs);
+        }
+    });
+}
+
+int64_t ProxyHttpServer::waitTopologyChange(int64_t version) {
+    rapidjson::Document doc;
+    std::string path = "/watchTopology?version=" + std::to_string(version) + "&timeoutMs=" + std::to_string(options_.topologyWatchTimeoutMs);
+    // 给 master 的等待留出余量，超过这个时间仍无响应视为 master 不可用
+    if (!fetchFromMaster(path, doc, options_.topologyWatchTimeoutMs + options_.connectTimeoutMs + 5000)) {
+        return -1;
+    }
+    if (!doc.HasMember("data") || !doc["data"].HasMember("version") || !doc["data"]["version"].IsInt64()) {
+        GlobalLogger->error("Invalid topology watch response");
+        return -1;
+    }
+    return doc["data"]["version"].GetInt64();
+}
+
 void ProxyHttpServer::startNodeUpdateTimer() {
     std::thread([this]() {
+        int64_t version = -1;
+        int backoffMs = 1000;
         while (running_) {
-            std::this_thread::sleep_for(std::chrono::seconds(30));
-            fetchAndUpdateNodes();
+            // 拓扑变化时长轮询立即返回；超时返回时也刷新一次，兜底漏掉的变化
+            int64_t latest = waitTopologyChange(version);
+            if (latest < 0) {
+                // master 不可用或不支持订阅，退避后退化为轮询
+                std::this_thread::sleep_for(std::chrono::milliseconds(backoffMs));
+                backoffMs = std::min(backoffMs * 2, 30000);
+            } else {
+                backoffMs = 1000;
+                if (latest != version) {
+                    GlobalLogger->info("Topology changed to version {}", latest);
+                }
+                version = latest;
+            }
+            if (running_) {
+                fetchAndUpdateNodes();
+            }
         }
     }).detach();
 }
@@ -15,11 +15,13 @@ log_state_machine::log_state_machine(VectorEngine* vector_engine) {
 
 ptr<buffer> log_state_machine::commit(const ulong log_idx, buffer& data) {
     std::string content(reinterpret_cast<const char*>(data.data() + data.pos()+sizeof(int)), data.size()-sizeof(int));
-    GlobalLogger->debug("Commit log_idx: {}", log_idx); // 添加打印日志
+    LOG_DEBUG("Commit log_idx: {}", log_idx); // 添加打印日志
     
     rapidjson::Document json_request;
     json_request.Parse(content.c_str());
     std::string operation_type = json_request[REQUEST_OPERATION].GetString();
+    // 先登记再应用，索引重建以此确定读取 WAL 的边界
+    vector_engine_->setAppliedLogID(log_idx);
     if (operation_type == "insert") {
         vector_engine_->insert(json_request);
     } else if (operation_type == "insert_batch") {
@@ -35,6 +37,6 @@ ptr<buffer> log_state_machine::commit(const ulong log_idx, buffer& data) {
 
 ptr<buffer> log_state_machine::pre_commit(const ulong log_idx, buffer& data) {
     std::string content(reinterpret_cast<const char*>(data.data() + data.pos()+sizeof(int)), data.size()-sizeof(int));
-    GlobalLogger->debug("Pre Commit log_idx: {}", log_idx); // 添加打印日志
+    LOG_DEBUG("Pre Commit log_idx: {}", log_idx); // 添加打印日志
     return nullptr;
 }
\ No newline at end of file
@@ -106,7 +106,7 @@ ptr<cmd_result<ptr<buffer>>> RaftStuff::appendEntries(const std::string& entry)
     size_t total_size = sizeof(int) + entry.size();
 
     // 添加调试日志
-    GlobalLogger->debug("Total size of entry: {}", total_size);
+    LOG_DEBUG("Total size of entry: {}", total_size);
 
     // 创建一个 Raft 日志条目
     ptr<buffer> log_entry_buffer = buffer::alloc(total_size);
@@ -115,10 +115,10 @@ ptr<cmd_result<ptr<buffer>>> RaftStuff::appendEntries(const std::string& entry)
     bs_log.put_str(entry);
 
     // 添加调试日志
-    GlobalLogger->debug("Created log_entry_buffer at address: {}", static_cast<const void*>(log_entry_buffer.get()));
+    LOG_DEBUG("Created log_entry_buffer at address: {}", static_cast<const void*>(log_entry_buffer.get()));
 
     // 添加调试日志
-    GlobalLogger->debug("Appending entry to Raft instance");
+    LOG_DEBUG("Appending entry to Raft instance");
 
     // 将日志条目追加到 Raft 实例中
     return raft_instance_->append_entries({log_entry_buffer});
@@ -0,0 +1,90 @@
+// hnswlib 自动扩容的并发测试：容量只有 100 的索引开启 setAutoGrow，
+// 多个线程插入的同时另外几个线程在搜索，结束后每个标签都要能搜到，
+// 图要通过 checkIntegrity，且所有节点都能从入口点到达
+#include "hnswlib/hnswlib.h"
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+static std::atomic<int> failures{0};
+
+static void expect(bool ok, const char* what) {
+    if (!ok) {
+        std::fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+int main() {
+    const int dim = 16;
+    const int num = 5000;
+    const int num_writers = 4;
+    const int num_readers = 4;
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> uniform;
+    std::vector<float> data(static_cast<size_t>(num) * dim);
+    for (float& value : data) {
+        value = uniform(rng);
+    }
+
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> index(&space, 100, 16, 200, 100);
+    index.setAutoGrow(true);
+
+    // 一个分块 1024 个元素，插满 num 个要扩容好几次
+    // 写线程按 i % num_writers 分片插入，读线程在插入期间不停地搜已经写入的向量
+    std::atomic<int> writers_done{0};
+    std::atomic<size_t> searches{0};
+    std::vector<std::thread> threads;
+    for (int w = 0; w < num_writers; w++) {
+        threads.emplace_back([&, w] {
+            for (int i = w; i < num; i += num_writers) {
+                index.addPoint(&data[static_cast<size_t>(i) * dim], i);
+            }
+            writers_done++;
+        });
+    }
+    for (int r = 0; r < num_readers; r++) {
+        threads.emplace_back([&, r] {
+            std::mt19937 local(r);
+            std::uniform_int_distribution<int> pick(0, num - 1);
+            while (writers_done < num_writers) {
+                int i = pick(local);
+                auto result = index.searchKnnWithEf(&data[static_cast<size_t>(i) * dim], 10, 50);
+                expect(result.size() <= 10, "search result size");
+                searches++;
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    std::printf("inserted %zu elements, capacity %zu, %zu concurrent searches\n",
+                index.getCurrentElementCount(), index.getMaxElements(), searches.load());
+    expect(index.getCurrentElementCount() == static_cast<size_t>(num), "all elements inserted");
+    expect(index.getMaxElements() >= static_cast<size_t>(num), "capacity grown");
+
+    hnswlib::GraphHealth health = index.graphHealth();
+    std::printf("after grow: %zu live, %zu deleted, %zu unreachable, %zu dangling links\n",
+                health.elements, health.deleted, health.unreachable, health.dangling_links);
+    expect(health.elements == static_cast<size_t>(num), "live element count");
+    expect(health.unreachable == 0, "no unreachable elements");
+    expect(health.dangling_links == 0, "no dangling links");
+    index.checkIntegrity();
+
+    int found = 0;
+    for (int i = 0; i < num; i++) {
+        auto result = index.searchKnnWithEf(&data[static_cast<size_t>(i) * dim], 1, 200);
+        if (!result.empty() && result.top().second == static_cast<size_t>(i)) {
+            found++;
+        }
+    }
+    std::printf("elements found by search: %d / %d\n", found, num);
+    expect(found == num, "every label searchable");
+
+    return failures == 0 ? 0 : 1;
+}
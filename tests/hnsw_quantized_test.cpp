@@ -0,0 +1,279 @@
+// space_quantized.h 的内核测试：SQ8 / fp16 / binary 的每个 SIMD 内核都和标量参考实现比对，
+// 维度故意不取寄存器宽度的整数倍，覆盖向量主循环和尾部；
+// 另外对所有 65536 个半精度位模式做 fp16 往返，覆盖规格数、次正规数、无穷和 NaN
+#include "hnswlib/hnswlib.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void expect(bool ok, const std::string& what) {
+    if (!ok) {
+        std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+        failures++;
+    }
+}
+
+// 浮点累加顺序不同，按相对误差比较
+static bool nearlyEqual(double got, double want) {
+    return std::fabs(got - want) <= 1e-5 * std::max(1.0, std::fabs(want));
+}
+
+static const size_t kDims[] = {1, 3, 7, 9, 15, 17, 31, 33, 100, 129, 255};
+
+struct Kernel {
+    const char* name;
+    hnswlib::DISTFUNC<float> func;
+    bool supported;
+};
+
+static void checkSQ8() {
+    const hnswlib::CpuFeatures& cpu = hnswlib::GetCpuFeatures();
+    std::vector<Kernel> kernels = {{"SQ8L2Sqr", hnswlib::SQ8L2Sqr, true}};
+#if defined(USE_AVX)
+    kernels.push_back({"SQ8L2SqrAVX2", hnswlib::SQ8L2SqrAVX2, cpu.avx2 && cpu.fma});
+#endif
+#if defined(USE_AVX512)
+    kernels.push_back({"SQ8L2SqrAVX512", hnswlib::SQ8L2SqrAVX512, cpu.avx512f});
+#endif
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::uniform_real_distribution<float> step(0.001f, 0.1f);
+    for (size_t dim : kDims) {
+        hnswlib::SQ8Space space(dim);
+        std::vector<float> weight(dim);
+        for (float& w : weight) {
+            w = step(rng);
+            w *= w;
+        }
+        hnswlib::SQ8Param param{dim, weight.data()};
+        for (int trial = 0; trial < 20; trial++) {
+            std::vector<unsigned char> a(dim), b(dim);
+            for (size_t i = 0; i < dim; i++) {
+                a[i] = static_cast<unsigned char>(byte(rng));
+                b[i] = static_cast<unsigned char>(byte(rng));
+            }
+            double want = 0;
+            for (size_t i = 0; i < dim; i++) {
+                double diff = static_cast<double>(a[i]) - b[i];
+                want += weight[i] * diff * diff;
+            }
+            for (const Kernel& kernel : kernels) {
+                if (kernel.supported) {
+                    expect(nearlyEqual(kernel.func(a.data(), b.data(), &param), want),
+                           std::string(kernel.name) + " dim " + std::to_string(dim));
+                }
+            }
+            // 空间对象分发出去的内核用的是它自己的参数，权重来自默认的 step
+            const hnswlib::SQ8Param* own = static_cast<const hnswlib::SQ8Param*>(space.get_dist_func_param());
+            double want_own = 0;
+            for (size_t i = 0; i < dim; i++) {
+                double diff = static_cast<double>(a[i]) - b[i];
+                want_own += own->weight[i] * diff * diff;
+            }
+            expect(nearlyEqual(space.get_dist_func()(a.data(), b.data(), own), want_own),
+                   "SQ8Space dispatch dim " + std::to_string(dim));
+        }
+    }
+    for (const Kernel& kernel : kernels) {
+        std::printf("sq8 kernel %s: %s\n", kernel.name, kernel.supported ? "checked" : "not supported by cpu");
+    }
+}
+
+static void checkFp16Kernels() {
+    const hnswlib::CpuFeatures& cpu = hnswlib::GetCpuFeatures();
+    std::vector<Kernel> kernels = {{"Fp16L2Sqr", hnswlib::Fp16L2Sqr, true}};
+#if defined(USE_AVX)
+    kernels.push_back({"Fp16L2SqrF16C", hnswlib::Fp16L2SqrF16C, cpu.f16c && cpu.fma});
+#endif
+#if defined(USE_AVX512)
+    kernels.push_back({"Fp16L2SqrAVX512", hnswlib::Fp16L2SqrAVX512, cpu.avx512f});
+#endif
+
+    std::mt19937 rng(2);
+    std::normal_distribution<float> normal;
+    for (size_t dim : kDims) {
+        hnswlib::Fp16Space space(dim);
+        for (int trial = 0; trial < 20; trial++) {
+            std::vector<float> va(dim), vb(dim);
+            for (size_t i = 0; i < dim; i++) {
+                va[i] = normal(rng) * 10;
+                vb[i] = normal(rng) * 10;
+            }
+            std::vector<uint16_t> a(dim), b(dim);
+            space.encode(va.data(), a.data());
+            space.encode(vb.data(), b.data());
+            double want = 0;
+            for (size_t i = 0; i < dim; i++) {
+                double diff = static_cast<double>(hnswlib::HalfToFloat(a[i])) - hnswlib::HalfToFloat(b[i]);
+                want += diff * diff;
+            }
+            for (const Kernel& kernel : kernels) {
+                if (kernel.supported) {
+                    expect(nearlyEqual(kernel.func(a.data(), b.data(), &dim), want),
+                           std::string(kernel.name) + " dim " + std::to_string(dim));
+                }
+            }
+            expect(nearlyEqual(space.get_dist_func()(a.data(), b.data(), space.get_dist_func_param()), want),
+                   "Fp16Space dispatch dim " + std::to_string(dim));
+        }
+    }
+    for (const Kernel& kernel : kernels) {
+        std::printf("fp16 kernel %s: %s\n", kernel.name, kernel.supported ? "checked" : "not supported by cpu");
+    }
+}
+
+static void checkBinary() {
+    const hnswlib::CpuFeatures& cpu = hnswlib::GetCpuFeatures();
+    std::vector<Kernel> kernels = {{"Hamming", hnswlib::Hamming, true}};
+#if defined(USE_SSE)
+    kernels.push_back({"HammingPOPCNT", hnswlib::HammingPOPCNT, cpu.popcnt});
+#endif
+#if defined(USE_AVX512)
+    kernels.push_back({"HammingAVX512", hnswlib::HammingAVX512, cpu.avx512vpopcntdq});
+#endif
+
+    // AVX-512 内核一次处理 8 个 64 位字，维度取到 8 个字以上且不是 512 的倍数
+    const size_t dims[] = {1, 63, 65, 200, 577, 1000, 1100};
+    std::mt19937 rng(3);
+    std::normal_distribution<float> normal;
+    for (size_t dim : dims) {
+        hnswlib::BinarySpace space(dim);
+        size_t words = space.get_data_size() / sizeof(uint64_t);
+        for (int trial = 0; trial < 20; trial++) {
+            std::vector<float> va(dim), vb(dim);
+            for (size_t i = 0; i < dim; i++) {
+                va[i] = normal(rng);
+                vb[i] = normal(rng);
+            }
+            std::vector<uint64_t> a(words), b(words);
+            space.encode(va.data(), a.data());
+            space.encode(vb.data(), b.data());
+            float want = 0;
+            for (size_t i = 0; i < dim; i++) {
+                want += (va[i] > 0) != (vb[i] > 0);
+            }
+            for (const Kernel& kernel : kernels) {
+                if (kernel.supported) {
+                    expect(kernel.func(a.data(), b.data(), &words) == want,
+                           std::string(kernel.name) + " dim " + std::to_string(dim));
+                }
+            }
+            expect(space.get_dist_func()(a.data(), b.data(), space.get_dist_func_param()) == want,
+                   "BinarySpace dispatch dim " + std::to_string(dim));
+        }
+    }
+    for (const Kernel& kernel : kernels) {
+        std::printf("binary kernel %s: %s\n", kernel.name, kernel.supported ? "checked" : "not supported by cpu");
+    }
+}
+
+#if defined(HNSWLIB_RUNTIME_DISPATCH) || defined(__F16C__)
+#define HAVE_F16C_REFERENCE
+HNSWLIB_TARGET_F16C
+static uint16_t hardwareFloatToHalf(float value) {
+    return static_cast<uint16_t>(_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT));
+}
+
+HNSWLIB_TARGET_F16C
+static float hardwareHalfToFloat(uint16_t value) {
+    return _cvtsh_ss(value);
+}
+
+static uint32_t bitsOf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+#endif
+
+static void checkFp16RoundTrip() {
+    // 每个半精度位模式转成 float 再转回来都应该不变，NaN 只要求仍是同符号的 NaN
+    int mismatches = 0;
+    for (uint32_t h = 0; h <= 0xffff; h++) {
+        uint16_t half = static_cast<uint16_t>(h);
+        float value = hnswlib::HalfToFloat(half);
+        uint16_t back = hnswlib::FloatToHalf(value);
+        bool is_nan = (half & 0x7c00) == 0x7c00 && (half & 0x3ff) != 0;
+        bool ok = is_nan ? (std::isnan(value) && (back & 0x7c00) == 0x7c00 && (back & 0x3ff) != 0 &&
+                            (back & 0x8000) == (half & 0x8000))
+                         : back == half;
+        if (!ok) {
+            mismatches++;
+        }
+    }
+    expect(mismatches == 0, "fp16 round trip over all bit patterns");
+
+    struct Case {
+        float value;
+        uint16_t half;
+    };
+    const Case cases[] = {
+        {0.0f, 0x0000},
+        {-0.0f, 0x8000},
+        {1.0f, 0x3c00},
+        {-2.0f, 0xc000},
+        {65504.0f, 0x7bff},                  // 最大规格数
+        {65520.0f, 0x7c00},                  // 舍入后溢出成无穷
+        {6.103515625e-05f, 0x0400},          // 最小规格数
+        {6.0975551605224609e-05f, 0x03ff},   // 最大次正规数
+        {5.9604644775390625e-08f, 0x0001},   // 最小次正规数
+        {2.98023223876953125e-08f, 0x0000},  // 最小次正规数的一半，向偶数舍入到 0
+        {4.4703483581542969e-08f, 0x0001},   // 0.75 个最小次正规数，舍入到 1
+        {1e-10f, 0x0000},
+        {INFINITY, 0x7c00},
+        {-INFINITY, 0xfc00},
+        {1e10f, 0x7c00},
+    };
+    for (const Case& c : cases) {
+        char what[64];
+        std::snprintf(what, sizeof(what), "FloatToHalf(%g)", c.value);
+        expect(hnswlib::FloatToHalf(c.value) == c.half, what);
+    }
+    expect(std::isnan(hnswlib::HalfToFloat(hnswlib::FloatToHalf(NAN))), "FloatToHalf(NaN) stays NaN");
+    expect(std::isnan(hnswlib::HalfToFloat(hnswlib::FloatToHalf(-NAN))), "FloatToHalf(-NaN) stays NaN");
+
+#if defined(HAVE_F16C_REFERENCE)
+    // 和 F16C 指令的转换结果逐位比对，随机 float 覆盖半精度上下溢出附近的指数范围
+    if (hnswlib::GetCpuFeatures().f16c) {
+        int half_mismatches = 0;
+        for (uint32_t h = 0; h <= 0xffff; h++) {
+            uint16_t half = static_cast<uint16_t>(h);
+            bool is_nan = (half & 0x7c00) == 0x7c00 && (half & 0x3ff) != 0;
+            if (!is_nan && bitsOf(hnswlib::HalfToFloat(half)) != bitsOf(hardwareHalfToFloat(half))) {
+                half_mismatches++;
+            }
+        }
+        expect(half_mismatches == 0, "HalfToFloat matches F16C");
+
+        std::mt19937 rng(4);
+        std::uniform_int_distribution<uint32_t> mantissa(0, 0x7fffff);
+        std::uniform_int_distribution<uint32_t> exponent(127 - 30, 127 + 17);
+        int float_mismatches = 0;
+        for (int i = 0; i < 1000000; i++) {
+            uint32_t bits = (static_cast<uint32_t>(i & 1) << 31) | (exponent(rng) << 23) | mantissa(rng);
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            if (hnswlib::FloatToHalf(value) != hardwareFloatToHalf(value)) {
+                float_mismatches++;
+            }
+        }
+        expect(float_mismatches == 0, "FloatToHalf matches F16C");
+        std::printf("fp16 conversions checked against F16C\n");
+    }
+#endif
+}
+
+int main() {
+    checkSQ8();
+    checkFp16Kernels();
+    checkBinary();
+    checkFp16RoundTrip();
+    return failures == 0 ? 0 : 1;
+}
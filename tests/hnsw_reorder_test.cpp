@@ -0,0 +1,118 @@
+// hnswlib reorderGraph 的回归测试：删除一部分节点后按 BFS / RCM 重排，
+// 重排前后搜索结果完全一致，已删除的标签仍被排除，保存再加载后布局不变
+#include "hnswlib/hnswlib.h"
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void expect(bool ok, const char* what) {
+    if (!ok) {
+        std::fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static std::vector<std::vector<hnswlib::labeltype>> searchAll(const hnswlib::HierarchicalNSW<float>& index,
+                                                              const std::vector<float>& queries,
+                                                              int dim, int k) {
+    std::vector<std::vector<hnswlib::labeltype>> labels;
+    for (size_t q = 0; q < queries.size() / dim; q++) {
+        auto result = index.searchKnnWithEf(&queries[q * dim], k, 100);
+        std::vector<hnswlib::labeltype> row;
+        while (!result.empty()) {
+            row.push_back(result.top().second);
+            result.pop();
+        }
+        labels.push_back(row);
+    }
+    return labels;
+}
+
+// 按内部 id 列出标签，重排后的布局就是这个序列
+static std::vector<hnswlib::labeltype> layoutOf(const hnswlib::HierarchicalNSW<float>& index) {
+    std::vector<hnswlib::labeltype> layout(index.cur_element_count);
+    for (size_t id = 0; id < layout.size(); id++) {
+        layout[id] = index.getExternalLabel(static_cast<hnswlib::tableint>(id));
+    }
+    return layout;
+}
+
+static void checkReorder(hnswlib::GraphOrder method, const char* name) {
+    const int dim = 16;
+    const int num = 5000;
+    const int num_queries = 200;
+    const int k = 10;
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> uniform;
+    std::vector<float> data(static_cast<size_t>(num) * dim);
+    for (float& value : data) {
+        value = uniform(rng);
+    }
+    std::vector<float> queries(static_cast<size_t>(num_queries) * dim);
+    for (float& value : queries) {
+        value = uniform(rng);
+    }
+
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> index(&space, num, 16, 200, 100);
+    for (int i = 0; i < num; i++) {
+        index.addPoint(&data[static_cast<size_t>(i) * dim], i);
+    }
+    // 每 7 个删一个
+    std::vector<char> deleted(num, 0);
+    for (int i = 0; i < num; i += 7) {
+        index.markDelete(i);
+        deleted[i] = 1;
+    }
+
+    auto before = searchAll(index, queries, dim, k);
+    auto layout_before = layoutOf(index);
+    index.reorderGraph(method);
+    index.checkIntegrity();
+    auto after = searchAll(index, queries, dim, k);
+
+    std::string stage = std::string(name) + ": ";
+    expect(layoutOf(index) != layout_before, (stage + "layout changed").c_str());
+    expect(after == before, (stage + "search results unchanged by reorder").c_str());
+    bool excluded = true;
+    for (const auto& row : after) {
+        for (hnswlib::labeltype label : row) {
+            if (deleted[label]) {
+                excluded = false;
+            }
+        }
+    }
+    expect(excluded, (stage + "deleted labels excluded").c_str());
+    expect(index.getDeletedCount() == static_cast<size_t>((num + 6) / 7), (stage + "deleted count kept").c_str());
+    bool data_kept = true;
+    for (int i = 1; i < num; i += 97) {
+        if (i % 7 == 0) {
+            continue;
+        }
+        std::vector<float> stored = index.getDataByLabel<float>(i);
+        if (stored != std::vector<float>(&data[static_cast<size_t>(i) * dim], &data[static_cast<size_t>(i + 1) * dim])) {
+            data_kept = false;
+        }
+    }
+    expect(data_kept, (stage + "vectors follow their labels").c_str());
+
+    std::string path = std::string("hnsw_reorder_test_") + name + ".bin";
+    index.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> loaded(&space, path);
+    std::remove(path.c_str());
+    loaded.checkIntegrity();
+    expect(layoutOf(loaded) == layoutOf(index), (stage + "layout survives save/load").c_str());
+    expect(searchAll(loaded, queries, dim, k) == before, (stage + "search results survive save/load").c_str());
+
+    std::printf("%s: %zu queries, results and layout preserved\n", name, before.size());
+}
+
+int main() {
+    checkReorder(hnswlib::GraphOrder::BFS, "bfs");
+    checkReorder(hnswlib::GraphOrder::RCM, "rcm");
+    return failures == 0 ? 0 : 1;
+}
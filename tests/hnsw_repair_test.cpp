@@ -0,0 +1,76 @@
+// hnswlib 删除修复的回归测试：大比例删除后修复、再复用删除的槽位，
+// 每一步之后图都要通过 checkIntegrity，且所有存活节点都能从入口点到达
+#include "hnswlib/hnswlib.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static int failures = 0;
+
+static void expect(bool ok, const char* what) {
+    if (!ok) {
+        std::fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static void checkHealth(const hnswlib::HierarchicalNSW<float>& index, const char* stage) {
+    hnswlib::GraphHealth health = index.graphHealth();
+    std::printf("%s: %zu live, %zu deleted, %zu unreachable, %zu dangling links\n",
+                stage, health.elements, health.deleted, health.unreachable, health.dangling_links);
+    expect(health.unreachable == 0, stage);
+}
+
+int main() {
+    const int dim = 32;
+    const int num = 20000;
+    const int num_deleted = num / 2;
+
+    // 前几维方差大、其余方差小，删除后更容易出现只被已删除节点指向的存活节点
+    std::mt19937 rng(7);
+    std::normal_distribution<float> normal;
+    std::vector<float> data(static_cast<size_t>(num) * 2 * dim);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (i % dim < 4) ? normal(rng) * 3 : normal(rng) * 0.1f;
+    }
+
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> index(&space, num, 16, 100, 100, true);
+    for (int i = 0; i < num; i++) {
+        index.addPoint(&data[static_cast<size_t>(i) * dim], i, true);
+    }
+
+    std::vector<int> order(num);
+    for (int i = 0; i < num; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+    for (int i = 0; i < num_deleted; i++) {
+        index.markDelete(order[i]);
+    }
+
+    index.repairDeletedElements();
+    checkHealth(index, "after repair");
+    index.checkIntegrity();
+
+    // 新标签复用已删除的槽位，元素总数不变
+    for (int i = num; i < num + num_deleted; i++) {
+        index.addPoint(&data[static_cast<size_t>(i) * dim], i, true);
+    }
+    expect(index.getCurrentElementCount() == static_cast<size_t>(num), "deleted slots reused");
+    checkHealth(index, "after reuse");
+    index.checkIntegrity();
+
+    int found = 0;
+    for (int i = num; i < num + num_deleted; i += 10) {
+        auto result = index.searchKnnWithEf(&data[static_cast<size_t>(i) * dim], 1, 100);
+        if (!result.empty() && result.top().second == static_cast<size_t>(i)) {
+            found++;
+        }
+    }
+    std::printf("reused elements found by search: %d / %d\n", found, num_deleted / 10);
+    expect(found >= num_deleted / 10 * 9 / 10, "reused elements searchable");
+
+    return failures == 0 ? 0 : 1;
+}
@@ -4,6 +4,8 @@
 #include "include/vector_index.h"
 #include "include/vector_storage.h"
 #include "include/vector_engine.h"
+#include "include/tracing.h"
+#include "include/hnswlib/hnswlib.h"
 #include <filesystem>
 #include <stdexcept>
 
@@ -29,6 +31,70 @@ std::map<std::string, std::string> readConfigFile(const std::string& filename) {
     return config;
 }
 
+// 读取索引构建参数，配置文件中没有的项保留默认值
+IndexParams readIndexParams(const std::map<std::string, std::string>& config) {
+    IndexParams params;
+    auto readInt = [&config](const std::string& key, int& value) {
+        auto it = config.find(key);
+        if (it != config.end() && !it->second.empty()) {
+            value = std::stoi(it->second);
+        }
+    };
+    readInt("hnsw_m", params.hnsw_m);
+    readInt("ef_construction", params.ef_construction);
+    readInt("ef_search", params.ef_search);
+    readInt("nlist", params.nlist);
+    readInt("nprobe", params.nprobe);
+    readInt("pq_m", params.pq_m);
+    readInt("pq_nbits", params.pq_nbits);
+    readInt("search_threads", params.search_threads);
+    readInt("train_size", params.train_size);
+    readInt("memtable_size", params.memtable_size);
+    readInt("merge_factor", params.merge_factor);
+    readInt("rerank_factor", params.rerank_factor);
+    readInt("hnsw_repair_percent", params.hnsw_repair_percent);
+    auto it = config.find("segment_type");
+    if (it != config.end() && !it->second.empty()) {
+        params.segment_type = it->second;
+    }
+    it = config.find("graph_order");
+    if (it != config.end() && !it->second.empty()) {
+        params.graph_order = it->second;
+    }
+    // 与 /rebuildIndex 请求体里的校验一致，启动时就拒绝写错的取值
+    if (params.graph_order != "none" && params.graph_order != "bfs" && params.graph_order != "rcm") {
+        GlobalLogger->error("graph_order is illegal: {}", params.graph_order);
+        throw std::runtime_error("graph_order is illegal: " + params.graph_order);
+    }
+    it = config.find("hnsw_quantizer");
+    if (it != config.end() && !it->second.empty()) {
+        params.hnsw_quantizer = it->second;
+    }
+    return params;
+}
+
+// 读取 hnswlib 索引内存的大页与 NUMA 放置策略，非法取值直接报错
+hnswlib::MemoryPolicy readMemoryPolicy(const std::map<std::string, std::string>& config) {
+    hnswlib::MemoryPolicy policy;
+    auto it = config.find("huge_pages");
+    if (it != config.end()) {
+        policy.huge_pages = hnswlib::MemoryPolicy::parseHugePages(it->second);
+    }
+    it = config.find("numa_policy");
+    if (it != config.end()) {
+        policy.numa = hnswlib::MemoryPolicy::parseNumaMode(it->second);
+    }
+    it = config.find("numa_nodes");
+    if (it != config.end() && !it->second.empty()) {
+        try {
+            policy.numa_nodes = hnswlib::MemoryPolicy::parseNodeList(it->second);
+        } catch (const std::logic_error& e) {
+            throw std::runtime_error("numa_nodes is illegal: " + it->second);
+        }
+    }
+    return policy;
+}
+
 void reset_directory(const fs::path& dir_path) {
     try {
         // 如果目标文件夹已存在
@@ -69,10 +135,15 @@ int main(int argc, char* argv[]) {
     // 读取配置文件
     auto config = readConfigFile(config_file_path);
 
-    init_global_logger();
-    set_log_level(spdlog::level::debug);
+    init_global_logger(readLogOptions(config));
 
     GlobalLogger->info("Global logger initialized");
+    // 同一个二进制部署在不同代际的 CPU 上，记录本机实际选用的距离计算指令集
+    GlobalLogger->info("hnswlib distance kernels: {}", hnswlib::DescribeDistanceKernels());
+    // 必须在创建索引之前设置，之后分配的图内存才会按此策略放置
+    hnswlib::MemoryPolicy memory_policy = readMemoryPolicy(config);
+    hnswlib::setDefaultMemoryPolicy(memory_policy);
+    GlobalLogger->info("hnswlib index memory policy: {}", memory_policy.describe());
 
     std::string base_path = config["base_path"];
     // create_directory(base_path);
@@ -106,35 +177,18 @@ int main(int argc, char* argv[]) {
 
     if (server_type == ServerType::VDB || server_type == ServerType::INDEX) {
         IndexFactory* globalIndexFactory = getGlobalIndexFactory();
-        std::string index_type = config["index_type"];
-        if (index_type == "FLAT") {
-            IndexFactory::IndexType type = IndexFactory::IndexType::FLAT;
-            void* index = globalIndexFactory->init(type, dim, num_train);
-            vector_index = new VectorIndex(index, type);
-        } else if (index_type == "HNSWFLAT") {
-            IndexFactory::IndexType type = IndexFactory::IndexType::HNSWFLAT;
-            void* index = globalIndexFactory->init(type, dim, num_train);
-            vector_index = new VectorIndex(index, type);
-        } else if (index_type == "FLAT_GPU") {
-            IndexFactory::IndexType type = IndexFactory::IndexType::FLAT_GPU;
-            void* index = globalIndexFactory->init(type, dim, num_train);
-            vector_index = new VectorIndex(index, type);
-        } else if (index_type == "IVFPQ") {
-            IndexFactory::IndexType type = IndexFactory::IndexType::IVFPQ;
-            void* index = globalIndexFactory->init(type, dim, num_train);
-            vector_index = new VectorIndex(index, type);
-        } else if (index_type == "CAGRA") {
-            IndexFactory::IndexType type = IndexFactory::IndexType::CAGRA;
-            void* index = globalIndexFactory->init(type, dim, num_train);
-            vector_index = new VectorIndex(index, type);
-        } else if (index_type == "CUDAHNSW") {
-            IndexFactory::IndexType type = IndexFactory::IndexType::CUDAHNSW;
-            void* index = globalIndexFactory->init(type, dim, num_train);
-            vector_index = new VectorIndex(index, type);
-        } else {
+        IndexParams index_params = readIndexParams(config);
+        IndexFactory::IndexType type = IndexFactory::parseIndexType(config["index_type"]);
+        if (type == IndexFactory::IndexType::UNKNOWN) {
             throw std::runtime_error("index_type is illegal");
             exit(1);
         }
+        void* index = globalIndexFactory->init(type, dim, num_train, IndexFactory::MetricType::L2, index_params);
+        vector_index = new VectorIndex(index, type);
+        vector_index->setBuildParams(dim, num_train, index_params);
+        if (IndexFactory::needsTraining(vector_index->type, index_params)) {
+            vector_index->deferTraining(dim, IndexFactory::trainSize(vector_index->type, index_params));
+        }
     }
     if (server_type == ServerType::VDB || server_type == ServerType::STORAGE) {
         vector_storage = new VectorStorage(db_path);
@@ -142,6 +196,19 @@ int main(int argc, char* argv[]) {
 
     VectorEngine vector_engine(db_path, wal_path, vector_index, vector_storage, server_type);
     vector_engine.reloadDatabase();
+    // 搜索结果缓存，单位 MB，0 或未配置表示关闭
+    if (server_type != ServerType::STORAGE && !config["result_cache_mb"].empty() && std::stoi(config["result_cache_mb"]) > 0) {
+        vector_engine.enableResultCache(static_cast<size_t>(std::stoi(config["result_cache_mb"])) << 20);
+    }
+    if (config["search_single_flight"] == "0") {
+        vector_engine.enableSingleFlight(false);
+    }
+    // 请求追踪的采样率和保留条数，上游已采样的请求总会被记录
+    if (!config["trace_sample_rate"].empty() || !config["trace_buffer_size"].empty()) {
+        double sample_rate = config["trace_sample_rate"].empty() ? 0.01 : std::stod(config["trace_sample_rate"]);
+        size_t buffer_size = config["trace_buffer_size"].empty() ? 256 : std::stoul(config["trace_buffer_size"]);
+        Tracer::instance().configure(sample_rate, buffer_size);
+    }
     RaftStuff raft_stuff(node_id, endpoint, port, &vector_engine);
 
     // 创建并启动HTTP服务器
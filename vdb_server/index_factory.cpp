@@ -6,10 +6,15 @@
 #include "include/cagra_index.h"
 #include "include/logger.h"
 #include "include/cuda_hnsw_index.h"
+#include "include/hnsw_sq_index.h"
+#include "include/ivf_cpu_index.h"
+#include "include/segmented_index.h"
 #include <faiss/MetricType.h>
 #include <faiss/IndexFlat.h>
 #include <faiss/IndexHNSW.h>
 #include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexScalarQuantizer.h>
+#include <faiss/IndexIVFFlat.h>
 #include <faiss/gpu/GpuIndexIVFPQ.h>
 #include <faiss/gpu/GpuIndexCagra.h>
 #include <faiss/IndexIDMap.h>
@@ -19,6 +24,9 @@
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <random>
 #include <ctime>
+#include <algorithm>
+#include <stdexcept>
+#include <map>
  
 int getRandomIntInRange(int min, int max) {
     // 创建一个随机数生成器
@@ -29,13 +37,10 @@ int getRandomIntInRange(int min, int max) {
     return dis(gen); // 生成并返回随机数
 }
 
-std::vector<float> randVecs(size_t num, size_t dim) {
-    std::vector<float> v(num * dim);
-    auto seed = static_cast<unsigned>(std::time(0));
-
-    faiss::float_rand(v.data(), v.size(), seed);
-
-    return v;
+// faiss 的 k-means 在每个中心少于 39 个样本时效果变差，多于 256 个时会自行下采样，
+// 因此训练集大小限制在这个区间内
+int ivfTrainSize(int num_train, int num_centroids) {
+    return std::min(std::max(num_train, 39 * num_centroids), 256 * num_centroids);
 }
 
 namespace {
@@ -46,24 +51,18 @@ IndexFactory* getGlobalIndexFactory() {
     return &globalIndexFactory;
 }
 
-void* IndexFactory::init(IndexType type, int dim, int num_add, MetricType metric) {
+void* IndexFactory::init(IndexType type, int dim, int num_add, MetricType metric, const IndexParams& params) {
     faiss::MetricType faiss_metric = (metric == MetricType::L2) ? faiss::METRIC_L2 : faiss::METRIC_INNER_PRODUCT;
-    int num_train = num_add;
     switch (type) {
         case IndexType::FLAT: {
             FlatIndex* index = new FlatIndex(new faiss::IndexFlat(dim, faiss_metric));
-            std::vector<float> add_vec = randVecs(num_add, dim);
-            index->add(num_add, add_vec);
             return index;
         }
         case IndexType::HNSWFLAT: {
-            int M = 16;
-            faiss::IndexHNSWFlat* hnsw_index = new faiss::IndexHNSWFlat(dim, M);
-            hnsw_index->hnsw.efConstruction = 200;
-            hnsw_index->hnsw.efSearch = 50;
+            faiss::IndexHNSWFlat* hnsw_index = new faiss::IndexHNSWFlat(dim, params.hnsw_m);
+            hnsw_index->hnsw.efConstruction = params.ef_construction;
+            hnsw_index->hnsw.efSearch = params.ef_search;
             HnswFlatIndex* index = new HnswFlatIndex(hnsw_index);
-            std::vector<float> add_vec = randVecs(num_add, dim);
-            index->add(num_add, add_vec);
             return index;
         }
         case IndexType::FLAT_GPU: {
@@ -76,8 +75,6 @@ void* IndexFactory::init(IndexType type, int dim, int num_add, MetricType metric
             config.device = device;
             config.useFloat16 = false;
             FlatGPUIndex* index = new FlatGPUIndex(new faiss::gpu::GpuIndexFlat(&res, dim, faiss_metric, config));
-            std::vector<float> add_vec = randVecs(num_add, dim);
-            index->add(num_add, add_vec);
             return index;
         }
         case IndexType::IVFPQ: {
@@ -106,11 +103,8 @@ void* IndexFactory::init(IndexType type, int dim, int num_add, MetricType metric
             config.interleavedLayout = false;
             config.use_cuvs = true;
 
+            // 训练推迟到收集到足够的真实向量之后，见 VectorIndex::deferTraining
             IVFPQIndex* index = new IVFPQIndex(new faiss::gpu::GpuIndexIVFPQ(&res, &cpuIndex, config));
-            std::vector<float> train_vec = randVecs(num_train, dim);
-            index->train(num_train, train_vec);
-            // std::vector<float> add_vec = randVecs(num_add, dim);
-            // index->add(num_add, add_vec);
             return index;
         }
         case IndexType::CAGRA: {
@@ -133,24 +127,135 @@ void* IndexFactory::init(IndexType type, int dim, int num_add, MetricType metric
             cpu_index->base_level_only = false;
             cpu_index->hnsw.efConstruction = 200;
             CAGRAIndex* index = new CAGRAIndex(cpu_index, gpu_index);
-            std::vector<float> train_vec = randVecs(num_train, dim);
-            index->train(num_train, train_vec);
-            // std::vector<float> add_vec = randVecs(num_add, dim);
-            // index->add(num_add, add_vec);
             return index;
         }
         case IndexType::CUDAHNSW: {
-            // return new CUDAHNSWIndex(dim, num_train);
-            CUDAHNSWIndex *cuindex = new CUDAHNSWIndex(dim, num_add, 16, 200);
-            std::vector<float> add_vec = randVecs(num_add, dim);
-            std::vector<long> labels(num_add);
-            for (int i = 0; i < num_add; i++) {
-                labels[i] = i;
-            }
-            cuindex->insert_vectors_batch(add_vec, labels);
+            // num_add 作为图的初始容量
+            CUDAHNSWIndex *cuindex = new CUDAHNSWIndex(dim, num_add, params.hnsw_m, params.ef_construction, params.ef_search, params.hnsw_quantizer, params.rerank_factor, params.hnsw_repair_percent);
             return cuindex;
         }
+        case IndexType::HNSWSQ8:
+        case IndexType::HNSWFP16: {
+            faiss::ScalarQuantizer::QuantizerType qtype = type == IndexType::HNSWSQ8 ? faiss::ScalarQuantizer::QT_8bit : faiss::ScalarQuantizer::QT_fp16;
+            faiss::IndexHNSWSQ* hnsw_index = new faiss::IndexHNSWSQ(dim, qtype, params.hnsw_m, faiss_metric);
+            hnsw_index->hnsw.efConstruction = params.ef_construction;
+            hnsw_index->hnsw.efSearch = params.ef_search;
+            HnswSQIndex* index = new HnswSQIndex(hnsw_index);
+            return index;
+        }
+        case IndexType::IVFFLAT:
+        case IndexType::IVFPQ_CPU:
+        case IndexType::IVFSQ8: {
+            if (type == IndexType::IVFPQ_CPU) {
+                if (params.pq_m <= 0 || dim % params.pq_m != 0) {
+                    throw std::runtime_error("pq_m must be a positive divisor of dim");
+                }
+                if (params.pq_nbits <= 0 || params.pq_nbits > 16) {
+                    throw std::runtime_error("pq_nbits must be in [1, 16]");
+                }
+            }
+
+            faiss::Index* quantizer = new faiss::IndexFlat(dim, faiss_metric);
+            faiss::IndexIVF* ivf_index = nullptr;
+            if (type == IndexType::IVFFLAT) {
+                ivf_index = new faiss::IndexIVFFlat(quantizer, dim, params.nlist, faiss_metric);
+            } else if (type == IndexType::IVFPQ_CPU) {
+                ivf_index = new faiss::IndexIVFPQ(quantizer, dim, params.nlist, params.pq_m, params.pq_nbits, faiss_metric);
+            } else {
+                ivf_index = new faiss::IndexIVFScalarQuantizer(quantizer, dim, params.nlist, faiss::ScalarQuantizer::QT_8bit, faiss_metric);
+            }
+            ivf_index->own_fields = true;
+            ivf_index->nprobe = params.nprobe;
+            // 在线服务每次只查一个向量，按探查的倒排表并行而不是按查询并行
+            ivf_index->parallel_mode = params.search_threads > 1 ? 1 : 0;
+
+            IVFCPUIndex* index = new IVFCPUIndex(ivf_index, params.search_threads);
+            return index;
+        }
+        case IndexType::SEGMENTED: {
+            if (params.segment_type != "HNSWFLAT" && params.segment_type != "IVFFLAT" && params.segment_type != "FLAT") {
+                throw std::runtime_error("segment_type must be one of HNSWFLAT, IVFFLAT, FLAT");
+            }
+            SegmentedIndex* index = new SegmentedIndex(dim, faiss_metric, params);
+            return index;
+        }
         default:
             return nullptr;
     }
+}
+
+namespace {
+
+const std::map<std::string, IndexFactory::IndexType>& indexTypeNames() {
+    using IndexType = IndexFactory::IndexType;
+    static const std::map<std::string, IndexType> types = {
+        {"FLAT", IndexType::FLAT},
+        {"HNSWFLAT", IndexType::HNSWFLAT},
+        {"FLAT_GPU", IndexType::FLAT_GPU},
+        {"IVFPQ", IndexType::IVFPQ},
+        {"CAGRA", IndexType::CAGRA},
+        {"CUDAHNSW", IndexType::CUDAHNSW},
+        {"HNSWSQ8", IndexType::HNSWSQ8},
+        {"HNSWFP16", IndexType::HNSWFP16},
+        {"IVFSQ8", IndexType::IVFSQ8},
+        {"IVFFLAT", IndexType::IVFFLAT},
+        {"IVFPQ_CPU", IndexType::IVFPQ_CPU},
+        {"SEGMENTED", IndexType::SEGMENTED},
+    };
+    return types;
+}
+
+} // namespace
+
+IndexFactory::IndexType IndexFactory::parseIndexType(const std::string& name) {
+    auto it = indexTypeNames().find(name);
+    return it == indexTypeNames().end() ? IndexType::UNKNOWN : it->second;
+}
+
+std::string IndexFactory::typeName(IndexType type) {
+    for (const auto& item : indexTypeNames()) {
+        if (item.second == type) {
+            return item.first;
+        }
+    }
+    return "UNKNOWN";
+}
+
+bool IndexFactory::needsTraining(IndexType type, const IndexParams& params) {
+    switch (type) {
+        case IndexType::IVFPQ:
+        case IndexType::CAGRA:
+        case IndexType::HNSWSQ8:
+        case IndexType::IVFSQ8:
+        case IndexType::IVFFLAT:
+        case IndexType::IVFPQ_CPU:
+            return true;
+        case IndexType::CUDAHNSW:
+            // sq8 需要每一维的取值范围
+            return params.hnsw_quantizer == "sq8";
+        default:
+            return false;
+    }
+}
+
+int IndexFactory::trainSize(IndexType type, const IndexParams& params) {
+    if (params.train_size > 0) {
+        return params.train_size;
+    }
+    // 默认按每个聚类中心 100 个样本估算
+    switch (type) {
+        case IndexType::IVFFLAT:
+        case IndexType::IVFSQ8:
+            return ivfTrainSize(100 * params.nlist, params.nlist);
+        case IndexType::IVFPQ_CPU: {
+            int num_centroids = std::max(params.nlist, 1 << params.pq_nbits);
+            return ivfTrainSize(100 * num_centroids, num_centroids);
+        }
+        case IndexType::IVFPQ:
+            // GPU IVFPQ 固定 256 个中心
+            return ivfTrainSize(100 * 256, 256);
+        default:
+            // SQ8 的取值范围和 CAGRA 的初始图
+            return 10000;
+    }
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "include/vdb_http_server.h"
 #include "include/logger.h"
+#include "include/metrics.h"
+#include "include/tracing.h"
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/writer.h"
 
@@ -25,6 +27,16 @@ VdbHttpServer::VdbHttpServer(const std::string& host, int port, VectorEngine* ve
     server.Get("/listNode", [this](const httplib::Request& req, httplib::Response& res) {
         listNodeHandler(req, res);
     });
+    server.Post("/rebuildIndex", [this](const httplib::Request& req, httplib::Response& res) {
+        rebuildIndexHandler(req, res);
+    });
+    server.Get("/rebuildIndex", [this](const httplib::Request& req, httplib::Response& res) {
+        rebuildStatusHandler(req, res);
+    });
+    server.Get("/health", [this](const httplib::Request& req, httplib::Response& res) {
+        healthHandler(req, res);
+    });
+    instrumentHttpServer(server, "vdb", {"/search", "/insert", "/query", "/insertBatch", "/addFollower", "/snapshot", "/listNode", "/rebuildIndex", "/health"});
 }
 
 void VdbHttpServer::start() {
@@ -43,6 +55,8 @@ bool VdbHttpServer::isRequestValid(const rapidjson::Document& json_request, Chec
             return json_request.HasMember(REQUEST_OPERATION) && json_request.HasMember(REQUEST_OBJECTS);
         case CheckType::ADD_FOLLOWER:
             return json_request.HasMember(REQUEST_OPERATION) && json_request.HasMember(REQUEST_NODE_ID) && json_request.HasMember(REQUEST_ENDPOINT);
+        case CheckType::REBUILD_INDEX:
+            return !json_request.HasMember(REQUEST_INDEX_TYPE) || json_request[REQUEST_INDEX_TYPE].IsString();
         default:
             return false;
     }
@@ -65,13 +79,14 @@ void VdbHttpServer::setErrorJsonResponse(httplib::Response&res, int error_code,
 }
 
 void VdbHttpServer::searchHandler(const httplib::Request& req, httplib::Response& res) {
-    // auto start = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-    GlobalLogger->debug("Received search request");
-    // GlobalLogger->debug("接到请求的时间:{}", start);
+    LOG_DEBUG("Received search request");
 
     // 解析json请求
     rapidjson::Document json_request;
-    json_request.Parse(req.body.c_str());
+    {
+        TraceSpan span("parse");
+        json_request.Parse(req.body.c_str());
+    }
 
     // // 打印用户的输入参数
     // GlobalLogger->info("Search request parameters: {}", req.body);
@@ -99,12 +114,17 @@ void VdbHttpServer::searchHandler(const httplib::Request& req, httplib::Response
     }
     int k = json_request[REQUEST_K].GetInt();
     
-    GlobalLogger->debug("Query parameters: k = {}", k);
+    LOG_DEBUG("Query parameters: k = {}", k);
 
     // 使用 VectorIndex 的 search 接口执行查询
-    std::pair<std::vector<long>, std::vector<float>> results = vector_engine_->search(json_request);
+    std::pair<std::vector<long>, std::vector<float>> results;
+    {
+        TraceSpan span("engine.search");
+        results = vector_engine_->search(json_request);
+    }
 
     // 将结果转换为JSON
+    TraceSpan serialize("serialize");
     rapidjson::Document json_response;
     json_response.SetObject();
     rapidjson::Document::AllocatorType& allocator = json_response.GetAllocator();
@@ -132,13 +152,14 @@ void VdbHttpServer::searchHandler(const httplib::Request& req, httplib::Response
 }
 
 void VdbHttpServer::insertHandler(const httplib::Request& req, httplib::Response& res) {
-    // auto start = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-    GlobalLogger->debug("Received insert request");
-    // GlobalLogger->debug("接到请求的时间:{}", start);
+    LOG_DEBUG("Received insert request");
 
     // 解析JSON请求
     rapidjson::Document json_request;
-    json_request.Parse(req.body.c_str());
+    {
+        TraceSpan span("parse");
+        json_request.Parse(req.body.c_str());
+    }
 
     // // 打印用户的输入参数
     // GlobalLogger->info("Insert request parameters: {}", req.body);
@@ -161,9 +182,14 @@ void VdbHttpServer::insertHandler(const httplib::Request& req, httplib::Response
 
     // vector_engine_->insert(json_request);
     // vector_engine_->writeWalLog("insert", json_request);
-    auto cmd_result = raft_stuff_->appendEntries(req.body);
+    // 阻塞到日志提交并在本节点应用，状态机在 raft 线程上执行，其内部阶段见 /metrics
+    ptr<cmd_result<ptr<buffer>>> cmd_result;
+    {
+        TraceSpan span("raft.commit");
+        cmd_result = raft_stuff_->appendEntries(req.body);
+    }
     if (cmd_result->get_result_code() == 0) {
-        GlobalLogger->debug("insert successfully");
+        LOG_DEBUG("insert successfully");
         rapidjson::Document json_response;
         json_response.SetObject();
         rapidjson::Document::AllocatorType& allocator = json_response.GetAllocator();
@@ -172,7 +198,7 @@ void VdbHttpServer::insertHandler(const httplib::Request& req, httplib::Response
         json_response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
         setJsonResponse(json_response, res);
     } else {
-        GlobalLogger->debug("insert error: {}", cmd_result->get_result_str());
+        LOG_DEBUG("insert error: {}", cmd_result->get_result_str());
         res.status = 400;
         setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, cmd_result->get_result_str());
         return;
@@ -190,11 +216,14 @@ void VdbHttpServer::insertHandler(const httplib::Request& req, httplib::Response
 }
 
 void VdbHttpServer::queryHandler(const httplib::Request& req, httplib::Response& res) {
-    GlobalLogger->debug("Received query request");
+    LOG_DEBUG("Received query request");
 
     // 解析JSON请求
     rapidjson::Document json_request;
-    json_request.Parse(req.body.c_str());
+    {
+        TraceSpan span("parse");
+        json_request.Parse(req.body.c_str());
+    }
 
     // // 打印用户的输入参数
     // GlobalLogger->info("Insert request parameters: {}", req.body);
@@ -215,7 +244,11 @@ void VdbHttpServer::queryHandler(const httplib::Request& req, httplib::Response&
         return;
     }
 
-    rapidjson::Document result = vector_engine_->query(json_request);
+    rapidjson::Document result;
+    {
+        TraceSpan span("storage.query");
+        result = vector_engine_->query(json_request);
+    }
 
     // 设置响应
     rapidjson::Document json_response;
@@ -234,11 +267,14 @@ void VdbHttpServer::queryHandler(const httplib::Request& req, httplib::Response&
 }
 
 void VdbHttpServer::insertBatchHandler(const httplib::Request& req, httplib::Response& res) {
-    GlobalLogger->debug("Received insert batch request");
+    LOG_DEBUG("Received insert batch request");
 
     // 解析JSON请求
     rapidjson::Document json_request;
-    json_request.Parse(req.body.c_str());
+    {
+        TraceSpan span("parse");
+        json_request.Parse(req.body.c_str());
+    }
 
     // // 打印用户的输入参数
     // GlobalLogger->info("Insert request parameters: {}", req.body);
@@ -261,9 +297,14 @@ void VdbHttpServer::insertBatchHandler(const httplib::Request& req, httplib::Res
 
     // vector_engine_->insert_batch(json_request);
     // vector_engine_->writeWalLog("insert_batch", json_request);
-    auto cmd_result = raft_stuff_->appendEntries(req.body);
+    // 阻塞到日志提交并在本节点应用，状态机在 raft 线程上执行，其内部阶段见 /metrics
+    ptr<cmd_result<ptr<buffer>>> cmd_result;
+    {
+        TraceSpan span("raft.commit");
+        cmd_result = raft_stuff_->appendEntries(req.body);
+    }
     if (cmd_result->get_result_code() == 0) {
-        GlobalLogger->debug("insert batch successfully");
+        LOG_DEBUG("insert batch successfully");
         rapidjson::Document json_response;
         json_response.SetObject();
         rapidjson::Document::AllocatorType& allocator = json_response.GetAllocator();
@@ -272,7 +313,7 @@ void VdbHttpServer::insertBatchHandler(const httplib::Request& req, httplib::Res
         json_response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
         setJsonResponse(json_response, res);
     } else {
-        GlobalLogger->debug("insert batch error: {}", cmd_result->get_result_str());
+        LOG_DEBUG("insert batch error: {}", cmd_result->get_result_str());
         res.status = 400;
         setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, cmd_result->get_result_str());
         return;
@@ -290,11 +331,14 @@ void VdbHttpServer::insertBatchHandler(const httplib::Request& req, httplib::Res
 }
 
 void VdbHttpServer::addFollowerHandler(const httplib::Request& req, httplib::Response& res) {
-    GlobalLogger->debug("Received addFollower request");
+    LOG_DEBUG("Received addFollower request");
 
     // 解析JSON请求
     rapidjson::Document json_request;
-    json_request.Parse(req.body.c_str());
+    {
+        TraceSpan span("parse");
+        json_request.Parse(req.body.c_str());
+    }
 
     // 检查JSON文档是否为有效对象
     if (!json_request.IsObject()) {
@@ -327,7 +371,7 @@ void VdbHttpServer::addFollowerHandler(const httplib::Request& req, httplib::Res
     // 调用 RaftStuff 的 addSrv 方法将新的follower节点添加到集群中
     auto cmd_result = raft_stuff_->addSrv(node_id, endpoint).get();
     if (cmd_result->get_result_code() == 0) {
-        GlobalLogger->debug("addFollower successfully");
+        LOG_DEBUG("addFollower successfully");
         rapidjson::Document json_response;
         json_response.SetObject();
         rapidjson::Document::AllocatorType& allocator = json_response.GetAllocator();
@@ -336,7 +380,7 @@ void VdbHttpServer::addFollowerHandler(const httplib::Request& req, httplib::Res
         json_response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
         setJsonResponse(json_response, res);
     } else {
-        GlobalLogger->debug("addFollower error: {}", cmd_result->get_result_str());
+        LOG_DEBUG("addFollower error: {}", cmd_result->get_result_str());
         res.status = 400;
         setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, cmd_result->get_result_str());
         return;
@@ -344,7 +388,7 @@ void VdbHttpServer::addFollowerHandler(const httplib::Request& req, httplib::Res
 }
 
 void VdbHttpServer::listNodeHandler(const httplib::Request& req, httplib::Response& res) {
-    GlobalLogger->debug("Received listNode request");
+    LOG_DEBUG("Received listNode request");
 
     // 获取所有节点信息
     auto nodes_info = raft_stuff_->getAllNodesInfo();
@@ -372,7 +416,7 @@ void VdbHttpServer::listNodeHandler(const httplib::Request& req, httplib::Respon
 }
 
 void VdbHttpServer::snapshotHandler(const httplib::Request& req, httplib::Response& res) {
-    GlobalLogger->debug("Received snapshot request");
+    LOG_DEBUG("Received snapshot request");
 
     vector_engine_->takeSnapshot();
 
@@ -383,4 +427,69 @@ void VdbHttpServer::snapshotHandler(const httplib::Request& req, httplib::Respon
     // 设置响应
     json_response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
     setJsonResponse(json_response, res);
-}
\ No newline at end of file
+}
+
+void VdbHttpServer::rebuildIndexHandler(const httplib::Request& req, httplib::Response& res) {
+    LOG_DEBUG("Received rebuildIndex request");
+
+    // 解析JSON请求，请求体为空时按当前索引类型和参数重建
+    rapidjson::Document json_request;
+    if (req.body.empty()) {
+        json_request.SetObject();
+    } else {
+        json_request.Parse(req.body.c_str());
+    }
+
+    // 检查JSON文档是否为有效对象
+    if (!json_request.IsObject()) {
+        GlobalLogger->error("Invalid JSON request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Invalid JSON request");
+        return;
+    }
+
+    // 检查请求的合法性
+    if (!isRequestValid(json_request, CheckType::REBUILD_INDEX)) {
+        GlobalLogger->error("Missing parameter in the request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Missing parameter in the request");
+        return;
+    }
+
+    try {
+        vector_engine_->rebuildIndex(json_request);
+    } catch (const std::exception& e) {
+        GlobalLogger->error("rebuildIndex error: {}", e.what());
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, e.what());
+        return;
+    }
+
+    rapidjson::Document json_response;
+    json_response.SetObject();
+    rapidjson::Document::AllocatorType& allocator = json_response.GetAllocator();
+
+    // 设置响应
+    json_response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
+    setJsonResponse(json_response, res);
+}
+
+void VdbHttpServer::rebuildStatusHandler(const httplib::Request& req, httplib::Response& res) {
+    rapidjson::Document json_response;
+    json_response.SetObject();
+    rapidjson::Document::AllocatorType& allocator = json_response.GetAllocator();
+
+    // 设置响应
+    json_response.AddMember("rebuilding", vector_engine_->isRebuilding(), allocator);
+    json_response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
+    setJsonResponse(json_response, res);
+}
+
+void VdbHttpServer::healthHandler(const httplib::Request& req, httplib::Response& res) {
+    // 供 proxy 主动探测，只确认进程能处理请求，不访问索引和存储
+    rapidjson::Document json_response;
+    json_response.SetObject();
+    rapidjson::Document::AllocatorType& allocator = json_response.GetAllocator();
+    json_response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
+    setJsonResponse(json_response, res);
+}
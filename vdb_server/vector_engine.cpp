@@ -4,14 +4,18 @@
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
 #include "logger.h"
+#include "include/tracing.h"
 #include "vdb_http_server.h"
 #include <mutex>
 
-int num = 0;
-int64_t total;
-std::mutex mu;
-
-VectorEngine::VectorEngine(std::string db_path, std::string wal_path, VectorIndex* vector_index, VectorStorage* vector_storage, ServerType server_type) :db_path(db_path), vector_index_(vector_index), vector_storage_(vector_storage), server_type(server_type) {
+VectorEngine::VectorEngine(std::string db_path, std::string wal_path, VectorIndex* vector_index, VectorStorage* vector_storage, ServerType server_type) :db_path(db_path), vector_index_(vector_index), vector_storage_(vector_storage), server_type(server_type), single_flight_(new SingleFlight<SearchResult>()),
+  single_flight_shared_(MetricsRegistry::instance().counter("vdb_search_single_flight_shared_total", "Searches answered by an identical in-flight search")) {
+    for (const char* op : {"insert", "insert_batch"}) {
+        for (const char* stage : {"index", "storage"}) {
+            write_latency_[std::string(op) + "/" + stage] = &MetricsRegistry::instance().histogram("vdb_write_stage_seconds", "Write latency per stage",
+                std::string("op=\"") + op + "\",stage=\"" + stage + "\"");
+        }
+    }
     if (vector_index_ != nullptr) {
         vector_index_->wal_init(wal_path);
     }
@@ -31,19 +35,56 @@ std::pair<std::vector<long>, std::vector<float>> VectorEngine::search(const rapi
         data.push_back(q.GetFloat());
     }
     int k = json_request[REQUEST_K].GetInt();
+    // 可选的单次请求搜索参数
+    int ef_search = 0;
+    if (json_request.HasMember(REQUEST_EF_SEARCH) && json_request[REQUEST_EF_SEARCH].IsInt()) {
+        ef_search = json_request[REQUEST_EF_SEARCH].GetInt();
+    }
+    int nprobe = 0;
+    if (json_request.HasMember(REQUEST_NPROBE) && json_request[REQUEST_NPROBE].IsInt()) {
+        nprobe = json_request[REQUEST_NPROBE].GetInt();
+    }
 
-    // auto start = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-    // auto res = vector_index_->search(data, k);
-    // auto end = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-    // GlobalLogger->debug("开始查询的时间:{}, 结束查询的时间:{}", start, end);
-    auto start = std::chrono::high_resolution_clock::now();
-    auto res = vector_index_->search(data, k);
-    auto end = std::chrono::high_resolution_clock::now();
-
-    std::lock_guard<std::mutex> lock(mu);
-    num++;
-    total += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-    GlobalLogger->debug("平均时间:{}", total / num);
+    // 缓存和合并请求的键为查询向量的原始字节加上搜索参数，完全相同的请求才会命中
+    std::string cache_key;
+    uint64_t version = 0;
+    if (result_cache_ || single_flight_) {
+        cache_key.reserve(data.size() * sizeof(float) + 3 * sizeof(int));
+        cache_key.append(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(float));
+        for (int param : {k, ef_search, nprobe}) {
+            cache_key.append(reinterpret_cast<const char*>(&param), sizeof(param));
+        }
+        version = dataVersion();
+    }
+    if (result_cache_) {
+        TraceSpan span("cache.lookup");
+        SearchResult cached;
+        if (result_cache_->get(cache_key, version, cached)) {
+            return cached;
+        }
+    }
+
+    auto run_search = [&]() {
+        ScopedTimer timer(searchLatency(vector_index_->type));
+        TraceSpan span("index.search");
+        return vector_index_->search(data, k, ef_search, nprobe);
+    };
+    SearchResult res;
+    if (single_flight_) {
+        // 同一版本下相同的并发搜索只执行一次，其余请求等待并共享结果
+        std::string flight_key = cache_key;
+        flight_key.append(reinterpret_cast<const char*>(&version), sizeof(version));
+        bool shared = false;
+        res = single_flight_->run(flight_key, run_search, &shared);
+        if (shared) {
+            single_flight_shared_.add();
+        }
+    } else {
+        res = run_search();
+    }
+    if (result_cache_) {
+        result_cache_->put(cache_key, version, res);
+    }
     return res;
 }
     
@@ -71,19 +112,16 @@ void VectorEngine::insert(const rapidjson::Document& json_request) {
     // auto end = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
     // GlobalLogger->debug("开始插入的时间:{}, 结束插入的时间:{}", start, end);
 
-    auto start = std::chrono::high_resolution_clock::now();
     if (server_type == ServerType::INDEX || server_type == ServerType::VDB) {
+        ScopedTimer timer(*write_latency_.at("insert/index"));
         vector_index_->insert(data, id);
     }
     if (server_type == ServerType::STORAGE || server_type == ServerType::VDB) {
+        ScopedTimer timer(*write_latency_.at("insert/storage"));
         vector_storage_->insert(id, json_request);
     }
-    auto end = std::chrono::high_resolution_clock::now();
-
-    std::lock_guard<std::mutex> lock(mu);
-    num++;
-    total += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-    GlobalLogger->debug("平均时间:{}", total / num);
+    // 写入生效之后再递增版本，之前开始的搜索缓存的结果都会失效
+    write_version_++;
 }
 
 rapidjson::Document VectorEngine::query(const rapidjson::Document& json_request) {
@@ -121,11 +159,14 @@ void VectorEngine::insert_batch(const rapidjson::Document& json_request) {
     }
 
     if (server_type == ServerType::INDEX || server_type == ServerType::VDB) {
+        ScopedTimer timer(*write_latency_.at("insert_batch/index"));
         vector_index_->insert_batch(vectors, ids);
     }
     if (server_type == ServerType::STORAGE || server_type == ServerType::VDB) {
+        ScopedTimer timer(*write_latency_.at("insert_batch/storage"));
         vector_storage_->insert_batch(ids, json_request);
     }
+    write_version_++;
 }
 
 void VectorEngine::reloadDatabase() {
@@ -163,6 +204,7 @@ void VectorEngine::reloadDatabase() {
         operation_type.clear();
         vector_index_->readNextWalLog(&operation_type, &json_data);
     }
+    vector_index_->setAppliedLogID(vector_index_->getID());
 }
 
 void VectorEngine::writeWalLog(const std::string& operation_type, const rapidjson::Document& json_data) {
@@ -198,9 +240,110 @@ void VectorEngine::loadSnapshot() {
     vector_index_->takeSnapshot();
 }
 
+void VectorEngine::rebuildIndex(const rapidjson::Document& json_request) {
+    if (server_type == ServerType::STORAGE) {
+        throw std::runtime_error("This is storage node, cannot rebuild index!");
+    }
+    IndexFactory::IndexType type = vector_index_->type;
+    if (json_request.HasMember(REQUEST_INDEX_TYPE) && json_request[REQUEST_INDEX_TYPE].IsString()) {
+        type = IndexFactory::parseIndexType(json_request[REQUEST_INDEX_TYPE].GetString());
+        if (type == IndexFactory::IndexType::UNKNOWN) {
+            throw std::runtime_error("index_type is illegal");
+        }
+    }
+
+    // 请求中没有给出的参数沿用当前索引的参数
+    IndexParams params = vector_index_->getBuildParams();
+    auto readInt = [&json_request](const char* key, int& value) {
+        if (json_request.HasMember(key) && json_request[key].IsInt()) {
+            value = json_request[key].GetInt();
+        }
+    };
+    readInt("hnsw_m", params.hnsw_m);
+    readInt("ef_construction", params.ef_construction);
+    readInt(REQUEST_EF_SEARCH, params.ef_search);
+    readInt("nlist", params.nlist);
+    readInt(REQUEST_NPROBE, params.nprobe);
+    readInt("pq_m", params.pq_m);
+    readInt("pq_nbits", params.pq_nbits);
+    readInt("search_threads", params.search_threads);
+    readInt("train_size", params.train_size);
+    readInt("memtable_size", params.memtable_size);
+    readInt("merge_factor", params.merge_factor);
+    readInt("rerank_factor", params.rerank_factor);
+    readInt("hnsw_repair_percent", params.hnsw_repair_percent);
+    if (json_request.HasMember("segment_type") && json_request["segment_type"].IsString()) {
+        params.segment_type = json_request["segment_type"].GetString();
+    }
+    if (json_request.HasMember("graph_order") && json_request["graph_order"].IsString()) {
+        params.graph_order = json_request["graph_order"].GetString();
+    }
+    if (params.graph_order != "none" && params.graph_order != "bfs" && params.graph_order != "rcm") {
+        throw std::runtime_error("graph_order is illegal");
+    }
+    if (json_request.HasMember("hnsw_quantizer") && json_request["hnsw_quantizer"].IsString()) {
+        params.hnsw_quantizer = json_request["hnsw_quantizer"].GetString();
+    }
+    if (params.hnsw_quantizer != "none" && params.hnsw_quantizer != "sq8" && params.hnsw_quantizer != "fp16" && params.hnsw_quantizer != "binary") {
+        throw std::runtime_error("hnsw_quantizer is illegal");
+    }
+    if (params.rerank_factor < 0) {
+        throw std::runtime_error("rerank_factor is illegal");
+    }
+    if (params.hnsw_repair_percent < 0 || params.hnsw_repair_percent > 100) {
+        throw std::runtime_error("hnsw_repair_percent is illegal");
+    }
+
+    vector_index_->rebuild(type, params);
+}
+
+bool VectorEngine::isRebuilding() const {
+    if (server_type == ServerType::STORAGE) {
+        return false;
+    }
+    return vector_index_->isRebuilding();
+}
+
+void VectorEngine::setAppliedLogID(uint64_t log_id) {
+    if (server_type == ServerType::STORAGE) {
+        return;
+    }
+    vector_index_->setAppliedLogID(log_id);
+}
+
 int64_t VectorEngine::getStartIndexID() const {
     if (server_type == ServerType::STORAGE) {
         return 1;
     }
     return vector_index_->getID();
-}
\ No newline at end of file
+}
+
+void VectorEngine::enableResultCache(size_t capacity_bytes) {
+    result_cache_.reset(new ResultCache<SearchResult>(capacity_bytes, [](const SearchResult& result) {
+        return result.first.size() * sizeof(long) + result.second.size() * sizeof(float);
+    }));
+    ResultCache<SearchResult>* cache = result_cache_.get();
+    MetricsRegistry::instance().gauge("vdb_search_cache_hits", "Search result cache hits", "", [cache] { return static_cast<double>(cache->hits()); });
+    MetricsRegistry::instance().gauge("vdb_search_cache_misses", "Search result cache misses", "", [cache] { return static_cast<double>(cache->misses()); });
+    GlobalLogger->info("Search result cache enabled, capacity {} bytes", capacity_bytes);
+}
+
+uint64_t VectorEngine::dataVersion() const {
+    return write_version_.load() + vector_index_->generation();
+}
+
+void VectorEngine::enableSingleFlight(bool enabled) {
+    single_flight_.reset(enabled ? new SingleFlight<SearchResult>() : nullptr);
+}
+
+Histogram& VectorEngine::searchLatency(IndexFactory::IndexType type) {
+    // 每种索引类型的直方图只在第一次使用时注册，之后无锁读取
+    size_t slot = static_cast<size_t>(type) % search_latency_.size();
+    Histogram* histogram = search_latency_[slot].load(std::memory_order_acquire);
+    if (histogram == nullptr) {
+        histogram = &MetricsRegistry::instance().histogram("vdb_index_search_seconds", "Index search latency",
+            "index_type=\"" + IndexFactory::typeName(type) + "\"");
+        search_latency_[slot].store(histogram, std::memory_order_release);
+    }
+    return *histogram;
+}
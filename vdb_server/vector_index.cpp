@@ -5,21 +5,517 @@
 #include "include/flat_gpu_index.h"
 #include "include/ivfpq_index.h"
 #include "include/cuda_hnsw_index.h"
+#include "include/hnsw_sq_index.h"
+#include "include/ivf_cpu_index.h"
+#include "include/segmented_index.h"
 #include "cagra_index.h"
 #include "include/constant.h"
 #include "include/logger.h"
+#include "include/tracing.h"
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
+#include <faiss/IndexFlat.h>
 #include <sstream>
 #include <filesystem>
+#include <algorithm>
+#include <limits>
+#include <unordered_set>
+#include <chrono>
+#include <random>
 
 VectorIndex::~VectorIndex() {
+    if (train_thread_.joinable()) {
+        train_thread_.join();
+    }
+    if (rebuild_thread_.joinable()) {
+        rebuild_thread_.join();
+    }
+    delete staging_index_;
     if (wal_log_file_.is_open()) {
         wal_log_file_.close();
     }
 }
 
+void VectorIndex::deferTraining(int dim, int train_size, IndexFactory::MetricType metric) {
+    std::unique_lock<std::shared_mutex> lock(staging_mutex_);
+    metric_ = metric;
+    train_size_ = std::max(train_size, 1);
+    next_train_trigger_ = train_size_;
+    faiss::MetricType faiss_metric = (metric == IndexFactory::MetricType::L2) ? faiss::METRIC_L2 : faiss::METRIC_INNER_PRODUCT;
+    delete staging_index_;
+    staging_index_ = new faiss::IndexFlat(dim, faiss_metric);
+    staging_ids_.clear();
+    train_state_ = TrainState::BUFFERING;
+    GlobalLogger->info("Index type {} will be trained after {} vectors are inserted", static_cast<int>(type), train_size_);
+}
+
+std::pair<std::vector<long>, std::vector<float>> VectorIndex::search(const std::vector<float>& data, int k, int ef_search, int nprobe) {
+    // 重建索引切换时会在这里等待
+    std::shared_lock<std::shared_mutex> swap_lock(swap_mutex_, std::defer_lock);
+    {
+        TraceSpan span("index.lock");
+        swap_lock.lock();
+    }
+    if (train_state_.load(std::memory_order_acquire) == TrainState::TRAINED) {
+        return indexSearch(data, k, ef_search, nprobe);
+    }
+
+    std::shared_lock<std::shared_mutex> lock(staging_mutex_);
+    TrainState state = train_state_.load(std::memory_order_acquire);
+    if (state == TrainState::TRAINED) {
+        lock.unlock();
+        return indexSearch(data, k, ef_search, nprobe);
+    }
+    std::pair<std::vector<long>, std::vector<float>> staged = searchStaging(data, k);
+    if (state != TrainState::DRAINING) {
+        return staged;
+    }
+
+    // 缓冲区正在迁移到索引中，两边都查，按 id 去重后合并
+    std::pair<std::vector<long>, std::vector<float>> indexed = indexSearch(data, k, ef_search, nprobe);
+    bool larger_is_better = (metric_ == IndexFactory::MetricType::IP);
+    size_t num_queries = staged.first.size() / k;
+    std::pair<std::vector<long>, std::vector<float>> results;
+    results.first.assign(num_queries * k, -1);
+    results.second.assign(num_queries * k, larger_is_better ? std::numeric_limits<float>::lowest() : std::numeric_limits<float>::max());
+    for (size_t q = 0; q < num_queries; q++) {
+        std::vector<std::pair<float, long>> candidates;
+        for (size_t i = q * k; i < (q + 1) * k; i++) {
+            if (staged.first[i] >= 0) {
+                candidates.emplace_back(staged.second[i], staged.first[i]);
+            }
+            if (i < indexed.first.size() && indexed.first[i] >= 0) {
+                candidates.emplace_back(indexed.second[i], indexed.first[i]);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [larger_is_better](const std::pair<float, long>& a, const std::pair<float, long>& b) {
+            return larger_is_better ? a.first > b.first : a.first < b.first;
+        });
+        std::unordered_set<long> seen;
+        size_t out = q * k;
+        for (const auto& candidate : candidates) {
+            if (out == (q + 1) * k) {
+                break;
+            }
+            if (seen.insert(candidate.second).second) {
+                results.first[out] = candidate.second;
+                results.second[out] = candidate.first;
+                out++;
+            }
+        }
+    }
+    return results;
+}
+
+void VectorIndex::insert(const std::vector<float>& data, uint64_t id) {
+    std::shared_lock<std::shared_mutex> swap_lock(swap_mutex_);
+    if (rebuilding_.load(std::memory_order_acquire)) {
+        // 状态机在应用前登记了这条日志的 log id
+        uint64_t log_id = applied_log_id_.load(std::memory_order_acquire);
+        std::lock_guard<std::mutex> lock(capture_mutex_);
+        captured_vectors_.insert(captured_vectors_.end(), data.begin(), data.end());
+        captured_ids_.push_back(static_cast<long>(id));
+        captured_log_ids_.push_back(log_id);
+    }
+    if (train_state_.load(std::memory_order_acquire) != TrainState::TRAINED) {
+        long label = static_cast<long>(id);
+        if (stage(data.data(), 1, &label)) {
+            return;
+        }
+    }
+    indexInsert(data, id);
+}
+
+void VectorIndex::insert_batch(const std::vector<std::vector<float>>& vectors, const std::vector<long>& ids) {
+    std::shared_lock<std::shared_mutex> swap_lock(swap_mutex_);
+    if (rebuilding_.load(std::memory_order_acquire)) {
+        uint64_t log_id = applied_log_id_.load(std::memory_order_acquire);
+        std::lock_guard<std::mutex> lock(capture_mutex_);
+        for (const auto& vector : vectors) {
+            captured_vectors_.insert(captured_vectors_.end(), vector.begin(), vector.end());
+        }
+        captured_ids_.insert(captured_ids_.end(), ids.begin(), ids.end());
+        captured_log_ids_.insert(captured_log_ids_.end(), ids.size(), log_id);
+    }
+    if (train_state_.load(std::memory_order_acquire) != TrainState::TRAINED) {
+        std::vector<float> flat;
+        for (const auto& vector : vectors) {
+            flat.insert(flat.end(), vector.begin(), vector.end());
+        }
+        if (stage(flat.data(), ids.size(), ids.data())) {
+            return;
+        }
+    }
+    indexInsertBatch(vectors, ids);
+}
+
+// 返回 false 表示训练已完成，调用方应直接写入索引
+bool VectorIndex::stage(const float* data, size_t n, const long* ids) {
+    std::unique_lock<std::shared_mutex> lock(staging_mutex_);
+    if (train_state_.load(std::memory_order_acquire) == TrainState::TRAINED) {
+        return false;
+    }
+    staging_index_->add(n, data);
+    staging_ids_.insert(staging_ids_.end(), ids, ids + n);
+
+    if (train_state_.load(std::memory_order_acquire) == TrainState::BUFFERING && staging_ids_.size() >= next_train_trigger_) {
+        train_state_ = TrainState::TRAINING;
+        // 上一次训练失败的线程已经退出，回收后再启动新的训练
+        if (train_thread_.joinable()) {
+            train_thread_.join();
+        }
+        train_thread_ = std::thread(&VectorIndex::trainInBackground, this);
+    }
+    return true;
+}
+
+std::pair<std::vector<long>, std::vector<float>> VectorIndex::searchStaging(const std::vector<float>& data, int k) {
+    int num_queries = data.size() / staging_index_->d;
+    std::vector<long> indices(num_queries * k);
+    std::vector<float> distances(num_queries * k);
+    staging_index_->search(num_queries, data.data(), k, distances.data(), indices.data());
+    for (auto& idx : indices) {
+        if (idx >= 0) {
+            idx = staging_ids_[idx];
+        }
+    }
+    return {indices, distances};
+}
+
+void VectorIndex::trainInBackground() {
+    std::vector<float> train_vec;
+    std::vector<long> train_ids;
+    int num_train = 0;
+    int dim = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(staging_mutex_);
+        dim = staging_index_->d;
+        num_train = staging_ids_.size();
+        const float* xb = staging_index_->get_xb();
+        train_vec.assign(xb, xb + static_cast<size_t>(num_train) * dim);
+        train_ids = staging_ids_;
+    }
+
+    GlobalLogger->info("Training index type {} with {} vectors", static_cast<int>(type), num_train);
+    try {
+        indexTrain(num_train, train_vec, train_ids);
+    } catch (const std::exception& e) {
+        GlobalLogger->error("Failed to train index with {} vectors: {}", num_train, e.what());
+        std::unique_lock<std::shared_mutex> lock(staging_mutex_);
+        next_train_trigger_ = staging_ids_.size() + train_size_;
+        train_state_ = TrainState::BUFFERING;
+        return;
+    }
+    std::vector<float>().swap(train_vec);
+
+    {
+        std::unique_lock<std::shared_mutex> lock(staging_mutex_);
+        train_state_ = TrainState::DRAINING;
+    }
+
+    // 拷贝缓冲区中 [begin, end) 的数据，调用方需持有锁
+    auto copyRows = [this, dim](size_t begin, size_t end, std::vector<std::vector<float>>& rows, std::vector<long>& ids) {
+        const float* xb = staging_index_->get_xb();
+        for (size_t i = begin; i < end; i++) {
+            rows.emplace_back(xb + i * dim, xb + (i + 1) * dim);
+        }
+        ids.assign(staging_ids_.begin() + begin, staging_ids_.begin() + end);
+    };
+
+    // 分批迁移，迁移期间不阻塞写入，最后一批在独占锁下完成
+    const size_t batch_size = 4096;
+    size_t drained = 0;
+    while (true) {
+        std::vector<std::vector<float>> rows;
+        std::vector<long> ids;
+        {
+            std::shared_lock<std::shared_mutex> lock(staging_mutex_);
+            if (staging_ids_.size() - drained <= batch_size) {
+                break;
+            }
+            copyRows(drained, drained + batch_size, rows, ids);
+        }
+        indexInsertBatch(rows, ids);
+        drained += ids.size();
+    }
+
+    {
+        std::unique_lock<std::shared_mutex> lock(staging_mutex_);
+        std::vector<std::vector<float>> rows;
+        std::vector<long> ids;
+        copyRows(drained, staging_ids_.size(), rows, ids);
+        if (!ids.empty()) {
+            indexInsertBatch(rows, ids);
+        }
+        drained += ids.size();
+        delete staging_index_;
+        staging_index_ = nullptr;
+        std::vector<long>().swap(staging_ids_);
+        train_state_ = TrainState::TRAINED;
+    }
+    GlobalLogger->info("Index type {} is trained, {} staged vectors moved into the index", static_cast<int>(type), drained);
+}
+
+void VectorIndex::setBuildParams(int dim, int num_train, const IndexParams& params) {
+    std::unique_lock<std::shared_mutex> swap_lock(swap_mutex_);
+    dim_ = dim;
+    num_train_ = num_train;
+    build_params_ = params;
+}
+
+IndexParams VectorIndex::getBuildParams() const {
+    std::shared_lock<std::shared_mutex> swap_lock(swap_mutex_);
+    return build_params_;
+}
+
+bool VectorIndex::isRebuilding() const {
+    return rebuilding_.load(std::memory_order_acquire);
+}
+
+void VectorIndex::setAppliedLogID(uint64_t log_id) {
+    applied_log_id_.store(log_id, std::memory_order_release);
+}
+
+uint64_t VectorIndex::generation() const {
+    return generation_.load(std::memory_order_acquire);
+}
+
+void VectorIndex::rebuild(IndexFactory::IndexType new_type, const IndexParams& params) {
+    if (new_type == IndexFactory::IndexType::UNKNOWN) {
+        throw std::runtime_error("Unknown index type for rebuild");
+    }
+    if (wal_path_.empty() || dim_ <= 0) {
+        throw std::runtime_error("Index is not initialized for rebuild");
+    }
+    if (train_state_.load(std::memory_order_acquire) != TrainState::TRAINED) {
+        throw std::runtime_error("Index is still waiting for training data, rebuild later");
+    }
+
+    std::unique_lock<std::shared_mutex> swap_lock(swap_mutex_);
+    bool expected = false;
+    if (!rebuilding_.compare_exchange_strong(expected, true)) {
+        throw std::runtime_error("Index rebuild is already in progress");
+    }
+    // 持有独占锁时开始记录写入：边界之后应用的日志一定会被记录下来，
+    // 边界及之前的日志可能在两边各出现一次，重放时跳过 log id 不超过边界的记录
+    uint64_t applied_log_id = applied_log_id_.load(std::memory_order_acquire);
+    if (rebuild_thread_.joinable()) {
+        rebuild_thread_.join();
+    }
+    rebuild_thread_ = std::thread(&VectorIndex::rebuildInBackground, this, new_type, params, applied_log_id);
+    GlobalLogger->info("Start rebuilding index type {} -> {} from WAL up to log id {}", static_cast<int>(type), static_cast<int>(new_type), applied_log_id);
+}
+
+void VectorIndex::forEachWalBatch(uint64_t max_log_id, size_t batch_size,
+                                  const std::function<void(const std::vector<float>&, const std::vector<long>&)>& callback) {
+    std::ifstream wal_file(wal_path_);
+    if (!wal_file.is_open()) {
+        throw std::runtime_error("Failed to open WAL log file at path: " + wal_path_);
+    }
+
+    std::vector<float> vectors;
+    std::vector<long> ids;
+    auto appendObject = [&vectors, &ids, this](const rapidjson::Value& object) {
+        if (!object.HasMember(REQUEST_VECTOR) || !object[REQUEST_VECTOR].IsArray() || !object.HasMember(REQUEST_ID) || !object[REQUEST_ID].IsInt()) {
+            return;
+        }
+        const rapidjson::Value& vector = object[REQUEST_VECTOR];
+        if (static_cast<int>(vector.Size()) != dim_) {
+            return;
+        }
+        for (const auto& value : vector.GetArray()) {
+            vectors.push_back(value.GetFloat());
+        }
+        ids.push_back(object[REQUEST_ID].GetInt());
+    };
+    auto flush = [&vectors, &ids, &callback]() {
+        if (!ids.empty()) {
+            callback(vectors, ids);
+            vectors.clear();
+            ids.clear();
+        }
+    };
+
+    std::string line;
+    while (std::getline(wal_file, line)) {
+        std::istringstream iss(line);
+        std::string log_id_str, version, operation_type, json_data_str;
+        std::getline(iss, log_id_str, '|');
+        std::getline(iss, version, '|');
+        std::getline(iss, operation_type, '|');
+        std::getline(iss, json_data_str, '|');
+        if (log_id_str.empty() || std::stoull(log_id_str) > max_log_id) {
+            continue;
+        }
+
+        rapidjson::Document json_data;
+        json_data.Parse(json_data_str.c_str());
+        if (!json_data.IsObject()) {
+            continue;
+        }
+        if (operation_type == "insert" && json_data.HasMember(REQUEST_OBJECT)) {
+            appendObject(json_data[REQUEST_OBJECT]);
+        } else if (operation_type == "insert_batch" && json_data.HasMember(REQUEST_OBJECTS) && json_data[REQUEST_OBJECTS].IsArray()) {
+            for (const auto& object : json_data[REQUEST_OBJECTS].GetArray()) {
+                appendObject(object);
+            }
+        }
+        if (ids.size() >= batch_size) {
+            flush();
+        }
+    }
+    flush();
+}
+
+void VectorIndex::sampleWalVectors(uint64_t max_log_id, size_t num_sample, std::vector<float>& vectors, std::vector<long>& ids) {
+    // 蓄水池抽样：只扫一遍 WAL，内存中最多保留 num_sample 条
+    std::mt19937_64 rng(std::random_device{}());
+    size_t seen = 0;
+    vectors.clear();
+    ids.clear();
+    forEachWalBatch(max_log_id, 4096, [&](const std::vector<float>& batch_vectors, const std::vector<long>& batch_ids) {
+        for (size_t i = 0; i < batch_ids.size(); i++, seen++) {
+            size_t slot = seen;
+            if (seen >= num_sample) {
+                slot = std::uniform_int_distribution<size_t>(0, seen)(rng);
+                if (slot >= num_sample) {
+                    continue;
+                }
+            }
+            const float* row = batch_vectors.data() + i * dim_;
+            if (slot == ids.size()) {
+                vectors.insert(vectors.end(), row, row + dim_);
+                ids.push_back(batch_ids[i]);
+            } else {
+                std::copy(row, row + dim_, vectors.begin() + slot * dim_);
+                ids[slot] = batch_ids[i];
+            }
+        }
+    });
+}
+
+void VectorIndex::rebuildInBackground(IndexFactory::IndexType new_type, IndexParams params, uint64_t applied_log_id) {
+    auto start = std::chrono::steady_clock::now();
+    VectorIndex* rebuilt = nullptr;
+    const size_t batch_size = 4096;
+
+    // 分批写入新索引
+    auto insertRows = [this, &rebuilt, batch_size](const std::vector<float>& vectors, const std::vector<long>& ids) {
+        std::vector<std::vector<float>> rows;
+        std::vector<long> row_ids;
+        for (size_t i = 0; i < ids.size(); i++) {
+            rows.emplace_back(vectors.begin() + i * dim_, vectors.begin() + (i + 1) * dim_);
+            row_ids.push_back(ids[i]);
+            if (row_ids.size() == batch_size) {
+                rebuilt->indexInsertBatch(rows, row_ids);
+                rows.clear();
+                row_ids.clear();
+            }
+        }
+        if (!row_ids.empty()) {
+            rebuilt->indexInsertBatch(rows, row_ids);
+        }
+    };
+    // 重放构建期间记录的写入，WAL 中已经读过的日志（log id 不超过边界）跳过，
+    // 之后的按原顺序全部重放，同一 id 的更新也不会丢
+    auto replayCaptured = [this, &insertRows, applied_log_id](const std::vector<float>& vectors, const std::vector<long>& ids, const std::vector<uint64_t>& log_ids) {
+        std::vector<float> replay_vectors;
+        std::vector<long> replay_ids;
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (log_ids[i] <= applied_log_id) {
+                continue;
+            }
+            replay_vectors.insert(replay_vectors.end(), vectors.begin() + i * dim_, vectors.begin() + (i + 1) * dim_);
+            replay_ids.push_back(ids[i]);
+        }
+        insertRows(replay_vectors, replay_ids);
+    };
+
+    try {
+        void* new_index = getGlobalIndexFactory()->init(new_type, dim_, num_train_, metric_, params);
+        if (new_index == nullptr) {
+            throw std::runtime_error("Unsupported index type for rebuild");
+        }
+        rebuilt = new VectorIndex(new_index, new_type);
+
+        if (IndexFactory::needsTraining(new_type, params)) {
+            // 训练集从整个 WAL 中随机抽样，避免只用最早写入的那部分数据
+            std::vector<float> train_vec;
+            std::vector<long> train_ids;
+            sampleWalVectors(applied_log_id, static_cast<size_t>(IndexFactory::trainSize(new_type, params)), train_vec, train_ids);
+            if (train_ids.empty()) {
+                throw std::runtime_error("No data in WAL to train the new index");
+            }
+            rebuilt->indexTrain(static_cast<int>(train_ids.size()), train_vec, train_ids);
+        }
+
+        size_t num_built = 0;
+        forEachWalBatch(applied_log_id, batch_size, [&insertRows, &num_built](const std::vector<float>& vectors, const std::vector<long>& ids) {
+            insertRows(vectors, ids);
+            num_built += ids.size();
+        });
+        // 新索引还没有对外提供查询，可以在这里独占地重排图，之后追平的少量写入按新布局插入
+        if (params.graph_order != "none" && !params.graph_order.empty()) {
+            rebuilt->indexReorder(params.graph_order);
+        }
+
+        // 追平构建期间的写入，剩余不多时再在独占锁下完成最后一批并替换
+        while (true) {
+            std::vector<float> captured_vectors;
+            std::vector<long> captured_ids;
+            std::vector<uint64_t> captured_log_ids;
+            {
+                std::lock_guard<std::mutex> lock(capture_mutex_);
+                if (captured_ids_.size() <= batch_size) {
+                    break;
+                }
+                captured_vectors.swap(captured_vectors_);
+                captured_ids.swap(captured_ids_);
+                captured_log_ids.swap(captured_log_ids_);
+            }
+            replayCaptured(captured_vectors, captured_ids, captured_log_ids);
+        }
+
+        {
+            std::unique_lock<std::shared_mutex> swap_lock(swap_mutex_);
+            {
+                std::lock_guard<std::mutex> lock(capture_mutex_);
+                replayCaptured(captured_vectors_, captured_ids_, captured_log_ids_);
+                std::vector<float>().swap(captured_vectors_);
+                std::vector<long>().swap(captured_ids_);
+                std::vector<uint64_t>().swap(captured_log_ids_);
+            }
+            std::swap(index, rebuilt->index);
+            std::swap(type, rebuilt->type);
+            generation_++;
+            build_params_ = params;
+            rebuilding_.store(false, std::memory_order_release);
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        GlobalLogger->info("Index rebuilt as type {} with {} vectors from WAL in {} ms", static_cast<int>(new_type), num_built,
+                           std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+    } catch (const std::exception& e) {
+        GlobalLogger->error("Failed to rebuild index: {}", e.what());
+        {
+            std::unique_lock<std::shared_mutex> swap_lock(swap_mutex_);
+            std::lock_guard<std::mutex> lock(capture_mutex_);
+            std::vector<float>().swap(captured_vectors_);
+            std::vector<long>().swap(captured_ids_);
+            std::vector<uint64_t>().swap(captured_log_ids_);
+            rebuilding_.store(false, std::memory_order_release);
+        }
+    }
+
+    // 此时 rebuilt 持有的是旧索引（或失败时构建了一半的新索引）
+    if (rebuilt != nullptr) {
+        rebuilt->destroyIndex();
+        delete rebuilt;
+    }
+}
+
 void VectorIndex::wal_init(const std::string& local_path) {
+    wal_path_ = local_path;
     wal_log_file_.open(local_path, std::ios::app | std::ios::in | std::ios::out);
     if (!wal_log_file_.is_open()) {
         GlobalLogger->error("Can not open wal log file: {}", std::strerror(errno)); // 使用日志打印错误消息和原因
@@ -27,7 +523,7 @@ void VectorIndex::wal_init(const std::string& local_path) {
     }
 }
 
-std::pair<std::vector<long>, std::vector<float>> VectorIndex::search(const std::vector<float>& data, int k) {
+std::pair<std::vector<long>, std::vector<float>> VectorIndex::indexSearch(const std::vector<float>& data, int k, int ef_search, int nprobe) {
     // 根据索引类型初始化索引对象并调用 search_vectors 函数
     std::pair<std::vector<long>, std::vector<float>> results;
     switch (type) {
@@ -56,13 +552,36 @@ std::pair<std::vector<long>, std::vector<float>> VectorIndex::search(const std::
             results = cagra_index->search_vectors(data, k);
             break;
         }
+        case IndexFactory::IndexType::HNSWSQ8:
+        case IndexFactory::IndexType::HNSWFP16: {
+            HnswSQIndex* hnsw_sq_index = static_cast<HnswSQIndex*>(index);
+            results = hnsw_sq_index->search_vectors(data, k, ef_search);
+            break;
+        }
+        case IndexFactory::IndexType::IVFFLAT:
+        case IndexFactory::IndexType::IVFPQ_CPU:
+        case IndexFactory::IndexType::IVFSQ8: {
+            IVFCPUIndex* ivf_cpu_index = static_cast<IVFCPUIndex*>(index);
+            results = ivf_cpu_index->search_vectors(data, k, nprobe);
+            break;
+        }
+        case IndexFactory::IndexType::SEGMENTED: {
+            SegmentedIndex* segmented_index = static_cast<SegmentedIndex*>(index);
+            results = segmented_index->search_vectors(data, k, ef_search, nprobe);
+            break;
+        }
+        case IndexFactory::IndexType::CUDAHNSW: {
+            CUDAHNSWIndex* cudahnsw_index = static_cast<CUDAHNSWIndex*>(index);
+            results = cudahnsw_index->search_vectors(data, k, ef_search);
+            break;
+        }
         default:
             break;
     }
     return results;
 }
 
-void VectorIndex::insert(const std::vector<float>& data, uint64_t id) {
+void VectorIndex::indexInsert(const std::vector<float>& data, uint64_t id) {
     switch (type) {
         case IndexFactory::IndexType::FLAT: {
             FlatIndex* flat_index = static_cast<FlatIndex*>(index);
@@ -89,6 +608,24 @@ void VectorIndex::insert(const std::vector<float>& data, uint64_t id) {
             cagra_index->insert_vectors(data, id);
             break;
         }
+        case IndexFactory::IndexType::HNSWSQ8:
+        case IndexFactory::IndexType::HNSWFP16: {
+            HnswSQIndex* hnsw_sq_index = static_cast<HnswSQIndex*>(index);
+            hnsw_sq_index->insert_vectors(data, id);
+            break;
+        }
+        case IndexFactory::IndexType::IVFFLAT:
+        case IndexFactory::IndexType::IVFPQ_CPU:
+        case IndexFactory::IndexType::IVFSQ8: {
+            IVFCPUIndex* ivf_cpu_index = static_cast<IVFCPUIndex*>(index);
+            ivf_cpu_index->insert_vectors(data, id);
+            break;
+        }
+        case IndexFactory::IndexType::SEGMENTED: {
+            SegmentedIndex* segmented_index = static_cast<SegmentedIndex*>(index);
+            segmented_index->insert_vectors(data, id);
+            break;
+        }
         case IndexFactory::IndexType::CUDAHNSW: {
             CUDAHNSWIndex* cudahnsw_index = static_cast<CUDAHNSWIndex*>(index);
             cudahnsw_index->insert_vectors(data.data(), id);
@@ -99,7 +636,7 @@ void VectorIndex::insert(const std::vector<float>& data, uint64_t id) {
     }
 }
 
-void VectorIndex::insert_batch(const std::vector<std::vector<float>>& vectors, const std::vector<long>& ids) {
+void VectorIndex::indexInsertBatch(const std::vector<std::vector<float>>& vectors, const std::vector<long>& ids) {
     switch (type) {
         case IndexFactory::IndexType::FLAT: {
             FlatIndex* flat_index = static_cast<FlatIndex*>(index);
@@ -126,6 +663,24 @@ void VectorIndex::insert_batch(const std::vector<std::vector<float>>& vectors, c
             cagra_index->insert_batch_vectors(vectors, ids);
             break;
         }
+        case IndexFactory::IndexType::HNSWSQ8:
+        case IndexFactory::IndexType::HNSWFP16: {
+            HnswSQIndex* hnsw_sq_index = static_cast<HnswSQIndex*>(index);
+            hnsw_sq_index->insert_batch_vectors(vectors, ids);
+            break;
+        }
+        case IndexFactory::IndexType::IVFFLAT:
+        case IndexFactory::IndexType::IVFPQ_CPU:
+        case IndexFactory::IndexType::IVFSQ8: {
+            IVFCPUIndex* ivf_cpu_index = static_cast<IVFCPUIndex*>(index);
+            ivf_cpu_index->insert_batch_vectors(vectors, ids);
+            break;
+        }
+        case IndexFactory::IndexType::SEGMENTED: {
+            SegmentedIndex* segmented_index = static_cast<SegmentedIndex*>(index);
+            segmented_index->insert_batch_vectors(vectors, ids);
+            break;
+        }
         case IndexFactory::IndexType::CUDAHNSW: {
             CUDAHNSWIndex* cudahnsw_index = static_cast<CUDAHNSWIndex*>(index);
             cudahnsw_index->insert_vectors_batch(vectors, ids);
@@ -136,7 +691,101 @@ void VectorIndex::insert_batch(const std::vector<std::vector<float>>& vectors, c
     }
 }
 
+void VectorIndex::destroyIndex() {
+    switch (type) {
+        case IndexFactory::IndexType::FLAT:
+            delete static_cast<FlatIndex*>(index);
+            break;
+        case IndexFactory::IndexType::HNSWFLAT:
+            delete static_cast<HnswFlatIndex*>(index);
+            break;
+        case IndexFactory::IndexType::FLAT_GPU:
+            delete static_cast<FlatGPUIndex*>(index);
+            break;
+        case IndexFactory::IndexType::IVFPQ:
+            delete static_cast<IVFPQIndex*>(index);
+            break;
+        case IndexFactory::IndexType::CAGRA:
+            delete static_cast<CAGRAIndex*>(index);
+            break;
+        case IndexFactory::IndexType::CUDAHNSW:
+            delete static_cast<CUDAHNSWIndex*>(index);
+            break;
+        case IndexFactory::IndexType::HNSWSQ8:
+        case IndexFactory::IndexType::HNSWFP16:
+            delete static_cast<HnswSQIndex*>(index);
+            break;
+        case IndexFactory::IndexType::IVFFLAT:
+        case IndexFactory::IndexType::IVFPQ_CPU:
+        case IndexFactory::IndexType::IVFSQ8:
+            delete static_cast<IVFCPUIndex*>(index);
+            break;
+        case IndexFactory::IndexType::SEGMENTED:
+            delete static_cast<SegmentedIndex*>(index);
+            break;
+        default:
+            break;
+    }
+    index = nullptr;
+}
+
+void VectorIndex::indexTrain(int num_train, const std::vector<float>& train_vec, const std::vector<long>& train_ids) {
+    switch (type) {
+        case IndexFactory::IndexType::IVFPQ: {
+            IVFPQIndex* ivfpq_index = static_cast<IVFPQIndex*>(index);
+            ivfpq_index->train(num_train, train_vec);
+            break;
+        }
+        case IndexFactory::IndexType::CAGRA: {
+            CAGRAIndex* cagra_index = static_cast<CAGRAIndex*>(index);
+            cagra_index->train(num_train, train_vec, train_ids);
+            break;
+        }
+        case IndexFactory::IndexType::HNSWSQ8:
+        case IndexFactory::IndexType::HNSWFP16: {
+            HnswSQIndex* hnsw_sq_index = static_cast<HnswSQIndex*>(index);
+            hnsw_sq_index->train(num_train, train_vec);
+            break;
+        }
+        case IndexFactory::IndexType::IVFFLAT:
+        case IndexFactory::IndexType::IVFPQ_CPU:
+        case IndexFactory::IndexType::IVFSQ8: {
+            IVFCPUIndex* ivf_cpu_index = static_cast<IVFCPUIndex*>(index);
+            ivf_cpu_index->train(num_train, train_vec);
+            break;
+        }
+        case IndexFactory::IndexType::CUDAHNSW: {
+            CUDAHNSWIndex* cudahnsw_index = static_cast<CUDAHNSWIndex*>(index);
+            cudahnsw_index->train(num_train, train_vec);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void VectorIndex::indexReorder(const std::string& order) {
+    auto start = std::chrono::steady_clock::now();
+    switch (type) {
+        case IndexFactory::IndexType::CUDAHNSW: {
+            CUDAHNSWIndex* cudahnsw_index = static_cast<CUDAHNSWIndex*>(index);
+            cudahnsw_index->reorder(order);
+            break;
+        }
+        default:
+            GlobalLogger->warn("graph_order is not supported by index type {}, skip reordering", IndexFactory::typeName(type));
+            return;
+    }
+    auto end = std::chrono::steady_clock::now();
+    GlobalLogger->info("Index graph reordered by {} in {} ms", order, std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+}
+
 void VectorIndex::saveIndex(const std::string& folder_path) {
+    if (train_state_.load(std::memory_order_acquire) != TrainState::TRAINED) {
+        GlobalLogger->warn("Index is not trained yet, skip saving index to {}", folder_path);
+        return;
+    }
+    std::shared_lock<std::shared_mutex> swap_lock(swap_mutex_);
     std::string file_path = folder_path + std::to_string(static_cast<int>(type)) + ".index";
 
     switch (type) {
@@ -165,6 +814,29 @@ void VectorIndex::saveIndex(const std::string& folder_path) {
             cagra_index->saveIndex(file_path);
             break;
         }
+        case IndexFactory::IndexType::HNSWSQ8:
+        case IndexFactory::IndexType::HNSWFP16: {
+            HnswSQIndex* hnsw_sq_index = static_cast<HnswSQIndex*>(index);
+            hnsw_sq_index->saveIndex(file_path);
+            break;
+        }
+        case IndexFactory::IndexType::IVFFLAT:
+        case IndexFactory::IndexType::IVFPQ_CPU:
+        case IndexFactory::IndexType::IVFSQ8: {
+            IVFCPUIndex* ivf_cpu_index = static_cast<IVFCPUIndex*>(index);
+            ivf_cpu_index->saveIndex(file_path);
+            break;
+        }
+        case IndexFactory::IndexType::SEGMENTED: {
+            SegmentedIndex* segmented_index = static_cast<SegmentedIndex*>(index);
+            segmented_index->saveIndex(file_path);
+            break;
+        }
+        case IndexFactory::IndexType::CUDAHNSW: {
+            CUDAHNSWIndex* cudahnsw_index = static_cast<CUDAHNSWIndex*>(index);
+            cudahnsw_index->saveIndex(file_path);
+            break;
+        }
         default:
             break;
     }
@@ -177,6 +849,7 @@ void VectorIndex::loadIndex(const std::string& folder_path) {
         return;
     }
 
+    std::unique_lock<std::shared_mutex> swap_lock(swap_mutex_);
     switch (type) {
         case IndexFactory::IndexType::FLAT: {
             FlatIndex* flat_index = static_cast<FlatIndex*>(index);
@@ -203,9 +876,44 @@ void VectorIndex::loadIndex(const std::string& folder_path) {
             cagra_index->loadIndex(file_path);
             break;
         }
+        case IndexFactory::IndexType::HNSWSQ8:
+        case IndexFactory::IndexType::HNSWFP16: {
+            HnswSQIndex* hnsw_sq_index = static_cast<HnswSQIndex*>(index);
+            hnsw_sq_index->loadIndex(file_path);
+            break;
+        }
+        case IndexFactory::IndexType::IVFFLAT:
+        case IndexFactory::IndexType::IVFPQ_CPU:
+        case IndexFactory::IndexType::IVFSQ8: {
+            IVFCPUIndex* ivf_cpu_index = static_cast<IVFCPUIndex*>(index);
+            ivf_cpu_index->loadIndex(file_path);
+            break;
+        }
+        case IndexFactory::IndexType::SEGMENTED: {
+            SegmentedIndex* segmented_index = static_cast<SegmentedIndex*>(index);
+            segmented_index->loadIndex(file_path);
+            break;
+        }
+        case IndexFactory::IndexType::CUDAHNSW: {
+            CUDAHNSWIndex* cudahnsw_index = static_cast<CUDAHNSWIndex*>(index);
+            cudahnsw_index->loadIndex(file_path);
+            break;
+        }
         default:
             break;
     }
+
+    // 保存的索引一定是训练过的，缓冲区不再需要
+    if (train_state_.load(std::memory_order_acquire) != TrainState::TRAINED) {
+        if (train_thread_.joinable()) {
+            train_thread_.join();
+        }
+        std::unique_lock<std::shared_mutex> lock(staging_mutex_);
+        delete staging_index_;
+        staging_index_ = nullptr;
+        std::vector<long>().swap(staging_ids_);
+        train_state_ = TrainState::TRAINED;
+    }
 }
 
 uint64_t VectorIndex::increaseID() {
@@ -272,6 +980,11 @@ void VectorIndex::readNextWalLog(std::string* operation_type, rapidjson::Documen
 
 void VectorIndex::takeSnapshot() {
     GlobalLogger->debug("Taking snapshot");
+    // 未训练的索引无法保存，不推进快照位置，重启后由 WAL 重放恢复
+    if (train_state_.load(std::memory_order_acquire) != TrainState::TRAINED) {
+        GlobalLogger->warn("Index is not trained yet, skip taking snapshot");
+        return;
+    }
 
     lastSnapshotID_ =  increaseID_;
     std::string snapshot_folder_path = "snapshots_";